@@ -212,6 +212,7 @@ pub fn build(b: *Builder) void {
     "src/bip37.c",
     "src/bip39.c",
     "src/bip152.c",
+    "src/bip330.c",
     "src/block.c",
     "src/bloom.c",
     "src/buffer.c",
@@ -530,6 +531,7 @@ pub fn build(b: *Builder) void {
       "chain",
       "mempool",
       "miner",
+      "pool",
       "rpc",
       // wallet
       "wallet"
@@ -596,6 +598,7 @@ pub fn build(b: *Builder) void {
     "bip37",
     "bip39",
     "bip152",
+    "bip330",
     "block",
     "bloom",
     "coin",
@@ -29,7 +29,10 @@ struct btc_conf_s {
   int cache_size;
   int checkpoints;
   int prune;
+  int max_mempool;
+  int compact_mempool;
   int workers;
+  int io_threads;
   int listen;
   int port;
   btc_vector_t bind;
@@ -48,6 +51,7 @@ struct btc_conf_s {
   int bip37;
   int bip152;
   int bip157;
+  int bip330;
   enum btc_ipnet only_net;
   int rpc_port;
   btc_vector_t rpc_bind;
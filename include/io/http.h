@@ -95,9 +95,16 @@ typedef struct http_req {
   http_string_t body;
 } http_req_t;
 
+struct http_res;
+
+typedef void http_res_close_cb(struct http_res *);
+
 typedef struct http_res {
   btc_socket_t *socket;
   http_head_t headers;
+  int deferred;
+  http_res_close_cb *on_close;
+  void *data;
 } http_res_t;
 
 struct http_server;
@@ -167,6 +174,12 @@ http_res_error(http_res_t *res, unsigned int status);
 BTC_EXTERN void
 http_res_unauthorized(http_res_t *res, const char *realm);
 
+BTC_EXTERN int
+http_res_defer(http_res_t *res, http_res_close_cb *on_close, void *data);
+
+BTC_EXTERN void
+http_res_release(http_res_t *res);
+
 /*
  * Server
  */
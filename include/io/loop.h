@@ -12,6 +12,7 @@ extern "C" {
 #endif
 
 #include <stddef.h>
+#include <stdint.h>
 #include "../mako/common.h"
 
 /*
@@ -21,14 +22,19 @@ extern "C" {
 typedef struct btc_loop_s btc_loop_t;
 typedef struct btc_socket_s btc_socket_t;
 typedef struct btc_server_s btc_server_t;
+typedef struct btc_sockbuf_s btc_sockbuf_t;
+typedef struct btc_timer_s btc_timer_t;
 
 struct btc_sockaddr_s;
 
 typedef void btc_loop_tick_cb(void *arg);
+typedef void btc_loop_post_cb(void *arg);
+typedef void btc_timer_cb(btc_timer_t *);
 typedef void btc_socket_socket_cb(btc_socket_t *, btc_socket_t *);
 typedef void btc_socket_connect_cb(btc_socket_t *);
 typedef void btc_socket_close_cb(btc_socket_t *);
 typedef void btc_socket_error_cb(btc_socket_t *);
+typedef void *btc_socket_alloc_cb(btc_socket_t *, size_t *);
 typedef  int btc_socket_data_cb(btc_socket_t *, const void *, size_t);
 typedef void btc_socket_drain_cb(btc_socket_t *);
 typedef void btc_socket_message_cb(btc_socket_t *,
@@ -36,6 +42,25 @@ typedef void btc_socket_message_cb(btc_socket_t *,
                                    size_t,
                                    const struct btc_sockaddr_s *);
 
+/*
+ * Socket Buffer
+ */
+
+BTC_EXTERN btc_sockbuf_t *
+btc_sockbuf_create(void *data, size_t length);
+
+BTC_EXTERN btc_sockbuf_t *
+btc_sockbuf_ref(btc_sockbuf_t *buf);
+
+BTC_EXTERN void
+btc_sockbuf_unref(btc_sockbuf_t *buf);
+
+BTC_EXTERN const void *
+btc_sockbuf_data(const btc_sockbuf_t *buf);
+
+BTC_EXTERN size_t
+btc_sockbuf_length(const btc_sockbuf_t *buf);
+
 /*
  * Socket
  */
@@ -61,6 +86,9 @@ btc_socket_on_error(btc_socket_t *socket, btc_socket_error_cb *handler);
 BTC_EXTERN void
 btc_socket_on_data(btc_socket_t *socket, btc_socket_data_cb *handler);
 
+BTC_EXTERN void
+btc_socket_on_alloc(btc_socket_t *socket, btc_socket_alloc_cb *handler);
+
 BTC_EXTERN void
 btc_socket_on_drain(btc_socket_t *socket, btc_socket_drain_cb *handler);
 
@@ -82,9 +110,21 @@ btc_socket_buffered(btc_socket_t *socket);
 BTC_EXTERN void
 btc_socket_set_nodelay(btc_socket_t *socket, int value);
 
+BTC_EXTERN void
+btc_socket_pause(btc_socket_t *socket);
+
+BTC_EXTERN void
+btc_socket_resume(btc_socket_t *socket);
+
 BTC_EXTERN int
 btc_socket_write(btc_socket_t *socket, void *data, size_t len);
 
+BTC_EXTERN int
+btc_socket_write_copy(btc_socket_t *socket, const void *data, size_t len);
+
+BTC_EXTERN int
+btc_socket_write_buf(btc_socket_t *socket, btc_sockbuf_t *buf);
+
 BTC_EXTERN int
 btc_socket_send(btc_socket_t *socket,
                 void *data,
@@ -97,6 +137,31 @@ btc_socket_close(btc_socket_t *socket);
 BTC_EXTERN void
 btc_socket_timeout(btc_socket_t *socket);
 
+BTC_EXTERN void
+btc_socket_detach(btc_socket_t *socket);
+
+/*
+ * Timer
+ */
+
+BTC_EXTERN btc_timer_t *
+btc_timer_create(btc_loop_t *loop, btc_timer_cb *handler, void *data);
+
+BTC_EXTERN void
+btc_timer_destroy(btc_timer_t *timer);
+
+BTC_EXTERN void *
+btc_timer_get_data(btc_timer_t *timer);
+
+BTC_EXTERN void
+btc_timer_start(btc_timer_t *timer, int64_t msec);
+
+BTC_EXTERN void
+btc_timer_stop(btc_timer_t *timer);
+
+BTC_EXTERN int
+btc_timer_active(const btc_timer_t *timer);
+
 /*
  * Loop
  */
@@ -113,6 +178,9 @@ btc_loop_on_tick(btc_loop_t *loop, btc_loop_tick_cb *handler, void *data);
 BTC_EXTERN void
 btc_loop_off_tick(btc_loop_t *loop, btc_loop_tick_cb *handler, void *data);
 
+BTC_EXTERN void
+btc_loop_post(btc_loop_t *loop, btc_loop_post_cb *handler, void *data);
+
 BTC_EXTERN const char *
 btc_loop_strerror(btc_loop_t *loop);
 
@@ -128,6 +196,9 @@ btc_loop_bind(btc_loop_t *loop, const struct btc_sockaddr_s *addr);
 BTC_EXTERN btc_socket_t *
 btc_loop_talk(btc_loop_t *loop, int family);
 
+BTC_EXTERN int
+btc_loop_attach(btc_loop_t *loop, btc_socket_t *socket);
+
 BTC_EXTERN void
 btc_loop_start(btc_loop_t *loop);
 
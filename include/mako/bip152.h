@@ -70,7 +70,15 @@ BTC_EXTERN int
 btc_cmpct_setup(btc_cmpct_t *blk);
 
 BTC_EXTERN int
-btc_cmpct_fill_mempool(btc_cmpct_t *blk, const btc_hashmap_t *map, int witness);
+btc_cmpct_fill_mempool(btc_cmpct_t *blk,
+                       const btc_mpindex_t *mempool,
+                       int witness);
+
+BTC_EXTERN int
+btc_cmpct_fill_extra(btc_cmpct_t *blk,
+                     btc_tx_t *const *txs,
+                     size_t length,
+                     int witness);
 
 BTC_EXTERN int
 btc_cmpct_fill_missing(btc_cmpct_t *blk, const btc_blocktxn_t *msg);
@@ -0,0 +1,91 @@
+/*!
+ * bip330.h - transaction reconciliation for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#ifndef BTC_BIP330_H
+#define BTC_BIP330_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h"
+#include "common.h"
+#include "impl.h"
+
+/*
+ * Constants
+ */
+
+#define BTC_RECON_VERSION 1
+#define BTC_RECON_MAX_CAPACITY 128
+#define BTC_RECON_Q 8191 /* 0.25 */
+#define BTC_RECON_Q_PRECISION 32767
+
+/*
+ * Types
+ */
+
+typedef struct btc_sketch_s {
+  uint32_t *syndromes;
+  size_t capacity;
+} btc_sketch_t;
+
+/*
+ * Sketch
+ */
+
+BTC_DEFINE_SERIALIZABLE_OBJECT(btc_sketch, BTC_SCOPE_EXTERN)
+
+BTC_EXTERN void
+btc_sketch_init(btc_sketch_t *z);
+
+BTC_EXTERN void
+btc_sketch_clear(btc_sketch_t *z);
+
+BTC_EXTERN void
+btc_sketch_copy(btc_sketch_t *z, const btc_sketch_t *x);
+
+BTC_EXTERN void
+btc_sketch_reset(btc_sketch_t *z, size_t capacity);
+
+BTC_EXTERN void
+btc_sketch_add(btc_sketch_t *z, uint32_t x);
+
+BTC_EXTERN void
+btc_sketch_merge(btc_sketch_t *z, const btc_sketch_t *x);
+
+BTC_EXTERN int
+btc_sketch_solve(btc_array_t *z, const btc_sketch_t *x);
+
+BTC_EXTERN size_t
+btc_sketch_size(const btc_sketch_t *x);
+
+BTC_EXTERN uint8_t *
+btc_sketch_write(uint8_t *zp, const btc_sketch_t *x);
+
+BTC_EXTERN int
+btc_sketch_read(btc_sketch_t *z, const uint8_t **xp, size_t *xn);
+
+/*
+ * Reconciliation
+ */
+
+BTC_EXTERN void
+btc_recon_key(uint8_t *key, uint64_t salt1, uint64_t salt2);
+
+BTC_EXTERN uint32_t
+btc_recon_sid(const uint8_t *key, const uint8_t *wtxid);
+
+BTC_EXTERN size_t
+btc_recon_capacity(size_t local, size_t remote, unsigned int q);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BTC_BIP330_H */
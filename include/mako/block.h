@@ -90,6 +90,43 @@ btc_block_inspect(const btc_block_t *block,
                   const btc_view_t *view,
                   const btc_network_t *network);
 
+/*
+ * Raw Block
+ */
+
+BTC_EXTERN void
+btc_rawblock_init(btc_rawblock_t *z);
+
+BTC_EXTERN void
+btc_rawblock_clear(btc_rawblock_t *z);
+
+BTC_EXTERN int
+btc_rawblock_read(btc_rawblock_t *z, const uint8_t **xp, size_t *xn);
+
+BTC_EXTERN int
+btc_rawblock_import(btc_rawblock_t *z, const uint8_t *xp, size_t xn);
+
+BTC_EXTERN int
+btc_rawblock_merkle_root(uint8_t *root, const btc_rawblock_t *blk);
+
+BTC_EXTERN int
+btc_rawblock_witness_root(uint8_t *root, const btc_rawblock_t *blk);
+
+BTC_EXTERN size_t
+btc_rawblock_base_size(const btc_rawblock_t *blk);
+
+BTC_EXTERN size_t
+btc_rawblock_size(const btc_rawblock_t *blk);
+
+BTC_EXTERN size_t
+btc_rawblock_weight(const btc_rawblock_t *blk);
+
+BTC_EXTERN uint8_t *
+btc_rawblock_base_write(uint8_t *zp, const btc_rawblock_t *x);
+
+BTC_EXTERN btc_block_t *
+btc_rawblock_decode(const btc_rawblock_t *x);
+
 #ifdef __cplusplus
 }
 #endif
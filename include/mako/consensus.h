@@ -163,6 +163,32 @@ extern "C" {
 
 #define BTC_MAX_MULTISIG_PUBKEYS 20
 
+/**
+ * Tapscript leaf version (consensus).
+ */
+
+#define BTC_TAPROOT_LEAF_TAPSCRIPT 0xc0
+
+/**
+ * Max taproot merkle path depth (consensus).
+ */
+
+#define BTC_TAPROOT_MAX_DEPTH 128
+
+/**
+ * Validation weight charged per tapscript
+ * signature check (consensus).
+ */
+
+#define BTC_VALIDATION_WEIGHT_PER_SIGOP 50
+
+/**
+ * Validation weight granted to every tapscript
+ * spend on top of its witness size (consensus).
+ */
+
+#define BTC_VALIDATION_WEIGHT_OFFSET 50
+
 /**
  * The date bip16 (p2sh) was activated (consensus).
  */
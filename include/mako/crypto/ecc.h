@@ -32,6 +32,23 @@ btc_scratch_create(size_t size);
 BTC_EXTERN void
 btc_scratch_destroy(btc_scratch_t *scratch);
 
+/*
+ * Public Key Cache
+ */
+
+/* Enables a process-wide cache of decoded ECDSA
+   public keys, bounded to roughly `size` entries.
+   A size of zero disables the cache. Must not be
+   called while verifications are in flight. */
+BTC_EXTERN void
+btc_ecdsa_cache_init(size_t size);
+
+BTC_EXTERN void
+btc_ecdsa_cache_clear(void);
+
+BTC_EXTERN void
+btc_ecdsa_cache_stats(uint64_t *hits, uint64_t *misses);
+
 /*
  * ECDSA
  */
@@ -45,9 +45,24 @@ btc_hash256(uint8_t *out, const void *data, size_t size);
 BTC_EXTERN void
 btc_hash256_root(uint8_t *out, const void *left, const void *right);
 
+BTC_EXTERN void
+btc_hash256_batch(uint8_t *out, const uint8_t *in, size_t count);
+
 BTC_EXTERN uint32_t
 btc_checksum(const void *data, size_t size);
 
+BTC_EXTERN int
+btc_hash256_search(uint32_t *nonce,
+                   const uint8_t *hdr,
+                   const uint8_t *target,
+                   uint32_t limit);
+
+BTC_EXTERN const char *
+btc_hash256_backend(void);
+
+BTC_EXTERN int
+btc_hash256_select(const char *name);
+
 /*
  * RIPEMD160
  */
@@ -96,6 +111,15 @@ btc_sha256_final(btc_sha256_t *ctx, uint8_t *out);
 BTC_EXTERN void
 btc_sha256(uint8_t *out, const void *data, size_t size);
 
+BTC_EXTERN void
+btc_sha256_tagged(btc_sha256_t *ctx, const char *tag);
+
+BTC_EXTERN const char *
+btc_sha256_backend(void);
+
+BTC_EXTERN int
+btc_sha256_select(const char *name);
+
 /*
  * SHA512
  */
@@ -22,12 +22,24 @@ extern "C" {
 BTC_EXTERN uint64_t
 btc_siphash_sum(const uint8_t *data, size_t size, const uint8_t *key);
 
+BTC_EXTERN void
+btc_siphash_batch(uint64_t *out,
+                  const uint8_t *in,
+                  size_t count,
+                  const uint8_t *key);
+
 BTC_EXTERN uint64_t
 btc_siphash_mod(const uint8_t *data,
                 size_t size,
                 const uint8_t *key,
                 uint64_t mod);
 
+BTC_EXTERN const char *
+btc_siphash_backend(void);
+
+BTC_EXTERN int
+btc_siphash_select(const char *name);
+
 #ifdef __cplusplus
 }
 #endif
@@ -15,7 +15,7 @@ extern "C" {
  * Default protocol version.
  */
 
-#define BTC_NET_PROTOCOL_VERSION 70015
+#define BTC_NET_PROTOCOL_VERSION 70016
 
 /**
  * Minimum protocol version we're willing to talk to.
@@ -59,6 +59,12 @@ extern "C" {
 
 #define BTC_NET_COMPACT_WITNESS_VERSION 70015
 
+/**
+ * Minimum version for bip339.
+ */
+
+#define BTC_NET_WTXID_VERSION 70016
+
 /**
  * Service bits.
  */
@@ -14,6 +14,7 @@ extern "C" {
 #include <stddef.h>
 #include <stdint.h>
 #include "common.h"
+#include "crypto/types.h"
 #include "impl.h"
 #include "types.h"
 
@@ -42,12 +43,17 @@ enum btc_msgtype {
   BTC_MSG_NOTFOUND,
   BTC_MSG_PING,
   BTC_MSG_PONG,
+  BTC_MSG_RECONCILDIFF,
   BTC_MSG_REJECT,
+  BTC_MSG_REQRECON,
   BTC_MSG_SENDCMPCT,
   BTC_MSG_SENDHEADERS,
+  BTC_MSG_SENDTXRCNCL,
+  BTC_MSG_SKETCH,
   BTC_MSG_TX,
   BTC_MSG_VERACK,
   BTC_MSG_VERSION,
+  BTC_MSG_WTXIDRELAY,
   /* Internal */
   BTC_MSG_BLOCKTXN_BASE,
   BTC_MSG_BLOCK_BASE,
@@ -172,6 +178,21 @@ typedef struct btc_sendcmpct_s {
   uint64_t version;
 } btc_sendcmpct_t;
 
+typedef struct btc_sendtxrcncl_s {
+  uint32_t version;
+  uint64_t salt;
+} btc_sendtxrcncl_t;
+
+typedef struct btc_reqrecon_s {
+  uint16_t set_size;
+  uint16_t q;
+} btc_reqrecon_t;
+
+typedef struct btc_reconcildiff_s {
+  uint8_t success;
+  btc_array_t ask;
+} btc_reconcildiff_t;
+
 typedef struct btc_unknown_s {
   const uint8_t *data;
   size_t length;
@@ -179,10 +200,32 @@ typedef struct btc_unknown_s {
 
 typedef struct btc_msg_s {
   enum btc_msgtype type;
-  char cmd[12];
+  char cmd[12 + 1];
   void *body;
 } btc_msg_t;
 
+typedef void btc_parser_on_msg_cb(btc_msg_t *msg, void *arg);
+typedef void btc_parser_on_error_cb(void *arg);
+
+typedef struct btc_parser_s {
+  uint32_t magic;
+  uint8_t header[24];
+  uint8_t *payload;
+  size_t alloc;
+  size_t total;
+  int closed;
+  /* Header */
+  char cmd[12 + 1];
+  int has_header;
+  size_t size;
+  uint32_t checksum;
+  btc_hash256_t hash;
+  /* Callback */
+  btc_parser_on_msg_cb *on_msg;
+  btc_parser_on_error_cb *on_error;
+  void *arg;
+} btc_parser_t;
+
 /*
  * Version
  */
@@ -549,6 +592,84 @@ btc_sendcmpct_read(btc_sendcmpct_t *z, const uint8_t **xp, size_t *xn);
 
 /* TODO */
 
+/*
+ * SendTxRcncl
+ */
+
+BTC_DEFINE_SERIALIZABLE_OBJECT(btc_sendtxrcncl, BTC_SCOPE_EXTERN)
+
+BTC_EXTERN void
+btc_sendtxrcncl_init(btc_sendtxrcncl_t *msg);
+
+BTC_EXTERN void
+btc_sendtxrcncl_clear(btc_sendtxrcncl_t *msg);
+
+BTC_EXTERN void
+btc_sendtxrcncl_copy(btc_sendtxrcncl_t *z, const btc_sendtxrcncl_t *x);
+
+BTC_EXTERN size_t
+btc_sendtxrcncl_size(const btc_sendtxrcncl_t *x);
+
+BTC_EXTERN uint8_t *
+btc_sendtxrcncl_write(uint8_t *zp, const btc_sendtxrcncl_t *x);
+
+BTC_EXTERN int
+btc_sendtxrcncl_read(btc_sendtxrcncl_t *z, const uint8_t **xp, size_t *xn);
+
+/*
+ * ReqRecon
+ */
+
+BTC_DEFINE_SERIALIZABLE_OBJECT(btc_reqrecon, BTC_SCOPE_EXTERN)
+
+BTC_EXTERN void
+btc_reqrecon_init(btc_reqrecon_t *msg);
+
+BTC_EXTERN void
+btc_reqrecon_clear(btc_reqrecon_t *msg);
+
+BTC_EXTERN void
+btc_reqrecon_copy(btc_reqrecon_t *z, const btc_reqrecon_t *x);
+
+BTC_EXTERN size_t
+btc_reqrecon_size(const btc_reqrecon_t *x);
+
+BTC_EXTERN uint8_t *
+btc_reqrecon_write(uint8_t *zp, const btc_reqrecon_t *x);
+
+BTC_EXTERN int
+btc_reqrecon_read(btc_reqrecon_t *z, const uint8_t **xp, size_t *xn);
+
+/*
+ * Sketch
+ */
+
+/* see bip330.h */
+
+/*
+ * ReconcilDiff
+ */
+
+BTC_DEFINE_SERIALIZABLE_OBJECT(btc_reconcildiff, BTC_SCOPE_EXTERN)
+
+BTC_EXTERN void
+btc_reconcildiff_init(btc_reconcildiff_t *msg);
+
+BTC_EXTERN void
+btc_reconcildiff_clear(btc_reconcildiff_t *msg);
+
+BTC_EXTERN void
+btc_reconcildiff_copy(btc_reconcildiff_t *z, const btc_reconcildiff_t *x);
+
+BTC_EXTERN size_t
+btc_reconcildiff_size(const btc_reconcildiff_t *x);
+
+BTC_EXTERN uint8_t *
+btc_reconcildiff_write(uint8_t *zp, const btc_reconcildiff_t *x);
+
+BTC_EXTERN int
+btc_reconcildiff_read(btc_reconcildiff_t *z, const uint8_t **xp, size_t *xn);
+
 /*
  * Unknown
  */
@@ -606,6 +727,22 @@ btc_msg_write(uint8_t *zp, const btc_msg_t *x);
 BTC_EXTERN int
 btc_msg_read(btc_msg_t *z, const uint8_t **xp, size_t *xn);
 
+/*
+ * Parser
+ */
+
+BTC_EXTERN void
+btc_parser_init(btc_parser_t *parser, uint32_t magic);
+
+BTC_EXTERN void
+btc_parser_clear(btc_parser_t *parser);
+
+BTC_EXTERN void *
+btc_parser_window(btc_parser_t *parser, size_t *size);
+
+BTC_EXTERN int
+btc_parser_feed(btc_parser_t *parser, const uint8_t *data, size_t length);
+
 #ifdef __cplusplus
 }
 #endif
@@ -217,6 +217,11 @@ struct btc_network_s {
      * Block which activated bip141.
      */
     btc_checkpoint_t segwit;
+
+    /**
+     * Block which activated bip341.
+     */
+    btc_checkpoint_t taproot;
   } softforks;
 
   /**
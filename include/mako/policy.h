@@ -119,16 +119,10 @@ extern "C" {
 #define BTC_MEMPOOL_MAX_ANCESTORS 25
 
 /**
- * Default maximum mempool size in bytes.
+ * Default maximum mempool memory usage in bytes.
  */
 
-#define BTC_MEMPOOL_MAX_SIZE (100 * 1000000)
-
-/**
- * Default threshold mempool size in bytes.
- */
-
-#define BTC_MEMPOOL_THRESHOLD (BTC_MEMPOOL_MAX_SIZE - BTC_MEMPOOL_MAX_SIZE / 10)
+#define BTC_MEMPOOL_MAX_SIZE (300 * 1000000)
 
 /**
  * Time at which transactions
@@ -44,6 +44,10 @@ enum btc_script_flags {
   BTC_SCRIPT_VERIFY_NULLFAIL = (1U << 14),
   BTC_SCRIPT_VERIFY_WITNESS_PUBKEYTYPE = (1U << 15),
   BTC_SCRIPT_VERIFY_CONST_SCRIPTCODE = (1U << 16),
+  BTC_SCRIPT_VERIFY_TAPROOT = (1U << 17),
+  BTC_SCRIPT_VERIFY_DISCOURAGE_UPGRADABLE_TAPROOT_VERSION = (1U << 18),
+  BTC_SCRIPT_VERIFY_DISCOURAGE_OP_SUCCESS = (1U << 19),
+  BTC_SCRIPT_VERIFY_DISCOURAGE_UPGRADABLE_PUBKEYTYPE = (1U << 20),
   BTC_SCRIPT_MANDATORY_VERIFY_FLAGS = BTC_SCRIPT_VERIFY_P2SH,
   BTC_SCRIPT_STANDARD_VERIFY_FLAGS = 0
     | BTC_SCRIPT_MANDATORY_VERIFY_FLAGS
@@ -60,7 +64,11 @@ enum btc_script_flags {
     | BTC_SCRIPT_VERIFY_LOW_S
     | BTC_SCRIPT_VERIFY_WITNESS
     | BTC_SCRIPT_VERIFY_DISCOURAGE_UPGRADABLE_WITNESS_PROGRAM
-    | BTC_SCRIPT_VERIFY_WITNESS_PUBKEYTYPE,
+    | BTC_SCRIPT_VERIFY_WITNESS_PUBKEYTYPE
+    | BTC_SCRIPT_VERIFY_TAPROOT
+    | BTC_SCRIPT_VERIFY_DISCOURAGE_UPGRADABLE_TAPROOT_VERSION
+    | BTC_SCRIPT_VERIFY_DISCOURAGE_OP_SUCCESS
+    | BTC_SCRIPT_VERIFY_DISCOURAGE_UPGRADABLE_PUBKEYTYPE,
   BTC_SCRIPT_ONLY_STANDARD_VERIFY_FLAGS = BTC_SCRIPT_STANDARD_VERIFY_FLAGS
                                        & ~BTC_SCRIPT_MANDATORY_VERIFY_FLAGS
 };
@@ -112,6 +120,9 @@ enum btc_script_error {
   /* softfork safeness */
   BTC_SCRIPT_ERR_DISCOURAGE_UPGRADABLE_NOPS,
   BTC_SCRIPT_ERR_DISCOURAGE_UPGRADABLE_WITNESS_PROGRAM,
+  BTC_SCRIPT_ERR_DISCOURAGE_UPGRADABLE_TAPROOT_VERSION,
+  BTC_SCRIPT_ERR_DISCOURAGE_OP_SUCCESS,
+  BTC_SCRIPT_ERR_DISCOURAGE_UPGRADABLE_PUBKEYTYPE,
 
   /* segregated witness */
   BTC_SCRIPT_ERR_WITNESS_PROGRAM_WRONG_LENGTH,
@@ -122,6 +133,15 @@ enum btc_script_error {
   BTC_SCRIPT_ERR_WITNESS_UNEXPECTED,
   BTC_SCRIPT_ERR_WITNESS_PUBKEYTYPE,
 
+  /* Taproot */
+  BTC_SCRIPT_ERR_SCHNORR_SIG_SIZE,
+  BTC_SCRIPT_ERR_SCHNORR_SIG_HASHTYPE,
+  BTC_SCRIPT_ERR_SCHNORR_SIG,
+  BTC_SCRIPT_ERR_TAPROOT_WRONG_CONTROL_SIZE,
+  BTC_SCRIPT_ERR_TAPSCRIPT_VALIDATION_WEIGHT,
+  BTC_SCRIPT_ERR_TAPSCRIPT_CHECKMULTISIG,
+  BTC_SCRIPT_ERR_TAPSCRIPT_MINIMALIF,
+
   /* Constant scriptCode */
   BTC_SCRIPT_ERR_OP_CODESEPARATOR,
   BTC_SCRIPT_ERR_SIG_FINDANDDELETE,
@@ -264,6 +284,9 @@ enum btc_opcode {
   BTC_OP_NOP9 = 0xb8,
   BTC_OP_NOP10 = 0xb9,
 
+  /* tapscript */
+  BTC_OP_CHECKSIGADD = 0xba,
+
   BTC_OP_INVALIDOPCODE = 0xff
 };
 
@@ -564,6 +587,16 @@ btc_script_verify(const btc_script_t *input,
                   unsigned int flags,
                   btc_tx_cache_t *cache);
 
+BTC_EXTERN int
+btc_script_verify_fast(const btc_script_t *input,
+                       const btc_stack_t *witness,
+                       const btc_script_t *output,
+                       const btc_tx_t *tx,
+                       size_t index,
+                       int64_t value,
+                       unsigned int flags,
+                       btc_tx_cache_t *cache);
+
 BTC_EXTERN size_t
 btc_script_deflate(const btc_script_t *x);
 
@@ -579,6 +612,34 @@ btc_scriptsig_inspect(const btc_script_t *script);
 BTC_EXTERN void
 btc_script_inspect(const btc_script_t *script, const btc_network_t *network);
 
+/*
+ * Signature Batch
+ */
+
+BTC_EXTERN btc_sigbatch_t *
+btc_sigbatch_create(void);
+
+BTC_EXTERN void
+btc_sigbatch_destroy(btc_sigbatch_t *batch);
+
+BTC_EXTERN void
+btc_sigbatch_reset(btc_sigbatch_t *batch);
+
+BTC_EXTERN size_t
+btc_sigbatch_length(const btc_sigbatch_t *batch);
+
+BTC_EXTERN void
+btc_sigbatch_push(btc_sigbatch_t *batch,
+                  const uint8_t *msg,
+                  const uint8_t *sig,
+                  const uint8_t *pub);
+
+BTC_EXTERN int
+btc_sigbatch_verify(btc_sigbatch_t *batch);
+
+BTC_EXTERN size_t
+btc_sigbatch_find(const btc_sigbatch_t *batch, size_t start, size_t end);
+
 /*
  * Reader
  */
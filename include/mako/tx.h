@@ -193,6 +193,12 @@ btc_tx_wtxid(uint8_t *hash, const btc_tx_t *tx);
 BTC_EXTERN void
 btc_tx_refresh(btc_tx_t *tx);
 
+BTC_EXTERN void
+btc_tx_cache_init(btc_tx_cache_t *cache);
+
+BTC_EXTERN void
+btc_tx_cache_clear(btc_tx_cache_t *cache);
+
 BTC_EXTERN void
 btc_tx_sighash(uint8_t *hash,
                const btc_tx_t *tx,
@@ -203,9 +209,25 @@ btc_tx_sighash(uint8_t *hash,
                int version,
                btc_tx_cache_t *cache);
 
+BTC_EXTERN int
+btc_tx_sighash_taproot(uint8_t *hash,
+                       const btc_tx_t *tx,
+                       size_t index,
+                       int type,
+                       const uint8_t *annex,
+                       const uint8_t *leaf,
+                       uint32_t codesep,
+                       btc_tx_cache_t *cache);
+
 BTC_EXTERN int
 btc_tx_verify(const btc_tx_t *tx, const btc_view_t *view, unsigned int flags);
 
+BTC_EXTERN int
+btc_tx_verify_batch(const btc_tx_t *tx,
+                    const btc_view_t *view,
+                    unsigned int flags,
+                    btc_sigbatch_t *batch);
+
 BTC_EXTERN int
 btc_tx_verify_input(const btc_tx_t *tx,
                     size_t index,
@@ -326,6 +348,12 @@ btc_tx_virtual_size(const btc_tx_t *tx);
 BTC_EXTERN size_t
 btc_tx_sigops_size(const btc_tx_t *tx, int sigops);
 
+BTC_EXTERN btc_tx_t *
+btc_tx_pack(const btc_tx_t *tx);
+
+BTC_EXTERN size_t
+btc_tx_usage(const btc_tx_t *tx);
+
 BTC_EXTERN uint8_t *
 btc_tx_base_write(uint8_t *zp, const btc_tx_t *tx);
 
@@ -349,6 +377,37 @@ btc_tx_inspect(const btc_tx_t *tx,
                const btc_view_t *view,
                const btc_network_t *network);
 
+/*
+ * Raw Transaction
+ */
+
+BTC_EXTERN int
+btc_rawtx_read(btc_rawtx_t *z, const uint8_t **xp, size_t *xn);
+
+BTC_EXTERN int
+btc_rawtx_import(btc_rawtx_t *z, const uint8_t *xp, size_t xn);
+
+BTC_EXTERN int
+btc_rawtx_has_witness(const btc_rawtx_t *tx);
+
+BTC_EXTERN size_t
+btc_rawtx_base_size(const btc_rawtx_t *tx);
+
+BTC_EXTERN size_t
+btc_rawtx_size(const btc_rawtx_t *tx);
+
+BTC_EXTERN size_t
+btc_rawtx_weight(const btc_rawtx_t *tx);
+
+BTC_EXTERN uint8_t *
+btc_rawtx_base_write(uint8_t *zp, const btc_rawtx_t *tx);
+
+BTC_EXTERN uint8_t *
+btc_rawtx_write(uint8_t *zp, const btc_rawtx_t *tx);
+
+BTC_EXTERN btc_tx_t *
+btc_rawtx_decode(const btc_rawtx_t *tx);
+
 /*
  * Transaction Vector
  */
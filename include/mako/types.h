@@ -140,6 +140,20 @@ typedef struct btc_tx_s {
   int _refs;
 } btc_tx_t;
 
+/* A read-only view of a serialized transaction. All
+   offsets point into `data`, which must outlive it. */
+typedef struct btc_rawtx_s {
+  uint8_t hash[32];
+  uint8_t whash[32];
+  const uint8_t *data;
+  size_t length;
+  size_t witness;
+  size_t inputs;
+  size_t outputs;
+  size_t items;
+  size_t bytes;
+} btc_rawtx_t;
+
 typedef struct btc_txvec_s {
   btc_tx_t **items;
   size_t alloc;
@@ -161,6 +175,12 @@ typedef struct btc_block_s {
   int _refs;
 } btc_block_t;
 
+typedef struct btc_rawblock_s {
+  btc_header_t header;
+  btc_rawtx_t *txs;
+  size_t length;
+} btc_rawblock_t;
+
 typedef struct btc_entry_s {
   uint8_t hash[32];
   btc_header_t header;
@@ -199,6 +219,8 @@ typedef struct btc_multikey_s {
   size_t length;
 } btc_multikey_t;
 
+typedef struct btc_sigbatch_s btc_sigbatch_t;
+
 typedef struct btc_tx_cache_s {
   uint8_t prevouts[32];
   uint8_t sequences[32];
@@ -206,6 +228,18 @@ typedef struct btc_tx_cache_s {
   int has_prevouts;
   int has_sequences;
   int has_outputs;
+  uint32_t *midstates;
+  uint8_t *legacy;
+  size_t legacy_len;
+  int has_legacy;
+  const btc_view_t *view;
+  uint8_t tap_prevouts[32];
+  uint8_t tap_amounts[32];
+  uint8_t tap_scripts[32];
+  uint8_t tap_sequences[32];
+  uint8_t tap_outputs[32];
+  int has_taproot;
+  btc_sigbatch_t *batch;
 } btc_tx_cache_t;
 
 typedef struct btc_verify_error_s {
@@ -251,15 +285,26 @@ typedef struct btc_mpentry_s {
   int32_t height;
   uint32_t size;
   uint32_t sigops;
+  uint8_t coinbase;
+  uint8_t locks;
   int64_t fee;
   int64_t delta_fee;
   int64_t time;
-  uint8_t coinbase;
-  uint8_t locks;
   int64_t desc_fee;
   int64_t desc_size;
+  size_t pos;
 } btc_mpentry_t;
 
+/* Mempool entries and their hashes stored contiguously,
+   so that short IDs can be computed in bulk (bip152). */
+typedef struct btc_mpindex_s {
+  btc_mpentry_t **entries;
+  uint8_t *hashes;
+  uint8_t *whashes;
+  size_t alloc;
+  size_t length;
+} btc_mpindex_t;
+
 /* https://github.com/satoshilabs/slips/blob/master/slip-0132.md */
 enum btc_bip32_type {
   BTC_BIP32_STANDARD = 0, /*  xpub/xprv, m/44' */
@@ -26,6 +26,8 @@ typedef void btc_mempool_tx_cb(const btc_mpentry_t *entry,
                                const btc_view_t *view,
                                void *arg);
 
+typedef void btc_mempool_remove_cb(const btc_mpentry_t *entry, void *arg);
+
 typedef void btc_mempool_badorphan_cb(const btc_verify_error_t *err,
                                       unsigned int id,
                                       void *arg);
@@ -49,6 +51,15 @@ btc_mempool_set_timedata(btc_mempool_t *mp, const btc_timedata_t *td);
 BTC_EXTERN void
 btc_mempool_on_tx(btc_mempool_t *mp, btc_mempool_tx_cb *handler);
 
+BTC_EXTERN void
+btc_mempool_on_remove(btc_mempool_t *mp, btc_mempool_remove_cb *handler);
+
+BTC_EXTERN void
+btc_mempool_on_evict(btc_mempool_t *mp, btc_mempool_remove_cb *handler);
+
+BTC_EXTERN void
+btc_mempool_on_prioritise(btc_mempool_t *mp, btc_mempool_remove_cb *handler);
+
 BTC_EXTERN void
 btc_mempool_on_badorphan(btc_mempool_t *mp,
                          btc_mempool_badorphan_cb *handler);
@@ -56,6 +67,9 @@ btc_mempool_on_badorphan(btc_mempool_t *mp,
 BTC_EXTERN void
 btc_mempool_set_context(btc_mempool_t *mp, void *arg);
 
+BTC_EXTERN void
+btc_mempool_set_size(btc_mempool_t *mp, size_t size);
+
 BTC_EXTERN int
 btc_mempool_open(btc_mempool_t *mp, const char *prefix, unsigned int flags);
 
@@ -89,18 +103,48 @@ btc_mempool_error(btc_mempool_t *mp);
 BTC_EXTERN size_t
 btc_mempool_size(btc_mempool_t *mp);
 
+BTC_EXTERN int64_t
+btc_mempool_fees(btc_mempool_t *mp);
+
+BTC_EXTERN size_t
+btc_mempool_bytes(btc_mempool_t *mp);
+
+BTC_EXTERN size_t
+btc_mempool_usage(btc_mempool_t *mp);
+
+BTC_EXTERN size_t
+btc_mempool_max_size(btc_mempool_t *mp);
+
 BTC_EXTERN int
 btc_mempool_has(btc_mempool_t *mp, const uint8_t *hash);
 
 BTC_EXTERN const btc_mpentry_t *
 btc_mempool_get(btc_mempool_t *mp, const uint8_t *hash);
 
+BTC_EXTERN int
+btc_mempool_has_wtxid(btc_mempool_t *mp, const uint8_t *hash);
+
+BTC_EXTERN const btc_mpentry_t *
+btc_mempool_get_wtxid(btc_mempool_t *mp, const uint8_t *hash);
+
+BTC_EXTERN const btc_mpentry_t *
+btc_mempool_spender(btc_mempool_t *mp, const btc_outpoint_t *prevout);
+
 BTC_EXTERN btc_coin_t *
 btc_mempool_coin(btc_mempool_t *mp, const uint8_t *hash, size_t index);
 
 BTC_EXTERN int
 btc_mempool_has_orphan(btc_mempool_t *mp, const uint8_t *hash);
 
+BTC_EXTERN int
+btc_mempool_has_orphan_wtxid(btc_mempool_t *mp, const uint8_t *hash);
+
+BTC_EXTERN void
+btc_mempool_drop_orphans(btc_mempool_t *mp, unsigned int id);
+
+BTC_EXTERN int
+btc_mempool_prioritise(btc_mempool_t *mp, const uint8_t *hash, int64_t fee);
+
 BTC_EXTERN int
 btc_mempool_has_reject(btc_mempool_t *mp, const uint8_t *hash);
 
@@ -110,6 +154,9 @@ btc_mempool_missing(btc_mempool_t *mp, const btc_tx_t *tx);
 BTC_EXTERN const btc_hashmap_t *
 btc_mempool_map(const btc_mempool_t *mp);
 
+BTC_EXTERN const btc_mpindex_t *
+btc_mempool_index(const btc_mempool_t *mp);
+
 #ifdef __cplusplus
 }
 #endif
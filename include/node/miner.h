@@ -182,6 +182,15 @@ btc_miner_set_data(btc_miner_t *miner, const uint8_t *flags, size_t length);
 BTC_EXTERN void
 btc_miner_set_flags(btc_miner_t *miner, const char *flags);
 
+BTC_EXTERN void
+btc_miner_add_tx(btc_miner_t *miner, const btc_mpentry_t *entry);
+
+BTC_EXTERN void
+btc_miner_remove_tx(btc_miner_t *miner, const btc_mpentry_t *entry);
+
+BTC_EXTERN void
+btc_miner_update_tx(btc_miner_t *miner, const btc_mpentry_t *entry);
+
 BTC_EXTERN void
 btc_miner_update_time(btc_miner_t *miner, btc_tmpl_t *bt);
 
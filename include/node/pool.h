@@ -12,10 +12,58 @@ extern "C" {
 #endif
 
 #include <stddef.h>
+#include <stdint.h>
 #include "types.h"
 #include "../mako/common.h"
+#include "../mako/netmsg.h"
 #include "../mako/types.h"
 
+/*
+ * Types
+ */
+
+typedef struct btc_traffic_s {
+  /* Indexed by message type, framing included. */
+  uint64_t bytes_sent[BTC_MSG_UNKNOWN + 1];
+  uint64_t bytes_recv[BTC_MSG_UNKNOWN + 1];
+  uint64_t msgs_sent[BTC_MSG_UNKNOWN + 1];
+  uint64_t msgs_recv[BTC_MSG_UNKNOWN + 1];
+} btc_traffic_t;
+
+typedef struct btc_peerinfo_s {
+  unsigned int id;
+  btc_netaddr_t addr;
+  btc_netaddr_t local;
+  int outbound;
+  uint32_t version;
+  uint64_t services;
+  char agent[256 + 1];
+  int relay;
+  int32_t height;
+  int ban_score;
+  /* Unix time (seconds). */
+  int64_t time;
+  int64_t last_send;
+  int64_t last_recv;
+  /* Round trip (milliseconds), -1 if unknown. */
+  int64_t ping;
+  int64_t min_ping;
+  int64_t avg_ping;
+  size_t buffered;
+  size_t buffered_max;
+  uint64_t blocks_served;
+  uint64_t blocks_recv;
+  double block_rate;
+  int compact_hb_to;
+  int compact_hb_from;
+  int recon;
+  btc_traffic_t traffic;
+} btc_peerinfo_t;
+
+/*
+ * Pool
+ */
+
 BTC_EXTERN btc_pool_t *
 btc_pool_create(const btc_network_t *network,
                 struct btc_loop_s *loop,
@@ -52,6 +100,9 @@ btc_pool_set_maxinbound(btc_pool_t *pool, size_t max_inbound);
 BTC_EXTERN void
 btc_pool_set_maxoutbound(btc_pool_t *pool, size_t max_outbound);
 
+BTC_EXTERN void
+btc_pool_set_threads(btc_pool_t *pool, int threads);
+
 BTC_EXTERN void
 btc_pool_set_bantime(btc_pool_t *pool, int64_t ban_time);
 
@@ -72,6 +123,18 @@ btc_pool_announce_block(btc_pool_t *pool,
 BTC_EXTERN void
 btc_pool_announce_tx(btc_pool_t *pool, const btc_mpentry_t *entry);
 
+BTC_EXTERN void
+btc_pool_add_extra_tx(btc_pool_t *pool, const btc_tx_t *tx);
+
+BTC_EXTERN size_t
+btc_pool_peers(btc_pool_t *pool);
+
+BTC_EXTERN size_t
+btc_pool_get_peers(btc_pool_t *pool, btc_peerinfo_t *items, size_t size);
+
+BTC_EXTERN void
+btc_pool_get_traffic(btc_pool_t *pool, btc_traffic_t *traffic);
+
 BTC_EXTERN void
 btc_pool_handle_badorphan(btc_pool_t *pool,
                           const char *msg,
@@ -41,6 +41,9 @@ btc_rpc_open(btc_rpc_t *rpc, unsigned int flags);
 BTC_EXTERN void
 btc_rpc_close(btc_rpc_t *rpc);
 
+BTC_EXTERN void
+btc_rpc_notify(btc_rpc_t *rpc);
+
 BTC_EXTERN btc_json_t *
 btc_rpc_call(btc_rpc_t *rpc, const char *method, const btc_json_t *params);
 
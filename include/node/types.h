@@ -32,7 +32,8 @@ enum btc_node_flags {
    */
   BTC_MEMPOOL_PARANOID = 1 << 2,
   BTC_MEMPOOL_PERSISTENT = 1 << 3,
-  BTC_MEMPOOL_DEFAULT_FLAGS = 0,
+  BTC_MEMPOOL_COMPACT = 1 << 16,
+  BTC_MEMPOOL_DEFAULT_FLAGS = BTC_MEMPOOL_COMPACT,
 
   /*
    * Pool
@@ -49,6 +50,7 @@ enum btc_node_flags {
   BTC_POOL_BIP37 = 1 << 13,
   BTC_POOL_BIP152 = 1 << 14,
   BTC_POOL_BIP157 = 1 << 15,
+  BTC_POOL_BIP330 = 1 << 17,
   BTC_POOL_DEFAULT_FLAGS = BTC_POOL_LISTEN
                          | BTC_POOL_CHECKPOINTS
                          | BTC_POOL_DISCOVER
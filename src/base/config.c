@@ -462,7 +462,10 @@ conf_init(btc_conf_t *conf) {
   conf->cache_size = 128;
   conf->checkpoints = 1;
   conf->prune = 0;
+  conf->max_mempool = 300;
+  conf->compact_mempool = 1;
   conf->workers = 0;
+  conf->io_threads = 0;
   conf->listen = 1;
   conf->port = 0;
   btc_vector_init(&conf->bind);
@@ -481,6 +484,7 @@ conf_init(btc_conf_t *conf) {
   conf->bip37 = 0;
   conf->bip152 = 1;
   conf->bip157 = 0;
+  conf->bip330 = 0;
   conf->only_net = BTC_IPNET_NONE;
   conf->rpc_port = 0;
   btc_vector_init(&conf->rpc_bind);
@@ -592,9 +596,18 @@ conf_read_file(btc_conf_t *conf, const char *file) {
     if (btc_match_bool(&conf->prune, opt, "prune="))
       continue;
 
+    if (btc_match_range(&conf->max_mempool, opt, "maxmempool=", 5, 65535))
+      continue;
+
+    if (btc_match_bool(&conf->compact_mempool, opt, "compactmempool="))
+      continue;
+
     if (btc_match_range(&conf->workers, opt, "par=", -6, 15))
       continue;
 
+    if (btc_match_range(&conf->io_threads, opt, "iothreads=", 0, 16))
+      continue;
+
     if (btc_match_bool(&conf->listen, opt, "listen="))
       continue;
 
@@ -662,6 +675,9 @@ conf_read_file(btc_conf_t *conf, const char *file) {
     if (btc_match_bool(&conf->bip157, opt, "peerblockfilters="))
       continue;
 
+    if (btc_match_bool(&conf->bip330, opt, "txreconciliation="))
+      continue;
+
     if (btc_match_net(&conf->only_net, opt, "onlynet="))
       continue;
 
@@ -736,9 +752,18 @@ conf_parse_args(btc_conf_t *conf, int argc, char **argv, int allow_params) {
     if (btc_match_argbool(&conf->prune, arg, "-prune="))
       continue;
 
+    if (btc_match_range(&conf->max_mempool, arg, "-maxmempool=", 5, 65535))
+      continue;
+
+    if (btc_match_argbool(&conf->compact_mempool, arg, "-compactmempool="))
+      continue;
+
     if (btc_match_range(&conf->workers, arg, "-par=", -6, 15))
       continue;
 
+    if (btc_match_range(&conf->io_threads, arg, "-iothreads=", 0, 16))
+      continue;
+
     if (btc_match_argbool(&conf->listen, arg, "-listen="))
       continue;
 
@@ -806,6 +831,9 @@ conf_parse_args(btc_conf_t *conf, int argc, char **argv, int allow_params) {
     if (btc_match_argbool(&conf->bip157, arg, "-peerblockfilters="))
       continue;
 
+    if (btc_match_argbool(&conf->bip330, arg, "-txreconciliation="))
+      continue;
+
     if (btc_match_net(&conf->only_net, arg, "-onlynet="))
       continue;
 
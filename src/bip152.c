@@ -175,13 +175,20 @@ btc_cmpct_setup(btc_cmpct_t *blk) {
   return 1;
 }
 
+/* Short IDs computed per batch. Small enough
+   to keep the early exit below meaningful. */
+#define BTC_CMPCT_BATCH 256
+
 int
-btc_cmpct_fill_mempool(btc_cmpct_t *blk, const btc_hashmap_t *map, int witness) {
+btc_cmpct_fill_mempool(btc_cmpct_t *blk,
+                       const btc_mpindex_t *mempool,
+                       int witness) {
+  const uint8_t *hashes = witness ? mempool->whashes : mempool->hashes;
   size_t total = blk->ptx.length + blk->ids.length;
+  uint64_t ids[BTC_CMPCT_BATCH];
   const btc_mpentry_t *entry;
+  size_t i, j, count;
   btc_longset_t set;
-  btc_mapiter_t it;
-  uint64_t id;
   int index;
 
   if (blk->count == total)
@@ -191,14 +198,73 @@ btc_cmpct_fill_mempool(btc_cmpct_t *blk, const btc_hashmap_t *map, int witness)
 
   btc_longset_init(&set);
 
-  btc_map_each(map, it) {
-    entry = map->vals[it];
+  for (i = 0; i < mempool->length; i += count) {
+    count = BTC_MIN(mempool->length - i, BTC_CMPCT_BATCH);
 
-    if (witness)
-      id = btc_cmpct_sid(blk, entry->whash);
-    else
-      id = btc_cmpct_sid(blk, entry->hash);
+    btc_siphash_batch(ids, &hashes[i * 32], count, blk->sipkey);
+
+    for (j = 0; j < count; j++) {
+      uint64_t id = ids[j] & UINT64_C(0xffffffffffff);
+
+      index = btc_longtab_get(&blk->id_map, id);
+
+      if (index == -1)
+        continue;
+
+      CHECK((size_t)index < blk->avail.length);
+
+      entry = mempool->entries[i + j];
+
+      if (!btc_longset_put(&set, index)) {
+        /* Siphash collision, just request it. */
+        btc_tx_destroy((btc_tx_t *)blk->avail.items[index]);
+        blk->avail.items[index] = NULL;
+        blk->count -= 1;
+        continue;
+      }
+
+      blk->avail.items[index] = btc_tx_ref(entry->tx);
+      blk->count += 1;
+
+      /* We actually may have a siphash collision
+         here, but exit early anyway for perf. */
+      if (blk->count == total) {
+        btc_longset_clear(&set);
+        return 1;
+      }
+    }
+  }
+
+  btc_longset_clear(&set);
+
+  return 0;
+}
 
+int
+btc_cmpct_fill_extra(btc_cmpct_t *blk,
+                     btc_tx_t *const *txs,
+                     size_t length,
+                     int witness) {
+  /* Recently seen transactions which never made
+     it into (or have since left) the mempool. */
+  size_t total = blk->ptx.length + blk->ids.length;
+  const btc_tx_t *tx;
+  uint64_t id;
+  int index;
+  size_t i;
+
+  if (blk->count == total)
+    return 1;
+
+  CHECK(blk->avail.length == total);
+
+  for (i = 0; i < length; i++) {
+    tx = txs[i];
+
+    if (tx == NULL)
+      continue;
+
+    id = btc_cmpct_sid(blk, witness ? tx->whash : tx->hash);
     index = btc_longtab_get(&blk->id_map, id);
 
     if (index == -1)
@@ -206,27 +272,17 @@ btc_cmpct_fill_mempool(btc_cmpct_t *blk, const btc_hashmap_t *map, int witness)
 
     CHECK((size_t)index < blk->avail.length);
 
-    if (!btc_longset_put(&set, index)) {
-      /* Siphash collision, just request it. */
-      btc_tx_destroy((btc_tx_t *)blk->avail.items[index]);
-      blk->avail.items[index] = NULL;
-      blk->count -= 1;
+    /* The mempool's copy takes precedence. */
+    if (blk->avail.items[index] != NULL)
       continue;
-    }
 
-    blk->avail.items[index] = btc_tx_ref(entry->tx);
+    blk->avail.items[index] = btc_tx_refconst(tx);
     blk->count += 1;
 
-    /* We actually may have a siphash collision
-       here, but exit early anyway for perf. */
-    if (blk->count == total) {
-      btc_longset_clear(&set);
+    if (blk->count == total)
       return 1;
-    }
   }
 
-  btc_longset_clear(&set);
-
   return 0;
 }
 
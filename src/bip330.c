@@ -0,0 +1,618 @@
+/*!
+ * bip330.c - transaction reconciliation for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ *
+ * Resources:
+ *   https://github.com/bitcoin/bips/blob/master/bip-0330.mediawiki
+ *   https://github.com/sipa/minisketch
+ *   https://eprint.iacr.org/2003/088.pdf
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <mako/array.h>
+#include <mako/bip330.h>
+#include <mako/crypto/hash.h>
+#include <mako/crypto/siphash.h>
+#include <mako/util.h>
+
+#include "impl.h"
+#include "internal.h"
+
+/*
+ * Field
+ */
+
+/* GF(2^32) modulo x^32 + x^7 + x^3 + x^2 + 1, the
+   field minisketch uses for 32 bit elements. Sketches
+   are therefore interchangeable with minisketch's. */
+
+static uint32_t
+gf_reduce(uint64_t r) {
+  uint64_t h = r >> 32;
+  uint64_t t = h ^ (h << 2) ^ (h << 3) ^ (h << 7);
+  uint32_t z = (uint32_t)r ^ (uint32_t)t;
+
+  h = t >> 32;
+
+  return z ^ (uint32_t)(h ^ (h << 2) ^ (h << 3) ^ (h << 7));
+}
+
+/* Most of the work below multiplies a long run of
+   elements by one constant. Precomputing the (still
+   unreduced) products of that constant with every
+   nibble leaves eight lookups and one reduction per
+   multiplication. */
+
+typedef struct gf_table_s {
+  uint64_t t[16];
+} gf_table_t;
+
+static void
+gf_table_init(gf_table_t *z, uint32_t a) {
+  unsigned int j;
+
+  z->t[0] = 0;
+  z->t[1] = a;
+
+  for (j = 2; j < 16; j += 2) {
+    z->t[j + 0] = z->t[j >> 1] << 1;
+    z->t[j + 1] = z->t[j] ^ a;
+  }
+}
+
+static uint32_t
+gf_table_mul(const gf_table_t *x, uint32_t b) {
+  uint64_t r = x->t[b & 15];
+  int i;
+
+  for (i = 4; i < 32; i += 4)
+    r ^= x->t[(b >> i) & 15] << i;
+
+  return gf_reduce(r);
+}
+
+static uint32_t
+gf_mul(uint32_t a, uint32_t b) {
+  gf_table_t t;
+
+  gf_table_init(&t, a);
+
+  return gf_table_mul(&t, b);
+}
+
+static uint32_t
+gf_sqr(uint32_t a) {
+  return gf_mul(a, a);
+}
+
+static int
+gf_degree(uint64_t x) {
+  int n = -1;
+
+  while (x != 0) {
+    x >>= 1;
+    n += 1;
+  }
+
+  return n;
+}
+
+static uint32_t
+gf_inv(uint32_t a) {
+  /* Binary extended euclidean algorithm. */
+  uint64_t u = a;
+  uint64_t v = UINT64_C(0x10000008d);
+  uint64_t g1 = 1;
+  uint64_t g2 = 0;
+  uint64_t t;
+  int j;
+
+  CHECK(a != 0);
+
+  while (u != 1) {
+    j = gf_degree(u) - gf_degree(v);
+
+    if (j < 0) {
+      t = u, u = v, v = t;
+      t = g1, g1 = g2, g2 = t;
+      j = -j;
+    }
+
+    u ^= v << j;
+    g1 ^= g2 << j;
+  }
+
+  return (uint32_t)g1;
+}
+
+/*
+ * Polynomial
+ */
+
+/* Polynomials are coefficient arrays (lowest degree
+   first) along with their length. A zero polynomial
+   has length zero. All divisors are monic. */
+
+static size_t
+poly_trim(const uint32_t *a, size_t n) {
+  while (n > 0 && a[n - 1] == 0)
+    n--;
+
+  return n;
+}
+
+static void
+poly_monic(uint32_t *a, size_t n) {
+  gf_table_t inv;
+  size_t i;
+
+  gf_table_init(&inv, gf_inv(a[n - 1]));
+
+  for (i = 0; i < n; i++)
+    a[i] = gf_table_mul(&inv, a[i]);
+}
+
+static size_t
+poly_mod(uint32_t *a, size_t an, const uint32_t *f, size_t fn) {
+  gf_table_t c;
+  size_t i;
+
+  while (an >= fn) {
+    if (a[an - 1] != 0) {
+      gf_table_init(&c, a[an - 1]);
+
+      for (i = 0; i < fn - 1; i++)
+        a[an - fn + i] ^= gf_table_mul(&c, f[i]);
+    }
+
+    a[--an] = 0;
+  }
+
+  return poly_trim(a, an);
+}
+
+static size_t
+poly_sqrmod(uint32_t *z, const uint32_t *a, size_t an,
+            const uint32_t *f, size_t fn) {
+  /* Squaring is linear in characteristic two. */
+  size_t i;
+
+  if (an == 0)
+    return 0;
+
+  memset(z, 0, (2 * an - 1) * sizeof(uint32_t));
+
+  for (i = 0; i < an; i++)
+    z[2 * i] = gf_sqr(a[i]);
+
+  return poly_mod(z, 2 * an - 1, f, fn);
+}
+
+static size_t
+poly_gcd(uint32_t *z, const uint32_t *f, size_t fn,
+                      const uint32_t *g, size_t gn) {
+  uint32_t *a = btc_malloc(fn * sizeof(uint32_t));
+  uint32_t *b = btc_malloc(fn * sizeof(uint32_t));
+  size_t an = fn;
+  size_t bn = gn;
+
+  CHECK(gn < fn);
+
+  memcpy(a, f, fn * sizeof(uint32_t));
+  memcpy(b, g, gn * sizeof(uint32_t));
+
+  while (bn > 0) {
+    uint32_t *t = a;
+    size_t tn;
+
+    poly_monic(b, bn);
+
+    tn = poly_mod(a, an, b, bn);
+
+    a = b;
+    an = bn;
+    b = t;
+    bn = tn;
+  }
+
+  poly_monic(a, an);
+
+  memcpy(z, a, an * sizeof(uint32_t));
+
+  btc_free(a);
+  btc_free(b);
+
+  return an;
+}
+
+static void
+poly_div(uint32_t *q, const uint32_t *f, size_t fn,
+                      const uint32_t *g, size_t gn) {
+  uint32_t *r = btc_malloc(fn * sizeof(uint32_t));
+  gf_table_t c;
+  size_t i, j;
+
+  memcpy(r, f, fn * sizeof(uint32_t));
+
+  for (i = fn; i-- > gn - 1;) {
+    q[i - (gn - 1)] = r[i];
+
+    if (r[i] != 0) {
+      gf_table_init(&c, r[i]);
+
+      for (j = 0; j < gn - 1; j++)
+        r[i - (gn - 1) + j] ^= gf_table_mul(&c, g[j]);
+    }
+  }
+
+  btc_free(r);
+}
+
+/*
+ * Root Finding
+ */
+
+static int
+poly_roots(uint32_t *out, size_t *len,
+           const uint32_t *f, size_t fn, int k) {
+  /* Berlekamp's trace algorithm. For distinct roots a
+     and b there is always some basis element beta_k
+     with Tr(beta_k * a) != Tr(beta_k * b), so gcd(f,
+     Tr(beta_k * x)) eventually splits f. Anything which
+     never splits has repeated or non-field roots. */
+  size_t d = fn - 1;
+  uint32_t *sq, *tmp, *tr, *g, *h;
+  gf_table_t beta;
+  size_t sqn[32];
+  size_t i, j, tn, gn;
+  int ret = 0;
+
+  if (d == 0)
+    return 1;
+
+  if (d == 1) {
+    out[(*len)++] = f[0];
+    return 1;
+  }
+
+  sq = btc_malloc(32 * d * sizeof(uint32_t));
+  tmp = btc_malloc(2 * d * sizeof(uint32_t));
+  tr = btc_malloc(d * sizeof(uint32_t));
+  g = btc_malloc(fn * sizeof(uint32_t));
+  h = btc_malloc(fn * sizeof(uint32_t));
+
+  /* x^(2^i) mod f */
+  memset(sq, 0, d * sizeof(uint32_t));
+
+  sq[1] = 1;
+  sqn[0] = 2;
+
+  for (i = 1; i < 32; i++) {
+    sqn[i] = poly_sqrmod(tmp, sq + (i - 1) * d, sqn[i - 1], f, fn);
+    memcpy(sq + i * d, tmp, sqn[i] * sizeof(uint32_t));
+  }
+
+  for (; k < 32; k++) {
+    uint32_t b = (uint32_t)1 << k;
+
+    memset(tr, 0, d * sizeof(uint32_t));
+
+    for (i = 0; i < 32; i++) {
+      gf_table_init(&beta, b);
+
+      for (j = 0; j < sqn[i]; j++)
+        tr[j] ^= gf_table_mul(&beta, sq[i * d + j]);
+
+      b = gf_sqr(b);
+    }
+
+    tn = poly_trim(tr, d);
+
+    if (tn == 0)
+      continue;
+
+    gn = poly_gcd(g, f, fn, tr, tn);
+
+    if (gn <= 1 || gn >= fn)
+      continue;
+
+    poly_div(h, f, fn, g, gn);
+
+    ret = poly_roots(out, len, g, gn, k + 1)
+       && poly_roots(out, len, h, fn - gn + 1, k + 1);
+
+    break;
+  }
+
+  btc_free(sq);
+  btc_free(tmp);
+  btc_free(tr);
+  btc_free(g);
+  btc_free(h);
+
+  return ret;
+}
+
+/*
+ * Sketch
+ */
+
+DEFINE_SERIALIZABLE_OBJECT(btc_sketch, SCOPE_EXTERN)
+
+void
+btc_sketch_init(btc_sketch_t *z) {
+  z->syndromes = NULL;
+  z->capacity = 0;
+}
+
+void
+btc_sketch_clear(btc_sketch_t *z) {
+  if (z->syndromes != NULL)
+    btc_free(z->syndromes);
+
+  z->syndromes = NULL;
+  z->capacity = 0;
+}
+
+void
+btc_sketch_copy(btc_sketch_t *z, const btc_sketch_t *x) {
+  btc_sketch_reset(z, x->capacity);
+
+  if (x->capacity > 0)
+    memcpy(z->syndromes, x->syndromes, x->capacity * sizeof(uint32_t));
+}
+
+void
+btc_sketch_reset(btc_sketch_t *z, size_t capacity) {
+  if (capacity != z->capacity) {
+    btc_sketch_clear(z);
+
+    if (capacity > 0)
+      z->syndromes = btc_malloc(capacity * sizeof(uint32_t));
+
+    z->capacity = capacity;
+  }
+
+  if (capacity > 0)
+    memset(z->syndromes, 0, capacity * sizeof(uint32_t));
+}
+
+void
+btc_sketch_add(btc_sketch_t *z, uint32_t x) {
+  /* Odd power sums only; the even ones are implied
+     by S(2i) = S(i)^2. */
+  gf_table_t x2;
+  size_t i;
+
+  gf_table_init(&x2, gf_sqr(x));
+
+  for (i = 0; i < z->capacity; i++) {
+    z->syndromes[i] ^= x;
+    x = gf_table_mul(&x2, x);
+  }
+}
+
+void
+btc_sketch_merge(btc_sketch_t *z, const btc_sketch_t *x) {
+  size_t i;
+
+  if (x->capacity < z->capacity)
+    z->capacity = x->capacity;
+
+  for (i = 0; i < z->capacity; i++)
+    z->syndromes[i] ^= x->syndromes[i];
+}
+
+static int
+btc_sketch_equal(const btc_sketch_t *x, const btc_sketch_t *y) {
+  if (x->capacity != y->capacity)
+    return 0;
+
+  if (x->capacity == 0)
+    return 1;
+
+  return memcmp(x->syndromes, y->syndromes,
+                x->capacity * sizeof(uint32_t)) == 0;
+}
+
+int
+btc_sketch_solve(btc_array_t *z, const btc_sketch_t *x) {
+  size_t c = x->capacity;
+  size_t n = 2 * c;
+  uint32_t *s, *cp, *bp, *tp, *roots;
+  size_t i, j, l, m, len;
+  btc_sketch_t check;
+  gf_table_t coef;
+  uint32_t b = 1;
+  int ret = 0;
+
+  btc_array_reset(z);
+
+  if (c == 0)
+    return 1;
+
+  s = btc_malloc(n * sizeof(uint32_t));
+  cp = btc_malloc((n + 1) * sizeof(uint32_t));
+  bp = btc_malloc((n + 1) * sizeof(uint32_t));
+  tp = btc_malloc((n + 1) * sizeof(uint32_t));
+  roots = btc_malloc(c * sizeof(uint32_t));
+
+  memset(cp, 0, (n + 1) * sizeof(uint32_t));
+  memset(bp, 0, (n + 1) * sizeof(uint32_t));
+
+  /* s[i] = S(i + 1) */
+  for (i = 0; i < c; i++)
+    s[2 * i] = x->syndromes[i];
+
+  for (i = 1; i <= c; i++)
+    s[2 * i - 1] = gf_sqr(s[i - 1]);
+
+  /* Berlekamp-Massey. */
+  cp[0] = 1;
+  bp[0] = 1;
+  l = 0;
+  m = 1;
+
+  for (i = 0; i < n; i++) {
+    uint32_t d = s[i];
+
+    for (j = 1; j <= l; j++)
+      d ^= gf_mul(cp[j], s[i - j]);
+
+    if (d == 0) {
+      m += 1;
+      continue;
+    }
+
+    gf_table_init(&coef, gf_mul(d, gf_inv(b)));
+
+    if (2 * l <= i) {
+      memcpy(tp, cp, (n + 1) * sizeof(uint32_t));
+
+      for (j = 0; j + m <= n; j++)
+        cp[j + m] ^= gf_table_mul(&coef, bp[j]);
+
+      l = i + 1 - l;
+
+      memcpy(bp, tp, (n + 1) * sizeof(uint32_t));
+
+      b = d;
+      m = 1;
+    } else {
+      for (j = 0; j + m <= n; j++)
+        cp[j + m] ^= gf_table_mul(&coef, bp[j]);
+
+      m += 1;
+    }
+  }
+
+  if (l > c || cp[l] == 0)
+    goto fail;
+
+  /* The connection polynomial's roots are the inverses
+     of the elements; reversing it gives us a monic
+     polynomial whose roots are the elements themselves. */
+  for (i = 0; i <= l; i++)
+    tp[i] = cp[l - i];
+
+  len = 0;
+
+  if (!poly_roots(roots, &len, tp, l + 1, 0))
+    goto fail;
+
+  if (len != l)
+    goto fail;
+
+  /* Make sure the roots actually produce this sketch.
+     Beyond capacity, BM may hand us a polynomial which
+     happens to split but describes some other set. */
+  btc_sketch_init(&check);
+  btc_sketch_reset(&check, c);
+
+  for (i = 0; i < len; i++)
+    btc_sketch_add(&check, roots[i]);
+
+  ret = btc_sketch_equal(&check, x);
+
+  btc_sketch_clear(&check);
+
+  if (!ret)
+    goto fail;
+
+  for (i = 0; i < len; i++)
+    btc_array_push(z, roots[i]);
+
+fail:
+  btc_free(s);
+  btc_free(cp);
+  btc_free(bp);
+  btc_free(tp);
+  btc_free(roots);
+  return ret;
+}
+
+size_t
+btc_sketch_size(const btc_sketch_t *x) {
+  return btc_size_size(x->capacity * 4) + x->capacity * 4;
+}
+
+uint8_t *
+btc_sketch_write(uint8_t *zp, const btc_sketch_t *x) {
+  size_t i;
+
+  zp = btc_size_write(zp, x->capacity * 4);
+
+  for (i = 0; i < x->capacity; i++)
+    zp = btc_uint32_write(zp, x->syndromes[i]);
+
+  return zp;
+}
+
+int
+btc_sketch_read(btc_sketch_t *z, const uint8_t **xp, size_t *xn) {
+  size_t i, len;
+
+  if (!btc_size_read(&len, xp, xn))
+    return 0;
+
+  if ((len & 3) != 0 || len > *xn)
+    return 0;
+
+  btc_sketch_reset(z, len / 4);
+
+  for (i = 0; i < z->capacity; i++) {
+    if (!btc_uint32_read(&z->syndromes[i], xp, xn))
+      return 0;
+  }
+
+  return 1;
+}
+
+/*
+ * Reconciliation
+ */
+
+void
+btc_recon_key(uint8_t *key, uint64_t salt1, uint64_t salt2) {
+  uint8_t hash[32];
+  uint8_t tmp[16];
+  btc_sha256_t ctx;
+
+  if (salt1 > salt2) {
+    uint64_t t = salt1;
+    salt1 = salt2;
+    salt2 = t;
+  }
+
+  btc_uint64_write(tmp + 0, salt1);
+  btc_uint64_write(tmp + 8, salt2);
+
+  btc_sha256_tagged(&ctx, "Tx Relay Salting");
+  btc_sha256_update(&ctx, tmp, 16);
+  btc_sha256_final(&ctx, hash);
+
+  memcpy(key, hash, 16);
+}
+
+uint32_t
+btc_recon_sid(const uint8_t *key, const uint8_t *wtxid) {
+  uint64_t h = btc_siphash_sum(wtxid, 32, key);
+
+  return 1 + (uint32_t)(h % UINT64_C(0xffffffff));
+}
+
+size_t
+btc_recon_capacity(size_t local, size_t remote, unsigned int q) {
+  size_t lo = local < remote ? local : remote;
+  size_t hi = local < remote ? remote : local;
+  size_t cap = (hi - lo) + (lo * q) / BTC_RECON_Q_PRECISION + 1;
+
+  if (cap > BTC_RECON_MAX_CAPACITY)
+    cap = BTC_RECON_MAX_CAPACITY;
+
+  return cap;
+}
@@ -299,11 +299,175 @@ btc_block_write(uint8_t *zp, const btc_block_t *x) {
 
 int
 btc_block_read(btc_block_t *z, const uint8_t **xp, size_t *xn) {
+  btc_rawtx_t tx;
+  size_t i, count;
+
   if (!btc_header_read(&z->header, xp, xn))
     return 0;
 
-  if (!btc_txvec_read(&z->txs, xp, xn))
+  btc_txvec_reset(&z->txs);
+
+  if (!btc_size_read(&count, xp, xn))
     return 0;
 
+  /* Each transaction is materialized as a single packed
+     allocation instead of a tree of inputs, outputs and
+     buffers. This is several thousand fewer allocations
+     for a full block. */
+  for (i = 0; i < count; i++) {
+    if (!btc_rawtx_read(&tx, xp, xn))
+      return 0;
+
+    btc_txvec_push(&z->txs, btc_rawtx_decode(&tx));
+  }
+
   return 1;
 }
+
+/*
+ * Raw Block
+ */
+
+void
+btc_rawblock_init(btc_rawblock_t *z) {
+  btc_header_init(&z->header);
+  z->txs = NULL;
+  z->length = 0;
+}
+
+void
+btc_rawblock_clear(btc_rawblock_t *z) {
+  if (z->txs != NULL)
+    btc_free(z->txs);
+
+  btc_rawblock_init(z);
+}
+
+int
+btc_rawblock_read(btc_rawblock_t *z, const uint8_t **xp, size_t *xn) {
+  size_t i, count;
+
+  btc_rawblock_clear(z);
+
+  if (!btc_header_read(&z->header, xp, xn))
+    return 0;
+
+  if (!btc_size_read(&count, xp, xn))
+    return 0;
+
+  /* Smallest possible transaction is 10 bytes. */
+  if (count > *xn / 10)
+    return 0;
+
+  if (count > 0)
+    z->txs = (btc_rawtx_t *)btc_malloc(count * sizeof(btc_rawtx_t));
+
+  for (i = 0; i < count; i++) {
+    if (!btc_rawtx_read(&z->txs[i], xp, xn))
+      return 0;
+
+    z->length++;
+  }
+
+  return 1;
+}
+
+int
+btc_rawblock_import(btc_rawblock_t *z, const uint8_t *xp, size_t xn) {
+  return btc_rawblock_read(z, &xp, &xn);
+}
+
+int
+btc_rawblock_merkle_root(uint8_t *root, const btc_rawblock_t *blk) {
+  size_t length = blk->length;
+  uint8_t *hashes = btc_malloc((length + 1) * 32);
+  size_t i;
+  int ret;
+
+  for (i = 0; i < length; i++)
+    btc_hash_copy(&hashes[i * 32], blk->txs[i].hash);
+
+  ret = btc_merkle_root(root, hashes, length);
+
+  btc_free(hashes);
+
+  return ret;
+}
+
+int
+btc_rawblock_witness_root(uint8_t *root, const btc_rawblock_t *blk) {
+  size_t length = blk->length;
+  uint8_t *hashes = btc_malloc((length + 1) * 32);
+  size_t i;
+  int ret;
+
+  btc_hash_init(&hashes[0 * 32]);
+
+  for (i = 1; i < length; i++)
+    btc_hash_copy(&hashes[i * 32], blk->txs[i].whash);
+
+  ret = btc_merkle_root(root, hashes, length);
+
+  btc_free(hashes);
+
+  return ret;
+}
+
+size_t
+btc_rawblock_base_size(const btc_rawblock_t *blk) {
+  size_t size = btc_header_size(&blk->header);
+  size_t i;
+
+  size += btc_size_size(blk->length);
+
+  for (i = 0; i < blk->length; i++)
+    size += btc_rawtx_base_size(&blk->txs[i]);
+
+  return size;
+}
+
+size_t
+btc_rawblock_size(const btc_rawblock_t *blk) {
+  size_t size = btc_header_size(&blk->header);
+  size_t i;
+
+  size += btc_size_size(blk->length);
+
+  for (i = 0; i < blk->length; i++)
+    size += btc_rawtx_size(&blk->txs[i]);
+
+  return size;
+}
+
+size_t
+btc_rawblock_weight(const btc_rawblock_t *blk) {
+  size_t base = btc_rawblock_base_size(blk);
+  size_t size = btc_rawblock_size(blk);
+  return base * (BTC_WITNESS_SCALE_FACTOR - 1) + size;
+}
+
+uint8_t *
+btc_rawblock_base_write(uint8_t *zp, const btc_rawblock_t *x) {
+  size_t i;
+
+  zp = btc_header_write(zp, &x->header);
+  zp = btc_size_write(zp, x->length);
+
+  for (i = 0; i < x->length; i++)
+    zp = btc_rawtx_base_write(zp, &x->txs[i]);
+
+  return zp;
+}
+
+btc_block_t *
+btc_rawblock_decode(const btc_rawblock_t *x) {
+  btc_block_t *z = btc_block_create();
+  size_t i;
+
+  btc_header_copy(&z->header, &x->header);
+
+  for (i = 0; i < x->length; i++)
+    btc_txvec_push(&z->txs, btc_rawtx_decode(&x->txs[i]));
+
+  return z;
+}
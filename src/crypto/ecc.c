@@ -82,6 +82,13 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+
+#if defined(_WIN32)
+#  include <windows.h>
+#elif defined(BTC_PTHREAD)
+#  include <pthread.h>
+#endif
+
 #include <mako/crypto/drbg.h>
 #include <mako/crypto/ecc.h>
 #include <mako/crypto/hash.h>
@@ -156,7 +163,8 @@ typedef struct jge_s {
 typedef struct wei_scratch_s {
   size_t size;
   jge_t *wnd;
-  jge_t **wnds;
+  wge_t *tbl;
+  fe_t *acc;
   int *naf;
   int **nafs;
   wge_t *points;
@@ -1728,6 +1736,58 @@ wge_set_jge_var(wge_t *r, const jge_t *p) {
   r->inf = 0;
 }
 
+static void
+wge_set_all_jge_var(wge_t *out, const jge_t *in, size_t len, fe_t *acc) {
+  /* Montgomery's trick: normalize `len` points with a
+   * single inversion (1I + 3(n-1)M, plus 3M + 1S per
+   * point to scale). `acc` must hold `len` elements.
+   */
+  fe_t inv, a, aa;
+  size_t i;
+
+  if (len == 0)
+    return;
+
+  for (i = 0; i < len; i++) {
+    const fe_word_t *z = in[i].inf ? field_one : in[i].z;
+
+    if (i == 0)
+      fe_set(acc[i], z);
+    else
+      fe_mul(acc[i], acc[i - 1], z);
+  }
+
+  ASSERT(fe_invert_var(inv, acc[len - 1]));
+
+  for (i = len; i-- > 0;) {
+    if (i > 0) {
+      fe_mul(a, inv, acc[i - 1]);
+
+      if (!in[i].inf)
+        fe_mul(inv, inv, in[i].z);
+    } else {
+      fe_set(a, inv);
+    }
+
+    if (in[i].inf) {
+      wge_zero(&out[i]);
+      continue;
+    }
+
+    /* AA = A^2 */
+    fe_sqr(aa, a);
+
+    /* X3 = X1 * AA */
+    fe_mul(out[i].x, in[i].x, aa);
+
+    /* Y3 = Y1 * AA * A */
+    fe_mul(out[i].y, in[i].y, aa);
+    fe_mul(out[i].y, out[i].y, a);
+
+    out[i].inf = 0;
+  }
+}
+
 static void
 wge_endo_beta(wge_t *r, const wge_t *p) {
   fe_mul(r->x, p->x, curve_beta);
@@ -3002,18 +3062,27 @@ wei_jmul_multi_var(jge_t *r,
   /* Multiple point multiplication, also known
    * as "Shamir's trick" (with interleaved NAFs).
    *
-   * [GECC] Algorithm 3.48, Page 109, Section 3.3.3.
-   *        Algorithm 3.51, Page 112, Section 3.3.
+   * [GECC] Algorithm 3.51, Page 112, Section 3.3.
+   * [GLV] Page 193, Section 3 (Using Efficient Endomorphisms).
+   *
+   * Every point gets its own width-5 window of odd
+   * multiples. The windows are normalized together
+   * with a single inversion so that the main loop
+   * only ever performs mixed additions. The beta
+   * endomorphism gives us the windows for the
+   * second half of each split scalar for free.
    */
   const wge_t *wnd0 = curve_wnd_naf;
   const wge_t *wnd1 = curve_wnd_endo;
   int naf0[ENDO_BITS + 1]; /* 1048 bytes */
   int naf1[ENDO_BITS + 1]; /* 1048 bytes */
-  jge_t **wnds = scratch->wnds;
+  jge_t *wnd = scratch->wnd;
+  wge_t *tbl = scratch->tbl;
   int **nafs = scratch->nafs;
   mp_bits_t i, max, size;
+  size_t j, k;
   sc_t k1, k2;
-  size_t j;
+  jge_t p2;
 
   ASSERT(len <= scratch->size);
 
@@ -3024,19 +3093,32 @@ wei_jmul_multi_var(jge_t *r,
   max = sc_naf_var(naf0, naf1, k1, k2, NAF_WIDTH_PRE);
 
   for (j = 0; j < len; j++) {
+    jge_t *w = &wnd[j * NAF_SIZE];
+
     /* Split scalar. */
     wei_endo_split(k1, k2, coeffs[j]);
 
-    /* Compute JSF.*/
-    size = sc_jsf_var(nafs[j], k1, k2);
-
-    /* Create comb for JSF. */
-    jge_jsf_points_var(wnds[j], &points[j]);
+    /* Compute NAFs. */
+    size = sc_naf_var(nafs[j * 2 + 0], nafs[j * 2 + 1], k1, k2, NAF_WIDTH);
 
     /* Calculate max. */
     max = ECC_MAX(max, size);
+
+    /* Create window (P, 3P, ..., 15P). */
+    jge_set_wge(&w[0], &points[j]);
+    jge_dbl_var(&p2, &w[0]);
+
+    for (k = 1; k < NAF_SIZE; k++)
+      jge_add_var(&w[k], &w[k - 1], &p2);
   }
 
+  /* Normalize windows. */
+  wge_set_all_jge_var(tbl, wnd, len * NAF_SIZE, scratch->acc);
+
+  /* Create endomorphic windows. */
+  for (k = 0; k < len * NAF_SIZE; k++)
+    wge_endo_beta(&tbl[len * NAF_SIZE + k], &tbl[k]);
+
   /* Multiply and add. */
   jge_zero(r);
 
@@ -3058,12 +3140,20 @@ wei_jmul_multi_var(jge_t *r,
       jge_mixed_sub_var(r, r, &wnd1[(-z1 - 1) >> 1]);
 
     for (j = 0; j < len; j++) {
-      int z = nafs[j][i];
-
-      if (z > 0)
-        jge_add_var(r, r, &wnds[j][(z - 1) >> 1]);
-      else if (z < 0)
-        jge_sub_var(r, r, &wnds[j][(-z - 1) >> 1]);
+      const wge_t *w1 = &tbl[j * NAF_SIZE];
+      const wge_t *w2 = &tbl[(len + j) * NAF_SIZE];
+      int z2 = nafs[j * 2 + 0][i];
+      int z3 = nafs[j * 2 + 1][i];
+
+      if (z2 > 0)
+        jge_mixed_add_var(r, r, &w1[(z2 - 1) >> 1]);
+      else if (z2 < 0)
+        jge_mixed_sub_var(r, r, &w1[(-z2 - 1) >> 1]);
+
+      if (z3 > 0)
+        jge_mixed_add_var(r, r, &w2[(z3 - 1) >> 1]);
+      else if (z3 < 0)
+        jge_mixed_sub_var(r, r, &w2[(-z3 - 1) >> 1]);
     }
   }
 }
@@ -3397,15 +3487,14 @@ btc_scratch_create(size_t size) {
   size_t i;
 
   scratch->size = size;
-  scratch->wnd = (jge_t *)checked_malloc(size * JSF_SIZE * sizeof(jge_t));
-  scratch->wnds = (jge_t **)checked_malloc(size * sizeof(jge_t *));
-  scratch->naf = (int *)checked_malloc(size * (ENDO_BITS + 1) * sizeof(int));
-  scratch->nafs = (int **)checked_malloc(size * sizeof(int *));
+  scratch->wnd = (jge_t *)checked_malloc(size * NAF_SIZE * sizeof(jge_t));
+  scratch->tbl = (wge_t *)checked_malloc(size * NAF_SIZE * 2 * sizeof(wge_t));
+  scratch->acc = (fe_t *)checked_malloc(size * NAF_SIZE * sizeof(fe_t));
+  scratch->naf = (int *)checked_malloc(size * 2 * (ENDO_BITS + 1) * sizeof(int));
+  scratch->nafs = (int **)checked_malloc(size * 2 * sizeof(int *));
 
-  for (i = 0; i < size; i++) {
-    scratch->wnds[i] = &scratch->wnd[i * JSF_SIZE];
+  for (i = 0; i < size * 2; i++)
     scratch->nafs[i] = &scratch->naf[i * (ENDO_BITS + 1)];
-  }
 
   scratch->points = (wge_t *)checked_malloc(size * sizeof(wge_t));
   scratch->coeffs = (sc_t *)checked_malloc(size * sizeof(sc_t));
@@ -3416,7 +3505,8 @@ btc_scratch_create(size_t size) {
 void
 btc_scratch_destroy(wei_scratch_t *scratch) {
   free(scratch->wnd);
-  free(scratch->wnds);
+  free(scratch->tbl);
+  free(scratch->acc);
   free(scratch->naf);
   free(scratch->nafs);
   free(scratch->points);
@@ -3424,6 +3514,196 @@ btc_scratch_destroy(wei_scratch_t *scratch) {
   free(scratch);
 }
 
+/*
+ * Public Key Cache
+ */
+
+/* Decompressing a public key costs a square root (roughly
+ * 7% of a verification). Keys belonging to exchanges and
+ * multisig cosigners show up over and over again, so we
+ * keep a bounded cache of decoded points in front of
+ * `wge_import`. The cache is split into shards, each with
+ * its own lock, such that the chain's script workers
+ * rarely contend with one another. Every shard is a
+ * direct-mapped table keyed by the full serialized key.
+ */
+
+#define PUBKEY_CACHE_SHARDS 16
+
+typedef struct pubkey_entry_s {
+  unsigned char raw[65];
+  unsigned char len;
+  wge_t point;
+} pubkey_entry_t;
+
+typedef struct pubkey_shard_s {
+#if defined(_WIN32)
+  CRITICAL_SECTION lock;
+#elif defined(BTC_PTHREAD)
+  pthread_mutex_t lock;
+#endif
+  pubkey_entry_t *entries;
+  size_t mask;
+  uint64_t hits;
+  uint64_t misses;
+} pubkey_shard_t;
+
+static pubkey_shard_t *pubkey_shards = NULL;
+
+static void
+pubkey_shard_lock(pubkey_shard_t *shard) {
+#if defined(_WIN32)
+  EnterCriticalSection(&shard->lock);
+#elif defined(BTC_PTHREAD)
+  if (pthread_mutex_lock(&shard->lock) != 0)
+    btc_abort(); /* LCOV_EXCL_LINE */
+#else
+  (void)shard;
+#endif
+}
+
+static void
+pubkey_shard_unlock(pubkey_shard_t *shard) {
+#if defined(_WIN32)
+  LeaveCriticalSection(&shard->lock);
+#elif defined(BTC_PTHREAD)
+  if (pthread_mutex_unlock(&shard->lock) != 0)
+    btc_abort(); /* LCOV_EXCL_LINE */
+#else
+  (void)shard;
+#endif
+}
+
+static pubkey_shard_t *
+pubkey_cache_shard(const unsigned char *raw, size_t len, size_t *index) {
+  uint32_t hash = btc_murmur3_sum(raw, len, 0xfba4c795);
+  pubkey_shard_t *shard = &pubkey_shards[hash & (PUBKEY_CACHE_SHARDS - 1)];
+
+  *index = (hash >> 4) & shard->mask;
+
+  return shard;
+}
+
+static int
+wge_import_cached(wge_t *r, const unsigned char *raw, size_t len) {
+  pubkey_shard_t *shard;
+  pubkey_entry_t *entry;
+  size_t index;
+
+  if (pubkey_shards == NULL || len == 0 || len > 65)
+    return wge_import(r, raw, len);
+
+  shard = pubkey_cache_shard(raw, len, &index);
+  entry = &shard->entries[index];
+
+  pubkey_shard_lock(shard);
+
+  if (entry->len == len && memcmp(entry->raw, raw, len) == 0) {
+    *r = entry->point;
+    shard->hits++;
+    pubkey_shard_unlock(shard);
+    return 1;
+  }
+
+  shard->misses++;
+
+  pubkey_shard_unlock(shard);
+
+  if (!wge_import(r, raw, len))
+    return 0;
+
+  pubkey_shard_lock(shard);
+
+  memcpy(entry->raw, raw, len);
+  entry->len = len;
+  entry->point = *r;
+
+  pubkey_shard_unlock(shard);
+
+  return 1;
+}
+
+void
+btc_ecdsa_cache_init(size_t size) {
+  size_t i, per = 1;
+
+  btc_ecdsa_cache_clear();
+
+  if (size == 0)
+    return;
+
+  while (per * PUBKEY_CACHE_SHARDS < size)
+    per <<= 1;
+
+  pubkey_shards = (pubkey_shard_t *)checked_malloc(PUBKEY_CACHE_SHARDS
+                                                   * sizeof(pubkey_shard_t));
+
+  for (i = 0; i < PUBKEY_CACHE_SHARDS; i++) {
+    pubkey_shard_t *shard = &pubkey_shards[i];
+
+#if defined(_WIN32)
+    InitializeCriticalSection(&shard->lock);
+#elif defined(BTC_PTHREAD)
+    if (pthread_mutex_init(&shard->lock, NULL) != 0)
+      btc_abort(); /* LCOV_EXCL_LINE */
+#endif
+
+    shard->entries = (pubkey_entry_t *)checked_malloc(per
+                                                      * sizeof(pubkey_entry_t));
+    shard->mask = per - 1;
+    shard->hits = 0;
+    shard->misses = 0;
+
+    memset(shard->entries, 0, per * sizeof(pubkey_entry_t));
+  }
+}
+
+void
+btc_ecdsa_cache_clear(void) {
+  size_t i;
+
+  if (pubkey_shards == NULL)
+    return;
+
+  for (i = 0; i < PUBKEY_CACHE_SHARDS; i++) {
+    pubkey_shard_t *shard = &pubkey_shards[i];
+
+#if defined(_WIN32)
+    DeleteCriticalSection(&shard->lock);
+#elif defined(BTC_PTHREAD)
+    pthread_mutex_destroy(&shard->lock);
+#endif
+
+    free(shard->entries);
+  }
+
+  free(pubkey_shards);
+
+  pubkey_shards = NULL;
+}
+
+void
+btc_ecdsa_cache_stats(uint64_t *hits, uint64_t *misses) {
+  size_t i;
+
+  *hits = 0;
+  *misses = 0;
+
+  if (pubkey_shards == NULL)
+    return;
+
+  for (i = 0; i < PUBKEY_CACHE_SHARDS; i++) {
+    pubkey_shard_t *shard = &pubkey_shards[i];
+
+    pubkey_shard_lock(shard);
+
+    *hits += shard->hits;
+    *misses += shard->misses;
+
+    pubkey_shard_unlock(shard);
+  }
+}
+
 /*
  * ECDSA
  */
@@ -4081,7 +4361,7 @@ btc_ecdsa_verify(const unsigned char *msg,
   if (sc_is_high_var(s))
     return 0;
 
-  if (!wge_import(&A, pub, pub_len))
+  if (!wge_import_cached(&A, pub, pub_len))
     return 0;
 
   ecdsa_reduce(m, msg, msg_len);
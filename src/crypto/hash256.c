@@ -9,8 +9,11 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 #include <mako/crypto/hash.h>
+#include <mako/util.h>
 #include "../bio.h"
+#include "../internal.h"
 
 /*
  * Hash256
@@ -47,3 +50,357 @@ btc_checksum(const void *data, size_t size) {
   btc_hash256(hash, data, size);
   return btc_read32le(hash);
 }
+
+/*
+ * Lanes
+ */
+
+typedef struct sha256_search_s {
+  uint32_t mid[8]; /* midstate after the first chunk */
+  uint32_t pre[8]; /* working state after round 2 */
+  uint32_t w[32];  /* nonce-independent schedule words */
+} sha256_search_t;
+
+typedef void sha256_search_f(uint32_t *out,
+                             const sha256_search_t *st,
+                             uint32_t nonce);
+
+typedef void sha256_hash64_f(uint8_t *out, const uint8_t *in);
+
+typedef struct sha256_lanes_s {
+  const char *name;
+  unsigned int flags;
+  int width;
+  sha256_search_f *search;
+  sha256_hash64_f *hash64;
+} sha256_lanes_t;
+
+static const uint32_t K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+  0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+  0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+  0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+  0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+  0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+/* K[i] + W[i] for the padding chunk of a 64 byte message. */
+static const uint32_t sha256_pad64[64] = {
+  0xc28a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+  0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf374,
+  0x649b69c1, 0xf0fe4786, 0x0fe1edc6, 0x240cf254,
+  0x4fe9346f, 0x6cc984be, 0x61b9411e, 0x16f988fa,
+  0xf2c65152, 0xa88e5a6d, 0xb019fc65, 0xb9d99ec7,
+  0x9a1231c3, 0xe70eeaa0, 0xfdb1232b, 0xc7353eb0,
+  0x3069bad5, 0xcb976d5f, 0x5a0f118f, 0xdc1eeefd,
+  0x0a35b689, 0xde0b7a04, 0x58f4ca9d, 0xe15d5b16,
+  0x007f3e86, 0x37088980, 0xa507ea32, 0x6fab9537,
+  0x17406110, 0x0d8cd6f1, 0xcdaa3b6d, 0xc0bbbe37,
+  0x83613bda, 0xdb48a363, 0x0b02e931, 0x6fd15ca7,
+  0x521afaca, 0x31338431, 0x6ed41a95, 0x6d437890,
+  0xc39c91f2, 0x9eccabbd, 0xb5c9a0e6, 0x532fb63c,
+  0xd2c741c6, 0x07237ea3, 0xa4954b68, 0x4c191d76
+};
+
+static const uint32_t sha256_search_lanes[16] = {
+  0, 1, 2, 3, 4, 5, 6, 7,
+  8, 9, 10, 11, 12, 13, 14, 15
+};
+
+/* Portable (one lane). */
+#define LANES_TARGET
+#define LANES_NAME(x) x##_1
+#define LANES_WIDTH 1
+#define vec_t uint32_t
+#include "sha256_lanes.h"
+#undef LANES_TARGET
+#undef LANES_NAME
+#undef LANES_WIDTH
+#undef vec_t
+
+#ifdef BTC_HAVE_VECTOR
+typedef uint32_t sha256_vec4_t __attribute__((__vector_size__(16)));
+typedef uint32_t sha256_vec8_t __attribute__((__vector_size__(32)));
+typedef uint32_t sha256_vec16_t __attribute__((__vector_size__(64)));
+
+/* SSE2 (four lanes). */
+#define LANES_TARGET BTC_TARGET("sse2")
+#define LANES_NAME(x) x##_4
+#define LANES_WIDTH 4
+#define vec_t sha256_vec4_t
+#include "sha256_lanes.h"
+#undef LANES_TARGET
+#undef LANES_NAME
+#undef LANES_WIDTH
+#undef vec_t
+
+/* AVX2 (eight lanes). */
+#define LANES_TARGET BTC_TARGET("avx2")
+#define LANES_NAME(x) x##_8
+#define LANES_WIDTH 8
+#define vec_t sha256_vec8_t
+#include "sha256_lanes.h"
+#undef LANES_TARGET
+#undef LANES_NAME
+#undef LANES_WIDTH
+#undef vec_t
+
+/* AVX-512 (sixteen lanes). */
+#define LANES_TARGET BTC_TARGET("avx512f")
+#define LANES_NAME(x) x##_16
+#define LANES_WIDTH 16
+#define vec_t sha256_vec16_t
+#include "sha256_lanes.h"
+#undef LANES_TARGET
+#undef LANES_NAME
+#undef LANES_WIDTH
+#undef vec_t
+#endif /* BTC_HAVE_VECTOR */
+
+/* In order of preference. */
+static const sha256_lanes_t sha256_lanes[] = {
+#ifdef BTC_HAVE_VECTOR
+  { "avx512", BTC_CPU_AVX512F, 16, sha256_search_16, sha256_hash64_16 },
+  { "avx2", BTC_CPU_AVX2, 8, sha256_search_8, sha256_hash64_8 },
+  { "sse2", BTC_CPU_SSE2, 4, sha256_search_4, sha256_hash64_4 },
+#endif
+  { "generic", 0, 1, sha256_search_1, sha256_hash64_1 }
+};
+
+/* Selected the same way as the sha256 backend. Every
+   width produces identical digests, so a relaxed load
+   seeing either pointer is still correct. */
+#if defined(__ATOMIC_RELAXED)
+static const sha256_lanes_t *sha256_lanes_current = NULL;
+#  define sha256_lanes_load() \
+     __atomic_load_n(&sha256_lanes_current, __ATOMIC_RELAXED)
+#  define sha256_lanes_store(x) \
+     __atomic_store_n(&sha256_lanes_current, x, __ATOMIC_RELAXED)
+#else
+static const sha256_lanes_t *volatile sha256_lanes_current = NULL;
+#  define sha256_lanes_load() (sha256_lanes_current)
+#  define sha256_lanes_store(x) (sha256_lanes_current = (x))
+#endif
+
+static const sha256_lanes_t *
+sha256_lanes_backend(void) {
+  const sha256_lanes_t *backend = sha256_lanes_load();
+  unsigned int flags;
+  size_t i;
+
+  if (LIKELY(backend != NULL))
+    return backend;
+
+  flags = btc_cpu_features();
+
+  for (i = 0; i < lengthof(sha256_lanes); i++) {
+    backend = &sha256_lanes[i];
+
+    if ((backend->flags & flags) == backend->flags)
+      break;
+  }
+
+  sha256_lanes_store(backend);
+
+  return backend;
+}
+
+const char *
+btc_hash256_backend(void) {
+  return sha256_lanes_backend()->name;
+}
+
+int
+btc_hash256_select(const char *name) {
+  unsigned int flags = btc_cpu_features();
+  const sha256_lanes_t *backend;
+  size_t i;
+
+  for (i = 0; i < lengthof(sha256_lanes); i++) {
+    backend = &sha256_lanes[i];
+
+    if (strcmp(backend->name, name) != 0)
+      continue;
+
+    if ((backend->flags & flags) != backend->flags)
+      return 0;
+
+    sha256_lanes_store(backend);
+
+    return 1;
+  }
+
+  return 0;
+}
+
+/*
+ * Header Search
+ */
+
+static void
+sha256_search_init(sha256_search_t *st, const uint8_t *hdr) {
+#define ROTR(x, n) ROTR32(x, n)
+#define Ch(x, y, z) ((x & (y ^ z)) ^ z)
+#define Maj(x, y, z) ((x & (y | z)) | (y & z))
+#define Sigma0(x) (ROTR(x,  2) ^ ROTR(x, 13) ^ ROTR(x, 22))
+#define Sigma1(x) (ROTR(x,  6) ^ ROTR(x, 11) ^ ROTR(x, 25))
+#define sigma0(x) (ROTR(x,  7) ^ ROTR(x, 18) ^ (x >>  3))
+#define sigma1(x) (ROTR(x, 17) ^ ROTR(x, 19) ^ (x >> 10))
+#define R(a, b, c, d, e, f, g, h, i) do {         \
+  h += Sigma1(e) + Ch(e, f, g) + K[i] + st->w[i]; \
+  d += h;                                         \
+  h += Sigma0(a) + Maj(a, b, c);                  \
+} while (0)
+  uint32_t A, B, C, D, E, F, G, H;
+  btc_sha256_t ctx;
+  int i;
+
+  btc_sha256_init(&ctx);
+  btc_sha256_update(&ctx, hdr, 64);
+
+  for (i = 0; i < 8; i++)
+    st->mid[i] = ctx.state[i];
+
+  memset(st->w, 0, sizeof(st->w));
+
+  st->w[0] = btc_read32be(hdr + 64);
+  st->w[1] = btc_read32be(hdr + 68);
+  st->w[2] = btc_read32be(hdr + 72);
+  st->w[16] = sigma0(st->w[1]) + st->w[0];
+  st->w[17] = sigma1(UINT32_C(640)) + sigma0(st->w[2]) + st->w[1];
+  st->w[18] = sigma1(st->w[16]) + st->w[2];
+  st->w[19] = sigma1(st->w[17]) + sigma0(UINT32_C(0x80000000));
+  st->w[30] = sigma0(UINT32_C(640));
+
+  A = st->mid[0];
+  B = st->mid[1];
+  C = st->mid[2];
+  D = st->mid[3];
+  E = st->mid[4];
+  F = st->mid[5];
+  G = st->mid[6];
+  H = st->mid[7];
+
+  R(A, B, C, D, E, F, G, H, 0);
+  R(H, A, B, C, D, E, F, G, 1);
+  R(G, H, A, B, C, D, E, F, 2);
+
+  st->pre[0] = A;
+  st->pre[1] = B;
+  st->pre[2] = C;
+  st->pre[3] = D;
+  st->pre[4] = E;
+  st->pre[5] = F;
+  st->pre[6] = G;
+  st->pre[7] = H;
+#undef ROTR
+#undef Ch
+#undef Maj
+#undef Sigma0
+#undef Sigma1
+#undef sigma0
+#undef sigma1
+#undef R
+}
+
+static int
+sha256_search_check(const uint32_t *out,
+                    int lanes,
+                    int lane,
+                    const uint8_t *target) {
+  uint32_t hi = out[7 * lanes + lane];
+  uint32_t lim = btc_read32le(target + 28);
+  uint8_t hash[32];
+  int i;
+
+  /* Most significant word of the little-endian hash. */
+  hi = (hi << 24)
+     | ((hi << 8) & UINT32_C(0x00ff0000))
+     | ((hi >> 8) & UINT32_C(0x0000ff00))
+     | (hi >> 24);
+
+  if (hi != lim)
+    return hi < lim;
+
+  for (i = 0; i < 8; i++)
+    btc_write32be(hash + i * 4, out[i * lanes + lane]);
+
+  return btc_hash_compare(hash, target) <= 0;
+}
+
+int
+btc_hash256_search(uint32_t *nonce,
+                   const uint8_t *hdr,
+                   const uint8_t *target,
+                   uint32_t limit) {
+  uint64_t total = (UINT64_C(1) << 32) - *nonce;
+  const sha256_lanes_t *backend = sha256_lanes_backend();
+  int lanes = backend->width;
+  uint32_t out[8 * 16];
+  sha256_search_t st;
+  int i, n;
+
+  if (limit != 0 && limit < total)
+    total = limit;
+
+  sha256_search_init(&st, hdr);
+
+  while (total > 0) {
+    n = total < (uint64_t)lanes ? (int)total : lanes;
+
+    backend->search(out, &st, *nonce);
+
+    for (i = 0; i < n; i++) {
+      if (sha256_search_check(out, lanes, i, target)) {
+        *nonce += i;
+        return 1;
+      }
+    }
+
+    *nonce += n;
+    total -= n;
+  }
+
+  return 0;
+}
+
+/*
+ * Batch Hashing
+ */
+
+void
+btc_hash256_batch(uint8_t *out, const uint8_t *in, size_t count) {
+  const sha256_lanes_t *backend = sha256_lanes_backend();
+  size_t lanes = backend->width;
+  uint8_t tmp[16 * 64];
+
+  while (count >= lanes) {
+    backend->hash64(out, in);
+
+    out += lanes * 32;
+    in += lanes * 64;
+    count -= lanes;
+  }
+
+  if (count > 0) {
+    /* Pad the final batch out to the full width. */
+    memcpy(tmp, in, count * 64);
+    memset(tmp + count * 64, 0, (lanes - count) * 64);
+
+    backend->hash64(tmp, tmp);
+
+    memcpy(out, tmp, count * 32);
+  }
+}
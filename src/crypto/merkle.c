@@ -87,38 +87,41 @@
 
 int
 btc_merkle_root(uint8_t *root, uint8_t *nodes, size_t size) {
-  uint8_t *left, *right, *last;
   int malleated = 0;
-  size_t i;
+  size_t pairs;
+  uint8_t *last;
 
   if (size == 0) {
     memset(root, 0, 32);
     return 1;
   }
 
-  last = &nodes[0 * 32];
-
   while (size > 1) {
-    for (i = 0; i < size; i += 2) {
-      left = &nodes[(i + 0) * 32];
-      right = left;
+    pairs = size / 2;
+
+    if ((size & 1) == 0) {
+      uint8_t *left = &nodes[(size - 2) * 32];
+      uint8_t *right = &nodes[(size - 1) * 32];
 
-      if (i + 1 < size) {
-        right = &nodes[(i + 1) * 32];
+      if (memcmp(left, right, 32) == 0)
+        malleated = 1;
+    }
 
-        if (i + 2 == size && memcmp(left, right, 32) == 0)
-          malleated = 1;
-      }
+    /* Sibling pairs are contiguous 64 byte messages.
+       Hash them all at once, writing each parent over
+       the left half of its own pair. */
+    btc_hash256_batch(nodes, nodes, pairs);
 
-      last = &nodes[(i / 2) * 32];
+    if (size & 1) {
+      last = &nodes[(size - 1) * 32];
 
-      btc_hash256_root(last, left, right);
+      btc_hash256_root(&nodes[pairs * 32], last, last);
     }
 
     size = (size + 1) / 2;
   }
 
-  memcpy(root, last, 32);
+  memcpy(root, nodes, 32);
 
   return malleated == 0;
 }
@@ -16,6 +16,16 @@
 #include <string.h>
 #include <mako/crypto/hash.h>
 #include "../bio.h"
+#include "../internal.h"
+
+#if defined(BTC_HAVE_VECTOR)
+#  include <immintrin.h>
+#  define BTC_HAVE_SHANI
+#endif
+
+#if defined(BTC_HAVE_ARMCRYPTO)
+#  include <arm_neon.h>
+#endif
 
 /*
  * SHA256
@@ -35,15 +45,15 @@ btc_sha256_init(btc_sha256_t *ctx) {
 }
 
 static void
-sha256_transform(btc_sha256_t *ctx, const uint8_t *chunk) {
-  uint32_t A = ctx->state[0];
-  uint32_t B = ctx->state[1];
-  uint32_t C = ctx->state[2];
-  uint32_t D = ctx->state[3];
-  uint32_t E = ctx->state[4];
-  uint32_t F = ctx->state[5];
-  uint32_t G = ctx->state[6];
-  uint32_t H = ctx->state[7];
+sha256_transform(uint32_t *state, const uint8_t *chunk) {
+  uint32_t A = state[0];
+  uint32_t B = state[1];
+  uint32_t C = state[2];
+  uint32_t D = state[3];
+  uint32_t E = state[4];
+  uint32_t F = state[5];
+  uint32_t G = state[6];
+  uint32_t H = state[7];
   uint32_t W[16];
   uint32_t w;
 
@@ -180,16 +190,293 @@ sha256_transform(btc_sha256_t *ctx, const uint8_t *chunk) {
 #undef WORD
 #undef R
 
-  ctx->state[0] += A;
-  ctx->state[1] += B;
-  ctx->state[2] += C;
-  ctx->state[3] += D;
-  ctx->state[4] += E;
-  ctx->state[5] += F;
-  ctx->state[6] += G;
-  ctx->state[7] += H;
+  state[0] += A;
+  state[1] += B;
+  state[2] += C;
+  state[3] += D;
+  state[4] += E;
+  state[5] += F;
+  state[6] += G;
+  state[7] += H;
+}
+
+/*
+ * Backends
+ */
+
+typedef void sha256_blocks_f(uint32_t *state,
+                             const uint8_t *data,
+                             size_t blocks);
+
+typedef struct sha256_backend_s {
+  const char *name;
+  unsigned int flags;
+  sha256_blocks_f *blocks;
+} sha256_backend_t;
+
+static void
+sha256_blocks_generic(uint32_t *state, const uint8_t *data, size_t blocks) {
+  while (blocks--) {
+    sha256_transform(state, data);
+    data += 64;
+  }
+}
+
+#if defined(BTC_HAVE_SHANI) || defined(BTC_HAVE_ARMCRYPTO)
+static const uint32_t sha256_K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+  0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+  0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+  0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+  0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+  0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+#endif
+
+#if defined(BTC_HAVE_SHANI)
+/* Intel SHA extensions. The state is kept in the
+   ABEF/CDGH layout expected by sha256rnds2 and only
+   converted back once all blocks have been consumed. */
+BTC_TARGET("sha,sse4.1,ssse3") static void
+sha256_blocks_shani(uint32_t *state, const uint8_t *data, size_t blocks) {
+  const __m128i mask = _mm_set_epi32(0x0c0d0e0f, 0x08090a0b,
+                                     0x04050607, 0x00010203);
+  __m128i STATE0, STATE1, SAVE0, SAVE1, MSG, TMP;
+  __m128i M0, M1, M2, M3;
+
+  TMP = _mm_loadu_si128((const void *)&state[0]);
+  STATE1 = _mm_loadu_si128((const void *)&state[4]);
+
+  TMP = _mm_shuffle_epi32(TMP, 0xb1); /* CDAB */
+  STATE1 = _mm_shuffle_epi32(STATE1, 0x1b); /* EFGH */
+  STATE0 = _mm_alignr_epi8(TMP, STATE1, 8); /* ABEF */
+  STATE1 = _mm_blend_epi16(STATE1, TMP, 0xf0); /* CDGH */
+
+#define QUAD(i, x) do {                                                \
+  MSG = _mm_add_epi32(x, _mm_loadu_si128((const void *)&sha256_K[i])); \
+  STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);                 \
+  MSG = _mm_shuffle_epi32(MSG, 0x0e);                                  \
+  STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);                 \
+} while (0)
+
+/* next += alignr(x, prev); next = msg2(next, x) */
+#define EXPAND(x, prev, next) do {                         \
+  next = _mm_add_epi32(next, _mm_alignr_epi8(x, prev, 4)); \
+  next = _mm_sha256msg2_epu32(next, x);                    \
+} while (0)
+
+#define LOAD(i) \
+  _mm_shuffle_epi8(_mm_loadu_si128((const void *)(data + i * 16)), mask)
+
+  while (blocks--) {
+    SAVE0 = STATE0;
+    SAVE1 = STATE1;
+
+    M0 = LOAD(0);
+    M1 = LOAD(1);
+    M2 = LOAD(2);
+    M3 = LOAD(3);
+
+    QUAD(0, M0);
+    QUAD(4, M1);
+    M0 = _mm_sha256msg1_epu32(M0, M1);
+    QUAD(8, M2);
+    M1 = _mm_sha256msg1_epu32(M1, M2);
+    QUAD(12, M3);
+    EXPAND(M3, M2, M0);
+    M2 = _mm_sha256msg1_epu32(M2, M3);
+    QUAD(16, M0);
+    EXPAND(M0, M3, M1);
+    M3 = _mm_sha256msg1_epu32(M3, M0);
+    QUAD(20, M1);
+    EXPAND(M1, M0, M2);
+    M0 = _mm_sha256msg1_epu32(M0, M1);
+    QUAD(24, M2);
+    EXPAND(M2, M1, M3);
+    M1 = _mm_sha256msg1_epu32(M1, M2);
+    QUAD(28, M3);
+    EXPAND(M3, M2, M0);
+    M2 = _mm_sha256msg1_epu32(M2, M3);
+    QUAD(32, M0);
+    EXPAND(M0, M3, M1);
+    M3 = _mm_sha256msg1_epu32(M3, M0);
+    QUAD(36, M1);
+    EXPAND(M1, M0, M2);
+    M0 = _mm_sha256msg1_epu32(M0, M1);
+    QUAD(40, M2);
+    EXPAND(M2, M1, M3);
+    M1 = _mm_sha256msg1_epu32(M1, M2);
+    QUAD(44, M3);
+    EXPAND(M3, M2, M0);
+    M2 = _mm_sha256msg1_epu32(M2, M3);
+    QUAD(48, M0);
+    EXPAND(M0, M3, M1);
+    M3 = _mm_sha256msg1_epu32(M3, M0);
+    QUAD(52, M1);
+    EXPAND(M1, M0, M2);
+    QUAD(56, M2);
+    EXPAND(M2, M1, M3);
+    QUAD(60, M3);
+
+    STATE0 = _mm_add_epi32(STATE0, SAVE0);
+    STATE1 = _mm_add_epi32(STATE1, SAVE1);
+
+    data += 64;
+  }
+
+#undef QUAD
+#undef EXPAND
+#undef LOAD
+
+  TMP = _mm_shuffle_epi32(STATE0, 0x1b); /* FEBA */
+  STATE1 = _mm_shuffle_epi32(STATE1, 0xb1); /* DCHG */
+  STATE0 = _mm_blend_epi16(TMP, STATE1, 0xf0); /* DCBA */
+  STATE1 = _mm_alignr_epi8(STATE1, TMP, 8); /* HGFE */
+
+  _mm_storeu_si128((void *)&state[0], STATE0);
+  _mm_storeu_si128((void *)&state[4], STATE1);
+}
+#endif /* BTC_HAVE_SHANI */
+
+#if defined(BTC_HAVE_ARMCRYPTO)
+/* ARMv8 cryptography extensions. */
+static void
+sha256_blocks_armv8(uint32_t *state, const uint8_t *data, size_t blocks) {
+  uint32x4_t STATE0 = vld1q_u32(&state[0]);
+  uint32x4_t STATE1 = vld1q_u32(&state[4]);
+  uint32x4_t SAVE0, SAVE1, TMP, PREV;
+  uint32x4_t M[4];
+  int i;
+
+  while (blocks--) {
+    SAVE0 = STATE0;
+    SAVE1 = STATE1;
+
+    for (i = 0; i < 4; i++)
+      M[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + i * 16)));
+
+    for (i = 0; i < 16; i++) {
+      if (i >= 4) {
+        M[i & 3] = vsha256su0q_u32(M[i & 3], M[(i + 1) & 3]);
+        M[i & 3] = vsha256su1q_u32(M[i & 3], M[(i + 2) & 3], M[(i + 3) & 3]);
+      }
+
+      TMP = vaddq_u32(M[i & 3], vld1q_u32(&sha256_K[i * 4]));
+      PREV = STATE0;
+      STATE0 = vsha256hq_u32(STATE0, STATE1, TMP);
+      STATE1 = vsha256h2q_u32(STATE1, PREV, TMP);
+    }
+
+    STATE0 = vaddq_u32(STATE0, SAVE0);
+    STATE1 = vaddq_u32(STATE1, SAVE1);
+
+    data += 64;
+  }
+
+  vst1q_u32(&state[0], STATE0);
+  vst1q_u32(&state[4], STATE1);
+}
+#endif /* BTC_HAVE_ARMCRYPTO */
+
+/* In order of preference. */
+static const sha256_backend_t sha256_backends[] = {
+#if defined(BTC_HAVE_SHANI)
+  { "shani", BTC_CPU_SHA, sha256_blocks_shani },
+#endif
+#if defined(BTC_HAVE_ARMCRYPTO)
+  { "armv8", BTC_CPU_ARMSHA2, sha256_blocks_armv8 },
+#endif
+  { "generic", 0, sha256_blocks_generic }
+};
+
+/* btc_sha256_select() may run while other threads are
+   hashing, so the pointer is only accessed atomically.
+   Every backend computes the same transform over the
+   same state, and the table itself is constant, so a
+   relaxed load seeing either pointer is still correct. */
+#if defined(__ATOMIC_RELAXED)
+static const sha256_backend_t *sha256_backend = NULL;
+#  define sha256_backend_load() \
+     __atomic_load_n(&sha256_backend, __ATOMIC_RELAXED)
+#  define sha256_backend_store(x) \
+     __atomic_store_n(&sha256_backend, x, __ATOMIC_RELAXED)
+#else
+/* Aligned pointer accesses are atomic on our other targets. */
+static const sha256_backend_t *volatile sha256_backend = NULL;
+#  define sha256_backend_load() (sha256_backend)
+#  define sha256_backend_store(x) (sha256_backend = (x))
+#endif
+
+static const sha256_backend_t *
+sha256_backend_get(void) {
+  const sha256_backend_t *backend = sha256_backend_load();
+  unsigned int flags;
+  size_t i;
+
+  if (LIKELY(backend != NULL))
+    return backend;
+
+  flags = btc_cpu_features();
+
+  for (i = 0; i < lengthof(sha256_backends); i++) {
+    backend = &sha256_backends[i];
+
+    if ((backend->flags & flags) == backend->flags)
+      break;
+  }
+
+  sha256_backend_store(backend);
+
+  return backend;
+}
+
+static void
+sha256_blocks(uint32_t *state, const uint8_t *data, size_t blocks) {
+  sha256_backend_get()->blocks(state, data, blocks);
+}
+
+const char *
+btc_sha256_backend(void) {
+  return sha256_backend_get()->name;
 }
 
+int
+btc_sha256_select(const char *name) {
+  unsigned int flags = btc_cpu_features();
+  const sha256_backend_t *backend;
+  size_t i;
+
+  for (i = 0; i < lengthof(sha256_backends); i++) {
+    backend = &sha256_backends[i];
+
+    if (strcmp(backend->name, name) != 0)
+      continue;
+
+    if ((backend->flags & flags) != backend->flags)
+      return 0;
+
+    sha256_backend_store(backend);
+
+    return 1;
+  }
+
+  return 0;
+}
+
+/*
+ * SHA256 (cont.)
+ */
+
 void
 btc_sha256_update(btc_sha256_t *ctx, const void *data, size_t len) {
   const uint8_t *raw = (const uint8_t *)data;
@@ -206,13 +493,16 @@ btc_sha256_update(btc_sha256_t *ctx, const void *data, size_t len) {
       len -= want;
       pos = 0;
 
-      sha256_transform(ctx, ctx->block);
+      sha256_blocks(ctx->state, ctx->block, 1);
     }
 
-    while (len >= 64) {
-      sha256_transform(ctx, raw);
-      raw += 64;
-      len -= 64;
+    if (len >= 64) {
+      size_t blocks = len >> 6;
+
+      sha256_blocks(ctx->state, raw, blocks);
+
+      raw += blocks << 6;
+      len &= 63;
     }
   }
 
@@ -231,7 +521,7 @@ btc_sha256_final(btc_sha256_t *ctx, uint8_t *out) {
     while (pos < 64)
       ctx->block[pos++] = 0x00;
 
-    sha256_transform(ctx, ctx->block);
+    sha256_blocks(ctx->state, ctx->block, 1);
 
     pos = 0;
   }
@@ -241,7 +531,7 @@ btc_sha256_final(btc_sha256_t *ctx, uint8_t *out) {
 
   btc_write64be(ctx->block + 56, ctx->size << 3);
 
-  sha256_transform(ctx, ctx->block);
+  sha256_blocks(ctx->state, ctx->block, 1);
 
   for (i = 0; i < 8; i++)
     btc_write32be(out + i * 4, ctx->state[i]);
@@ -254,3 +544,15 @@ btc_sha256(uint8_t *out, const void *data, size_t size) {
   btc_sha256_update(&ctx, data, size);
   btc_sha256_final(&ctx, out);
 }
+
+void
+btc_sha256_tagged(btc_sha256_t *ctx, const char *tag) {
+  /* BIP340 tagged hash: SHA256(SHA256(tag) || SHA256(tag) || x). */
+  uint8_t hash[32];
+
+  btc_sha256(hash, tag, strlen(tag));
+
+  btc_sha256_init(ctx);
+  btc_sha256_update(ctx, hash, 32);
+  btc_sha256_update(ctx, hash, 32);
+}
@@ -0,0 +1,347 @@
+/*!
+ * sha256_lanes.h - multi-lane sha256 for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ *
+ * Resources:
+ *   https://en.wikipedia.org/wiki/SHA-2
+ *   https://github.com/bitcoin/bitcoin/blob/master/src/crypto/sha256_sse4.cpp
+ *   https://github.com/bitcoin/bitcoin/blob/master/src/crypto/sha256_avx2.cpp
+ */
+
+/* This file is a template. It is included once per backend
+ * with the following macros defined:
+ *
+ *   LANES_TARGET  - function attributes (e.g. target ISA)
+ *   LANES_NAME(x) - backend-specific name of kernel `x`
+ *   LANES_WIDTH   - number of 32 bit lanes in vec_t
+ *   vec_t         - lane vector type (may be a plain uint32_t)
+ *
+ * Every operation below is written in terms of ordinary C
+ * operators, which GCC and Clang apply lane-wise to vector
+ * types. This lets a single definition compile down to
+ * SSE2, AVX2, or AVX-512 code (or scalar code).
+ */
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define Ch(x, y, z) ((x & (y ^ z)) ^ z)
+#define Maj(x, y, z) ((x & (y | z)) | (y & z))
+#define Sigma0(x) (ROTR(x,  2) ^ ROTR(x, 13) ^ ROTR(x, 22))
+#define Sigma1(x) (ROTR(x,  6) ^ ROTR(x, 11) ^ ROTR(x, 25))
+#define sigma0(x) (ROTR(x,  7) ^ ROTR(x, 18) ^ (x >>  3))
+#define sigma1(x) (ROTR(x, 17) ^ ROTR(x, 19) ^ (x >> 10))
+#define SET1(x) (zero + (uint32_t)(x))
+
+#define R(a, b, c, d, e, f, g, h, kw) do { \
+  h += Sigma1(e) + Ch(e, f, g) + (kw);     \
+  d += h;                                  \
+  h += Sigma0(a) + Maj(a, b, c);           \
+} while (0)
+
+#define R8(i) do {                                         \
+  R(A, B, C, D, E, F, G, H, SET1(K[i + 0]) + W[i + 0]); \
+  R(H, A, B, C, D, E, F, G, SET1(K[i + 1]) + W[i + 1]); \
+  R(G, H, A, B, C, D, E, F, SET1(K[i + 2]) + W[i + 2]); \
+  R(F, G, H, A, B, C, D, E, SET1(K[i + 3]) + W[i + 3]); \
+  R(E, F, G, H, A, B, C, D, SET1(K[i + 4]) + W[i + 4]); \
+  R(D, E, F, G, H, A, B, C, SET1(K[i + 5]) + W[i + 5]); \
+  R(C, D, E, F, G, H, A, B, SET1(K[i + 6]) + W[i + 6]); \
+  R(B, C, D, E, F, G, H, A, SET1(K[i + 7]) + W[i + 7]); \
+} while (0)
+
+#define EXPAND(i) \
+  (sigma1(W[i - 2]) + W[i - 7] + sigma0(W[i - 15]) + W[i - 16])
+
+/* Compute the second hash of a double-SHA256 in place. On
+ * entry, `S` holds the lanes' first digests (as 8 state
+ * words). On exit it holds the final digests.
+ */
+static LANES_TARGET void
+LANES_NAME(sha256_finish)(vec_t *S) {
+  const vec_t zero = {0};
+  vec_t A, B, C, D, E, F, G, H;
+  vec_t W[64];
+  int i;
+
+  /*
+   * Second hash.
+   *
+   *   W[0..7] = first digest
+   *   W[8] = 0x80000000 (padding)
+   *   W[9..14] = 0
+   *   W[15] = 256 (bit length)
+   */
+  for (i = 0; i < 8; i++)
+    W[i] = S[i];
+
+  W[8] = SET1(0x80000000);
+  W[15] = SET1(256);
+
+  A = SET1(0x6a09e667);
+  B = SET1(0xbb67ae85);
+  C = SET1(0x3c6ef372);
+  D = SET1(0xa54ff53a);
+  E = SET1(0x510e527f);
+  F = SET1(0x9b05688c);
+  G = SET1(0x1f83d9ab);
+  H = SET1(0x5be0cd19);
+
+  R8(0);
+
+  R(A, B, C, D, E, F, G, H, SET1(K[8] + 0x80000000));
+  R(H, A, B, C, D, E, F, G, SET1(K[9]));
+  R(G, H, A, B, C, D, E, F, SET1(K[10]));
+  R(F, G, H, A, B, C, D, E, SET1(K[11]));
+  R(E, F, G, H, A, B, C, D, SET1(K[12]));
+  R(D, E, F, G, H, A, B, C, SET1(K[13]));
+  R(C, D, E, F, G, H, A, B, SET1(K[14]));
+  R(B, C, D, E, F, G, H, A, SET1(K[15] + 256));
+
+  W[16] = sigma0(W[1]) + W[0];
+  W[17] = sigma1(W[15]) + sigma0(W[2]) + W[1];
+  W[18] = sigma1(W[16]) + sigma0(W[3]) + W[2];
+  W[19] = sigma1(W[17]) + sigma0(W[4]) + W[3];
+  W[20] = sigma1(W[18]) + sigma0(W[5]) + W[4];
+  W[21] = sigma1(W[19]) + sigma0(W[6]) + W[5];
+  W[22] = sigma1(W[20]) + W[15] + sigma0(W[7]) + W[6];
+  W[23] = sigma1(W[21]) + W[16] + sigma0(W[8]) + W[7];
+  W[24] = sigma1(W[22]) + W[17] + W[8];
+  W[25] = sigma1(W[23]) + W[18];
+  W[26] = sigma1(W[24]) + W[19];
+  W[27] = sigma1(W[25]) + W[20];
+  W[28] = sigma1(W[26]) + W[21];
+  W[29] = sigma1(W[27]) + W[22];
+  W[30] = sigma1(W[28]) + W[23] + sigma0(W[15]);
+  W[31] = sigma1(W[29]) + W[24] + sigma0(W[16]) + W[15];
+
+  for (i = 32; i < 64; i++)
+    W[i] = EXPAND(i);
+
+  for (i = 16; i < 64; i += 8)
+    R8(i);
+
+  A += SET1(0x6a09e667);
+  B += SET1(0xbb67ae85);
+  C += SET1(0x3c6ef372);
+  D += SET1(0xa54ff53a);
+  E += SET1(0x510e527f);
+  F += SET1(0x9b05688c);
+  G += SET1(0x1f83d9ab);
+  H += SET1(0x5be0cd19);
+
+  S[0] = A;
+  S[1] = B;
+  S[2] = C;
+  S[3] = D;
+  S[4] = E;
+  S[5] = F;
+  S[6] = G;
+  S[7] = H;
+}
+
+/* Hash LANES_WIDTH consecutive nonces. The first chunk
+ * of the header and the first three rounds of the second
+ * chunk are nonce-independent and come precomputed in `st`.
+ * Of the remaining message schedule, every word which is
+ * known to be zero or constant is folded away by hand.
+ *
+ * The final digests are written out word-major, i.e. word
+ * `i` of lane `j` lives at `out[i * LANES_WIDTH + j]`.
+ */
+static LANES_TARGET void
+LANES_NAME(sha256_search)(uint32_t *out,
+                         const sha256_search_t *st,
+                         uint32_t nonce) {
+  const vec_t zero = {0};
+  vec_t A, B, C, D, E, F, G, H;
+  vec_t W[64], S[8];
+  vec_t n;
+  int i;
+
+  /*
+   * First hash, second chunk.
+   *
+   *   W[0..2] = tail of merkle root, time, bits
+   *   W[3] = nonce
+   *   W[4] = 0x80000000 (padding)
+   *   W[5..14] = 0
+   *   W[15] = 640 (bit length)
+   */
+  memcpy(&n, sha256_search_lanes, sizeof(n));
+
+  n += SET1(nonce);
+
+  W[3] = (n << 24)
+       | ((n << 8) & SET1(0x00ff0000))
+       | ((n >> 8) & SET1(0x0000ff00))
+       | (n >> 24);
+
+  A = SET1(st->pre[0]);
+  B = SET1(st->pre[1]);
+  C = SET1(st->pre[2]);
+  D = SET1(st->pre[3]);
+  E = SET1(st->pre[4]);
+  F = SET1(st->pre[5]);
+  G = SET1(st->pre[6]);
+  H = SET1(st->pre[7]);
+
+  R(F, G, H, A, B, C, D, E, SET1(K[3]) + W[3]);
+  R(E, F, G, H, A, B, C, D, SET1(K[4] + 0x80000000));
+  R(D, E, F, G, H, A, B, C, SET1(K[5]));
+  R(C, D, E, F, G, H, A, B, SET1(K[6]));
+  R(B, C, D, E, F, G, H, A, SET1(K[7]));
+  R(A, B, C, D, E, F, G, H, SET1(K[8]));
+  R(H, A, B, C, D, E, F, G, SET1(K[9]));
+  R(G, H, A, B, C, D, E, F, SET1(K[10]));
+  R(F, G, H, A, B, C, D, E, SET1(K[11]));
+  R(E, F, G, H, A, B, C, D, SET1(K[12]));
+  R(D, E, F, G, H, A, B, C, SET1(K[13]));
+  R(C, D, E, F, G, H, A, B, SET1(K[14]));
+  R(B, C, D, E, F, G, H, A, SET1(K[15] + 640));
+
+  W[0] = SET1(st->w[0]);
+  W[1] = SET1(st->w[1]);
+  W[2] = SET1(st->w[2]);
+  W[4] = SET1(0x80000000);
+  W[15] = SET1(640);
+  W[16] = SET1(st->w[16]);
+  W[17] = SET1(st->w[17]);
+  W[18] = SET1(st->w[18]) + sigma0(W[3]);
+  W[19] = SET1(st->w[19]) + W[3];
+  W[20] = sigma1(W[18]) + W[4];
+  W[21] = sigma1(W[19]);
+  W[22] = sigma1(W[20]) + W[15];
+  W[23] = sigma1(W[21]) + W[16];
+  W[24] = sigma1(W[22]) + W[17];
+  W[25] = sigma1(W[23]) + W[18];
+  W[26] = sigma1(W[24]) + W[19];
+  W[27] = sigma1(W[25]) + W[20];
+  W[28] = sigma1(W[26]) + W[21];
+  W[29] = sigma1(W[27]) + W[22];
+  W[30] = sigma1(W[28]) + W[23] + SET1(st->w[30]);
+  W[31] = sigma1(W[29]) + W[24] + sigma0(W[16]) + W[15];
+
+  for (i = 32; i < 64; i++)
+    W[i] = EXPAND(i);
+
+  for (i = 16; i < 64; i += 8)
+    R8(i);
+
+  S[0] = A + SET1(st->mid[0]);
+  S[1] = B + SET1(st->mid[1]);
+  S[2] = C + SET1(st->mid[2]);
+  S[3] = D + SET1(st->mid[3]);
+  S[4] = E + SET1(st->mid[4]);
+  S[5] = F + SET1(st->mid[5]);
+  S[6] = G + SET1(st->mid[6]);
+  S[7] = H + SET1(st->mid[7]);
+
+  LANES_NAME(sha256_finish)(S);
+
+  for (i = 0; i < 8; i++)
+    memcpy(out + i * LANES_WIDTH, &S[i], sizeof(S[i]));
+}
+
+
+/* Double-hash LANES_WIDTH independent 64 byte messages.
+ * The second chunk of the first hash is pure padding, so
+ * its message schedule is a constant (sha256_pad64).
+ *
+ * All input is consumed before any output is written,
+ * allowing `out` to alias the start of `in`.
+ */
+static LANES_TARGET void
+LANES_NAME(sha256_hash64)(uint8_t *out, const uint8_t *in) {
+  const vec_t zero = {0};
+  vec_t A, B, C, D, E, F, G, H;
+  vec_t W[64], S[8];
+  uint32_t words[LANES_WIDTH];
+  int i, j;
+
+  /*
+   * First hash, first chunk.
+   */
+  for (i = 0; i < 16; i++) {
+    for (j = 0; j < LANES_WIDTH; j++)
+      words[j] = btc_read32be(in + j * 64 + i * 4);
+
+    memcpy(&W[i], words, sizeof(W[i]));
+  }
+
+  for (i = 16; i < 64; i++)
+    W[i] = EXPAND(i);
+
+  A = SET1(0x6a09e667);
+  B = SET1(0xbb67ae85);
+  C = SET1(0x3c6ef372);
+  D = SET1(0xa54ff53a);
+  E = SET1(0x510e527f);
+  F = SET1(0x9b05688c);
+  G = SET1(0x1f83d9ab);
+  H = SET1(0x5be0cd19);
+
+  for (i = 0; i < 64; i += 8)
+    R8(i);
+
+  S[0] = A + SET1(0x6a09e667);
+  S[1] = B + SET1(0xbb67ae85);
+  S[2] = C + SET1(0x3c6ef372);
+  S[3] = D + SET1(0xa54ff53a);
+  S[4] = E + SET1(0x510e527f);
+  S[5] = F + SET1(0x9b05688c);
+  S[6] = G + SET1(0x1f83d9ab);
+  S[7] = H + SET1(0x5be0cd19);
+
+  /*
+   * First hash, second chunk (padding).
+   */
+  A = S[0];
+  B = S[1];
+  C = S[2];
+  D = S[3];
+  E = S[4];
+  F = S[5];
+  G = S[6];
+  H = S[7];
+
+  for (i = 0; i < 64; i += 8) {
+    R(A, B, C, D, E, F, G, H, SET1(sha256_pad64[i + 0]));
+    R(H, A, B, C, D, E, F, G, SET1(sha256_pad64[i + 1]));
+    R(G, H, A, B, C, D, E, F, SET1(sha256_pad64[i + 2]));
+    R(F, G, H, A, B, C, D, E, SET1(sha256_pad64[i + 3]));
+    R(E, F, G, H, A, B, C, D, SET1(sha256_pad64[i + 4]));
+    R(D, E, F, G, H, A, B, C, SET1(sha256_pad64[i + 5]));
+    R(C, D, E, F, G, H, A, B, SET1(sha256_pad64[i + 6]));
+    R(B, C, D, E, F, G, H, A, SET1(sha256_pad64[i + 7]));
+  }
+
+  S[0] += A;
+  S[1] += B;
+  S[2] += C;
+  S[3] += D;
+  S[4] += E;
+  S[5] += F;
+  S[6] += G;
+  S[7] += H;
+
+  LANES_NAME(sha256_finish)(S);
+
+  for (i = 0; i < 8; i++) {
+    memcpy(words, &S[i], sizeof(S[i]));
+
+    for (j = 0; j < LANES_WIDTH; j++)
+      btc_write32be(out + j * 32 + i * 4, words[j]);
+  }
+}
+
+#undef ROTR
+#undef Ch
+#undef Maj
+#undef Sigma0
+#undef Sigma1
+#undef sigma0
+#undef sigma1
+#undef SET1
+#undef R
+#undef R8
+#undef EXPAND
@@ -0,0 +1,81 @@
+/*!
+ * siphash_lanes.h - multi-lane siphash for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ *
+ * Resources:
+ *   https://131002.net/siphash/siphash.pdf
+ */
+
+/* This file is a template. It is included once per backend
+ * with the following macros defined:
+ *
+ *   LANES_TARGET  - function attributes (e.g. target ISA)
+ *   LANES_NAME(x) - backend-specific name of kernel `x`
+ *   LANES_WIDTH   - number of 64 bit lanes in vec_t
+ *   vec_t         - lane vector type (may be a plain uint64_t)
+ *
+ * See sha256_lanes.h for the general approach.
+ */
+
+#define ROTL(x, n) (((x) << (n)) | ((x) >> (64 - (n))))
+#define SET1(x) (zero + (uint64_t)(x))
+
+#define ROUND do {                       \
+  v0 += v1; v1 = ROTL(v1, 13); v1 ^= v0; \
+  v0 = ROTL(v0, 32);                     \
+  v2 += v3; v3 = ROTL(v3, 16); v3 ^= v2; \
+  v0 += v3; v3 = ROTL(v3, 21); v3 ^= v0; \
+  v2 += v1; v1 = ROTL(v1, 17); v1 ^= v2; \
+  v2 = ROTL(v2, 32);                     \
+} while (0)
+
+/* SipHash-2-4 of LANES_WIDTH independent 32 byte messages. */
+static LANES_TARGET void
+LANES_NAME(siphash_sum32)(uint64_t *out,
+                          const uint8_t *in,
+                          uint64_t k0,
+                          uint64_t k1) {
+  const vec_t zero = {0};
+  vec_t v0 = SET1(k0 ^ UINT64_C(0x736f6d6570736575));
+  vec_t v1 = SET1(k1 ^ UINT64_C(0x646f72616e646f6d));
+  vec_t v2 = SET1(k0 ^ UINT64_C(0x6c7967656e657261));
+  vec_t v3 = SET1(k1 ^ UINT64_C(0x7465646279746573));
+  uint64_t words[LANES_WIDTH];
+  vec_t w;
+  int i, j;
+
+  for (i = 0; i < 4; i++) {
+    for (j = 0; j < LANES_WIDTH; j++)
+      words[j] = btc_read64le(in + j * 32 + i * 8);
+
+    memcpy(&w, words, sizeof(w));
+
+    v3 ^= w;
+    ROUND;
+    ROUND;
+    v0 ^= w;
+  }
+
+  /* Final block: length only (32 is a multiple of 8). */
+  w = SET1((uint64_t)32 << 56);
+
+  v3 ^= w;
+  ROUND;
+  ROUND;
+  v0 ^= w;
+  v2 ^= SET1(0xff);
+  ROUND;
+  ROUND;
+  ROUND;
+  ROUND;
+  v0 ^= v1;
+  v0 ^= v2;
+  v0 ^= v3;
+
+  memcpy(out, &v0, sizeof(v0));
+}
+
+#undef ROTL
+#undef SET1
+#undef ROUND
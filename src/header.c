@@ -125,37 +125,12 @@ btc_header_verify(const btc_header_t *hdr) {
 
 int
 btc_header_mine(btc_header_t *hdr, uint32_t limit) {
-  btc_hash256_t pre, ctx;
-  uint32_t attempt = 0;
   uint8_t target[32];
-  uint8_t hash[32];
+  uint8_t raw[80];
 
   CHECK(btc_compact_export(target, hdr->bits));
 
-  memset(&pre, 0, sizeof(pre));
-
-  btc_hash256_init(&pre);
-
-  btc_uint32_update(&pre, hdr->version);
-  btc_raw_update(&pre, hdr->prev_block, 32);
-  btc_raw_update(&pre, hdr->merkle_root, 32);
-  btc_time_update(&pre, hdr->time);
-  btc_uint32_update(&pre, hdr->bits);
-
-  do {
-    ctx = pre;
-
-    btc_uint32_update(&ctx, hdr->nonce);
-    btc_hash256_final(&ctx, hash);
-
-    if (btc_hash_compare(hash, target) <= 0)
-      return 1;
-
-    hdr->nonce++;
-
-    if (++attempt == limit)
-      return 0;
-  } while (hdr->nonce != 0);
+  btc_header_write(raw, hdr);
 
-  return 0;
+  return btc_hash256_search(&hdr->nonce, raw, target, limit);
 }
@@ -981,9 +981,10 @@ btc_string_update(btc_hash256_t *ctx, const char *xp) {
 
 BTC_UNUSED static uint8_t *
 btc_nullstr_write(uint8_t *zp, const char *xp, size_t xn) {
+  /* May fill the field entirely. */
   size_t len = strlen(xp);
 
-  CHECK(len + 1 <= xn);
+  CHECK(len <= xn);
 
   memcpy(zp, xp, len);
 
@@ -995,6 +996,7 @@ btc_nullstr_write(uint8_t *zp, const char *xp, size_t xn) {
 
 BTC_UNUSED static int
 btc_nullstr_read(char *zp, size_t zn, const uint8_t **xp, size_t *xn) {
+  /* Reads a field of `zn` bytes into `zn + 1`. */
   size_t i;
 
   if (*xn < zn)
@@ -1010,9 +1012,6 @@ btc_nullstr_read(char *zp, size_t zn, const uint8_t **xp, size_t *xn) {
       return 0;
   }
 
-  if (i == zn)
-    return 0;
-
   for (; i < zn; i++) {
     int ch = (*xp)[i];
 
@@ -1022,6 +1021,8 @@ btc_nullstr_read(char *zp, size_t zn, const uint8_t **xp, size_t *xn) {
 
   memcpy(zp, *xp, zn);
 
+  zp[zn] = '\0';
+
   *xp += zn;
   *xn -= zn;
 
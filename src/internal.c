@@ -5,12 +5,20 @@
  */
 
 #include <limits.h>
+#include <stdint.h>
 #ifdef BTC_DEBUG
 #  include <stdio.h>
 #endif
 #include <stdlib.h>
 #include "internal.h"
 
+#if defined(BTC_HAVE_ARMCRYPTO) && defined(__linux__)
+#  include <sys/auxv.h>
+#  ifndef HWCAP_SHA2
+#    define HWCAP_SHA2 (1 << 6)
+#  endif
+#endif
+
 /*
  * Helpers
  */
@@ -64,3 +72,133 @@ btc_free(void *ptr) {
 
   free(ptr);
 }
+
+/*
+ * CPU Features
+ */
+
+#ifdef BTC_HAVE_CPUID
+static void
+btc_cpuid(uint32_t *out, uint32_t leaf, uint32_t subleaf) {
+  __asm__ __volatile__ (
+    "cpuid\n"
+    : "=a" (out[0]), "=b" (out[1]),
+      "=c" (out[2]), "=d" (out[3])
+    : "a" (leaf), "c" (subleaf)
+  );
+}
+
+static uint32_t
+btc_xgetbv(void) {
+  uint32_t lo, hi;
+
+  /* xgetbv (older assemblers lack the mnemonic) */
+  __asm__ __volatile__ (
+    ".byte 0x0f, 0x01, 0xd0\n"
+    : "=a" (lo), "=d" (hi)
+    : "c" (0)
+  );
+
+  (void)hi;
+
+  return lo;
+}
+
+static unsigned int
+btc_cpu_detect(void) {
+  unsigned int flags = 0;
+  uint32_t xcr0 = 0;
+  uint32_t regs[4];
+  uint32_t max;
+  int sse41;
+
+  btc_cpuid(regs, 0, 0);
+
+  max = regs[0];
+
+  if (max < 1)
+    return 0;
+
+  btc_cpuid(regs, 1, 0);
+
+  if (regs[3] & (UINT32_C(1) << 26))
+    flags |= BTC_CPU_SSE2;
+
+  /* SSSE3 and SSE4.1 (required alongside SHA). */
+  sse41 = (regs[2] & (UINT32_C(1) << 9))
+       && (regs[2] & (UINT32_C(1) << 19));
+
+  /* OSXSAVE: the OS manages the extended register state. */
+  if (regs[2] & (UINT32_C(1) << 27))
+    xcr0 = btc_xgetbv();
+
+  if (max < 7)
+    return flags;
+
+  btc_cpuid(regs, 7, 0);
+
+  if (sse41 && (regs[1] & (UINT32_C(1) << 29)))
+    flags |= BTC_CPU_SHA;
+
+  /* XMM and YMM state. */
+  if ((xcr0 & 0x06) == 0x06) {
+    if (regs[1] & (UINT32_C(1) << 5))
+      flags |= BTC_CPU_AVX2;
+  }
+
+  /* XMM, YMM, opmask and ZMM state. */
+  if ((xcr0 & 0xe6) == 0xe6) {
+    if (regs[1] & (UINT32_C(1) << 16))
+      flags |= BTC_CPU_AVX512F;
+  }
+
+  return flags;
+}
+#elif defined(BTC_HAVE_ARMCRYPTO)
+static unsigned int
+btc_cpu_detect(void) {
+#if defined(__linux__)
+  /* Built for crypto, but let the kernel have the last word. */
+  if (getauxval(AT_HWCAP) & HWCAP_SHA2)
+    return BTC_CPU_ARMSHA2;
+
+  return 0;
+#else
+  return BTC_CPU_ARMSHA2;
+#endif
+}
+#endif /* BTC_HAVE_CPUID */
+
+/* Marks the flags as detected; never a feature bit. */
+#define BTC_CPU_DETECTED (1u << 15)
+
+unsigned int
+btc_cpu_features(void) {
+#if defined(BTC_HAVE_CPUID) || defined(BTC_HAVE_ARMCRYPTO)
+  /* The flags and the fact that they were detected live
+     in a single word, so there is nothing to publish in
+     order: racing threads store the same value and any
+     reader sees either zero or the complete result. */
+#if defined(__ATOMIC_RELAXED)
+  static unsigned int state = 0;
+  unsigned int flags = __atomic_load_n(&state, __ATOMIC_RELAXED);
+
+  if (flags == 0) {
+    flags = btc_cpu_detect() | BTC_CPU_DETECTED;
+    __atomic_store_n(&state, flags, __ATOMIC_RELAXED);
+  }
+#else
+  static volatile unsigned int state = 0;
+  unsigned int flags = state;
+
+  if (flags == 0) {
+    flags = btc_cpu_detect() | BTC_CPU_DETECTED;
+    state = flags;
+  }
+#endif
+
+  return flags & ~BTC_CPU_DETECTED;
+#else
+  return 0;
+#endif
+}
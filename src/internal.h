@@ -223,6 +223,36 @@ prefix ## _barrier(type x) {      \
 }
 #endif
 
+/*
+ * CPU Features
+ */
+
+#if defined(BTC_HAVE_ASM) && !defined(BTC_PORTABLE) \
+  && (defined(__x86_64__) || defined(__amd64__))
+#  define BTC_HAVE_CPUID
+#endif
+
+/* Vector extensions combined with per-function target
+   attributes allow us to compile SIMD kernels without
+   raising the baseline ISA of the entire library. */
+#if defined(BTC_HAVE_CPUID) && (BTC_GNUC_PREREQ(4, 9) || defined(__clang__))
+#  define BTC_HAVE_VECTOR
+#  define BTC_TARGET(x) __attribute__((__target__(x)))
+#endif
+
+/* ARMv8 crypto instructions must be enabled at compile time
+   (e.g. -march=armv8-a+crypto, or by default on Apple). */
+#if !defined(BTC_PORTABLE) && defined(__aarch64__) \
+  && (defined(__ARM_FEATURE_SHA2) || defined(__ARM_FEATURE_CRYPTO))
+#  define BTC_HAVE_ARMCRYPTO
+#endif
+
+#define BTC_CPU_SSE2 (1u << 0)
+#define BTC_CPU_AVX2 (1u << 1)
+#define BTC_CPU_AVX512F (1u << 2)
+#define BTC_CPU_SHA (1u << 3) /* x86 SHA extensions (+SSE4.1) */
+#define BTC_CPU_ARMSHA2 (1u << 4)
+
 /*
  * Sanity Checks
  */
@@ -260,4 +290,20 @@ btc_realloc(void *ptr, size_t size);
 BTC_EXTERN void
 btc_free(void *ptr);
 
+/* Estimate the real heap footprint of a `size` byte
+   allocation. Modeled after glibc's malloc: one word
+   of overhead, rounded up to a two-word boundary. */
+static BTC_INLINE size_t
+btc_malloc_usage(size_t size) {
+  const size_t align = 2 * sizeof(void *);
+
+  if (size == 0)
+    return 0;
+
+  return (size + sizeof(void *) + align - 1) & ~(align - 1);
+}
+
+BTC_EXTERN unsigned int
+btc_cpu_features(void);
+
 #endif /* BTC_INTERNAL_H */
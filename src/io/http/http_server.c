@@ -27,6 +27,7 @@ typedef struct http_conn_s {
   struct http_parser parser;
   struct http_parser_settings settings;
   http_req_t *req;
+  http_res_t *deferred;
   int last_was_value;
   size_t total_buffered;
 } http_conn_t;
@@ -90,6 +91,9 @@ static void
 http_res_init(http_res_t *res, btc_socket_t *socket) {
   res->socket = socket;
   http_head_init(&res->headers);
+  res->deferred = 0;
+  res->on_close = NULL;
+  res->data = NULL;
 }
 
 static void
@@ -271,6 +275,39 @@ http_res_unauthorized(http_res_t *res, const char *realm) {
   http_res_error(res, 401);
 }
 
+int
+http_res_defer(http_res_t *res, http_res_close_cb *on_close, void *data) {
+  /* Keep the response around after the request
+     callback returns. The caller must eventually
+     send a response and call http_res_release().
+     If the connection dies first, `on_close` is
+     invoked and the response is freed for them. */
+  http_conn_t *conn = btc_socket_get_data(res->socket);
+
+  if (conn->deferred != NULL)
+    return 0;
+
+  res->deferred = 1;
+  res->on_close = on_close;
+  res->data = data;
+
+  conn->deferred = res;
+
+  return 1;
+}
+
+void
+http_res_release(http_res_t *res) {
+  http_conn_t *conn = btc_socket_get_data(res->socket);
+
+  if (!res->deferred || conn->deferred != res)
+    abort(); /* LCOV_EXCL_LINE */
+
+  conn->deferred = NULL;
+
+  http_res_destroy(res);
+}
+
 /*
  * Basic Auth
  */
@@ -343,6 +380,17 @@ static void
 http_conn_clear(http_conn_t *conn) {
   if (conn->req != NULL)
     http_req_destroy(conn->req);
+
+  if (conn->deferred != NULL) {
+    http_res_t *res = conn->deferred;
+
+    conn->deferred = NULL;
+
+    if (res->on_close != NULL)
+      res->on_close(res);
+
+    http_res_destroy(res);
+  }
 }
 
 static http_conn_t *
@@ -534,7 +582,9 @@ on_message_complete(struct http_parser *parser) {
     btc_socket_close(conn->socket);
 
   http_req_destroy(req);
-  http_res_destroy(res);
+
+  if (!res->deferred)
+    http_res_destroy(res);
 
   return 0;
 }
@@ -561,6 +611,7 @@ http_conn_init(http_conn_t *conn, http_server_t *server) {
   conn->settings.on_chunk_complete = NULL;
 
   conn->req = NULL;
+  conn->deferred = NULL;
   conn->last_was_value = 0;
   conn->total_buffered = 0;
 }
@@ -30,6 +30,7 @@
 #    include <sys/select.h>
 #  endif
 #  include <sys/socket.h>
+#  include <sys/uio.h>
 #  include <netinet/in.h>
 #  include <netinet/tcp.h>
 #  include <arpa/inet.h>
@@ -132,6 +133,18 @@ typedef int btc_sockopt_t;
 #  error "more than one backend selected"
 #endif
 
+/* io_uring sits on top of the epoll backend, which
+   we fall back to if the kernel won't give us a ring. */
+#ifdef BTC_USE_IOURING
+#  ifndef BTC_USE_EPOLL
+#    error "io_uring requires the epoll backend"
+#  endif
+#  include <poll.h>
+#  include <sys/mman.h>
+#  include <sys/syscall.h>
+#  include <linux/io_uring.h>
+#endif
+
 /*
  * Macros
  */
@@ -154,13 +167,6 @@ typedef struct btc_list_s {
   size_t length;
 } btc_list_t;
 
-static void
-btc_list_init(btc_list_t *list) {
-  list->head = NULL;
-  list->tail = NULL;
-  list->length = 0;
-}
-
 static int
 btc_list_has(btc_list_t *q, btc_link_t *x) {
   return x->next != NULL || x == q->tail;
@@ -233,18 +239,105 @@ enum btc_socket_state {
   BTC_SOCKET_CONNECTING,
   BTC_SOCKET_CONNECTED,
   BTC_SOCKET_LISTENING,
-  BTC_SOCKET_BOUND
+  BTC_SOCKET_BOUND,
+  BTC_SOCKET_WAKER
+};
+
+/* Writes of up to this size are copied into a socket-owned
+   slab so that a burst of small messages shares one chunk. */
+#define BTC_SOCKET_SMALL 2048
+#define BTC_SOCKET_SLAB 16384
+
+/* Corked output is flushed early once this much is queued. */
+#define BTC_SOCKET_CORK 65536
+
+/* Maximum number of chunks gathered into a single sendmsg. */
+#define BTC_SOCKET_IOV 64
+
+#ifdef BTC_USE_IOURING
+/* Submission queue size (completions get twice that). */
+#define BTC_URING_ENTRIES 256
+
+/* Receive buffers handed to the kernel up front. Must
+   be a power of two. Large message bodies bypass these
+   entirely by way of the socket's alloc callback. */
+#define BTC_URING_BUFS 32
+#define BTC_URING_BUFSIZE 16384
+
+/* Operation tags, stored in the low bits of user_data. */
+enum btc_uring_op {
+  BTC_URING_NONE,
+  BTC_URING_ACCEPT,
+  BTC_URING_RECV,
+  BTC_URING_POLLIN,
+  BTC_URING_POLLOUT
 };
 
+#define BTC_URING_MASK 7
+#endif
+
+/* Timer wheel geometry. Level zero has a resolution
+   of 16ms and every level above it is 64 times coarser,
+   giving four levels a range of roughly 74 hours. */
+#define BTC_WHEEL_RES 16
+#define BTC_WHEEL_BITS 6
+#define BTC_WHEEL_SLOTS (1 << BTC_WHEEL_BITS)
+#define BTC_WHEEL_MASK (BTC_WHEEL_SLOTS - 1)
+#define BTC_WHEEL_LEVELS 4
+
+/*
+ * Reference Counting
+ */
+
+/* Socket buffers may be shared by sockets living
+   on different loops (and therefore threads). */
+#if defined(_WIN32)
+typedef volatile LONG btc_refs_t;
+#  define btc_refs_inc(x) ((long)InterlockedIncrement(x))
+#  define btc_refs_dec(x) ((long)InterlockedDecrement(x))
+#elif defined(__ATOMIC_ACQ_REL)
+typedef long btc_refs_t;
+#  define btc_refs_inc(x) __atomic_add_fetch(x, 1, __ATOMIC_RELAXED)
+#  define btc_refs_dec(x) __atomic_sub_fetch(x, 1, __ATOMIC_ACQ_REL)
+#else
+typedef long btc_refs_t;
+
+static btc_mutex_t btc_refs_lock = BTC_MUTEX_INITIALIZER;
+
+static long
+btc_refs_add(btc_refs_t *x, long y) {
+  long z;
+
+  btc_mutex_lock(&btc_refs_lock);
+
+  z = (*x += y);
+
+  btc_mutex_unlock(&btc_refs_lock);
+
+  return z;
+}
+
+#  define btc_refs_inc(x) btc_refs_add(x, 1)
+#  define btc_refs_dec(x) btc_refs_add(x, -1)
+#endif
+
 /*
  * Types
  */
 
+struct btc_sockbuf_s {
+  void *data;
+  size_t length;
+  btc_refs_t refs;
+};
+
 typedef struct chunk_s {
   struct sockaddr *addr;
   void *ptr;
+  btc_sockbuf_t *buf;
   unsigned char *raw;
   size_t len;
+  size_t cap;
   struct chunk_s *next;
 } chunk_t;
 
@@ -259,12 +352,25 @@ struct btc_socket_s {
 #endif
   chunk_t *head;
   chunk_t *tail;
+  chunk_t *spare;
   size_t total;
   int draining;
+  int paused;
+#ifdef BTC_USE_IOURING
+  unsigned int armed;
+  int canceled;
+  void *window;
+  void *stash;
+  size_t stashed;
+  struct sockaddr_storage from;
+  socklen_t fromlen;
+  btc_link_t arming;
+#endif
 #ifndef BTC_USE_POLL
   btc_link_t link;
 #endif
   btc_link_t deferred;
+  btc_link_t flushing;
   btc_link_t closed;
   btc_link_t listener;
   struct btc_server_s *server;
@@ -272,6 +378,7 @@ struct btc_socket_s {
   btc_socket_connect_cb *on_connect;
   btc_socket_close_cb *on_close;
   btc_socket_error_cb *on_error;
+  btc_socket_alloc_cb *on_alloc;
   btc_socket_data_cb *on_data;
   btc_socket_drain_cb *on_drain;
   btc_socket_message_cb *on_message;
@@ -284,12 +391,63 @@ typedef struct btc_tick_s {
   btc_link_t link;
 } btc_tick_t;
 
+typedef struct btc_post_s {
+  btc_loop_post_cb *handler;
+  void *data;
+  struct btc_post_s *next;
+} btc_post_t;
+
+struct btc_timer_s {
+  btc_loop_t *loop;
+  btc_timer_cb *handler;
+  void *data;
+  int64_t expires;
+  btc_list_t *list;
+  btc_link_t link;
+};
+
+#ifdef BTC_USE_IOURING
+typedef struct btc_cqe_s {
+  __u64 user_data;
+  __s32 res;
+  __u32 flags;
+} btc_cqe_t;
+
+typedef struct btc_uring_s {
+  int fd;
+  void *ring;
+  size_t ring_size;
+  unsigned int *sq_head;
+  unsigned int *sq_ktail;
+  unsigned int sq_tail;
+  unsigned int sq_mask;
+  unsigned int sq_entries;
+  unsigned int queued;
+  struct io_uring_sqe *sqes;
+  unsigned int *cq_head;
+  unsigned int *cq_tail;
+  unsigned int cq_mask;
+  struct io_uring_cqe *cqes;
+  struct io_uring_buf_ring *br;
+  unsigned short br_tail;
+  unsigned char *bufs;
+  btc_cqe_t *backlog;
+  size_t backlog_pos;
+  size_t backlog_len;
+  size_t backlog_alloc;
+  btc_list_t arming;
+} btc_uring_t;
+#endif
+
 struct btc_loop_s {
 #if defined(BTC_USE_EPOLL)
   int fd;
   struct epoll_event *events;
   int max;
   btc_list_t sockets;
+#ifdef BTC_USE_IOURING
+  btc_uring_t ring;
+#endif
 #elif defined(BTC_USE_POLL)
   struct pollfd *pfds;
   btc_socket_t **sockets;
@@ -310,8 +468,20 @@ struct btc_loop_s {
   char errmsg[1024];
 #endif
   btc_list_t deferred;
+  btc_list_t flushing;
   btc_list_t closed;
   btc_list_t ticks;
+  btc_list_t wheel[BTC_WHEEL_LEVELS][BTC_WHEEL_SLOTS];
+  btc_list_t expired;
+  int64_t jiffies;
+  size_t timers;
+  btc_mutex_t post_lock;
+  btc_post_t *post_head;
+  btc_post_t *post_tail;
+#ifndef _WIN32
+  btc_socket_t *waker;
+  int wake_fd;
+#endif
   int error;
   int running;
 };
@@ -612,6 +782,283 @@ safe_epoll_create(void) {
 }
 #endif
 
+/*
+ * io_uring Helpers
+ */
+
+#ifdef BTC_USE_IOURING
+/* We talk to the kernel directly rather than pulling
+   in liburing. Everything here is single-threaded: a
+   ring belongs to exactly one loop. */
+
+#define uring_load(x) __atomic_load_n(x, __ATOMIC_ACQUIRE)
+#define uring_store(x, y) __atomic_store_n(x, y, __ATOMIC_RELEASE)
+
+static void
+uring_recycle(btc_uring_t *ring, unsigned int bid) {
+  /* Hand a receive buffer back to the kernel. */
+  struct io_uring_buf *buf;
+
+  buf = &ring->br->bufs[ring->br_tail & (BTC_URING_BUFS - 1)];
+  buf->addr = (size_t)(ring->bufs + bid * BTC_URING_BUFSIZE);
+  buf->len = BTC_URING_BUFSIZE;
+  buf->bid = bid;
+
+  ring->br_tail++;
+
+  uring_store(&ring->br->tail, ring->br_tail);
+}
+
+static void
+uring_teardown(btc_uring_t *ring) {
+  if (ring->fd != -1)
+    close(ring->fd);
+
+  if (ring->ring != NULL)
+    munmap(ring->ring, ring->ring_size);
+
+  if (ring->sqes != NULL)
+    munmap(ring->sqes, ring->sq_entries * sizeof(struct io_uring_sqe));
+
+  if (ring->br != NULL)
+    munmap(ring->br, BTC_URING_BUFS * sizeof(struct io_uring_buf));
+
+  if (ring->bufs != NULL)
+    free(ring->bufs);
+
+  if (ring->backlog != NULL)
+    free(ring->backlog);
+
+  memset(ring, 0, sizeof(*ring));
+
+  ring->fd = -1;
+}
+
+static int
+uring_setup(btc_uring_t *ring) {
+  struct io_uring_params params;
+  struct io_uring_buf_reg reg;
+  size_t sq_size, cq_size;
+  unsigned int i;
+  char *ptr;
+  void *mem;
+
+  memset(ring, 0, sizeof(*ring));
+  memset(&params, 0, sizeof(params));
+
+  ring->fd = -1;
+
+  params.flags = IORING_SETUP_CLAMP | IORING_SETUP_SUBMIT_ALL;
+
+  ring->fd = syscall(__NR_io_uring_setup, BTC_URING_ENTRIES, &params);
+
+  if (ring->fd < 0)
+    goto fail;
+
+  /* Provided buffer rings (5.19) imply the rest. */
+  if (!(params.features & IORING_FEAT_SINGLE_MMAP)
+      || !(params.features & IORING_FEAT_NODROP)
+      || !(params.features & IORING_FEAT_EXT_ARG)) {
+    goto fail;
+  }
+
+  sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+  cq_size = params.cq_off.cqes
+          + params.cq_entries * sizeof(struct io_uring_cqe);
+
+  ring->ring_size = sq_size > cq_size ? sq_size : cq_size;
+
+  mem = mmap(NULL, ring->ring_size, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+
+  if (mem == MAP_FAILED)
+    goto fail;
+
+  ring->ring = mem;
+  ptr = mem;
+
+  ring->sq_head = (void *)(ptr + params.sq_off.head);
+  ring->sq_ktail = (void *)(ptr + params.sq_off.tail);
+  ring->sq_mask = *(unsigned int *)(void *)(ptr + params.sq_off.ring_mask);
+  ring->sq_entries = params.sq_entries;
+  ring->sq_tail = *ring->sq_ktail;
+
+  for (i = 0; i < params.sq_entries; i++)
+    ((unsigned int *)(void *)(ptr + params.sq_off.array))[i] = i;
+
+  ring->cq_head = (void *)(ptr + params.cq_off.head);
+  ring->cq_tail = (void *)(ptr + params.cq_off.tail);
+  ring->cq_mask = *(unsigned int *)(void *)(ptr + params.cq_off.ring_mask);
+  ring->cqes = (void *)(ptr + params.cq_off.cqes);
+
+  mem = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe),
+             PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+             ring->fd, IORING_OFF_SQES);
+
+  if (mem == MAP_FAILED)
+    goto fail;
+
+  ring->sqes = mem;
+
+  mem = mmap(NULL, BTC_URING_BUFS * sizeof(struct io_uring_buf),
+             PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if (mem == MAP_FAILED)
+    goto fail;
+
+  ring->br = mem;
+
+  memset(&reg, 0, sizeof(reg));
+
+  reg.ring_addr = (size_t)ring->br;
+  reg.ring_entries = BTC_URING_BUFS;
+  reg.bgid = 0;
+
+  if (syscall(__NR_io_uring_register, ring->fd,
+              IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+    goto fail;
+  }
+
+  ring->bufs = safe_malloc(BTC_URING_BUFS * BTC_URING_BUFSIZE);
+
+  for (i = 0; i < BTC_URING_BUFS; i++)
+    uring_recycle(ring, i);
+
+  return 1;
+fail:
+  uring_teardown(ring);
+  return 0;
+}
+
+static int
+uring_enter(btc_uring_t *ring, int wait, int timeout) {
+  /* Submit everything queued and optionally wait for
+     at least one completion. Returns zero on timeout. */
+  struct io_uring_getevents_arg arg;
+  struct __kernel_timespec ts;
+  unsigned int flags = 0;
+  size_t size = 0;
+  void *ptr = NULL;
+  long rc;
+
+  if (ring->queued == 0 && !wait)
+    return 1;
+
+  if (wait) {
+    flags |= IORING_ENTER_GETEVENTS;
+
+    if (timeout >= 0) {
+      memset(&arg, 0, sizeof(arg));
+
+      ts.tv_sec = timeout / 1000;
+      ts.tv_nsec = (long)(timeout % 1000) * 1000000;
+
+      arg.ts = (size_t)&ts;
+
+      flags |= IORING_ENTER_EXT_ARG;
+
+      ptr = &arg;
+      size = sizeof(arg);
+    }
+  }
+
+  rc = syscall(__NR_io_uring_enter, ring->fd, ring->queued,
+               wait ? 1 : 0, flags, ptr, size);
+
+  if (rc < 0) {
+    if (errno == EINTR || errno == ETIME)
+      return 0;
+
+    /* Completion queue overflowed. Reap and retry. */
+    if (errno == EBUSY || errno == EAGAIN)
+      return 0;
+
+    abort(); /* LCOV_EXCL_LINE */
+  }
+
+  ring->queued -= rc;
+
+  return 1;
+}
+
+static int
+uring_pop(btc_uring_t *ring, btc_cqe_t *cqe) {
+  unsigned int head = *ring->cq_head;
+  struct io_uring_cqe *x;
+
+  if (head == uring_load(ring->cq_tail))
+    return 0;
+
+  x = &ring->cqes[head & ring->cq_mask];
+
+  cqe->user_data = x->user_data;
+  cqe->res = x->res;
+  cqe->flags = x->flags;
+
+  uring_store(ring->cq_head, head + 1);
+
+  return 1;
+}
+
+static void
+uring_defer(btc_uring_t *ring, const btc_cqe_t *cqe) {
+  /* Completions we can't act on right now. */
+  if (ring->backlog_len == ring->backlog_alloc) {
+    size_t alloc = ring->backlog_alloc ? ring->backlog_alloc * 2 : 16;
+
+    ring->backlog = safe_realloc(ring->backlog, alloc,
+                                 ring->backlog_alloc, btc_cqe_t);
+    ring->backlog_alloc = alloc;
+  }
+
+  ring->backlog[ring->backlog_len++] = *cqe;
+}
+
+static int
+uring_next(btc_uring_t *ring, btc_cqe_t *cqe) {
+  if (ring->backlog_pos < ring->backlog_len) {
+    *cqe = ring->backlog[ring->backlog_pos++];
+
+    if (ring->backlog_pos == ring->backlog_len) {
+      ring->backlog_pos = 0;
+      ring->backlog_len = 0;
+    }
+
+    return 1;
+  }
+
+  return uring_pop(ring, cqe);
+}
+
+static struct io_uring_sqe *
+uring_sqe(btc_uring_t *ring) {
+  struct io_uring_sqe *sqe;
+  btc_cqe_t cqe;
+
+  while (ring->sq_tail - uring_load(ring->sq_head) == ring->sq_entries) {
+    if (uring_enter(ring, 0, 0))
+      continue;
+
+    while (uring_pop(ring, &cqe))
+      uring_defer(ring, &cqe);
+  }
+
+  sqe = &ring->sqes[ring->sq_tail & ring->sq_mask];
+
+  memset(sqe, 0, sizeof(*sqe));
+
+  return sqe;
+}
+
+static void
+uring_push(btc_uring_t *ring) {
+  ring->sq_tail++;
+  ring->queued++;
+
+  uring_store(ring->sq_ktail, ring->sq_tail);
+}
+#endif /* BTC_USE_IOURING */
+
 /*
  * Default Callbacks
  */
@@ -645,6 +1092,13 @@ default_data_cb(btc_socket_t *socket, const void *buf, size_t len) {
   return 1;
 }
 
+static void *
+default_alloc_cb(btc_socket_t *socket, size_t *size) {
+  (void)socket;
+  (void)size;
+  return NULL;
+}
+
 static void
 default_drain_cb(btc_socket_t *socket) {
   (void)socket;
@@ -661,6 +1115,49 @@ default_message_cb(btc_socket_t *socket,
   (void)addr;
 }
 
+/*
+ * Socket Buffer
+ */
+
+btc_sockbuf_t *
+btc_sockbuf_create(void *data, size_t length) {
+  btc_sockbuf_t *buf = (btc_sockbuf_t *)safe_malloc(sizeof(btc_sockbuf_t));
+
+  buf->data = data;
+  buf->length = length;
+  buf->refs = 1;
+
+  return buf;
+}
+
+btc_sockbuf_t *
+btc_sockbuf_ref(btc_sockbuf_t *buf) {
+  btc_refs_inc(&buf->refs);
+  return buf;
+}
+
+void
+btc_sockbuf_unref(btc_sockbuf_t *buf) {
+  long refs = btc_refs_dec(&buf->refs);
+
+  CHECK(refs >= 0);
+
+  if (refs == 0) {
+    free(buf->data);
+    free(buf);
+  }
+}
+
+const void *
+btc_sockbuf_data(const btc_sockbuf_t *buf) {
+  return buf->data;
+}
+
+size_t
+btc_sockbuf_length(const btc_sockbuf_t *buf) {
+  return buf->length;
+}
+
 /*
  * Socket
  */
@@ -679,13 +1176,18 @@ btc_socket_create(btc_loop_t *loop) {
   socket->link.value = socket;
 #endif
   socket->deferred.value = socket;
+  socket->flushing.value = socket;
   socket->closed.value = socket;
   socket->listener.value = socket;
+#ifdef BTC_USE_IOURING
+  socket->arming.value = socket;
+#endif
 
   socket->on_socket = default_socket_cb;
   socket->on_connect = default_connect_cb;
   socket->on_close = default_close_cb;
   socket->on_error = default_error_cb;
+  socket->on_alloc = default_alloc_cb;
   socket->on_data = default_data_cb;
   socket->on_drain = default_drain_cb;
   socket->on_message = default_message_cb;
@@ -693,23 +1195,56 @@ btc_socket_create(btc_loop_t *loop) {
   return socket;
 }
 
+static void
+chunk_destroy(chunk_t *chunk) {
+  if (chunk->addr != NULL)
+    free(chunk->addr);
+
+  if (chunk->buf != NULL)
+    btc_sockbuf_unref(chunk->buf);
+  else
+    free(chunk->ptr);
+
+  free(chunk);
+}
+
 static void
 btc_socket_destroy(btc_socket_t *socket) {
   chunk_t *chunk, *next;
 
   for (chunk = socket->head; chunk != NULL; chunk = next) {
     next = chunk->next;
+    chunk_destroy(chunk);
+  }
 
-    if (chunk->addr != NULL)
-      free(chunk->addr);
+  if (socket->spare != NULL)
+    chunk_destroy(socket->spare);
 
-    free(chunk->ptr);
-    free(chunk);
-  }
+#ifdef BTC_USE_IOURING
+  if (socket->stash != NULL)
+    free(socket->stash);
+#endif
 
   free(socket);
 }
 
+static void
+btc_socket_arm(btc_socket_t *socket) {
+  /* Queue the socket up for (re)submission of
+     whatever operations its state calls for. */
+#ifdef BTC_USE_IOURING
+  btc_loop_t *loop = socket->loop;
+
+  if (loop == NULL || loop->ring.fd == -1)
+    return;
+
+  if (!btc_list_has(&loop->ring.arming, &socket->arming))
+    btc_list_push(&loop->ring.arming, &socket->arming);
+#else
+  (void)socket;
+#endif
+}
+
 btc_loop_t *
 btc_socket_loop(btc_socket_t *socket) {
   return socket->loop;
@@ -745,6 +1280,11 @@ btc_socket_on_data(btc_socket_t *socket, btc_socket_data_cb *handler) {
   socket->on_data = handler;
 }
 
+void
+btc_socket_on_alloc(btc_socket_t *socket, btc_socket_alloc_cb *handler) {
+  socket->on_alloc = handler;
+}
+
 void
 btc_socket_on_drain(btc_socket_t *socket, btc_socket_drain_cb *handler) {
   socket->on_drain = handler;
@@ -782,6 +1322,17 @@ btc_socket_set_nodelay(btc_socket_t *socket, int value) {
   setsockopt(socket->fd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val));
 }
 
+void
+btc_socket_pause(btc_socket_t *socket) {
+  socket->paused = 1;
+}
+
+void
+btc_socket_resume(btc_socket_t *socket) {
+  socket->paused = 0;
+  btc_socket_arm(socket);
+}
+
 static int
 btc_socket_setaddr(btc_socket_t *socket, const btc_sockaddr_t *addr) {
   if (!btc_sockaddr_get(socket->addr, addr)) {
@@ -983,8 +1534,65 @@ btc_socket_talk(btc_socket_t *socket, int family) {
   return 1;
 }
 
+static void
+btc_socket_push(btc_socket_t *socket, chunk_t *chunk) {
+  if (socket->head == NULL)
+    socket->head = chunk;
+
+  if (socket->tail != NULL)
+    socket->tail->next = chunk;
+
+  socket->tail = chunk;
+  socket->total += chunk->len;
+}
+
+static void
+btc_socket_append(btc_socket_t *socket, const void *data, size_t len) {
+  chunk_t *chunk = socket->tail;
+
+  CHECK(len <= BTC_SOCKET_SLAB);
+
+  if (chunk == NULL || chunk->cap == 0
+      || chunk->cap - (size_t)(chunk->raw - (unsigned char *)chunk->ptr)
+                    - chunk->len < len) {
+    chunk = socket->spare;
+
+    if (chunk == NULL) {
+      chunk = (chunk_t *)safe_malloc(sizeof(chunk_t));
+      chunk->addr = NULL;
+      chunk->ptr = safe_malloc(BTC_SOCKET_SLAB);
+      chunk->buf = NULL;
+      chunk->cap = BTC_SOCKET_SLAB;
+    }
+
+    chunk->raw = (unsigned char *)chunk->ptr;
+    chunk->len = 0;
+    chunk->next = NULL;
+
+    socket->spare = NULL;
+
+    btc_socket_push(socket, chunk);
+  }
+
+  memcpy(chunk->raw + chunk->len, data, len);
+
+  chunk->len += len;
+
+  socket->total += len;
+}
+
+static void
+btc_socket_release(btc_socket_t *socket, chunk_t *chunk) {
+  /* Keep one slab around for the next burst. */
+  if (chunk->cap != 0 && socket->spare == NULL)
+    socket->spare = chunk;
+  else
+    chunk_destroy(chunk);
+}
+
+#ifdef _WIN32
 static int
-btc_socket_flush_write(btc_socket_t *socket) {
+btc_socket_flush_chunks(btc_socket_t *socket) {
   chunk_t *chunk, *next;
   size_t max;
   int len;
@@ -1019,20 +1627,109 @@ btc_socket_flush_write(btc_socket_t *socket) {
       socket->total -= len;
     }
 
-    if (chunk->len != 0) {
-      socket->draining = 1;
+    if (chunk->len != 0)
       return 0;
-    }
 
-    free(chunk->ptr);
-    free(chunk);
+    btc_socket_release(socket, chunk);
 
     socket->head = next;
   }
 
-  CHECK(socket->total == 0);
-
-  socket->head = NULL;
+  return 1;
+}
+#else /* !_WIN32 */
+static int
+btc_socket_flush_chunks(btc_socket_t *socket) {
+  /* Gather as many queued chunks as possible into
+     a single call. A short write means the send
+     buffer is full, so we wait for writability. */
+  struct iovec iov[BTC_SOCKET_IOV];
+  struct msghdr msg;
+  chunk_t *chunk;
+  size_t want, len;
+  ssize_t rc;
+  int count;
+
+  while (socket->head != NULL) {
+    count = 0;
+    want = 0;
+
+    for (chunk = socket->head; chunk != NULL; chunk = chunk->next) {
+      if (count == BTC_SOCKET_IOV || want >= (1 << 30))
+        break;
+
+      iov[count].iov_base = (void *)chunk->raw;
+      iov[count].iov_len = BTC_MIN(chunk->len, 1 << 30);
+
+      want += iov[count].iov_len;
+      count++;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
+
+    rc = sendmsg(socket->fd, &msg, BTC_NOSIGNAL);
+
+    if (rc == BTC_SOCKET_ERROR) {
+      int error = btc_errno;
+
+      if (error == BTC_EINTR)
+        continue;
+
+      if (error == BTC_EAGAIN || error == BTC_EWOULDBLOCK)
+        return 0;
+
+      socket->loop->error = error;
+
+      return -1;
+    }
+
+    len = rc;
+
+    socket->total -= len;
+
+    while (len > 0) {
+      chunk = socket->head;
+
+      if (len < chunk->len) {
+        chunk->raw += len;
+        chunk->len -= len;
+        break;
+      }
+
+      len -= chunk->len;
+
+      socket->head = chunk->next;
+
+      btc_socket_release(socket, chunk);
+    }
+
+    if ((size_t)rc < want)
+      return 0;
+  }
+
+  return 1;
+}
+#endif /* !_WIN32 */
+
+static int
+btc_socket_flush_write(btc_socket_t *socket) {
+  int rc = btc_socket_flush_chunks(socket);
+
+  if (rc == -1)
+    return -1;
+
+  if (rc == 0) {
+    socket->draining = 1;
+    btc_socket_arm(socket);
+    return 0;
+  }
+
+  CHECK(socket->total == 0);
+
+  socket->head = NULL;
   socket->tail = NULL;
   socket->total = 0;
 
@@ -1044,6 +1741,30 @@ btc_socket_flush_write(btc_socket_t *socket) {
   return 1;
 }
 
+static int
+btc_socket_cork(btc_socket_t *socket) {
+  btc_loop_t *loop = socket->loop;
+
+  if (socket->state == BTC_SOCKET_CONNECTING) {
+    socket->draining = 1;
+    return 0;
+  }
+
+  /* Already waiting on writability. */
+  if (socket->draining)
+    return 0;
+
+  if (socket->total >= BTC_SOCKET_CORK)
+    return btc_socket_flush_write(socket);
+
+  /* Otherwise, defer the flush until the end of
+     the current loop iteration (see handle_flush). */
+  if (!btc_list_has(&loop->flushing, &socket->flushing))
+    btc_list_push(&loop->flushing, &socket->flushing);
+
+  return 1;
+}
+
 int
 btc_socket_write(btc_socket_t *socket, void *data, size_t len) {
   unsigned char *raw = (unsigned char *)data;
@@ -1066,29 +1787,78 @@ btc_socket_write(btc_socket_t *socket, void *data, size_t len) {
     return !socket->draining;
   }
 
+  if (len <= BTC_SOCKET_SMALL) {
+    btc_socket_append(socket, data, len);
+    free(data);
+    return btc_socket_cork(socket);
+  }
+
   chunk = (chunk_t *)safe_malloc(sizeof(chunk_t));
 
   chunk->addr = NULL;
   chunk->ptr = raw;
+  chunk->buf = NULL;
   chunk->raw = raw;
   chunk->len = len;
+  chunk->cap = 0;
   chunk->next = NULL;
 
-  if (socket->head == NULL)
-    socket->head = chunk;
+  btc_socket_push(socket, chunk);
 
-  if (socket->tail != NULL)
-    socket->tail->next = chunk;
+  return btc_socket_cork(socket);
+}
 
-  socket->tail = chunk;
-  socket->total += len;
+int
+btc_socket_write_copy(btc_socket_t *socket, const void *data, size_t len) {
+  void *raw;
 
-  if (socket->state == BTC_SOCKET_CONNECTING) {
-    socket->draining = 1;
-    return 0;
+  if (socket->state != BTC_SOCKET_CONNECTING
+      && socket->state != BTC_SOCKET_CONNECTED) {
+    socket->loop->error = BTC_EPIPE;
+    return -1;
+  }
+
+  if (len == 0)
+    return !socket->draining;
+
+  if (len <= BTC_SOCKET_SMALL) {
+    btc_socket_append(socket, data, len);
+    return btc_socket_cork(socket);
+  }
+
+  raw = safe_malloc(len);
+
+  memcpy(raw, data, len);
+
+  return btc_socket_write(socket, raw, len);
+}
+
+int
+btc_socket_write_buf(btc_socket_t *socket, btc_sockbuf_t *buf) {
+  chunk_t *chunk;
+
+  if (buf->length <= BTC_SOCKET_SMALL)
+    return btc_socket_write_copy(socket, buf->data, buf->length);
+
+  if (socket->state != BTC_SOCKET_CONNECTING
+      && socket->state != BTC_SOCKET_CONNECTED) {
+    socket->loop->error = BTC_EPIPE;
+    return -1;
   }
 
-  return btc_socket_flush_write(socket);
+  chunk = (chunk_t *)safe_malloc(sizeof(chunk_t));
+
+  chunk->addr = NULL;
+  chunk->ptr = NULL;
+  chunk->buf = btc_sockbuf_ref(buf);
+  chunk->raw = (unsigned char *)buf->data;
+  chunk->len = buf->length;
+  chunk->cap = 0;
+  chunk->next = NULL;
+
+  btc_socket_push(socket, chunk);
+
+  return btc_socket_cork(socket);
 }
 
 static int
@@ -1183,8 +1953,10 @@ btc_socket_send(btc_socket_t *socket,
 
   chunk->addr = (struct sockaddr *)safe_malloc(sizeof(struct sockaddr_storage));
   chunk->ptr = raw;
+  chunk->buf = NULL;
   chunk->raw = raw;
   chunk->len = len;
+  chunk->cap = 0;
   chunk->next = NULL;
 
   btc_sockaddr_get(chunk->addr, addr);
@@ -1198,12 +1970,25 @@ btc_socket_send(btc_socket_t *socket,
   socket->tail = chunk;
   socket->total += len;
 
-  return btc_socket_flush_send(socket);
+  if (!btc_socket_flush_send(socket)) {
+    btc_socket_arm(socket);
+    return 0;
+  }
+
+  return 1;
 }
 
+static int
+btc_loop_register(btc_loop_t *loop, btc_socket_t *socket);
+
 static void
 btc_loop_unregister(btc_loop_t *loop, btc_socket_t *socket);
 
+#ifdef BTC_USE_IOURING
+static void
+uring_quiesce(btc_loop_t *loop, btc_socket_t *socket);
+#endif
+
 void
 btc_socket_close(btc_socket_t *socket) {
   btc_loop_t *loop = socket->loop;
@@ -1212,19 +1997,31 @@ btc_socket_close(btc_socket_t *socket) {
   if (socket->state == BTC_SOCKET_DISCONNECTED)
     return;
 
-  for (chunk = socket->head; chunk != NULL; chunk = next) {
-    next = chunk->next;
+  if (socket->state == BTC_SOCKET_WAKER)
+    return;
 
-    if (chunk->addr != NULL)
-      free(chunk->addr);
+  /* Output may still be corked. Give it one last
+     chance to reach the kernel before we drop it. */
+  if (socket->state == BTC_SOCKET_CONNECTED && socket->head != NULL) {
+    int error = loop->error;
 
-    free(chunk->ptr);
-    free(chunk);
+    btc_socket_flush_chunks(socket);
+
+    loop->error = error;
+  }
+
+  for (chunk = socket->head; chunk != NULL; chunk = next) {
+    next = chunk->next;
+    chunk_destroy(chunk);
   }
 
+  if (socket->spare != NULL)
+    chunk_destroy(socket->spare);
+
   socket->state = BTC_SOCKET_DISCONNECTED;
   socket->head = NULL;
   socket->tail = NULL;
+  socket->spare = NULL;
   socket->total = 0;
   socket->draining = 0;
 
@@ -1238,6 +2035,9 @@ btc_socket_kill(btc_socket_t *socket) {
   if (btc_list_has(&loop->deferred, &socket->deferred))
     btc_list_remove(&loop->deferred, &socket->deferred);
 
+  if (btc_list_has(&loop->flushing, &socket->flushing))
+    btc_list_remove(&loop->flushing, &socket->flushing);
+
   btc_loop_unregister(loop, socket);
 
   btc_closesocket(socket->fd);
@@ -1252,6 +2052,176 @@ btc_socket_timeout(btc_socket_t *socket) {
   btc_socket_close(socket);
 }
 
+void
+btc_socket_detach(btc_socket_t *socket) {
+  /* Hand a connection off to another loop (see
+     btc_loop_attach). Must be called from the
+     thread which currently owns the socket. */
+  btc_loop_t *loop = socket->loop;
+
+  CHECK(socket->state == BTC_SOCKET_CONNECTED);
+
+  if (btc_list_has(&loop->deferred, &socket->deferred))
+    btc_list_remove(&loop->deferred, &socket->deferred);
+
+  if (btc_list_has(&loop->flushing, &socket->flushing))
+    btc_list_remove(&loop->flushing, &socket->flushing);
+
+#ifdef BTC_USE_IOURING
+  if (loop->ring.fd != -1)
+    uring_quiesce(loop, socket);
+#endif
+
+  btc_loop_unregister(loop, socket);
+
+  socket->loop = NULL;
+}
+
+/*
+ * Timer
+ */
+
+static void
+btc_wheel_insert(btc_loop_t *loop, btc_timer_t *timer) {
+  /* Jiffies are level zero slots. Round up so
+     that a timer never fires early. */
+  int64_t when = (timer->expires + BTC_WHEEL_RES - 1) / BTC_WHEEL_RES;
+  int64_t delta = when - loop->jiffies;
+  int level = 0;
+
+  if (delta < 0) {
+    /* Overdue: fire on the next jiffy. */
+    when = loop->jiffies;
+    delta = 0;
+  }
+
+  while (level < BTC_WHEEL_LEVELS - 1) {
+    if (delta < ((int64_t)1 << ((level + 1) * BTC_WHEEL_BITS)))
+      break;
+
+    level++;
+  }
+
+  if (delta >= ((int64_t)1 << (BTC_WHEEL_LEVELS * BTC_WHEEL_BITS))) {
+    /* Beyond the wheel's range. Park it in the last
+       slot we can reach; it is reinserted on cascade. */
+    when = loop->jiffies + ((int64_t)1 << (level * BTC_WHEEL_BITS))
+                         * BTC_WHEEL_MASK;
+  }
+
+  timer->list = &loop->wheel[level][(when >> (level * BTC_WHEEL_BITS))
+                                    & BTC_WHEEL_MASK];
+
+  btc_list_push(timer->list, &timer->link);
+}
+
+static int
+btc_wheel_cascade(btc_loop_t *loop, int level) {
+  /* Redistribute one slot of a coarser level
+     into the finer levels below it. */
+  int index = (int)((loop->jiffies >> (level * BTC_WHEEL_BITS))
+                  & BTC_WHEEL_MASK);
+  btc_list_t *slot = &loop->wheel[level][index];
+
+  while (slot->head != NULL) {
+    btc_timer_t *timer = btc_list_shift(slot)->value;
+
+    btc_wheel_insert(loop, timer);
+  }
+
+  return index;
+}
+
+static void
+btc_wheel_advance(btc_loop_t *loop, int64_t now) {
+  /* Move everything due by `now` onto the expired
+     list. Costs one step per elapsed jiffy plus one
+     per timer touched; idle slots are free. */
+  int64_t target = now / BTC_WHEEL_RES;
+
+  if (loop->timers == 0) {
+    if (loop->jiffies <= target)
+      loop->jiffies = target + 1;
+    return;
+  }
+
+  while (loop->jiffies <= target) {
+    int index = (int)(loop->jiffies & BTC_WHEEL_MASK);
+    btc_list_t *slot = &loop->wheel[0][index];
+    int level = 1;
+
+    while (index == 0 && level < BTC_WHEEL_LEVELS)
+      index = btc_wheel_cascade(loop, level++);
+
+    while (slot->head != NULL) {
+      btc_timer_t *timer = btc_list_shift(slot)->value;
+
+      timer->list = &loop->expired;
+
+      btc_list_push(&loop->expired, &timer->link);
+    }
+
+    loop->jiffies++;
+  }
+}
+
+btc_timer_t *
+btc_timer_create(btc_loop_t *loop, btc_timer_cb *handler, void *data) {
+  btc_timer_t *timer = (btc_timer_t *)safe_malloc(sizeof(btc_timer_t));
+
+  memset(timer, 0, sizeof(*timer));
+
+  timer->loop = loop;
+  timer->handler = handler;
+  timer->data = data;
+  timer->link.value = timer;
+
+  return timer;
+}
+
+void
+btc_timer_destroy(btc_timer_t *timer) {
+  btc_timer_stop(timer);
+  free(timer);
+}
+
+void *
+btc_timer_get_data(btc_timer_t *timer) {
+  return timer->data;
+}
+
+void
+btc_timer_start(btc_timer_t *timer, int64_t msec) {
+  btc_loop_t *loop = timer->loop;
+
+  btc_timer_stop(timer);
+
+  if (msec < 0)
+    msec = 0;
+
+  timer->expires = btc_time_msec() + msec;
+
+  btc_wheel_insert(loop, timer);
+
+  loop->timers++;
+}
+
+void
+btc_timer_stop(btc_timer_t *timer) {
+  if (timer->list == NULL)
+    return;
+
+  btc_list_remove(timer->list, &timer->link);
+
+  timer->list = NULL;
+  timer->loop->timers--;
+}
+
+int
+btc_timer_active(const btc_timer_t *timer) {
+  return timer->list != NULL;
+}
+
 /*
  * Loop
  */
@@ -1282,9 +2252,16 @@ btc_loop_create(void) {
   memset(loop, 0, sizeof(*loop));
 
 #if defined(BTC_USE_EPOLL)
-  loop->fd = safe_epoll_create();
+  loop->fd = -1;
 
-  CHECK(loop->fd != -1);
+#ifdef BTC_USE_IOURING
+  if (!uring_setup(&loop->ring))
+#endif
+  {
+    loop->fd = safe_epoll_create();
+
+    CHECK(loop->fd != -1);
+  }
 #elif defined(BTC_USE_POLL)
   /* nothing */
 #else
@@ -1293,18 +2270,59 @@ btc_loop_create(void) {
 
   btc_loop_grow(loop, 64);
 
+  loop->jiffies = btc_time_msec() / BTC_WHEEL_RES;
+
+  btc_mutex_init(&loop->post_lock);
+
+#ifndef _WIN32
+  {
+    int fds[2];
+
+    CHECK(pipe(fds) == 0);
+
+    set_cloexec(fds[0]);
+    set_cloexec(fds[1]);
+
+    CHECK(set_nonblocking(fds[0]) == 0);
+    CHECK(set_nonblocking(fds[1]) == 0);
+
+    loop->waker = btc_socket_create(loop);
+    loop->waker->fd = fds[0];
+    loop->waker->state = BTC_SOCKET_WAKER;
+    loop->wake_fd = fds[1];
+
+    CHECK(btc_loop_register(loop, loop->waker));
+  }
+#endif
+
   return loop;
 }
 
 void
 btc_loop_destroy(btc_loop_t *loop) {
+  btc_post_t *post, *next_post;
   btc_link_t *it, *next;
 
   CHECK(loop->running == 0);
 
+#ifndef _WIN32
+#ifdef BTC_USE_IOURING
+  if (loop->ring.fd != -1)
+    uring_quiesce(loop, loop->waker);
+#endif
+
+  btc_loop_unregister(loop, loop->waker);
+  btc_closesocket(loop->waker->fd);
+  btc_socket_destroy(loop->waker);
+  close(loop->wake_fd);
+#endif
+
 #if defined(BTC_USE_EPOLL)
-  CHECK(loop->fd != -1);
-  close(loop->fd);
+#ifdef BTC_USE_IOURING
+  uring_teardown(&loop->ring);
+#endif
+  if (loop->fd != -1)
+    close(loop->fd);
   free(loop->events);
 #elif defined(BTC_USE_POLL)
   free(loop->pfds);
@@ -1316,6 +2334,13 @@ btc_loop_destroy(btc_loop_t *loop) {
     free(it->value);
   }
 
+  for (post = loop->post_head; post != NULL; post = next_post) {
+    next_post = post->next;
+    free(post);
+  }
+
+  btc_mutex_destroy(&loop->post_lock);
+
   free(loop);
 }
 
@@ -1347,6 +2372,43 @@ btc_loop_off_tick(btc_loop_t *loop, btc_loop_tick_cb *handler, void *data) {
   }
 }
 
+void
+btc_loop_post(btc_loop_t *loop, btc_loop_post_cb *handler, void *data) {
+  /* Thread-safe: queue a callback to run on the
+     loop's own thread during its next iteration. */
+  btc_post_t *post = (btc_post_t *)safe_malloc(sizeof(btc_post_t));
+  int wake;
+
+  post->handler = handler;
+  post->data = data;
+  post->next = NULL;
+
+  btc_mutex_lock(&loop->post_lock);
+
+  wake = (loop->post_head == NULL);
+
+  if (loop->post_tail != NULL)
+    loop->post_tail->next = post;
+  else
+    loop->post_head = post;
+
+  loop->post_tail = post;
+
+  btc_mutex_unlock(&loop->post_lock);
+
+#ifdef _WIN32
+  /* No wakeup; picked up after the poll timeout. */
+  (void)wake;
+#else
+  if (wake) {
+    unsigned char ch = 0;
+
+    while (write(loop->wake_fd, &ch, 1) == -1 && errno == EINTR)
+      ;
+  }
+#endif
+}
+
 const char *
 btc_loop_strerror(btc_loop_t *loop) {
 #ifdef _WIN32
@@ -1393,6 +2455,14 @@ btc_loop_register(btc_loop_t *loop, btc_socket_t *socket) {
 #if defined(BTC_USE_EPOLL)
   struct epoll_event ev;
 
+#ifdef BTC_USE_IOURING
+  if (loop->ring.fd != -1) {
+    btc_list_push(&loop->sockets, &socket->link);
+    btc_socket_arm(socket);
+    return 1;
+  }
+#endif
+
   memset(&ev, 0, sizeof(ev));
 
   ev.events = EPOLLIN | EPOLLOUT;
@@ -1450,6 +2520,19 @@ btc_loop_unregister(btc_loop_t *loop, btc_socket_t *socket) {
 #if defined(BTC_USE_EPOLL)
   struct epoll_event ev;
 
+#ifdef BTC_USE_IOURING
+  if (loop->ring.fd != -1) {
+    CHECK(socket->armed == 0);
+
+    if (btc_list_has(&loop->ring.arming, &socket->arming))
+      btc_list_remove(&loop->ring.arming, &socket->arming);
+
+    btc_list_remove(&loop->sockets, &socket->link);
+
+    return;
+  }
+#endif
+
   memset(&ev, 0, sizeof(ev));
 
   if (epoll_ctl(loop->fd, EPOLL_CTL_DEL, socket->fd, &ev) != 0) {
@@ -1552,6 +2635,33 @@ fail:
   return NULL;
 }
 
+int
+btc_loop_attach(btc_loop_t *loop, btc_socket_t *socket) {
+  /* Adopt a socket released by btc_socket_detach.
+     On failure the socket is destroyed. */
+  CHECK(socket->loop == NULL);
+  CHECK(socket->state == BTC_SOCKET_CONNECTED);
+
+  socket->loop = loop;
+
+  if (!btc_loop_register(loop, socket)) {
+    btc_closesocket(socket->fd);
+    btc_socket_destroy(socket);
+    return 0;
+  }
+
+  if (socket->head != NULL && !socket->draining)
+    btc_list_push(&loop->flushing, &socket->flushing);
+
+#ifdef BTC_USE_IOURING
+  /* Input that raced with the detach. */
+  if (socket->stash != NULL)
+    btc_list_push(&loop->deferred, &socket->deferred);
+#endif
+
+  return 1;
+}
+
 static void
 handle_read(btc_loop_t *loop, btc_socket_t *socket) {
   switch (socket->state) {
@@ -1575,13 +2685,24 @@ fail:
     }
 
     case BTC_SOCKET_CONNECTED: {
-      unsigned char *buf = loop->buffer;
-      size_t size = sizeof(loop->buffer);
       btc_sockfd_t fd = socket->fd;
+      unsigned char *buf;
+      size_t size;
       int len;
 
-      while (socket->state == BTC_SOCKET_CONNECTED) {
-        len = recv(fd, (void *)buf, size, 0);
+      while (socket->state == BTC_SOCKET_CONNECTED && !socket->paused) {
+        /* The consumer may ask us to read straight
+           into its own memory (e.g. a message body
+           whose length it already knows). */
+        size = 0;
+        buf = socket->on_alloc(socket, &size);
+
+        if (buf == NULL || size == 0) {
+          buf = loop->buffer;
+          size = sizeof(loop->buffer);
+        }
+
+        len = recv(fd, (void *)buf, BTC_MIN(size, INT_MAX), 0);
 
         if (len == BTC_SOCKET_ERROR) {
           int error = btc_errno;
@@ -1653,6 +2774,16 @@ fail:
 
       break;
     }
+
+#ifndef _WIN32
+    case BTC_SOCKET_WAKER: {
+      /* Posted callbacks are run once we're done here. */
+      while (read(socket->fd, loop->buffer, sizeof(loop->buffer)) > 0)
+        ;
+
+      break;
+    }
+#endif
   }
 }
 
@@ -1694,6 +2825,23 @@ handle_deferred(btc_loop_t *loop) {
     btc_link_t *it = btc_list_shift(&loop->deferred);
     btc_socket_t *socket = it->value;
 
+#ifdef BTC_USE_IOURING
+    if (socket->stash != NULL) {
+      void *stash = socket->stash;
+      size_t len = socket->stashed;
+
+      socket->stash = NULL;
+      socket->stashed = 0;
+
+      if (socket->state == BTC_SOCKET_CONNECTED)
+        socket->on_data(socket, stash, len);
+
+      free(stash);
+
+      continue;
+    }
+#endif
+
     if (socket->state != BTC_SOCKET_CONNECTING)
       continue;
 
@@ -1705,6 +2853,56 @@ handle_deferred(btc_loop_t *loop) {
   }
 }
 
+static void
+handle_flush(btc_loop_t *loop) {
+  while (loop->flushing.length > 0) {
+    btc_link_t *it = btc_list_shift(&loop->flushing);
+    btc_socket_t *socket = it->value;
+
+    if (socket->state != BTC_SOCKET_CONNECTED)
+      continue;
+
+    if (btc_socket_flush_write(socket) == -1)
+      socket->on_error(socket);
+  }
+}
+
+static void
+handle_posted(btc_loop_t *loop) {
+  btc_post_t *post, *next;
+
+  btc_mutex_lock(&loop->post_lock);
+
+  post = loop->post_head;
+
+  loop->post_head = NULL;
+  loop->post_tail = NULL;
+
+  btc_mutex_unlock(&loop->post_lock);
+
+  for (; post != NULL; post = next) {
+    next = post->next;
+    post->handler(post->data);
+    free(post);
+  }
+}
+
+static void
+handle_timers(btc_loop_t *loop) {
+  btc_wheel_advance(loop, btc_time_msec());
+
+  /* Handlers may start or stop any timer,
+     including those still waiting here. */
+  while (loop->expired.head != NULL) {
+    btc_timer_t *timer = btc_list_shift(&loop->expired)->value;
+
+    timer->list = NULL;
+    loop->timers--;
+
+    timer->handler(timer);
+  }
+}
+
 static void
 handle_ticks(btc_loop_t *loop) {
   btc_link_t *it;
@@ -1716,6 +2914,323 @@ handle_ticks(btc_loop_t *loop) {
   }
 }
 
+#ifdef BTC_USE_IOURING
+static void
+uring_arm(btc_loop_t *loop, btc_socket_t *socket, int op) {
+  struct io_uring_sqe *sqe;
+  unsigned int events;
+
+  if (socket->armed & (1u << op))
+    return;
+
+  sqe = uring_sqe(&loop->ring);
+
+  switch (op) {
+    case BTC_URING_ACCEPT: {
+      memset(&socket->from, 0, sizeof(socket->from));
+
+      socket->fromlen = sizeof(socket->from);
+
+      sqe->opcode = IORING_OP_ACCEPT;
+      sqe->addr = (size_t)&socket->from;
+      sqe->addr2 = (size_t)&socket->fromlen;
+      sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+
+      break;
+    }
+
+    case BTC_URING_RECV: {
+      /* The window must stay put until the receive
+         completes. Parsers only move it from within
+         on_data, so this holds for our consumers. */
+      size_t size = 0;
+      void *buf = socket->on_alloc(socket, &size);
+
+      sqe->opcode = IORING_OP_RECV;
+
+      if (buf != NULL && size > 0) {
+        sqe->addr = (size_t)buf;
+        sqe->len = BTC_MIN(size, INT_MAX);
+      } else {
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = 0;
+        sqe->len = BTC_URING_BUFSIZE;
+        buf = NULL;
+      }
+
+      socket->window = buf;
+
+      break;
+    }
+
+    default: {
+      events = (op == BTC_URING_POLLIN ? POLLIN : POLLOUT);
+
+      sqe->opcode = IORING_OP_POLL_ADD;
+#ifdef BTC_BIGENDIAN
+      sqe->poll32_events = (events << 16) | (events >> 16);
+#else
+      sqe->poll32_events = events;
+#endif
+
+      break;
+    }
+  }
+
+  sqe->fd = socket->fd;
+  sqe->user_data = (size_t)socket | op;
+
+  uring_push(&loop->ring);
+
+  socket->armed |= 1u << op;
+}
+
+static void
+uring_cancel(btc_loop_t *loop, btc_socket_t *socket) {
+  struct io_uring_sqe *sqe;
+  int op;
+
+  if (socket->canceled)
+    return;
+
+  for (op = BTC_URING_ACCEPT; op <= BTC_URING_POLLOUT; op++) {
+    if (!(socket->armed & (1u << op)))
+      continue;
+
+    sqe = uring_sqe(&loop->ring);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = (size_t)socket | op;
+    sqe->user_data = BTC_URING_NONE;
+
+    uring_push(&loop->ring);
+  }
+
+  socket->canceled = 1;
+}
+
+static void
+uring_settle(btc_loop_t *loop, btc_socket_t *socket, const btc_cqe_t *cqe) {
+  /* Retire an operation without running callbacks.
+     Anything we received is kept for later. */
+  int op = cqe->user_data & BTC_URING_MASK;
+  unsigned char *buf = socket->window;
+  unsigned int bid = 0;
+
+  if (!(cqe->flags & IORING_CQE_F_MORE))
+    socket->armed &= ~(1u << op);
+
+  if (cqe->flags & IORING_CQE_F_BUFFER) {
+    bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    buf = loop->ring.bufs + bid * BTC_URING_BUFSIZE;
+  }
+
+  if (op == BTC_URING_RECV && cqe->res > 0
+      && socket->state == BTC_SOCKET_CONNECTED) {
+    size_t len = cqe->res;
+
+    socket->stash = realloc(socket->stash, socket->stashed + len);
+
+    CHECK(socket->stash != NULL);
+
+    memcpy((char *)socket->stash + socket->stashed, buf, len);
+
+    socket->stashed += len;
+  }
+
+  if (op == BTC_URING_ACCEPT && cqe->res >= 0)
+    close(cqe->res);
+
+  if (cqe->flags & IORING_CQE_F_BUFFER)
+    uring_recycle(&loop->ring, bid);
+}
+
+static void
+uring_quiesce(btc_loop_t *loop, btc_socket_t *socket) {
+  /* Cancel whatever the kernel is doing on behalf of
+     a socket and wait for it to let go. Completions
+     for other sockets are saved for the next reap. */
+  btc_uring_t *ring = &loop->ring;
+  __u64 id = (size_t)socket;
+  size_t i, j;
+  btc_cqe_t cqe;
+
+  for (i = ring->backlog_pos, j = i; i < ring->backlog_len; i++) {
+    if ((ring->backlog[i].user_data & ~(__u64)BTC_URING_MASK) == id)
+      uring_settle(loop, socket, &ring->backlog[i]);
+    else
+      ring->backlog[j++] = ring->backlog[i];
+  }
+
+  ring->backlog_len = j;
+
+  uring_cancel(loop, socket);
+
+  while (socket->armed != 0) {
+    uring_enter(ring, 1, -1);
+
+    while (socket->armed != 0 && uring_pop(ring, &cqe)) {
+      if ((cqe.user_data & ~(__u64)BTC_URING_MASK) == id)
+        uring_settle(loop, socket, &cqe);
+      else
+        uring_defer(ring, &cqe);
+    }
+  }
+
+  socket->canceled = 0;
+}
+
+static void
+handle_arming(btc_loop_t *loop) {
+  btc_list_t *arming = &loop->ring.arming;
+
+  while (arming->length > 0) {
+    btc_link_t *it = btc_list_shift(arming);
+    btc_socket_t *socket = it->value;
+
+    switch (socket->state) {
+      case BTC_SOCKET_CONNECTING: {
+        uring_arm(loop, socket, BTC_URING_POLLOUT);
+        break;
+      }
+
+      case BTC_SOCKET_CONNECTED: {
+        if (!socket->paused)
+          uring_arm(loop, socket, BTC_URING_RECV);
+
+        if (socket->draining)
+          uring_arm(loop, socket, BTC_URING_POLLOUT);
+
+        break;
+      }
+
+      case BTC_SOCKET_LISTENING: {
+        uring_arm(loop, socket, BTC_URING_ACCEPT);
+        break;
+      }
+
+      case BTC_SOCKET_BOUND: {
+        uring_arm(loop, socket, BTC_URING_POLLIN);
+
+        if (socket->head != NULL)
+          uring_arm(loop, socket, BTC_URING_POLLOUT);
+
+        break;
+      }
+
+      case BTC_SOCKET_WAKER: {
+        uring_arm(loop, socket, BTC_URING_POLLIN);
+        break;
+      }
+    }
+  }
+}
+
+static void
+handle_accept(btc_loop_t *loop, btc_socket_t *server, int fd) {
+  btc_socket_t *socket;
+
+  if (fd < 0)
+    return;
+
+  if (server->state != BTC_SOCKET_LISTENING) {
+    close(fd);
+    return;
+  }
+
+  socket = btc_socket_create(loop);
+  socket->fd = fd;
+  socket->state = BTC_SOCKET_CONNECTED;
+
+  memcpy(&socket->storage, &server->from, sizeof(server->from));
+
+  if (!btc_loop_register(loop, socket)) {
+    close(fd);
+    btc_socket_destroy(socket);
+    return;
+  }
+
+  server->on_socket(server, socket);
+}
+
+static void
+handle_recv(btc_loop_t *loop, btc_socket_t *socket, void *buf, int len) {
+  if (socket->state != BTC_SOCKET_CONNECTED)
+    return;
+
+  if (len < 0) {
+    switch (-len) {
+      case ECANCELED:
+      case EINTR:
+      case EAGAIN:
+      case ENOBUFS:
+        return;
+    }
+
+    loop->error = -len;
+
+    socket->on_error(socket);
+
+    return;
+  }
+
+  socket->on_data(socket, buf, len);
+}
+
+static void
+handle_completion(btc_loop_t *loop, const btc_cqe_t *cqe) {
+  btc_socket_t *socket;
+  unsigned char *buf;
+  unsigned int bid;
+  int op;
+
+  if (cqe->user_data == BTC_URING_NONE)
+    return;
+
+  socket = (btc_socket_t *)(size_t)(cqe->user_data & ~(__u64)BTC_URING_MASK);
+  op = cqe->user_data & BTC_URING_MASK;
+  buf = socket->window;
+  bid = 0;
+
+  if (!(cqe->flags & IORING_CQE_F_MORE))
+    socket->armed &= ~(1u << op);
+
+  if (cqe->flags & IORING_CQE_F_BUFFER) {
+    bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    buf = loop->ring.bufs + bid * BTC_URING_BUFSIZE;
+  }
+
+  switch (op) {
+    case BTC_URING_ACCEPT: {
+      handle_accept(loop, socket, cqe->res);
+      break;
+    }
+
+    case BTC_URING_RECV: {
+      handle_recv(loop, socket, buf, cqe->res);
+      break;
+    }
+
+    case BTC_URING_POLLIN: {
+      if (cqe->res > 0)
+        handle_read(loop, socket);
+      break;
+    }
+
+    case BTC_URING_POLLOUT: {
+      if (cqe->res > 0)
+        handle_write(loop, socket);
+      break;
+    }
+  }
+
+  if (cqe->flags & IORING_CQE_F_BUFFER)
+    uring_recycle(&loop->ring, bid);
+
+  if (socket->state != BTC_SOCKET_DISCONNECTED)
+    btc_socket_arm(socket);
+}
+#endif /* BTC_USE_IOURING */
+
 static void
 handle_closed(btc_loop_t *loop) {
   btc_link_t *it, *next;
@@ -1725,13 +3240,62 @@ handle_closed(btc_loop_t *loop) {
     socket = it->value;
     next = it->next;
 
+#ifdef BTC_USE_IOURING
+    /* The kernel may still be using the socket. */
+    if (socket->armed != 0) {
+      uring_cancel(loop, socket);
+      continue;
+    }
+#endif
+
+    btc_list_remove(&loop->closed, it);
+
     btc_socket_kill(socket);
     btc_socket_destroy(socket);
   }
+}
+
+static void
+handle_closed_sync(btc_loop_t *loop) {
+  /* Don't return until every closed socket is gone. */
+  while (loop->closed.length > 0) {
+#ifdef BTC_USE_IOURING
+    btc_link_t *it;
+
+    for (it = loop->closed.head; it != NULL; it = it->next)
+      uring_quiesce(loop, it->value);
+#endif
 
-  btc_list_init(&loop->closed);
+    handle_closed(loop);
+  }
 }
 
+#ifdef BTC_USE_IOURING
+static void
+uring_poll(btc_loop_t *loop, int timeout) {
+  btc_uring_t *ring = &loop->ring;
+  btc_cqe_t cqe;
+
+  handle_posted(loop);
+  handle_deferred(loop);
+  handle_flush(loop);
+  handle_arming(loop);
+
+  /* One syscall submits everything we armed above
+     and waits for the next batch of completions. */
+  uring_enter(ring, timeout != 0 && ring->backlog_len == 0, timeout);
+
+  while (uring_next(ring, &cqe))
+    handle_completion(loop, &cqe);
+
+  handle_posted(loop);
+  handle_timers(loop);
+  handle_ticks(loop);
+  handle_flush(loop);
+  handle_closed(loop);
+}
+#endif
+
 void
 btc_loop_start(btc_loop_t *loop) {
   loop->running = 1;
@@ -1753,7 +3317,7 @@ void
 btc_loop_cleanup(btc_loop_t *loop) {
   CHECK(loop->running == 0);
 
-  handle_closed(loop);
+  handle_closed_sync(loop);
 }
 
 void
@@ -1761,7 +3325,16 @@ btc_loop_poll(btc_loop_t *loop, int timeout) {
 #if defined(BTC_USE_EPOLL)
   int i, count;
 
+#ifdef BTC_USE_IOURING
+  if (loop->ring.fd != -1) {
+    uring_poll(loop, timeout);
+    return;
+  }
+#endif
+
+  handle_posted(loop);
   handle_deferred(loop);
+  handle_flush(loop);
 
 retry:
   count = epoll_wait(loop->fd, loop->events, loop->max, timeout);
@@ -1787,12 +3360,17 @@ retry:
   if (count == loop->max)
     btc_loop_grow(loop, (count * 3) / 2);
 
+  handle_posted(loop);
+  handle_timers(loop);
   handle_ticks(loop);
+  handle_flush(loop);
   handle_closed(loop);
 #elif defined(BTC_USE_POLL)
   int count;
 
+  handle_posted(loop);
   handle_deferred(loop);
+  handle_flush(loop);
 
 retry:
   count = poll(loop->pfds, loop->length, timeout);
@@ -1827,14 +3405,19 @@ retry:
     }
   }
 
+  handle_posted(loop);
+  handle_timers(loop);
   handle_ticks(loop);
+  handle_flush(loop);
   handle_closed(loop);
 #else /* BTC_USE_SELECT */
   struct timeval *tp = NULL;
   struct timeval tv;
   int count;
 
+  handle_posted(loop);
   handle_deferred(loop);
+  handle_flush(loop);
 
 retry:
   memcpy(&loop->rfds, &loop->fds, sizeof(loop->fds));
@@ -1900,7 +3483,10 @@ retry:
     }
   }
 
+  handle_posted(loop);
+  handle_timers(loop);
   handle_ticks(loop);
+  handle_flush(loop);
   handle_closed(loop);
 #endif /* BTC_USE_SELECT */
 }
@@ -1915,7 +3501,7 @@ btc_loop_close(btc_loop_t *loop) {
   for (i = 0; i < loop->length; i++)
     btc_socket_close(loop->sockets[i]);
 
-  handle_closed(loop);
+  handle_closed_sync(loop);
 #else /* !BTC_USE_POLL */
   btc_link_t *it;
 
@@ -1924,7 +3510,7 @@ btc_loop_close(btc_loop_t *loop) {
   for (it = loop->sockets.head; it != NULL; it = it->next)
     btc_socket_close(it->value);
 
-  handle_closed(loop);
+  handle_closed_sync(loop);
 
 #if defined(BTC_USE_SELECT) && !defined(_WIN32)
   loop->nfds = 0;
@@ -658,6 +658,15 @@ static const btc_network_t mainnet = {
         0x74, 0x3b, 0xcb, 0xd9, 0x18, 0x80, 0x1c, 0x00,
         0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
       }
+    },
+    /* .taproot = */ {
+      709632,
+      {
+        0x44, 0x82, 0x4d, 0xa9, 0xc0, 0x4e, 0xb5, 0x4b,
+        0xb4, 0x29, 0x86, 0x31, 0x49, 0xf9, 0xc1, 0xc2,
+        0x4d, 0x19, 0x86, 0xa9, 0xbc, 0x87, 0x06, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+      }
     }
   },
   /* .activation_threshold = */ 1916, /* 95% of 2016 */
@@ -7,10 +7,13 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <mako/array.h>
 #include <mako/bip37.h>
 #include <mako/bip152.h>
+#include <mako/bip330.h>
 #include <mako/block.h>
 #include <mako/bloom.h>
+#include <mako/crypto/hash.h>
 #include <mako/header.h>
 #include <mako/netaddr.h>
 #include <mako/netmsg.h>
@@ -26,6 +29,15 @@
  * Constants
  */
 
+/* Bodies at least this large are read in place. */
+#define BTC_PARSER_DIRECT 16384
+
+/* Smallest body buffer we allocate. */
+#define BTC_PARSER_MIN 1024
+
+/* Largest body buffer kept between messages. */
+#define BTC_PARSER_KEEP (1 << 20)
+
 static const char *btc_cmds[] = {
   "addr",
   "block",
@@ -47,12 +59,17 @@ static const char *btc_cmds[] = {
   "notfound",
   "ping",
   "pong",
+  "reconcildiff",
   "reject",
+  "reqrecon",
   "sendcmpct",
   "sendheaders",
+  "sendtxrcncl",
+  "sketch",
   "tx",
   "verack",
   "version",
+  "wtxidrelay",
   /* Internal */
   "blocktxn", /* base */
   "block", /* base */
@@ -892,6 +909,165 @@ btc_sendcmpct_read(btc_sendcmpct_t *z, const uint8_t **xp, size_t *xn) {
   return 1;
 }
 
+/*
+ * SendTxRcncl
+ */
+
+DEFINE_SERIALIZABLE_OBJECT(btc_sendtxrcncl, SCOPE_EXTERN)
+
+void
+btc_sendtxrcncl_init(btc_sendtxrcncl_t *msg) {
+  msg->version = 0;
+  msg->salt = 0;
+}
+
+void
+btc_sendtxrcncl_clear(btc_sendtxrcncl_t *msg) {
+  (void)msg;
+}
+
+void
+btc_sendtxrcncl_copy(btc_sendtxrcncl_t *z, const btc_sendtxrcncl_t *x) {
+  *z = *x;
+}
+
+size_t
+btc_sendtxrcncl_size(const btc_sendtxrcncl_t *x) {
+  (void)x;
+  return 12;
+}
+
+uint8_t *
+btc_sendtxrcncl_write(uint8_t *zp, const btc_sendtxrcncl_t *x) {
+  zp = btc_uint32_write(zp, x->version);
+  zp = btc_uint64_write(zp, x->salt);
+  return zp;
+}
+
+int
+btc_sendtxrcncl_read(btc_sendtxrcncl_t *z, const uint8_t **xp, size_t *xn) {
+  if (!btc_uint32_read(&z->version, xp, xn))
+    return 0;
+
+  if (!btc_uint64_read(&z->salt, xp, xn))
+    return 0;
+
+  return 1;
+}
+
+/*
+ * ReqRecon
+ */
+
+DEFINE_SERIALIZABLE_OBJECT(btc_reqrecon, SCOPE_EXTERN)
+
+void
+btc_reqrecon_init(btc_reqrecon_t *msg) {
+  msg->set_size = 0;
+  msg->q = 0;
+}
+
+void
+btc_reqrecon_clear(btc_reqrecon_t *msg) {
+  (void)msg;
+}
+
+void
+btc_reqrecon_copy(btc_reqrecon_t *z, const btc_reqrecon_t *x) {
+  *z = *x;
+}
+
+size_t
+btc_reqrecon_size(const btc_reqrecon_t *x) {
+  (void)x;
+  return 4;
+}
+
+uint8_t *
+btc_reqrecon_write(uint8_t *zp, const btc_reqrecon_t *x) {
+  zp = btc_uint16_write(zp, x->set_size);
+  zp = btc_uint16_write(zp, x->q);
+  return zp;
+}
+
+int
+btc_reqrecon_read(btc_reqrecon_t *z, const uint8_t **xp, size_t *xn) {
+  if (!btc_uint16_read(&z->set_size, xp, xn))
+    return 0;
+
+  if (!btc_uint16_read(&z->q, xp, xn))
+    return 0;
+
+  return 1;
+}
+
+/*
+ * ReconcilDiff
+ */
+
+DEFINE_SERIALIZABLE_OBJECT(btc_reconcildiff, SCOPE_EXTERN)
+
+void
+btc_reconcildiff_init(btc_reconcildiff_t *msg) {
+  msg->success = 0;
+  btc_array_init(&msg->ask);
+}
+
+void
+btc_reconcildiff_clear(btc_reconcildiff_t *msg) {
+  btc_array_clear(&msg->ask);
+}
+
+void
+btc_reconcildiff_copy(btc_reconcildiff_t *z, const btc_reconcildiff_t *x) {
+  z->success = x->success;
+  btc_array_copy(&z->ask, &x->ask);
+}
+
+size_t
+btc_reconcildiff_size(const btc_reconcildiff_t *x) {
+  return 1 + btc_size_size(x->ask.length) + x->ask.length * 4;
+}
+
+uint8_t *
+btc_reconcildiff_write(uint8_t *zp, const btc_reconcildiff_t *x) {
+  size_t i;
+
+  zp = btc_uint8_write(zp, x->success);
+  zp = btc_size_write(zp, x->ask.length);
+
+  for (i = 0; i < x->ask.length; i++)
+    zp = btc_uint32_write(zp, (uint32_t)x->ask.items[i]);
+
+  return zp;
+}
+
+int
+btc_reconcildiff_read(btc_reconcildiff_t *z, const uint8_t **xp, size_t *xn) {
+  size_t i, count;
+  uint32_t id;
+
+  if (!btc_uint8_read(&z->success, xp, xn))
+    return 0;
+
+  if (!btc_size_read(&count, xp, xn))
+    return 0;
+
+  if (count > *xn / 4)
+    return 0;
+
+  btc_array_reset(&z->ask);
+
+  for (i = 0; i < count; i++) {
+    if (!btc_uint32_read(&id, xp, xn))
+      return 0;
+
+    btc_array_push(&z->ask, id);
+  }
+
+  return 1;
+}
+
 /*
  * Unknown
  */
@@ -960,6 +1136,7 @@ btc_msg_clear(btc_msg_t *msg) {
       btc_version_destroy((btc_version_t *)msg->body);
       break;
     case BTC_MSG_VERACK:
+    case BTC_MSG_WTXIDRELAY:
       break;
     case BTC_MSG_PING:
       btc_ping_destroy((btc_ping_t *)msg->body);
@@ -1032,6 +1209,18 @@ btc_msg_clear(btc_msg_t *msg) {
     case BTC_MSG_BLOCKTXN_BASE:
       btc_blocktxn_destroy((btc_blocktxn_t *)msg->body);
       break;
+    case BTC_MSG_SENDTXRCNCL:
+      btc_sendtxrcncl_destroy((btc_sendtxrcncl_t *)msg->body);
+      break;
+    case BTC_MSG_REQRECON:
+      btc_reqrecon_destroy((btc_reqrecon_t *)msg->body);
+      break;
+    case BTC_MSG_SKETCH:
+      btc_sketch_destroy((btc_sketch_t *)msg->body);
+      break;
+    case BTC_MSG_RECONCILDIFF:
+      btc_reconcildiff_destroy((btc_reconcildiff_t *)msg->body);
+      break;
     case BTC_MSG_UNKNOWN:
       btc_unknown_destroy((btc_unknown_t *)msg->body);
       break;
@@ -1072,6 +1261,7 @@ btc_msg_alloc(btc_msg_t *msg) {
       msg->body = btc_version_create();
       break;
     case BTC_MSG_VERACK:
+    case BTC_MSG_WTXIDRELAY:
       msg->body = NULL;
       break;
     case BTC_MSG_PING:
@@ -1149,6 +1339,18 @@ btc_msg_alloc(btc_msg_t *msg) {
     case BTC_MSG_BLOCKTXN_BASE:
       msg->body = btc_blocktxn_create();
       break;
+    case BTC_MSG_SENDTXRCNCL:
+      msg->body = btc_sendtxrcncl_create();
+      break;
+    case BTC_MSG_REQRECON:
+      msg->body = btc_reqrecon_create();
+      break;
+    case BTC_MSG_SKETCH:
+      msg->body = btc_sketch_create();
+      break;
+    case BTC_MSG_RECONCILDIFF:
+      msg->body = btc_reconcildiff_create();
+      break;
     case BTC_MSG_UNKNOWN:
       msg->body = btc_unknown_create();
       break;
@@ -1164,6 +1366,7 @@ btc_msg_size(const btc_msg_t *x) {
     case BTC_MSG_VERSION:
       return btc_version_size((const btc_version_t *)x->body);
     case BTC_MSG_VERACK:
+    case BTC_MSG_WTXIDRELAY:
       return 0;
     case BTC_MSG_PING:
       return btc_ping_size((const btc_ping_t *)x->body);
@@ -1222,6 +1425,14 @@ btc_msg_size(const btc_msg_t *x) {
       return btc_blocktxn_size((const btc_blocktxn_t *)x->body);
     case BTC_MSG_BLOCKTXN_BASE:
       return btc_blocktxn_base_size((const btc_blocktxn_t *)x->body);
+    case BTC_MSG_SENDTXRCNCL:
+      return btc_sendtxrcncl_size((const btc_sendtxrcncl_t *)x->body);
+    case BTC_MSG_REQRECON:
+      return btc_reqrecon_size((const btc_reqrecon_t *)x->body);
+    case BTC_MSG_SKETCH:
+      return btc_sketch_size((const btc_sketch_t *)x->body);
+    case BTC_MSG_RECONCILDIFF:
+      return btc_reconcildiff_size((const btc_reconcildiff_t *)x->body);
     case BTC_MSG_UNKNOWN:
       return btc_unknown_size((const btc_unknown_t *)x->body);
     default:
@@ -1235,6 +1446,7 @@ btc_msg_write(uint8_t *zp, const btc_msg_t *x) {
     case BTC_MSG_VERSION:
       return btc_version_write(zp, (const btc_version_t *)x->body);
     case BTC_MSG_VERACK:
+    case BTC_MSG_WTXIDRELAY:
       return zp;
     case BTC_MSG_PING:
       return btc_ping_write(zp, (const btc_ping_t *)x->body);
@@ -1293,6 +1505,14 @@ btc_msg_write(uint8_t *zp, const btc_msg_t *x) {
       return btc_blocktxn_write(zp, (const btc_blocktxn_t *)x->body);
     case BTC_MSG_BLOCKTXN_BASE:
       return btc_blocktxn_base_write(zp, (const btc_blocktxn_t *)x->body);
+    case BTC_MSG_SENDTXRCNCL:
+      return btc_sendtxrcncl_write(zp, (const btc_sendtxrcncl_t *)x->body);
+    case BTC_MSG_REQRECON:
+      return btc_reqrecon_write(zp, (const btc_reqrecon_t *)x->body);
+    case BTC_MSG_SKETCH:
+      return btc_sketch_write(zp, (const btc_sketch_t *)x->body);
+    case BTC_MSG_RECONCILDIFF:
+      return btc_reconcildiff_write(zp, (const btc_reconcildiff_t *)x->body);
     case BTC_MSG_UNKNOWN:
       return btc_unknown_write(zp, (const btc_unknown_t *)x->body);
     default:
@@ -1306,6 +1526,7 @@ btc_msg_read(btc_msg_t *z, const uint8_t **xp, size_t *xn) {
     case BTC_MSG_VERSION:
       return btc_version_read((btc_version_t *)z->body, xp, xn);
     case BTC_MSG_VERACK:
+    case BTC_MSG_WTXIDRELAY:
       return 1;
     case BTC_MSG_PING:
       return btc_ping_read((btc_ping_t *)z->body, xp, xn);
@@ -1360,9 +1581,228 @@ btc_msg_read(btc_msg_t *z, const uint8_t **xp, size_t *xn) {
     case BTC_MSG_BLOCKTXN:
     case BTC_MSG_BLOCKTXN_BASE:
       return btc_blocktxn_read((btc_blocktxn_t *)z->body, xp, xn);
+    case BTC_MSG_SENDTXRCNCL:
+      return btc_sendtxrcncl_read((btc_sendtxrcncl_t *)z->body, xp, xn);
+    case BTC_MSG_REQRECON:
+      return btc_reqrecon_read((btc_reqrecon_t *)z->body, xp, xn);
+    case BTC_MSG_SKETCH:
+      return btc_sketch_read((btc_sketch_t *)z->body, xp, xn);
+    case BTC_MSG_RECONCILDIFF:
+      return btc_reconcildiff_read((btc_reconcildiff_t *)z->body, xp, xn);
     case BTC_MSG_UNKNOWN:
       return btc_unknown_read((btc_unknown_t *)z->body, xp, xn);
     default:
       return 0;
   }
 }
+
+/*
+ * Parser
+ */
+
+void
+btc_parser_init(btc_parser_t *parser, uint32_t magic) {
+  parser->magic = magic;
+  parser->payload = NULL;
+  parser->alloc = 0;
+  parser->total = 0;
+  parser->closed = 0;
+  parser->cmd[0] = '\0';
+  parser->has_header = 0;
+  parser->size = 0;
+  parser->checksum = 0;
+  parser->on_msg = NULL;
+  parser->on_error = NULL;
+  parser->arg = NULL;
+}
+
+void
+btc_parser_clear(btc_parser_t *parser) {
+  if (parser->alloc > 0)
+    btc_free(parser->payload);
+
+  parser->payload = NULL;
+  parser->alloc = 0;
+}
+
+static void
+btc_parser_reserve(btc_parser_t *parser, size_t need) {
+  /* The header only claims a length. Grow the
+     body buffer as the bytes actually arrive so
+     that a bare header can't pin 4MB per peer. */
+  size_t alloc = parser->alloc;
+
+  if (need <= alloc)
+    return;
+
+  if (alloc < BTC_PARSER_MIN)
+    alloc = BTC_PARSER_MIN;
+
+  while (alloc < need)
+    alloc *= 2;
+
+  if (alloc > parser->size)
+    alloc = parser->size;
+
+  parser->payload = (uint8_t *)btc_realloc(parser->payload, alloc);
+  parser->alloc = alloc;
+}
+
+static int
+btc_parser_parse_header(btc_parser_t *parser) {
+  const uint8_t *xp = parser->header;
+  size_t xn = sizeof(parser->header);
+  uint32_t magic, size;
+
+  if (!btc_uint32_read(&magic, &xp, &xn))
+    return 0;
+
+  if (magic != parser->magic)
+    return 0;
+
+  if (!btc_nullstr_read(parser->cmd, 12, &xp, &xn))
+    return 0;
+
+  if (!btc_uint32_read(&size, &xp, &xn))
+    return 0;
+
+  if (size > BTC_NET_MAX_MESSAGE)
+    return 0;
+
+  if (!btc_uint32_read(&parser->checksum, &xp, &xn))
+    return 0;
+
+  btc_hash256_init(&parser->hash);
+
+  parser->size = size;
+  parser->has_header = 1;
+
+  return 1;
+}
+
+static int
+btc_parser_parse(btc_parser_t *parser) {
+  uint8_t hash[32];
+  btc_msg_t msg;
+
+  /* The body was hashed as it arrived. */
+  btc_hash256_final(&parser->hash, hash);
+
+  if (btc_read32le(hash) != parser->checksum)
+    return 0;
+
+  btc_msg_set_cmd(&msg, parser->cmd);
+  btc_msg_alloc(&msg);
+
+  if (!btc_msg_import(&msg, parser->payload, parser->size)) {
+    btc_msg_clear(&msg);
+    return 0;
+  }
+
+  parser->on_msg(&msg, parser->arg);
+
+  btc_msg_clear(&msg);
+
+  return 1;
+}
+
+static void
+btc_parser_finish(btc_parser_t *parser) {
+  if (!btc_parser_parse(parser)) {
+    if (!parser->closed)
+      parser->on_error(parser->arg);
+  }
+
+  parser->total = 0;
+  parser->has_header = 0;
+
+  /* Don't hold on to a large block buffer
+     while we wait for the next ping. */
+  if (parser->alloc > BTC_PARSER_KEEP)
+    btc_parser_clear(parser);
+}
+
+void *
+btc_parser_window(btc_parser_t *parser, size_t *size) {
+  /* Let the socket read a large body directly into
+     the payload buffer. Anything past the end of
+     this message goes through the usual path. */
+  size_t left = parser->size - parser->total;
+  size_t need;
+
+  if (parser->closed || !parser->has_header)
+    return NULL;
+
+  if (left < BTC_PARSER_DIRECT)
+    return NULL;
+
+  /* At most double what we've received so far. */
+  need = BTC_MAX(parser->total * 2, parser->total + BTC_PARSER_DIRECT);
+
+  btc_parser_reserve(parser, BTC_MIN(need, parser->size));
+
+  *size = BTC_MIN(left, parser->alloc - parser->total);
+
+  return parser->payload + parser->total;
+}
+
+int
+btc_parser_feed(btc_parser_t *parser, const uint8_t *data, size_t length) {
+  int parsed = 0;
+  size_t n;
+
+  while (!parser->closed && length > 0) {
+    if (!parser->has_header) {
+      n = BTC_MIN(sizeof(parser->header) - parser->total, length);
+
+      memcpy(parser->header + parser->total, data, n);
+
+      parser->total += n;
+
+      data += n;
+      length -= n;
+
+      if (parser->total < sizeof(parser->header))
+        break;
+
+      parser->total = 0;
+
+      if (!btc_parser_parse_header(parser)) {
+        parser->on_error(parser->arg);
+        continue;
+      }
+
+      if (parser->size > 0)
+        continue;
+    } else {
+      uint8_t *body;
+
+      n = BTC_MIN(parser->size - parser->total, length);
+
+      /* Already in place if we handed out a window. */
+      if (parser->alloc <= parser->total
+          || data != parser->payload + parser->total) {
+        btc_parser_reserve(parser, parser->total + n);
+        memcpy(parser->payload + parser->total, data, n);
+      }
+
+      body = parser->payload + parser->total;
+
+      btc_hash256_update(&parser->hash, body, n);
+
+      parser->total += n;
+
+      data += n;
+      length -= n;
+
+      if (parser->total < parser->size)
+        break;
+    }
+
+    btc_parser_finish(parser);
+
+    parsed = 1;
+  }
+
+  return parsed;
+}
@@ -17,9 +17,11 @@
 #include <base/logger.h>
 #include <base/timedata.h>
 
+#include <mako/array.h>
 #include <mako/block.h>
 #include <mako/coins.h>
 #include <mako/consensus.h>
+#include <mako/crypto/ecc.h>
 #include <mako/crypto/hash.h>
 #include <mako/entry.h>
 #include <mako/header.h>
@@ -85,34 +87,114 @@ btc_orphan_copy(btc_orphan_t *z, const btc_orphan_t *x) {
  * TX Checker
  */
 
+/* Transactions are handed to the workers in chunks.
+ * Schnorr signatures are collected per chunk and batch
+ * verified once every script in the chunk has run. If
+ * the batch fails, individual checks find the culprit.
+ *
+ * Each worker pulls chunks until none are left and
+ * keeps one signature batch (and its multi-scalar
+ * scratch space) for all of them. The batches belong
+ * to the chain and are reused from block to block.
+ */
+
+#define BTC_CHECKER_CHUNK 16
+
+/* Matches the thread limit in btc_chain_set_threads. */
+#define BTC_CHECKER_LANES 16
+
 typedef struct btc_txwork_s {
-  const btc_tx_t *tx;
+  const btc_tx_t *txs[BTC_CHECKER_CHUNK];
+  size_t ends[BTC_CHECKER_CHUNK];
+  size_t length;
   const btc_view_t *view;
   unsigned int flags;
+  const btc_tx_t *culprit;
   int result;
   struct btc_txwork_s *next;
 } btc_txwork_t;
 
+typedef struct btc_checklane_s {
+  struct btc_checker_s *checker;
+  btc_sigbatch_t *batch;
+} btc_checklane_t;
+
 typedef struct btc_checker_s {
   btc_workers_t *pool;
   btc_txwork_t *head;
   btc_txwork_t *tail;
+  btc_txwork_t *next;
+  btc_mutex_t lock;
   btc_workq_t batch;
+  btc_checklane_t lanes[BTC_CHECKER_LANES];
   size_t length;
+  const btc_tx_t *culprit;
 } btc_checker_t;
 
 static void
 btc_checker_init(btc_checker_t *checker, btc_workers_t *pool) {
   checker->pool = pool;
+  checker->next = NULL;
+  checker->culprit = NULL;
   btc_queue_init(checker);
   btc_workq_init(&checker->batch);
 }
 
+static void
+btc_checker_run(btc_txwork_t *work, btc_sigbatch_t *batch) {
+  size_t i, bad;
+
+  btc_sigbatch_reset(batch);
+
+  work->result = 1;
+
+  for (i = 0; i < work->length; i++) {
+    const btc_tx_t *tx = work->txs[i];
+
+    if (!btc_tx_verify_batch(tx, work->view, work->flags, batch)) {
+      work->culprit = tx;
+      work->result = 0;
+      return;
+    }
+
+    work->ends[i] = btc_sigbatch_length(batch);
+  }
+
+  if (!btc_sigbatch_verify(batch)) {
+    bad = btc_sigbatch_find(batch, 0, btc_sigbatch_length(batch));
+
+    for (i = 0; i < work->length; i++) {
+      if (bad < work->ends[i]) {
+        work->culprit = work->txs[i];
+        break;
+      }
+    }
+
+    work->result = 0;
+  }
+}
+
 static void
 btc_checker_work(void *arg) {
-  btc_txwork_t *work = arg;
+  btc_checklane_t *lane = arg;
+  btc_checker_t *checker = lane->checker;
+  btc_txwork_t *work;
+
+  for (;;) {
+    btc_mutex_lock(&checker->lock);
+
+    work = checker->next;
+
+    if (work != NULL)
+      checker->next = work->next;
+
+    btc_mutex_unlock(&checker->lock);
 
-  work->result = btc_tx_verify(work->tx, work->view, work->flags);
+    if (work == NULL)
+      break;
+
+    btc_checker_run(work, lane->batch);
+  }
 }
 
 static void
@@ -120,29 +202,61 @@ btc_checker_push(btc_checker_t *checker,
                  const btc_tx_t *tx,
                  const btc_view_t *view,
                  unsigned int flags) {
-  btc_txwork_t *work = btc_malloc(sizeof(btc_txwork_t));
+  btc_txwork_t *work = checker->tail;
+
+  if (work == NULL || work->length == BTC_CHECKER_CHUNK
+                   || work->view != view
+                   || work->flags != flags) {
+    work = btc_malloc(sizeof(btc_txwork_t));
+
+    work->length = 0;
+    work->view = view;
+    work->flags = flags;
+    work->culprit = NULL;
+    work->result = 0;
+    work->next = NULL;
 
-  work->tx = tx;
-  work->view = view;
-  work->flags = flags;
-  work->result = 0;
-  work->next = NULL;
+    btc_queue_push(checker, work);
+  }
 
-  btc_queue_push(checker, work);
-  btc_workq_push(&checker->batch, btc_checker_work, work);
+  work->txs[work->length++] = tx;
 }
 
 static int
-btc_checker_verify(btc_checker_t *checker) {
+btc_checker_verify(btc_checker_t *checker,
+                   btc_sigbatch_t **batches,
+                   int threads) {
+  size_t lanes = BTC_MIN(checker->length, (size_t)threads);
   btc_txwork_t *work, *next;
   int ret = 1;
+  size_t i;
+
+  btc_mutex_init(&checker->lock);
+
+  checker->next = checker->head;
+
+  for (i = 0; i < lanes; i++) {
+    btc_checklane_t *lane = &checker->lanes[i];
+
+    lane->checker = checker;
+    lane->batch = batches[i];
+
+    btc_workq_push(&checker->batch, btc_checker_work, lane);
+  }
 
   btc_workers_batch(checker->pool, &checker->batch);
   btc_workers_wait(checker->pool);
 
+  btc_mutex_destroy(&checker->lock);
+
   for (work = checker->head; work != NULL; work = next) {
     next = work->next;
+
+    if (checker->culprit == NULL)
+      checker->culprit = work->culprit;
+
     ret &= work->result;
+
     btc_free(work);
   }
 
@@ -219,6 +333,7 @@ struct btc_chain_s {
   btc_chaindb_t *db;
   const btc_timedata_t *timedata;
   btc_workers_t *workers;
+  btc_sigbatch_t *batches[BTC_CHECKER_LANES];
   btc_hashset_t invalid;
   btc_hashmap_t orphan_map;
   btc_hashmap_t orphan_prev;
@@ -244,6 +359,7 @@ BTC_DEFINE_LOGGER(btc_log, btc_chain_t, "chain")
 btc_chain_t *
 btc_chain_create(const btc_network_t *network) {
   btc_chain_t *chain = btc_malloc(sizeof(btc_chain_t));
+  int i;
 
   memset(chain, 0, sizeof(*chain));
 
@@ -251,6 +367,10 @@ btc_chain_create(const btc_network_t *network) {
   chain->logger = NULL;
   chain->db = btc_chaindb_create(network);
   chain->timedata = NULL;
+
+  for (i = 0; i < BTC_CHECKER_LANES; i++)
+    chain->batches[i] = btc_sigbatch_create();
+
   btc_hashset_init(&chain->invalid);
   btc_hashmap_init(&chain->orphan_map);
   btc_hashmap_init(&chain->orphan_prev);
@@ -272,6 +392,10 @@ btc_chain_create(const btc_network_t *network) {
 void
 btc_chain_destroy(btc_chain_t *chain) {
   btc_mapiter_t it;
+  int i;
+
+  for (i = 0; i < BTC_CHECKER_LANES; i++)
+    btc_sigbatch_destroy(chain->batches[i]);
 
   btc_map_each(&chain->invalid, it)
     btc_free(chain->invalid.keys[it]);
@@ -314,8 +438,8 @@ btc_chain_set_threads(btc_chain_t *chain, int threads) {
 
   if (threads <= 1)
     threads = 0;
-  else if (threads > 16)
-    threads = 16;
+  else if (threads > BTC_CHECKER_LANES)
+    threads = BTC_CHECKER_LANES;
 
   chain->threads = threads;
 }
@@ -972,6 +1096,17 @@ btc_chain_get_deployments(btc_chain_t *chain,
     state->flags |= BTC_SCRIPT_VERIFY_WITNESS;
     state->flags |= BTC_SCRIPT_VERIFY_NULLDUMMY;
   }
+
+  /* Taproot and tapscript (bip341 & bip342). */
+  deploy = btc_network_deployment(network, "taproot");
+
+  if (deploy != NULL)
+    active = btc_chain_is_active(chain, prev, deploy);
+  else
+    active = (height >= network->softforks.taproot.height);
+
+  if (active)
+    state->flags |= BTC_SCRIPT_VERIFY_TAPROOT;
 }
 
 static int
@@ -1481,7 +1616,14 @@ btc_chain_verify_inputs(btc_chain_t *chain,
       btc_checker_push(&checker, tx, view, state->flags);
     }
 
-    if (!btc_checker_verify(&checker)) {
+    if (!btc_checker_verify(&checker, chain->batches, chain->threads)) {
+      if (checker.culprit != NULL) {
+        btc_log_debug(chain, "Script verification failed for tx %H.",
+                             checker.culprit->hash);
+      } else {
+        btc_log_warn(chain, "Signature batch failed with no culprit.");
+      }
+
       btc_chain_throw(chain, hdr,
                       BTC_REJECT_INVALID,
                       "mandatory-script-verify-flag-failed",
@@ -1490,18 +1632,60 @@ btc_chain_verify_inputs(btc_chain_t *chain,
       goto fail;
     }
   } else {
+    btc_sigbatch_t *batch = chain->batches[0];
+    const btc_tx_t *culprit = NULL;
+    btc_array_t ends;
+    int ok = 1;
+    size_t bad;
+
+    btc_array_init(&ends);
+    btc_sigbatch_reset(batch);
+
     /* Verify all transactions. */
     for (i = 1; i < block->txs.length; i++) {
       const btc_tx_t *tx = block->txs.items[i];
 
-      if (!btc_tx_verify(tx, view, state->flags)) {
-        btc_chain_throw(chain, hdr,
-                        BTC_REJECT_INVALID,
-                        "mandatory-script-verify-flag-failed",
-                        100,
-                        0);
-        goto fail;
+      if (!btc_tx_verify_batch(tx, view, state->flags, batch)) {
+        culprit = tx;
+        ok = 0;
+        break;
       }
+
+      btc_array_push(&ends, btc_sigbatch_length(batch));
+    }
+
+    /* Verify all schnorr signatures at once. The batch
+       is authoritative even if no single signature can
+       be blamed for its failure. */
+    if (ok && !btc_sigbatch_verify(batch)) {
+      bad = btc_sigbatch_find(batch, 0, btc_sigbatch_length(batch));
+
+      for (i = 0; i < ends.length; i++) {
+        if (bad < (size_t)ends.items[i]) {
+          culprit = block->txs.items[i + 1];
+          break;
+        }
+      }
+
+      ok = 0;
+    }
+
+    btc_array_clear(&ends);
+
+    if (!ok) {
+      if (culprit != NULL) {
+        btc_log_debug(chain, "Script verification failed for tx %H.",
+                             culprit->hash);
+      } else {
+        btc_log_warn(chain, "Signature batch failed with no culprit.");
+      }
+
+      btc_chain_throw(chain, hdr,
+                      BTC_REJECT_INVALID,
+                      "mandatory-script-verify-flag-failed",
+                      100,
+                      0);
+      goto fail;
     }
   }
 
@@ -1807,6 +1991,7 @@ btc_chain_connect(btc_chain_t *chain,
   const btc_header_t *hdr = &block->header;
   btc_entry_t *entry = btc_entry_create();
   int64_t now = btc_time_usec();
+  uint64_t hits, misses;
   size_t rss;
 
   /* Sanity check. */
@@ -1839,6 +2024,14 @@ btc_chain_connect(btc_chain_t *chain,
 
     if ((rss = btc_ps_rss()))
       btc_log_debug(chain, "Memory: rss=%zumb", rss / (1 << 20));
+
+    btc_ecdsa_cache_stats(&hits, &misses);
+
+    if (hits + misses > 0) {
+      btc_log_debug(chain, "Pubkey cache: hits=%.2f%% (lookups=%.0f)",
+                           (double)hits * 100.0 / (double)(hits + misses),
+                           (double)(hits + misses));
+    }
   }
 
   btc_chain_maybe_sync(chain);
@@ -13,11 +13,13 @@
 
 #include <node/chain.h>
 #include <base/logger.h>
+#include <node/mempool.h>
 #include <node/node.h>
 #include <node/pool.h>
 #include <node/rpc.h>
 
 #include <base/config.h>
+#include <mako/crypto/ecc.h>
 #include <mako/netaddr.h>
 #include <mako/util.h>
 
@@ -35,6 +37,7 @@ static const char *node_args[] = {
   "-chain=",
   "-checkpoints=",
   "-compactblocks=",
+  "-compactmempool=",
   "-conf=",
   "-connect=",
   "-daemon=",
@@ -43,10 +46,12 @@ static const char *node_args[] = {
   "-disablewallet=",
   "-discover=",
   "-externalip=",
+  "-iothreads=",
   "-listen=",
   "-loglevel=",
   "-maxconnections=",
   "-maxinbound=",
+  "-maxmempool=",
   "-maxoutbound=",
   "-networkactive=",
   "-onion=",
@@ -63,6 +68,7 @@ static const char *node_args[] = {
   "-rpcport=",
   "-rpcuser=",
   "-testnet",
+  "-txreconciliation=",
   "-upnp=",
   "-version"
 };
@@ -102,6 +108,8 @@ set_config(btc_node_t *node, const btc_conf_t *conf) {
   btc_chain_set_threads(node->chain, conf->workers);
   btc_chain_set_cache(node->chain, (size_t)conf->cache_size << 20);
 
+  btc_mempool_set_size(node->mempool, (size_t)conf->max_mempool * 1000000);
+
   btc_pool_set_port(node->pool, conf->port);
 
   for (i = 0; i < conf->bind.length; i++)
@@ -116,6 +124,7 @@ set_config(btc_node_t *node, const btc_conf_t *conf) {
   btc_pool_set_proxy(node->pool, &conf->proxy);
   btc_pool_set_maxinbound(node->pool, conf->max_inbound);
   btc_pool_set_maxoutbound(node->pool, conf->max_outbound);
+  btc_pool_set_threads(node->pool, conf->io_threads);
   btc_pool_set_bantime(node->pool, conf->ban_time);
   btc_pool_set_onlynet(node->pool, conf->only_net);
 
@@ -137,6 +146,9 @@ get_node_flags(const btc_conf_t *conf) {
   if (conf->prune)
     flags |= BTC_CHAIN_PRUNE;
 
+  if (conf->compact_mempool)
+    flags |= BTC_MEMPOOL_COMPACT;
+
   if (conf->listen)
     flags |= BTC_POOL_LISTEN;
 
@@ -170,6 +182,9 @@ get_node_flags(const btc_conf_t *conf) {
   if (conf->bip157)
     flags |= BTC_POOL_BIP157;
 
+  if (conf->bip330)
+    flags |= BTC_POOL_BIP330;
+
   return flags;
 }
 
@@ -208,6 +223,7 @@ btc_main(const btc_conf_t *conf) {
   }
 
   btc_net_startup();
+  btc_ecdsa_cache_init(32768);
 
   node = btc_node_create(conf->network);
 
@@ -215,6 +231,7 @@ btc_main(const btc_conf_t *conf) {
 
   if (!btc_node_open(node, conf->prefix, get_node_flags(conf))) {
     btc_node_destroy(node);
+    btc_ecdsa_cache_clear();
     btc_net_cleanup();
     return 0;
   }
@@ -226,6 +243,7 @@ btc_main(const btc_conf_t *conf) {
   btc_node_close(node);
   btc_node_destroy(node);
 
+  btc_ecdsa_cache_clear();
   btc_net_cleanup();
 
   return 1;
@@ -24,6 +24,7 @@
 #include <mako/entry.h>
 #include <mako/header.h>
 #include <mako/heap.h>
+#include <mako/list.h>
 #include <mako/map.h>
 #include <mako/netmsg.h>
 #include <mako/network.h>
@@ -45,6 +46,9 @@ typedef struct btc_orphan_s {
   btc_tx_t *tx;
   int missing;
   unsigned int id;
+  size_t weight;
+  struct btc_orphan_s *prev;
+  struct btc_orphan_s *next;
 } btc_orphan_t;
 
 DEFINE_OBJECT(btc_orphan, SCOPE_STATIC)
@@ -67,6 +71,75 @@ btc_orphan_copy(btc_orphan_t *z, const btc_orphan_t *x) {
   *z = *x;
 }
 
+/*
+ * Orphan Wait List
+ */
+
+typedef struct btc_waitlist_s {
+  btc_outpoint_t prevout;
+  btc_vector_t orphans;
+} btc_waitlist_t;
+
+static btc_waitlist_t *
+btc_waitlist_create(const btc_outpoint_t *prevout) {
+  btc_waitlist_t *list = (btc_waitlist_t *)btc_malloc(sizeof(btc_waitlist_t));
+
+  btc_outpoint_copy(&list->prevout, prevout);
+  btc_vector_init(&list->orphans);
+
+  return list;
+}
+
+static void
+btc_waitlist_destroy(btc_waitlist_t *list) {
+  btc_vector_clear(&list->orphans);
+  btc_free(list);
+}
+
+static void
+btc_waitlist_remove(btc_waitlist_t *list, const btc_orphan_t *orphan) {
+  btc_vector_t *vec = &list->orphans;
+  size_t i;
+
+  for (i = 0; i < vec->length; i++) {
+    if (vec->items[i] == orphan) {
+      vec->items[i] = vec->items[vec->length - 1];
+      btc_vector_pop(vec);
+      break;
+    }
+  }
+}
+
+/*
+ * Orphan Peer
+ */
+
+typedef struct btc_orphanpeer_s {
+  unsigned int id;
+  size_t weight;
+  btc_orphan_t *head;
+  btc_orphan_t *tail;
+  size_t length;
+} btc_orphanpeer_t;
+
+static btc_orphanpeer_t *
+btc_orphanpeer_create(unsigned int id) {
+  btc_orphanpeer_t *peer =
+    (btc_orphanpeer_t *)btc_malloc(sizeof(btc_orphanpeer_t));
+
+  peer->id = id;
+  peer->weight = 0;
+
+  btc_list_init(peer);
+
+  return peer;
+}
+
+static void
+btc_orphanpeer_destroy(btc_orphanpeer_t *peer) {
+  btc_free(peer);
+}
+
 /**
  * Mempool Entry
  */
@@ -88,6 +161,7 @@ btc_mpentry_init(btc_mpentry_t *entry) {
   entry->locks = 0;
   entry->desc_fee = 0;
   entry->desc_size = 0;
+  entry->pos = 0;
 }
 
 static void
@@ -113,6 +187,7 @@ btc_mpentry_copy(btc_mpentry_t *z, const btc_mpentry_t *x) {
   z->locks = x->locks;
   z->desc_fee = x->desc_fee;
   z->desc_size = x->desc_size;
+  z->pos = 0;
 }
 
 static void
@@ -156,6 +231,22 @@ btc_mpentry_set(btc_mpentry_t *entry,
   entry->desc_size = size;
 }
 
+static void
+btc_mpentry_compact(btc_mpentry_t *entry) {
+  btc_tx_t *tx = btc_tx_pack(entry->tx);
+
+  btc_tx_destroy(entry->tx);
+
+  entry->tx = tx;
+  entry->hash = tx->hash;
+  entry->whash = tx->whash;
+}
+
+static size_t
+btc_mpentry_usage(const btc_mpentry_t *entry) {
+  return btc_malloc_usage(sizeof(btc_mpentry_t)) + btc_tx_usage(entry->tx);
+}
+
 static size_t
 btc_mpentry_size(const btc_mpentry_t *x) {
   return btc_tx_size(x->tx) + 30;
@@ -208,25 +299,117 @@ btc_mpentry_read(btc_mpentry_t *z, const uint8_t **xp, size_t *xn) {
   return 1;
 }
 
+/*
+ * Mempool Index
+ */
+
+static void
+btc_mpindex_init(btc_mpindex_t *z) {
+  z->entries = NULL;
+  z->hashes = NULL;
+  z->whashes = NULL;
+  z->alloc = 0;
+  z->length = 0;
+}
+
+static void
+btc_mpindex_clear(btc_mpindex_t *z) {
+  if (z->alloc > 0) {
+    btc_free(z->entries);
+    btc_free(z->hashes);
+    btc_free(z->whashes);
+  }
+
+  btc_mpindex_init(z);
+}
+
+static void
+btc_mpindex_push(btc_mpindex_t *z, btc_mpentry_t *entry) {
+  if (z->length == z->alloc) {
+    size_t alloc = z->alloc == 0 ? 64 : z->alloc * 2;
+
+    z->entries = btc_realloc(z->entries, alloc * sizeof(btc_mpentry_t *));
+    z->hashes = btc_realloc(z->hashes, alloc * 32);
+    z->whashes = btc_realloc(z->whashes, alloc * 32);
+    z->alloc = alloc;
+  }
+
+  entry->pos = z->length;
+
+  z->entries[z->length] = entry;
+
+  btc_hash_copy(&z->hashes[z->length * 32], entry->hash);
+  btc_hash_copy(&z->whashes[z->length * 32], entry->whash);
+
+  z->length++;
+}
+
+static void
+btc_mpindex_remove(btc_mpindex_t *z, const btc_mpentry_t *entry) {
+  size_t pos = entry->pos;
+  size_t last = z->length - 1;
+
+  CHECK(pos < z->length && z->entries[pos] == entry);
+
+  /* Swap the last entry into the hole. */
+  if (pos != last) {
+    z->entries[pos] = z->entries[last];
+    z->entries[pos]->pos = pos;
+
+    btc_hash_copy(&z->hashes[pos * 32], &z->hashes[last * 32]);
+    btc_hash_copy(&z->whashes[pos * 32], &z->whashes[last * 32]);
+  }
+
+  z->length--;
+}
+
+static size_t
+btc_mpindex_usage(const btc_mpindex_t *z) {
+  size_t usage = 0;
+
+  usage += btc_malloc_usage(z->alloc * sizeof(btc_mpentry_t *));
+  usage += btc_malloc_usage(z->alloc * 32) * 2;
+
+  return usage;
+}
+
 /*
  * Mempool
  */
 
+/* Heap footprint of a khash table (flags, keys, values). */
+#define btc_map_usage(map)                                              \
+  ((map)->n_buckets == 0 ? 0 :                                          \
+   btc_malloc_usage(((map)->n_buckets < 16 ? 1 : (map)->n_buckets >> 4) \
+                    * sizeof(*(map)->flags))                            \
+   + btc_malloc_usage((map)->n_buckets * sizeof(*(map)->keys))          \
+   + btc_malloc_usage((map)->n_buckets * sizeof(*(map)->vals)))
+
 struct btc_mempool_s {
   const btc_network_t *network;
   btc_logger_t *logger;
   const btc_timedata_t *timedata;
   btc_chain_t *chain;
   size_t size;
+  size_t usage;
+  size_t max_size;
+  int64_t fees;
   btc_hashmap_t map;
-  btc_hashmap_t waiting;
+  btc_hashmap_t wmap;
+  btc_mpindex_t index;
+  btc_outmap_t waiting;
   btc_hashmap_t orphans;
+  btc_hashmap_t worphans;
+  btc_intmap_t peers;
   btc_outmap_t spents;
   btc_filter_t rejects;
   btc_verify_error_t error;
   unsigned int flags;
   char file[BTC_PATH_MAX];
   btc_mempool_tx_cb *on_tx;
+  btc_mempool_remove_cb *on_remove;
+  btc_mempool_remove_cb *on_evict;
+  btc_mempool_remove_cb *on_prioritise;
   btc_mempool_badorphan_cb *on_badorphan;
   void *arg;
 };
@@ -243,10 +426,15 @@ btc_mempool_create(const btc_network_t *network, btc_chain_t *chain) {
   mp->chain = chain;
 
   btc_hashmap_init(&mp->map);
-  btc_hashmap_init(&mp->waiting); /* orphan prevout hashes */
+  btc_hashmap_init(&mp->wmap); /* wtxid->entry */
+  btc_mpindex_init(&mp->index);
+  btc_outmap_init(&mp->waiting); /* missing prevout->orphans */
   btc_hashmap_init(&mp->orphans);
+  btc_hashmap_init(&mp->worphans); /* wtxid->orphan */
+  btc_intmap_init(&mp->peers); /* peer id->orphans */
   btc_outmap_init(&mp->spents); /* mempool entry's outpoints */
 
+  mp->max_size = BTC_MEMPOOL_MAX_SIZE;
   mp->flags = BTC_MEMPOOL_DEFAULT_FLAGS;
   mp->file[0] = '\0';
 
@@ -263,17 +451,22 @@ btc_mempool_destroy(btc_mempool_t *mp) {
   btc_map_each(&mp->map, it)
     btc_mpentry_destroy(mp->map.vals[it]);
 
-  btc_map_each(&mp->waiting, it) {
-    btc_free(mp->waiting.keys[it]);
-    btc_hashset_destroy(mp->waiting.vals[it]);
-  }
+  btc_map_each(&mp->waiting, it)
+    btc_waitlist_destroy(mp->waiting.vals[it]);
 
   btc_map_each(&mp->orphans, it)
     btc_orphan_destroy(mp->orphans.vals[it]);
 
+  btc_map_each(&mp->peers, it)
+    btc_orphanpeer_destroy(mp->peers.vals[it]);
+
   btc_hashmap_clear(&mp->map);
-  btc_hashmap_clear(&mp->waiting);
+  btc_hashmap_clear(&mp->wmap);
+  btc_mpindex_clear(&mp->index);
+  btc_outmap_clear(&mp->waiting);
   btc_hashmap_clear(&mp->orphans);
+  btc_hashmap_clear(&mp->worphans);
+  btc_intmap_clear(&mp->peers);
   btc_outmap_clear(&mp->spents);
   btc_filter_clear(&mp->rejects);
 
@@ -295,6 +488,21 @@ btc_mempool_on_tx(btc_mempool_t *mp, btc_mempool_tx_cb *handler) {
   mp->on_tx = handler;
 }
 
+void
+btc_mempool_on_remove(btc_mempool_t *mp, btc_mempool_remove_cb *handler) {
+  mp->on_remove = handler;
+}
+
+void
+btc_mempool_on_evict(btc_mempool_t *mp, btc_mempool_remove_cb *handler) {
+  mp->on_evict = handler;
+}
+
+void
+btc_mempool_on_prioritise(btc_mempool_t *mp, btc_mempool_remove_cb *handler) {
+  mp->on_prioritise = handler;
+}
+
 void
 btc_mempool_on_badorphan(btc_mempool_t *mp,
                          btc_mempool_badorphan_cb *handler) {
@@ -306,6 +514,11 @@ btc_mempool_set_context(btc_mempool_t *mp, void *arg) {
   mp->arg = arg;
 }
 
+void
+btc_mempool_set_size(btc_mempool_t *mp, size_t size) {
+  mp->max_size = size;
+}
+
 int
 btc_mempool_open(btc_mempool_t *mp, const char *prefix, unsigned int flags) {
   mp->flags = flags;
@@ -363,64 +576,151 @@ btc_mempool_throw(btc_mempool_t *mp,
  * Orphan Handling
  */
 
-static int
-btc_mempool_remove_orphan(btc_mempool_t *mp, const uint8_t *hash) {
-  btc_orphan_t *orphan = btc_hashmap_get(&mp->orphans, hash);
-  const btc_tx_t *tx;
+static void
+btc_mempool_link_orphan(btc_mempool_t *mp,
+                        btc_orphan_t *orphan,
+                        const btc_view_t *view) {
+  const btc_tx_t *tx = orphan->tx;
+  btc_orphanpeer_t *peer;
+  btc_waitlist_t *list;
   size_t i;
 
-  if (orphan == NULL)
-    return 0;
+  for (i = 0; i < tx->inputs.length; i++) {
+    const btc_outpoint_t *prevout = &tx->inputs.items[i]->prevout;
 
-  tx = orphan->tx;
+    if (btc_view_has(view, prevout))
+      continue;
 
-  for (i = 0; i < tx->inputs.length; i++) {
-    const btc_input_t *input = tx->inputs.items[i];
-    const btc_outpoint_t *prevout = &input->prevout;
-    btc_hashset_t *set = btc_hashmap_get(&mp->waiting, prevout->hash);
+    list = btc_outmap_get(&mp->waiting, prevout);
+
+    if (list == NULL) {
+      list = btc_waitlist_create(prevout);
+      btc_outmap_put(&mp->waiting, &list->prevout, list);
+    }
+
+    btc_vector_push(&list->orphans, orphan);
+
+    orphan->missing++;
+  }
+
+  peer = btc_intmap_get(&mp->peers, orphan->id);
 
-    if (set == NULL)
+  if (peer == NULL) {
+    peer = btc_orphanpeer_create(orphan->id);
+    btc_intmap_put(&mp->peers, peer->id, peer);
+  }
+
+  btc_list_push(peer, orphan, btc_orphan_t);
+
+  peer->weight += orphan->weight;
+
+  CHECK(btc_hashmap_put(&mp->orphans, orphan->hash, orphan));
+  CHECK(btc_hashmap_put(&mp->worphans, tx->whash, orphan));
+}
+
+static void
+btc_mempool_unlink_orphan(btc_mempool_t *mp, btc_orphan_t *orphan) {
+  const btc_tx_t *tx = orphan->tx;
+  btc_orphanpeer_t *peer;
+  btc_waitlist_t *list;
+  size_t i;
+
+  /* Resolved orphans have already been
+     dropped from their wait lists. */
+  for (i = 0; i < tx->inputs.length && orphan->missing > 0; i++) {
+    const btc_outpoint_t *prevout = &tx->inputs.items[i]->prevout;
+
+    list = btc_outmap_get(&mp->waiting, prevout);
+
+    if (list == NULL)
       continue;
 
-    btc_hashset_del(set, hash);
+    btc_waitlist_remove(list, orphan);
 
-    if (set->size == 0) {
-      btc_free(btc_hashmap_del(&mp->waiting, prevout->hash));
-      btc_hashset_destroy(set);
+    if (list->orphans.length == 0) {
+      btc_outmap_del(&mp->waiting, prevout);
+      btc_waitlist_destroy(list);
     }
   }
 
-  btc_hashmap_del(&mp->orphans, hash);
+  peer = btc_intmap_get(&mp->peers, orphan->id);
+
+  CHECK(peer != NULL);
+
+  btc_list_remove(peer, orphan, btc_orphan_t);
+
+  peer->weight -= orphan->weight;
+
+  if (peer->length == 0) {
+    btc_intmap_del(&mp->peers, peer->id);
+    btc_orphanpeer_destroy(peer);
+  }
+
+  CHECK(btc_hashmap_del(&mp->orphans, orphan->hash));
+  CHECK(btc_hashmap_del(&mp->worphans, tx->whash));
+}
+
+static int
+btc_mempool_remove_orphan(btc_mempool_t *mp, const uint8_t *hash) {
+  btc_orphan_t *orphan = btc_hashmap_get(&mp->orphans, hash);
+
+  if (orphan == NULL)
+    return 0;
+
+  btc_mempool_unlink_orphan(mp, orphan);
   btc_orphan_destroy(orphan);
 
   return 1;
 }
 
+static void
+btc_mempool_remove_orphan_conflicts(btc_mempool_t *mp, const btc_tx_t *tx) {
+  btc_waitlist_t *list;
+  btc_orphan_t *orphan;
+  size_t i;
+
+  for (i = 0; i < tx->inputs.length; i++) {
+    const btc_outpoint_t *prevout = &tx->inputs.items[i]->prevout;
+
+    while ((list = btc_outmap_get(&mp->waiting, prevout)) != NULL) {
+      orphan = list->orphans.items[0];
+
+      btc_log_debug(mp, "Removing double-spent orphan %H from mempool.",
+                        orphan->hash);
+
+      btc_mempool_unlink_orphan(mp, orphan);
+      btc_orphan_destroy(orphan);
+    }
+  }
+}
+
 static int
 btc_mempool_limit_orphans(btc_mempool_t *mp) {
-  const uint8_t *hash = NULL;
+  btc_orphanpeer_t *peer = NULL;
+  btc_orphan_t *orphan;
   btc_mapiter_t it;
-  size_t index;
 
   if (mp->orphans.size < BTC_MEMPOOL_MAX_ORPHANS)
     return 0;
 
-  index = btc_uniform(mp->orphans.size);
+  /* Evict from whichever peer is using the most
+     orphan space. A peer flooding us with orphans
+     only ever pushes out its own transactions. */
+  btc_map_each(&mp->peers, it) {
+    btc_orphanpeer_t *item = mp->peers.vals[it];
 
-  btc_map_each(&mp->orphans, it) {
-    hash = mp->orphans.keys[it];
-
-    if (index == 0)
-      break;
-
-    index--;
+    if (peer == NULL || item->weight > peer->weight)
+      peer = item;
   }
 
-  CHECK(hash != NULL);
+  CHECK(peer != NULL);
 
-  btc_log_debug(mp, "Removing orphan %H from mempool.", hash);
+  orphan = peer->head;
 
-  btc_mempool_remove_orphan(mp, hash);
+  btc_log_debug(mp, "Removing orphan %H from mempool.", orphan->hash);
+
+  btc_mempool_unlink_orphan(mp, orphan);
+  btc_orphan_destroy(orphan);
 
   return 1;
 }
@@ -492,78 +792,61 @@ btc_mempool_add_orphan(btc_mempool_t *mp,
                        const btc_view_t *view,
                        unsigned int id) {
   btc_orphan_t *orphan = btc_orphan_create();
-  btc_hashset_t hashes;
-  btc_mapiter_t it;
-  size_t i;
-
-  btc_hashset_init(&hashes);
 
   orphan->tx = btc_tx_refconst(tx);
   orphan->hash = orphan->tx->hash;
   orphan->missing = 0;
   orphan->id = id;
+  orphan->weight = btc_tx_weight(tx);
 
   btc_mempool_limit_orphans(mp);
-
-  for (i = 0; i < orphan->tx->inputs.length; i++) {
-    const btc_input_t *input = orphan->tx->inputs.items[i];
-
-    if (!btc_view_has(view, &input->prevout))
-      btc_hashset_put(&hashes, input->prevout.hash);
-  }
-
-  btc_map_each(&hashes, it) {
-    const uint8_t *prev = hashes.keys[it];
-
-    if (!btc_hashmap_has(&mp->waiting, prev))
-      btc_hashmap_put(&mp->waiting, btc_hash_clone(prev), btc_hashset_create());
-
-    btc_hashset_put(btc_hashmap_get(&mp->waiting, prev), orphan->hash);
-
-    orphan->missing++;
-  }
-
-  btc_hashset_clear(&hashes);
-
-  CHECK(btc_hashmap_put(&mp->orphans, orphan->hash, orphan));
+  btc_mempool_link_orphan(mp, orphan, view);
 
   btc_log_debug(mp, "Added orphan %H to mempool.", tx->hash);
 }
 
 static btc_vector_t *
-btc_mempool_resolve_orphans(btc_mempool_t *mp, const uint8_t *parent) {
-  btc_hashset_t *set = btc_hashmap_get(&mp->waiting, parent);
-  btc_vector_t *resolved;
-  btc_mapiter_t it;
+btc_mempool_resolve_orphans(btc_mempool_t *mp, const btc_tx_t *parent) {
+  btc_vector_t *resolved = NULL;
+  btc_outpoint_t prevout;
+  btc_waitlist_t *list;
+  size_t i, j;
 
-  if (set == NULL)
-    return NULL;
+  for (i = 0; i < parent->outputs.length; i++) {
+    btc_outpoint_set(&prevout, parent->hash, i);
 
-  CHECK(set->size > 0);
+    list = btc_outmap_get(&mp->waiting, &prevout);
+
+    if (list == NULL)
+      continue;
 
-  resolved = btc_vector_create();
+    CHECK(list->orphans.length > 0);
 
-  btc_map_each(set, it) {
-    const uint8_t *hash = set->keys[it];
-    btc_orphan_t *orphan = btc_hashmap_get(&mp->orphans, hash);
+    for (j = 0; j < list->orphans.length; j++) {
+      btc_orphan_t *orphan = list->orphans.items[j];
 
-    CHECK(orphan != NULL);
+      if (--orphan->missing == 0) {
+        if (resolved == NULL)
+          resolved = btc_vector_create();
 
-    if (--orphan->missing == 0) {
-      btc_hashmap_del(&mp->orphans, hash);
-      btc_vector_push(resolved, orphan);
+        btc_vector_push(resolved, orphan);
+      }
     }
-  }
 
-  btc_free(btc_hashmap_del(&mp->waiting, parent));
+    btc_outmap_del(&mp->waiting, &prevout);
+    btc_waitlist_destroy(list);
+  }
 
-  btc_hashset_destroy(set);
+  if (resolved != NULL) {
+    for (i = 0; i < resolved->length; i++)
+      btc_mempool_unlink_orphan(mp, resolved->items[i]);
+  }
 
   return resolved;
 }
 
 static void
-btc_mempool_handle_orphans(btc_mempool_t *mp, const uint8_t *parent) {
+btc_mempool_handle_orphans(btc_mempool_t *mp, const btc_tx_t *parent) {
   btc_vector_t *resolved = btc_mempool_resolve_orphans(mp, parent);
   uint8_t hash[32];
   size_t i;
@@ -653,12 +936,12 @@ remove_fee(btc_mpentry_t *parent, const btc_mpentry_t *child) {
   parent->desc_size -= child->desc_size;
 }
 
-BTC_UNUSED static void
+static void
 preprioritise(btc_mpentry_t *parent, const btc_mpentry_t *child) {
   parent->desc_fee -= child->delta_fee;
 }
 
-BTC_UNUSED static void
+static void
 postprioritise(btc_mpentry_t *parent, const btc_mpentry_t *child) {
   parent->desc_fee += child->delta_fee;
 }
@@ -753,6 +1036,9 @@ btc_mempool_track_entry(btc_mempool_t *mp, btc_mpentry_t *entry) {
 
   CHECK(!btc_tx_is_coinbase(tx));
   CHECK(btc_hashmap_put(&mp->map, entry->hash, entry));
+  CHECK(btc_hashmap_put(&mp->wmap, entry->whash, entry));
+
+  btc_mpindex_push(&mp->index, entry);
 
   for (i = 0; i < tx->inputs.length; i++) {
     const btc_input_t *input = tx->inputs.items[i];
@@ -761,6 +1047,8 @@ btc_mempool_track_entry(btc_mempool_t *mp, btc_mpentry_t *entry) {
   }
 
   mp->size += entry->size;
+  mp->usage += btc_mpentry_usage(entry);
+  mp->fees += entry->fee;
 }
 
 static void
@@ -776,7 +1064,7 @@ btc_mempool_add_entry(btc_mempool_t *mp,
   btc_log_debug(mp, "Added %H to mempool (txs=%zu).",
                     entry->hash, (size_t)mp->map.size);
 
-  btc_mempool_handle_orphans(mp, entry->hash);
+  btc_mempool_handle_orphans(mp, entry->tx);
 }
 
 static void
@@ -787,6 +1075,9 @@ btc_mempool_untrack_entry(btc_mempool_t *mp,
 
   CHECK(!btc_tx_is_coinbase(tx));
   CHECK(btc_hashmap_del(&mp->map, entry->hash));
+  CHECK(btc_hashmap_del(&mp->wmap, entry->whash));
+
+  btc_mpindex_remove(&mp->index, entry);
 
   for (i = 0; i < tx->inputs.length; i++) {
     const btc_input_t *input = tx->inputs.items[i];
@@ -795,14 +1086,29 @@ btc_mempool_untrack_entry(btc_mempool_t *mp,
   }
 
   mp->size -= entry->size;
+  mp->usage -= btc_mpentry_usage(entry);
+  mp->fees -= entry->fee;
 }
 
 static void
 btc_mempool_remove_entry(btc_mempool_t *mp, btc_mpentry_t *entry) {
   btc_mempool_untrack_entry(mp, entry);
+
+  if (mp->on_remove != NULL)
+    mp->on_remove(entry, mp->arg);
+
   btc_mpentry_destroy(entry);
 }
 
+static void
+btc_mempool_discard_entry(btc_mempool_t *mp, btc_mpentry_t *entry) {
+  /* Removed without being mined. */
+  if (mp->on_evict != NULL)
+    mp->on_evict(entry, mp->arg);
+
+  btc_mempool_remove_entry(mp, entry);
+}
+
 static void
 btc_mempool_remove_spenders(btc_mempool_t *mp,
                             const btc_mpentry_t *entry) {
@@ -819,7 +1125,7 @@ btc_mempool_remove_spenders(btc_mempool_t *mp,
       continue;
 
     btc_mempool_remove_spenders(mp, spender);
-    btc_mempool_remove_entry(mp, spender);
+    btc_mempool_discard_entry(mp, spender);
   }
 }
 
@@ -827,7 +1133,7 @@ static void
 btc_mempool_evict_entry(btc_mempool_t *mp, btc_mpentry_t *entry) {
   btc_mempool_remove_spenders(mp, entry);
   btc_mempool_update_ancestors(mp, entry, remove_fee);
-  btc_mempool_remove_entry(mp, entry);
+  btc_mempool_discard_entry(mp, entry);
 }
 
 static void
@@ -903,11 +1209,12 @@ cmp_rate(const void *ap, const void *bp) {
 
 static int
 btc_mempool_limit_size(btc_mempool_t *mp, const uint8_t *added) {
+  size_t threshold = mp->max_size - mp->max_size / 10;
   btc_vector_t queue;
   btc_mapiter_t it;
   int64_t now;
 
-  if (mp->size <= BTC_MEMPOOL_MAX_SIZE)
+  if (btc_mempool_usage(mp) <= mp->max_size)
     return 0;
 
   now = btc_now();
@@ -932,7 +1239,7 @@ btc_mempool_limit_size(btc_mempool_t *mp, const uint8_t *added) {
     btc_heap_insert(&queue, entry, cmp_rate);
   }
 
-  while (queue.length > 0 && mp->size > BTC_MEMPOOL_THRESHOLD) {
+  while (queue.length > 0 && btc_mempool_usage(mp) > threshold) {
     btc_mpentry_t *entry = btc_heap_shift(&queue, cmp_rate);
 
     btc_log_debug(mp, "Removing package %H from mempool (low fee).",
@@ -1248,6 +1555,10 @@ btc_mempool_insert(btc_mempool_t *mp, const btc_tx_t *tx, unsigned int id) {
     return 0;
   }
 
+  /* Drop the object tree in favor of a single allocation. */
+  if (mp->flags & BTC_MEMPOOL_COMPACT)
+    btc_mpentry_compact(entry);
+
   /* Add and index the entry. */
   btc_mempool_add_entry(mp, entry, view);
   btc_view_destroy(view);
@@ -1269,12 +1580,18 @@ btc_mempool_add(btc_mempool_t *mp, const btc_tx_t *tx, unsigned int id) {
   if (!btc_mempool_insert(mp, tx, id)) {
     const btc_verify_error_t *err = &mp->error;
 
-    if (strstr(err->reason, "script-verify-flag") != NULL) {
-      if (!btc_tx_has_witness(tx) && !err->malleated)
-        btc_filter_add(&mp->rejects, tx->hash, 32);
-    } else {
-      if (!err->malleated)
+    /* Wtxid relay peers look the filter up by wtxid,
+       legacy peers by txid. A script failure may be
+       down to a bad witness alone, in which case some
+       other witness for the same txid could be valid
+       (bip339); only the wtxid is cached for those. */
+    if (!err->malleated) {
+      btc_filter_add(&mp->rejects, tx->whash, 32);
+
+      if (btc_tx_has_witness(tx)
+          && strstr(err->reason, "script-verify-flag") == NULL) {
         btc_filter_add(&mp->rejects, tx->hash, 32);
+      }
     }
 
     return 0;
@@ -1307,8 +1624,9 @@ btc_mempool_add_block(btc_mempool_t *mp,
 
     if (ent == NULL) {
       btc_mempool_remove_orphan(mp, tx->hash);
+      btc_mempool_remove_orphan_conflicts(mp, tx);
       btc_mempool_remove_double_spends(mp, tx);
-      btc_mempool_handle_orphans(mp, tx->hash);
+      btc_mempool_handle_orphans(mp, tx);
       continue;
     }
 
@@ -1425,6 +1743,30 @@ btc_mempool_size(btc_mempool_t *mp) {
   return mp->map.size;
 }
 
+int64_t
+btc_mempool_fees(btc_mempool_t *mp) {
+  return mp->fees;
+}
+
+size_t
+btc_mempool_bytes(btc_mempool_t *mp) {
+  return mp->size;
+}
+
+size_t
+btc_mempool_usage(btc_mempool_t *mp) {
+  /* Entries, plus the tables indexing them. */
+  return mp->usage + btc_map_usage(&mp->map)
+                   + btc_map_usage(&mp->wmap)
+                   + btc_map_usage(&mp->spents)
+                   + btc_mpindex_usage(&mp->index);
+}
+
+size_t
+btc_mempool_max_size(btc_mempool_t *mp) {
+  return mp->max_size;
+}
+
 int
 btc_mempool_has(btc_mempool_t *mp, const uint8_t *hash) {
   return btc_hashmap_has(&mp->map, hash);
@@ -1435,6 +1777,21 @@ btc_mempool_get(btc_mempool_t *mp, const uint8_t *hash) {
   return btc_hashmap_get(&mp->map, hash);
 }
 
+int
+btc_mempool_has_wtxid(btc_mempool_t *mp, const uint8_t *hash) {
+  return btc_hashmap_has(&mp->wmap, hash);
+}
+
+const btc_mpentry_t *
+btc_mempool_get_wtxid(btc_mempool_t *mp, const uint8_t *hash) {
+  return btc_hashmap_get(&mp->wmap, hash);
+}
+
+const btc_mpentry_t *
+btc_mempool_spender(btc_mempool_t *mp, const btc_outpoint_t *prevout) {
+  return btc_outmap_get(&mp->spents, prevout);
+}
+
 btc_coin_t *
 btc_mempool_coin(btc_mempool_t *mp, const uint8_t *hash, size_t index) {
   const btc_mpentry_t *entry = btc_mempool_get(mp, hash);
@@ -1457,6 +1814,60 @@ btc_mempool_has_orphan(btc_mempool_t *mp, const uint8_t *hash) {
   return btc_hashmap_has(&mp->orphans, hash);
 }
 
+int
+btc_mempool_has_orphan_wtxid(btc_mempool_t *mp, const uint8_t *hash) {
+  return btc_hashmap_has(&mp->worphans, hash);
+}
+
+void
+btc_mempool_drop_orphans(btc_mempool_t *mp, unsigned int id) {
+  btc_orphanpeer_t *peer = btc_intmap_get(&mp->peers, id);
+  size_t count = 0;
+
+  if (peer == NULL)
+    return;
+
+  /* The peer is freed along with its last orphan. */
+  while (btc_intmap_has(&mp->peers, id)) {
+    btc_orphan_t *orphan = peer->head;
+
+    btc_mempool_unlink_orphan(mp, orphan);
+    btc_orphan_destroy(orphan);
+
+    count++;
+  }
+
+  btc_log_debug(mp, "Removed %zu orphans from peer %u.", count, id);
+}
+
+int
+btc_mempool_prioritise(btc_mempool_t *mp, const uint8_t *hash, int64_t fee) {
+  btc_mpentry_t *entry = btc_hashmap_get(&mp->map, hash);
+
+  if (entry == NULL)
+    return 0;
+
+  if (-fee > entry->delta_fee)
+    fee = -entry->delta_fee;
+
+  if (fee == 0)
+    return 1;
+
+  btc_mempool_update_ancestors(mp, entry, preprioritise);
+
+  entry->delta_fee += fee;
+  entry->desc_fee += fee;
+
+  btc_mempool_update_ancestors(mp, entry, postprioritise);
+
+  if (mp->on_prioritise != NULL)
+    mp->on_prioritise(entry, mp->arg);
+
+  btc_log_debug(mp, "Prioritised %H by %v.", entry->hash, fee);
+
+  return 1;
+}
+
 int
 btc_mempool_has_reject(btc_mempool_t *mp, const uint8_t *hash) {
   return btc_filter_has(&mp->rejects, hash, 32);
@@ -1470,7 +1881,7 @@ btc_mempool_missing(btc_mempool_t *mp, const btc_tx_t *tx) {
   for (i = 0; i < tx->inputs.length; i++) {
     const btc_input_t *input = tx->inputs.items[i];
 
-    if (!btc_hashmap_has(&mp->waiting, input->prevout.hash))
+    if (!btc_outmap_has(&mp->waiting, &input->prevout))
       continue;
 
     if (btc_hashmap_has(&mp->orphans, input->prevout.hash))
@@ -1486,3 +1897,8 @@ const btc_hashmap_t *
 btc_mempool_map(const btc_mempool_t *mp) {
   return &mp->map;
 }
+
+const btc_mpindex_t *
+btc_mempool_index(const btc_mempool_t *mp) {
+  return &mp->index;
+}
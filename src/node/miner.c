@@ -94,6 +94,11 @@ struct btc_miner_s {
   unsigned int flags;
   btc_buffer_t cbflags;
   btc_vector_t addrs;
+  btc_hashmap_t candidates;
+  btc_vector_t ready;
+  unsigned int stamp;
+  btc_tmpl_t *last;
+  int dirty;
   btc_cpuminer_t cpu;
 };
 
@@ -120,9 +125,10 @@ btc_blockentry_clear(btc_blockentry_t *entry) {
 
 static void
 btc_blockentry_copy(btc_blockentry_t *z, const btc_blockentry_t *x) {
-  (void)z;
-  (void)x;
-  btc_abort(); /* LCOV_EXCL_LINE */
+  *z = *x;
+  z->tx = btc_tx_ref(x->tx);
+  z->hash = z->tx->hash;
+  z->whash = z->tx->whash;
 }
 
 static void
@@ -169,6 +175,192 @@ btc_blockentry_set_mpentry(btc_blockentry_t *z, const btc_mpentry_t *x) {
   z->dep_count = 0;
 }
 
+/*
+ * Template Candidate
+ */
+
+/* Candidates without in-mempool parents are kept in
+ * a heap ordered by feerate. Its order is maintained
+ * as transactions come and go (and as their package
+ * rates change), so selection starts from a copy of
+ * it rather than sorting the whole mempool again.
+ */
+
+#define BTC_CANDIDATE_NONE ((size_t)-1)
+
+typedef struct btc_candidate_s {
+  const btc_mpentry_t *entry;
+  btc_vector_t children;
+  int parents;
+  int dep_count;
+  unsigned int stamp;
+  size_t pos;
+  int64_t rate;
+  int64_t desc_rate;
+} btc_candidate_t;
+
+DEFINE_OBJECT(btc_candidate, SCOPE_STATIC)
+
+static void
+btc_candidate_init(btc_candidate_t *cand) {
+  cand->entry = NULL;
+  btc_vector_init(&cand->children);
+  cand->parents = 0;
+  cand->dep_count = 0;
+  cand->stamp = 0;
+  cand->pos = BTC_CANDIDATE_NONE;
+  cand->rate = 0;
+  cand->desc_rate = 0;
+}
+
+static void
+btc_candidate_clear(btc_candidate_t *cand) {
+  btc_vector_clear(&cand->children);
+}
+
+static void
+btc_candidate_copy(btc_candidate_t *z, const btc_candidate_t *x) {
+  (void)z;
+  (void)x;
+  btc_abort(); /* LCOV_EXCL_LINE */
+}
+
+static void
+btc_candidate_unlink(btc_candidate_t *parent, const btc_candidate_t *child) {
+  btc_vector_t *children = &parent->children;
+  size_t i;
+
+  for (i = 0; i < children->length; i++) {
+    if (children->items[i] == child) {
+      children->items[i] = children->items[children->length - 1];
+      children->length--;
+      return;
+    }
+  }
+}
+
+static void
+btc_candidate_update(btc_candidate_t *cand) {
+  const btc_mpentry_t *entry = cand->entry;
+
+  cand->rate = btc_get_rate(entry->delta_fee, entry->size);
+  cand->desc_rate = btc_get_rate(entry->desc_fee, entry->desc_size);
+}
+
+static int
+cmp_rate(const void *ap, const void *bp) {
+  const btc_candidate_t *a = ap;
+  const btc_candidate_t *b = bp;
+
+  int64_t x = a->rate;
+  int64_t y = b->rate;
+
+  if (a->desc_rate > a->rate)
+    x = a->desc_rate;
+
+  if (b->desc_rate > b->rate)
+    y = b->desc_rate;
+
+  return BTC_CMP(y, x);
+}
+
+/*
+ * Ready Queue
+ */
+
+static void
+btc_ready_swap(btc_vector_t *z, size_t i, size_t j) {
+  btc_candidate_t *x = z->items[i];
+  btc_candidate_t *y = z->items[j];
+
+  z->items[i] = y;
+  z->items[j] = x;
+
+  y->pos = i;
+  x->pos = j;
+}
+
+static void
+btc_ready_up(btc_vector_t *z, size_t i) {
+  while (i > 0) {
+    size_t j = (i - 1) / 2;
+
+    if (cmp_rate(z->items[i], z->items[j]) >= 0)
+      break;
+
+    btc_ready_swap(z, i, j);
+
+    i = j;
+  }
+}
+
+static int
+btc_ready_down(btc_vector_t *z, size_t i) {
+  size_t i0 = i;
+  size_t l, r, j;
+
+  for (;;) {
+    l = 2 * i + 1;
+
+    if (l >= z->length)
+      break;
+
+    j = l;
+    r = l + 1;
+
+    if (r < z->length && cmp_rate(z->items[r], z->items[l]) < 0)
+      j = r;
+
+    if (cmp_rate(z->items[j], z->items[i]) >= 0)
+      break;
+
+    btc_ready_swap(z, i, j);
+
+    i = j;
+  }
+
+  return i > i0;
+}
+
+static void
+btc_ready_insert(btc_vector_t *z, btc_candidate_t *cand) {
+  CHECK(cand->pos == BTC_CANDIDATE_NONE);
+
+  cand->pos = z->length;
+
+  btc_vector_push(z, cand);
+  btc_ready_up(z, cand->pos);
+}
+
+static void
+btc_ready_remove(btc_vector_t *z, btc_candidate_t *cand) {
+  size_t i = cand->pos;
+  size_t last = z->length - 1;
+
+  CHECK(i < z->length && z->items[i] == cand);
+
+  if (i != last)
+    btc_ready_swap(z, i, last);
+
+  btc_vector_pop(z);
+
+  cand->pos = BTC_CANDIDATE_NONE;
+
+  if (i != last) {
+    if (!btc_ready_down(z, i))
+      btc_ready_up(z, i);
+  }
+}
+
+static void
+btc_ready_fix(btc_vector_t *z, btc_candidate_t *cand) {
+  if (cand->pos == BTC_CANDIDATE_NONE)
+    return;
+
+  if (!btc_ready_down(z, cand->pos))
+    btc_ready_up(z, cand->pos);
+}
+
 /*
  * Merkle Steps
  */
@@ -331,6 +523,26 @@ btc_tmpl_witness_hash(uint8_t *hash, const btc_tmpl_t *bt) {
   btc_hash256_root(hash, root, zero_nonce);
 }
 
+static void
+btc_tmpl_inherit(btc_tmpl_t *z, const btc_tmpl_t *x) {
+  size_t i;
+
+  CHECK(z->txs.length == 0);
+
+  z->weight = x->weight;
+  z->sigops = x->sigops;
+  z->fees = x->fees;
+
+  btc_hash_copy(z->commitment, x->commitment);
+
+  z->steps = x->steps;
+
+  btc_vector_grow(&z->txs, x->txs.length);
+
+  for (i = 0; i < x->txs.length; i++)
+    btc_vector_push(&z->txs, btc_blockentry_clone(x->txs.items[i]));
+}
+
 void
 btc_tmpl_refresh(btc_tmpl_t *bt) {
   btc_tmpl_witness_hash(bt->commitment, bt);
@@ -1001,6 +1213,13 @@ btc_miner_create(const btc_network_t *network,
 
   btc_buffer_init(&miner->cbflags);
   btc_vector_init(&miner->addrs);
+  btc_hashmap_init(&miner->candidates);
+  btc_vector_init(&miner->ready);
+
+  miner->stamp = 0;
+  miner->last = NULL;
+  miner->dirty = 1;
+
   btc_cpuminer_init(&miner->cpu, miner, btc_sys_numcpu());
 
   btc_buffer_set(&miner->cbflags, default_flags, sizeof(default_flags) - 1);
@@ -1010,12 +1229,21 @@ btc_miner_create(const btc_network_t *network,
 
 void
 btc_miner_destroy(btc_miner_t *miner) {
+  btc_mapiter_t it;
   size_t i;
 
   for (i = 0; i < miner->addrs.length; i++)
     btc_address_destroy(miner->addrs.items[i]);
 
+  btc_map_each(&miner->candidates, it)
+    btc_candidate_destroy(miner->candidates.vals[it]);
+
+  if (miner->last != NULL)
+    btc_tmpl_destroy(miner->last);
+
   btc_vector_clear(&miner->addrs);
+  btc_hashmap_clear(&miner->candidates);
+  btc_vector_clear(&miner->ready);
   btc_buffer_clear(&miner->cbflags);
   btc_cpuminer_clear(&miner->cpu);
 
@@ -1038,6 +1266,15 @@ btc_miner_open(btc_miner_t *miner, unsigned int flags) {
 
   miner->flags = flags;
 
+  /* Pick up anything which was added before we were. */
+  if (miner->mempool != NULL) {
+    const btc_hashmap_t *map = btc_mempool_map(miner->mempool);
+    btc_mapiter_t it;
+
+    btc_map_each(map, it)
+      btc_miner_add_tx(miner, map->vals[it]);
+  }
+
   return 1;
 }
 
@@ -1089,79 +1326,196 @@ btc_miner_update_time(btc_miner_t *miner, btc_tmpl_t *bt) {
   bt->time = now;
 }
 
-static int
-cmp_rate(const void *ap, const void *bp) {
-  const btc_blockentry_t *a = ap;
-  const btc_blockentry_t *b = bp;
+static void
+btc_miner_refresh(btc_miner_t *miner,
+                  const btc_tx_t *tx,
+                  btc_hashset_t *seen) {
+  size_t i;
 
-  int64_t x = a->rate;
-  int64_t y = b->rate;
+  for (i = 0; i < tx->inputs.length; i++) {
+    const btc_input_t *input = tx->inputs.items[i];
+    btc_candidate_t *parent;
 
-  if (a->desc_rate > a->rate)
-    x = a->desc_rate;
+    parent = btc_hashmap_get(&miner->candidates, input->prevout.hash);
 
-  if (b->desc_rate > b->rate)
-    y = b->desc_rate;
+    if (parent == NULL || btc_hashset_has(seen, parent->entry->hash))
+      continue;
 
-  return BTC_CMP(y, x);
+    btc_hashset_put(seen, parent->entry->hash);
+
+    btc_candidate_update(parent);
+    btc_ready_fix(&miner->ready, parent);
+
+    btc_miner_refresh(miner, parent->entry->tx, seen);
+  }
 }
 
 static void
-btc_miner_assemble(btc_miner_t *miner, btc_tmpl_t *bt) {
-  const btc_hashmap_t *map = btc_mempool_map(miner->mempool);
-  int64_t locktime = btc_tmpl_locktime(bt);
-  btc_hashmap_t depmap;
-  btc_vector_t queue;
-  btc_mapiter_t it;
+btc_miner_update_ancestors(btc_miner_t *miner, const btc_tx_t *tx) {
+  /* The mempool has just changed the descendant
+     fees of these; move them to their new spot. */
+  btc_hashset_t seen;
+
+  btc_hashset_init(&seen);
+
+  btc_miner_refresh(miner, tx, &seen);
+
+  btc_hashset_clear(&seen);
+}
+
+void
+btc_miner_add_tx(btc_miner_t *miner, const btc_mpentry_t *entry) {
+  const btc_tx_t *tx = entry->tx;
+  btc_candidate_t *cand, *other;
+  btc_outpoint_t prevout;
   size_t i;
 
-  btc_hashmap_init(&depmap);
-  btc_vector_init(&queue);
+  if (btc_hashmap_has(&miner->candidates, entry->hash))
+    return;
 
-  btc_map_each(map, it) {
-    const btc_mpentry_t *entry = map->vals[it];
-    btc_blockentry_t *item = btc_blockentry_create();
+  cand = btc_candidate_create();
+  cand->entry = entry;
 
-    btc_blockentry_set_mpentry(item, entry);
+  btc_candidate_update(cand);
 
-    for (i = 0; i < item->tx->inputs.length; i++) {
-      const btc_input_t *input = item->tx->inputs.items[i];
-      const uint8_t *hash = input->prevout.hash;
+  /* Link to our in-mempool parents. */
+  for (i = 0; i < tx->inputs.length; i++) {
+    const btc_input_t *input = tx->inputs.items[i];
 
-      if (!btc_mempool_has(miner->mempool, hash))
-        continue;
+    other = btc_hashmap_get(&miner->candidates, input->prevout.hash);
 
-      item->dep_count += 1;
+    if (other == NULL)
+      continue;
 
-      if (!btc_hashmap_has(&depmap, hash))
-        btc_hashmap_put(&depmap, hash, btc_vector_create());
+    btc_vector_push(&other->children, cand);
 
-      btc_vector_push(btc_hashmap_get(&depmap, hash), item);
-    }
+    cand->parents++;
+  }
+
+  /* Children may already be present if the
+     transaction was re-added on a disconnect. */
+  for (i = 0; i < tx->outputs.length; i++) {
+    const btc_mpentry_t *spender;
+
+    btc_outpoint_set(&prevout, entry->hash, i);
+
+    spender = btc_mempool_spender(miner->mempool, &prevout);
+
+    if (spender == NULL)
+      continue;
+
+    other = btc_hashmap_get(&miner->candidates, spender->hash);
 
-    if (item->dep_count > 0)
+    if (other == NULL)
       continue;
 
-    btc_heap_insert(&queue, item, cmp_rate);
+    btc_vector_push(&cand->children, other);
+
+    if (other->parents++ == 0)
+      btc_ready_remove(&miner->ready, other);
   }
 
+  CHECK(btc_hashmap_put(&miner->candidates, entry->hash, cand));
+
+  if (cand->parents == 0)
+    btc_ready_insert(&miner->ready, cand);
+
+  btc_miner_update_ancestors(miner, tx);
+
+  miner->dirty = 1;
+}
+
+void
+btc_miner_remove_tx(btc_miner_t *miner, const btc_mpentry_t *entry) {
+  btc_candidate_t *cand = btc_hashmap_get(&miner->candidates, entry->hash);
+  const btc_tx_t *tx = entry->tx;
+  size_t i;
+
+  if (cand == NULL)
+    return;
+
+  if (cand->pos != BTC_CANDIDATE_NONE)
+    btc_ready_remove(&miner->ready, cand);
+
+  for (i = 0; i < cand->children.length; i++) {
+    btc_candidate_t *child = cand->children.items[i];
+
+    if (--child->parents == 0)
+      btc_ready_insert(&miner->ready, child);
+  }
+
+  for (i = 0; i < tx->inputs.length; i++) {
+    const btc_input_t *input = tx->inputs.items[i];
+    btc_candidate_t *parent;
+
+    parent = btc_hashmap_get(&miner->candidates, input->prevout.hash);
+
+    if (parent != NULL)
+      btc_candidate_unlink(parent, cand);
+  }
+
+  btc_hashmap_del(&miner->candidates, entry->hash);
+
+  btc_miner_update_ancestors(miner, tx);
+
+  btc_candidate_destroy(cand);
+
+  miner->dirty = 1;
+}
+
+void
+btc_miner_update_tx(btc_miner_t *miner, const btc_mpentry_t *entry) {
+  btc_candidate_t *cand = btc_hashmap_get(&miner->candidates, entry->hash);
+
+  if (cand == NULL)
+    return;
+
+  btc_candidate_update(cand);
+  btc_ready_fix(&miner->ready, cand);
+
+  btc_miner_update_ancestors(miner, entry->tx);
+
+  miner->dirty = 1;
+}
+
+static void
+btc_miner_select(btc_miner_t *miner, btc_tmpl_t *bt) {
+  int64_t locktime = btc_tmpl_locktime(bt);
+  btc_vector_t queue;
+  size_t i;
+
+  unsigned int stamp = ++miner->stamp;
+
+  /* Already a heap. */
+  btc_vector_init(&queue);
+  btc_vector_copy(&queue, &miner->ready);
+
   while (queue.length > 0) {
-    const btc_blockentry_t *item = btc_heap_shift(&queue, cmp_rate);
-    btc_vector_t *deps;
+    const btc_candidate_t *cand = btc_heap_shift(&queue, cmp_rate);
+    const btc_tx_t *tx = cand->entry->tx;
+    btc_blockentry_t *item;
 
-    if (!btc_tx_is_final(item->tx, bt->height, locktime))
+    if (!btc_tx_is_final(tx, bt->height, locktime))
       continue;
 
     if (!(bt->flags & BTC_SCRIPT_VERIFY_WITNESS)) {
-      if (btc_tx_has_witness(item->tx))
+      if (btc_tx_has_witness(tx))
         continue;
     }
 
-    if (bt->weight + item->weight > BTC_MAX_POLICY_BLOCK_WEIGHT)
+    item = btc_blockentry_create();
+
+    btc_blockentry_set_mpentry(item, cand->entry);
+
+    if (bt->weight + item->weight > BTC_MAX_POLICY_BLOCK_WEIGHT) {
+      btc_blockentry_destroy(item);
       continue;
+    }
 
-    if (bt->sigops + item->sigops > BTC_MAX_BLOCK_SIGOPS_COST)
+    if (bt->sigops + item->sigops > BTC_MAX_BLOCK_SIGOPS_COST) {
+      btc_blockentry_destroy(item);
       continue;
+    }
 
     bt->weight += item->weight;
     bt->sigops += item->sigops;
@@ -1169,26 +1523,69 @@ btc_miner_assemble(btc_miner_t *miner, btc_tmpl_t *bt) {
 
     btc_vector_push(&bt->txs, item);
 
-    deps = btc_hashmap_get(&depmap, item->hash);
+    for (i = 0; i < cand->children.length; i++) {
+      btc_candidate_t *child = cand->children.items[i];
 
-    if (deps == NULL)
-      continue;
-
-    for (i = 0; i < deps->length; i++) {
-      btc_blockentry_t *child = deps->items[i];
+      if (child->stamp != stamp) {
+        child->stamp = stamp;
+        child->dep_count = child->parents;
+      }
 
       if (--child->dep_count == 0)
         btc_heap_insert(&queue, child, cmp_rate);
     }
   }
 
+  btc_vector_clear(&queue);
+}
+
+static int
+btc_miner_fresh(btc_miner_t *miner, const btc_tmpl_t *bt) {
+  const btc_tmpl_t *last = miner->last;
+
+  if (last == NULL || miner->dirty)
+    return 0;
+
+  if (!btc_hash_equal(last->prev_block, bt->prev_block))
+    return 0;
+
+  if (last->flags != bt->flags)
+    return 0;
+
+  return btc_tmpl_locktime(last) == btc_tmpl_locktime(bt);
+}
+
+static void
+btc_miner_assemble(btc_miner_t *miner, btc_tmpl_t *bt) {
+  btc_tmpl_t *last;
+
+  /* The transaction set (and therefore the merkle
+     steps and witness commitment) only changes when
+     the mempool or the tip does. Reuse it otherwise. */
+  if (btc_miner_fresh(miner, bt)) {
+    btc_tmpl_inherit(bt, miner->last);
+    return;
+  }
+
+  btc_miner_select(miner, bt);
   btc_tmpl_refresh(bt);
 
-  btc_map_each(&depmap, it)
-    btc_vector_destroy(depmap.vals[it]);
+  if (miner->last != NULL)
+    btc_tmpl_destroy(miner->last);
 
-  btc_hashmap_clear(&depmap);
-  btc_vector_clear(&queue);
+  last = btc_tmpl_create();
+
+  btc_hash_copy(last->prev_block, bt->prev_block);
+
+  last->time = bt->time;
+  last->height = bt->height;
+  last->mtp = bt->mtp;
+  last->flags = bt->flags;
+
+  btc_tmpl_inherit(last, bt);
+
+  miner->last = last;
+  miner->dirty = 0;
 }
 
 btc_tmpl_t *
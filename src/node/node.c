@@ -70,6 +70,15 @@ on_bad_block_orphan(const btc_verify_error_t *err, unsigned int id, void *arg);
 static void
 on_tx(const btc_mpentry_t *entry, const btc_view_t *view, void *arg);
 
+static void
+on_remove_tx(const btc_mpentry_t *entry, void *arg);
+
+static void
+on_evict_tx(const btc_mpentry_t *entry, void *arg);
+
+static void
+on_prioritise_tx(const btc_mpentry_t *entry, void *arg);
+
 static void
 on_bad_tx_orphan(const btc_verify_error_t *err, unsigned int id, void *arg);
 
@@ -174,6 +183,9 @@ btc_node_create(const btc_network_t *network) {
 
   btc_mempool_set_context(node->mempool, node);
   btc_mempool_on_tx(node->mempool, on_tx);
+  btc_mempool_on_remove(node->mempool, on_remove_tx);
+  btc_mempool_on_evict(node->mempool, on_evict_tx);
+  btc_mempool_on_prioritise(node->mempool, on_prioritise_tx);
   btc_mempool_on_badorphan(node->mempool, on_bad_tx_orphan);
 
   return node;
@@ -314,6 +326,7 @@ on_connect(const btc_entry_t *entry,
 
   btc_mempool_add_block(node->mempool, entry, block);
   btc_wallet_add_block(node->wallet, entry, block);
+  btc_rpc_notify(node->rpc);
 }
 
 static void
@@ -360,8 +373,31 @@ on_tx(const btc_mpentry_t *entry, const btc_view_t *view, void *arg) {
 
   (void)view;
 
+  btc_miner_add_tx(node->miner, entry);
   btc_pool_announce_tx(node->pool, entry);
   btc_wallet_add_tx(node->wallet, entry->tx);
+  btc_rpc_notify(node->rpc);
+}
+
+static void
+on_remove_tx(const btc_mpentry_t *entry, void *arg) {
+  btc_node_t *node = (btc_node_t *)arg;
+
+  btc_miner_remove_tx(node->miner, entry);
+}
+
+static void
+on_evict_tx(const btc_mpentry_t *entry, void *arg) {
+  btc_node_t *node = (btc_node_t *)arg;
+
+  btc_pool_add_extra_tx(node->pool, entry->tx);
+}
+
+static void
+on_prioritise_tx(const btc_mpentry_t *entry, void *arg) {
+  btc_node_t *node = (btc_node_t *)arg;
+
+  btc_miner_update_tx(node->miner, entry);
 }
 
 static void
@@ -18,8 +18,10 @@
 #include <node/pool.h>
 #include <base/timedata.h>
 
+#include <mako/array.h>
 #include <mako/bip37.h>
 #include <mako/bip152.h>
+#include <mako/bip330.h>
 #include <mako/block.h>
 #include <mako/bloom.h>
 #include <mako/coins.h>
@@ -56,29 +58,108 @@ enum btc_peer_state {
   BTC_PEER_DEAD
 };
 
+/* Messages up to this size are framed on the stack. */
+#define BTC_PEER_SMALL 1024
+
+/* Framed messages shared between peers (must be a power of 2). */
+#define BTC_MSGCACHE_SLOTS 64
+#define BTC_MSGCACHE_BYTES (32 << 20)
+
+/* Decoded bytes an I/O thread may queue up for the
+   pool before it stops reading from that socket. */
+#define BTC_CONN_BACKLOG (8 << 20)
+
+/* Maximum number of I/O threads. */
+#define BTC_SHARD_MAX 16
+
+/* Transaction reconciliation (bip330). We initiate a
+   round with each outbound peer every few seconds and
+   keep flooding to a single outbound peer, so that new
+   transactions still make quick progress through the
+   network. Anything which doesn't fit in a set, or
+   collides on a short ID, is flooded as well. */
+#define BTC_RECON_INTERVAL 8000
+#define BTC_RECON_TIMEOUT 60000
+#define BTC_RECON_MAX_SET 3000
+#define BTC_RECON_FANOUT 1
+
+/* Peers we ask to push compact blocks unsolicited (bip152). */
+#define BTC_COMPACT_HB_PEERS 3
+
+/* Orphaned, rejected and evicted txs kept for compact
+   block reconstruction (-blockreconstructionextratxn). */
+#define BTC_EXTRA_TXS 100
+
+enum btc_connev_type {
+  /* I/O thread -> pool */
+  BTC_CONNEV_CONNECT,
+  BTC_CONNEV_MSG,
+  BTC_CONNEV_PARSE_ERROR,
+  BTC_CONNEV_HANGUP,
+  BTC_CONNEV_ERROR,
+  BTC_CONNEV_DRAIN,
+  BTC_CONNEV_CLOSE,
+  /* Pool -> I/O thread */
+  BTC_CONNOP_CONNECT,
+  BTC_CONNOP_ADOPT,
+  BTC_CONNOP_WRITE,
+  BTC_CONNOP_CLOSE,
+  BTC_CONNOP_RESUME,
+  BTC_CONNOP_RELEASE
+};
+
 /*
  * Types
  */
 
-typedef void btc_parser_on_msg_cb(btc_msg_t *msg, void *arg);
-typedef void btc_parser_on_error_cb(void *arg);
-
-typedef struct btc_parser_s {
-  uint32_t magic;
-  uint8_t *pending;
-  size_t alloc;
-  size_t total;
-  size_t waiting;
-  int closed;
-  /* Header */
-  char cmd[12];
-  int has_header;
-  uint32_t checksum;
-  /* Callback */
-  btc_parser_on_msg_cb *on_msg;
-  btc_parser_on_error_cb *on_error;
-  void *arg;
-} btc_parser_t;
+typedef struct btc_connev_s {
+  enum btc_connev_type type;
+  struct btc_conn_s *conn;
+  btc_msg_t msg;
+  char *error;
+  btc_sockaddr_t addr;
+  btc_socket_t *socket;
+  btc_sockbuf_t *buf;
+  void *data;
+  size_t length;
+  struct btc_connev_s *next;
+} btc_connev_t;
+
+typedef struct btc_connq_s {
+  btc_connev_t *head;
+  btc_connev_t *tail;
+} btc_connq_t;
+
+typedef struct btc_shard_s {
+  struct btc_pool_s *pool;
+  btc_loop_t *loop;
+  btc_thread_t thread;
+  btc_mutex_t lock;
+  btc_connq_t inbox;
+  struct btc_conn_s *head;
+  struct btc_conn_s *tail;
+  size_t length;
+  size_t peers;
+  int64_t sample_time;
+} btc_shard_t;
+
+typedef struct btc_conn_s {
+  struct btc_pool_s *pool;
+  struct btc_peer_s *peer;
+  btc_shard_t *shard;
+  /* Owned by the socket's thread. */
+  btc_socket_t *socket;
+  btc_parser_t parser;
+  struct btc_conn_s *prev;
+  struct btc_conn_s *next;
+  /* Guarded by the shard lock. */
+  size_t queued;
+  size_t buffered;
+  size_t backlog;
+  int paused;
+  /* Owned by the pool. */
+  int closing;
+} btc_conn_t;
 
 typedef struct btc_sendqueue_s {
   btc_invitem_t *head;
@@ -90,9 +171,7 @@ typedef struct btc_peer_s {
   btc_pool_t *pool;
   const btc_network_t *network;
   btc_logger_t *logger;
-  btc_loop_t *loop;
-  btc_socket_t *socket;
-  btc_parser_t parser;
+  btc_conn_t *conn;
   btc_sendqueue_t sending;
   enum btc_peer_state state;
   unsigned int id;
@@ -118,6 +197,18 @@ typedef struct btc_peer_s {
   int64_t fee_rate;
   int compact_mode;
   int compact_witness;
+  int compact_hb;
+  int64_t compact_time;
+  int wtxid_relay;
+  int recon;
+  int recon_flood;
+  int recon_offer;
+  int recon_accept;
+  int recon_busy;
+  uint64_t recon_salt;
+  uint64_t recon_peer_salt;
+  uint8_t recon_key[16];
+  int64_t recon_time;
   int syncing;
   int sent_addr;
   int getting_addr;
@@ -125,19 +216,34 @@ typedef struct btc_peer_s {
   uint64_t challenge;
   int64_t last_pong;
   int64_t last_ping;
+  int64_t ping_sent;
   int64_t min_ping;
+  int64_t ping;
+  int64_t ping_total;
+  int64_t ping_count;
   int64_t block_time;
   int64_t gb_time;
   int64_t gh_time;
   int64_t ping_timer;
   int64_t inv_timer;
   int64_t stall_timer;
+  btc_timer_t *compact_timer;
+  btc_timer_t *recon_timer;
   btc_filter_t addr_filter;
   btc_filter_t inv_filter;
   btc_bloom_t *spv_filter;
-  btc_hashtab_t block_map;
-  btc_hashtab_t tx_map;
+  btc_hashmap_t block_map;
+  btc_hashmap_t tx_map;
   btc_hashmap_t compact_map;
+  btc_longmap_t recon_set;
+  btc_longmap_t recon_snap;
+  btc_traffic_t traffic;
+  size_t buffered_max;
+  uint64_t blocks_served;
+  uint64_t blocks_recv;
+  uint64_t rate_blocks;
+  int64_t rate_time;
+  double block_rate;
   struct btc_peer_s *prev;
   struct btc_peer_s *next;
 } btc_peer_t;
@@ -146,6 +252,11 @@ typedef struct btc_nonces_s {
   btc_longset_t set;
 } btc_nonces_t;
 
+typedef struct btc_extras_s {
+  btc_tx_t *items[BTC_EXTRA_TXS];
+  size_t index;
+} btc_extras_t;
+
 typedef struct btc_peers_s {
   btc_netmap_t map;
   btc_intmap_t ids;
@@ -163,6 +274,18 @@ typedef struct btc_hdrnode_s {
   struct btc_hdrnode_s *next;
 } btc_hdrnode_t;
 
+typedef struct btc_msgslot_s {
+  uint8_t hash[32];
+  enum btc_msgtype type;
+  btc_sockbuf_t *buf;
+} btc_msgslot_t;
+
+typedef struct btc_msgcache_s {
+  btc_msgslot_t slots[BTC_MSGCACHE_SLOTS];
+  size_t bytes;
+  size_t hand;
+} btc_msgcache_t;
+
 struct btc_pool_s {
   const btc_network_t *network;
   btc_loop_t *loop;
@@ -186,6 +309,13 @@ struct btc_pool_s {
   btc_hashset_t block_map;
   btc_hashset_t tx_map;
   btc_hashset_t compact_map;
+  btc_msgcache_t msgcache;
+  btc_extras_t extras;
+  btc_traffic_t traffic;
+  btc_shard_t *shards;
+  int threads;
+  btc_mutex_t lock;
+  btc_connq_t outbox;
   int block_mode;
   int checkpoints;
   const btc_checkpoint_t *header_tip;
@@ -242,136 +372,137 @@ btc_nonces_remove(btc_nonces_t *list, uint64_t nonce) {
 }
 
 /*
- * Parser
+ * Traffic
  */
 
 static void
-btc_parser_init(btc_parser_t *parser, uint32_t magic) {
-  parser->magic = magic;
-  parser->pending = NULL;
-  parser->alloc = 0;
-  parser->total = 0;
-  parser->waiting = 24;
-  parser->closed = 0;
-  parser->cmd[0] = '\0';
-  parser->has_header = 0;
-  parser->checksum = 0;
-  parser->on_msg = NULL;
-  parser->on_error = NULL;
-  parser->arg = NULL;
+btc_traffic_add(btc_traffic_t *z, const btc_traffic_t *x) {
+  int i;
+
+  for (i = 0; i <= BTC_MSG_UNKNOWN; i++) {
+    z->bytes_sent[i] += x->bytes_sent[i];
+    z->bytes_recv[i] += x->bytes_recv[i];
+    z->msgs_sent[i] += x->msgs_sent[i];
+    z->msgs_recv[i] += x->msgs_recv[i];
+  }
 }
 
-static void
-btc_parser_clear(btc_parser_t *parser) {
-  if (parser->alloc > 0)
-    btc_free(parser->pending);
+/*
+ * Extra Transactions
+ */
 
-  parser->pending = NULL;
+static void
+btc_extras_init(btc_extras_t *ring) {
+  memset(ring, 0, sizeof(*ring));
 }
 
-static uint8_t *
-btc_parser_append(btc_parser_t *parser, const uint8_t *data, size_t length) {
-  if (parser->closed)
-    return parser->pending;
+static void
+btc_extras_clear(btc_extras_t *ring) {
+  size_t i;
 
-  if (parser->total + length > parser->alloc) {
-    parser->pending = btc_realloc(parser->pending, parser->total + length);
-    parser->alloc = parser->total + length;
+  for (i = 0; i < BTC_EXTRA_TXS; i++) {
+    if (ring->items[i] != NULL)
+      btc_tx_destroy(ring->items[i]);
   }
 
-  if (length > 0)
-    memcpy(parser->pending + parser->total, data, length);
-
-  parser->total += length;
-
-  return parser->pending;
+  btc_extras_init(ring);
 }
 
-static int
-btc_parser_parse_header(btc_parser_t *parser, const uint8_t **xp, size_t *xn) {
-  uint32_t magic, size;
-
-  if (!btc_uint32_read(&magic, xp, xn))
-    return 0;
-
-  if (magic != parser->magic)
-    return 0;
+static void
+btc_extras_push(btc_extras_t *ring, const btc_tx_t *tx) {
+  btc_tx_t **slot = &ring->items[ring->index];
 
-  if (!btc_nullstr_read(parser->cmd, sizeof(parser->cmd), xp, xn))
-    return 0;
+  if (*slot != NULL)
+    btc_tx_destroy(*slot);
 
-  if (!btc_uint32_read(&size, xp, xn))
-    return 0;
+  *slot = btc_tx_refconst(tx);
 
-  if (size > BTC_NET_MAX_MESSAGE)
-    return 0;
+  ring->index = (ring->index + 1) % BTC_EXTRA_TXS;
+}
 
-  if (!btc_uint32_read(&parser->checksum, xp, xn))
-    return 0;
+/*
+ * Message Cache
+ */
 
-  parser->waiting = size;
-  parser->has_header = 1;
+/* Serialized (and checksummed) messages for hot objects:
+ * the block we just announced, txs which every peer is
+ * about to request, and so on. Each peer queues the same
+ * immutable buffer rather than re-running the serializer.
+ */
 
-  return 1;
+static void
+btc_msgcache_init(btc_msgcache_t *cache) {
+  memset(cache, 0, sizeof(*cache));
 }
 
-static int
-btc_parser_parse(btc_parser_t *parser, const uint8_t *data, size_t length) {
-  btc_msg_t msg;
+static void
+btc_msgcache_evict(btc_msgcache_t *cache, btc_msgslot_t *slot) {
+  if (slot->buf != NULL) {
+    cache->bytes -= btc_sockbuf_length(slot->buf);
+    btc_sockbuf_unref(slot->buf);
+    slot->buf = NULL;
+  }
+}
 
-  CHECK(length <= BTC_NET_MAX_MESSAGE);
+static void
+btc_msgcache_clear(btc_msgcache_t *cache) {
+  size_t i;
 
-  if (!parser->has_header)
-    return btc_parser_parse_header(parser, &data, &length);
+  for (i = 0; i < BTC_MSGCACHE_SLOTS; i++)
+    btc_msgcache_evict(cache, &cache->slots[i]);
 
-  parser->waiting = 24;
-  parser->has_header = 0;
+  CHECK(cache->bytes == 0);
+}
 
-  if (btc_checksum(data, length) != parser->checksum)
-    return 0;
+static btc_msgslot_t *
+btc_msgcache_slot(btc_msgcache_t *cache,
+                  enum btc_msgtype type,
+                  const uint8_t *hash) {
+  uint32_t index = btc_read32le(hash) ^ ((uint32_t)type * 0x9e3779b1);
 
-  btc_msg_set_cmd(&msg, parser->cmd);
-  btc_msg_alloc(&msg);
+  return &cache->slots[index & (BTC_MSGCACHE_SLOTS - 1)];
+}
 
-  if (!btc_msg_import(&msg, data, length)) {
-    btc_msg_clear(&msg);
-    return 0;
-  }
+static btc_sockbuf_t *
+btc_msgcache_get(btc_msgcache_t *cache,
+                 enum btc_msgtype type,
+                 const uint8_t *hash) {
+  btc_msgslot_t *slot = btc_msgcache_slot(cache, type, hash);
 
-  parser->on_msg(&msg, parser->arg);
+  if (slot->buf == NULL || slot->type != type)
+    return NULL;
 
-  btc_msg_clear(&msg);
+  if (!btc_hash_equal(slot->hash, hash))
+    return NULL;
 
-  return 1;
+  return slot->buf;
 }
 
-static int
-btc_parser_feed(btc_parser_t *parser, const uint8_t *data, size_t length) {
-  uint8_t *ptr = btc_parser_append(parser, data, length);
-  size_t len = parser->total;
-  int parsed = 0;
+static btc_sockbuf_t *
+btc_msgcache_put(btc_msgcache_t *cache,
+                 enum btc_msgtype type,
+                 const uint8_t *hash,
+                 btc_sockbuf_t *buf) {
+  /* Takes ownership of `buf`. The returned pointer
+     is borrowed and valid until the next insertion. */
+  btc_msgslot_t *slot = btc_msgcache_slot(cache, type, hash);
+  size_t length = btc_sockbuf_length(buf);
 
-  while (!parser->closed && len >= parser->waiting) {
-    size_t size = parser->waiting;
-
-    if (parser->has_header)
-      parsed = 1;
-
-    if (!btc_parser_parse(parser, ptr, size)) {
-      if (!parser->closed)
-        parser->on_error(parser->arg);
-    }
+  btc_msgcache_evict(cache, slot);
 
-    ptr += size;
-    len -= size;
+  while (cache->bytes + length > BTC_MSGCACHE_BYTES && cache->bytes > 0) {
+    btc_msgcache_evict(cache, &cache->slots[cache->hand]);
+    cache->hand = (cache->hand + 1) & (BTC_MSGCACHE_SLOTS - 1);
   }
 
-  if (len > 0 && ptr != parser->pending)
-    memmove(parser->pending, ptr, len);
+  btc_hash_copy(slot->hash, hash);
 
-  parser->total = len;
+  slot->type = type;
+  slot->buf = buf;
 
-  return parsed;
+  cache->bytes += length;
+
+  return buf;
 }
 
 /*
@@ -396,8 +527,8 @@ btc_peer_on_close(btc_peer_t *peer);
 static void
 btc_peer_on_error(btc_peer_t *peer, const char *msg);
 
-static int
-btc_peer_on_data(btc_peer_t *peer, const uint8_t *data, size_t size);
+static void
+btc_peer_on_hangup(btc_peer_t *peer);
 
 static void
 btc_peer_on_drain(btc_peer_t *peer);
@@ -408,6 +539,15 @@ btc_peer_on_msg(btc_peer_t *peer, btc_msg_t *msg);
 static void
 btc_peer_on_parse_error(btc_peer_t *peer);
 
+static void
+btc_peer_on_stall(btc_peer_t *peer, btc_timer_t *timer, const char *type);
+
+static void
+btc_peer_on_compact_stall(btc_peer_t *peer);
+
+static void
+btc_peer_on_recon(btc_peer_t *peer);
+
 static void
 on_server_socket(btc_socket_t *listener, btc_socket_t *socket) {
   btc_socket_set_nodelay(socket, 1);
@@ -426,43 +566,769 @@ on_tick(void *arg) {
   btc_pool_on_tick(pool, now);
 }
 
+static void
+on_block_stall(btc_timer_t *timer) {
+  btc_peer_on_stall((btc_peer_t *)btc_timer_get_data(timer), timer, "block");
+}
+
+static void
+on_tx_stall(btc_timer_t *timer) {
+  btc_peer_on_stall((btc_peer_t *)btc_timer_get_data(timer), timer, "tx");
+}
+
+static void
+on_compact_stall(btc_timer_t *timer) {
+  btc_peer_on_compact_stall((btc_peer_t *)btc_timer_get_data(timer));
+}
+
+static void
+on_recon(btc_timer_t *timer) {
+  btc_peer_on_recon((btc_peer_t *)btc_timer_get_data(timer));
+}
+
+/*
+ * Connection Queue
+ */
+
+static void
+btc_connq_init(btc_connq_t *queue) {
+  queue->head = NULL;
+  queue->tail = NULL;
+}
+
+static int
+btc_connq_push(btc_connq_t *queue, btc_connev_t *ev) {
+  /* Returns true if the queue was empty. */
+  int empty = (queue->head == NULL);
+
+  ev->next = NULL;
+
+  if (queue->tail != NULL)
+    queue->tail->next = ev;
+  else
+    queue->head = ev;
+
+  queue->tail = ev;
+
+  return empty;
+}
+
+static btc_connev_t *
+btc_connq_take(btc_connq_t *queue) {
+  btc_connev_t *head = queue->head;
+
+  queue->head = NULL;
+  queue->tail = NULL;
+
+  return head;
+}
+
+static void
+btc_connev_init(btc_connev_t *ev, enum btc_connev_type type, btc_conn_t *conn) {
+  memset(ev, 0, sizeof(*ev));
+
+  ev->type = type;
+  ev->conn = conn;
+}
+
+static btc_connev_t *
+btc_connev_create(enum btc_connev_type type, btc_conn_t *conn) {
+  btc_connev_t *ev = btc_malloc(sizeof(btc_connev_t));
+  btc_connev_init(ev, type, conn);
+  return ev;
+}
+
+static void
+btc_connev_destroy(btc_connev_t *ev) {
+  btc_msg_clear(&ev->msg);
+
+  if (ev->error != NULL)
+    btc_free(ev->error);
+
+  if (ev->buf != NULL)
+    btc_sockbuf_unref(ev->buf);
+
+  if (ev->data != NULL)
+    btc_free(ev->data);
+
+  btc_free(ev);
+}
+
+/*
+ * Connection
+ */
+
+/* A connection is the transport half of a peer: its socket
+ * and message parser. Without I/O threads, it lives on the
+ * pool's loop and its events are dispatched synchronously.
+ *
+ * Otherwise, it is owned by one of the shards. Framing,
+ * checksums and deserialization happen on the shard's
+ * thread, and decoded messages are handed to the pool in
+ * batches. Writes travel the other way as queued ops. The
+ * peer outlives its connection until the final close event
+ * is dispatched, after which the shard frees the connection.
+ */
+
+static void
+btc_shard_post(btc_shard_t *shard, btc_connev_t *op);
+
+static btc_shard_t *
+btc_pool_shard(btc_pool_t *pool);
+
+static void
+btc_pool_drain(btc_pool_t *pool);
+
+static void
+on_pool_events(void *arg) {
+  btc_pool_drain((btc_pool_t *)arg);
+}
+
+static void
+btc_conn_dispatch(btc_conn_t *conn, btc_connev_t *ev) {
+  btc_peer_t *peer = conn->peer;
+
+  if (ev->type == BTC_CONNEV_CLOSE) {
+    btc_peer_on_close(peer);
+    return;
+  }
+
+  /* Stragglers from a connection we've closed. */
+  if (conn->closing)
+    return;
+
+  switch (ev->type) {
+    case BTC_CONNEV_CONNECT:
+      btc_peer_on_connect(peer);
+      break;
+    case BTC_CONNEV_MSG:
+      peer->last_recv = btc_time_msec();
+      peer->traffic.bytes_recv[ev->msg.type] += ev->length;
+      peer->traffic.msgs_recv[ev->msg.type] += 1;
+      btc_peer_on_msg(peer, &ev->msg);
+      break;
+    case BTC_CONNEV_PARSE_ERROR:
+      btc_peer_on_parse_error(peer);
+      break;
+    case BTC_CONNEV_HANGUP:
+      btc_peer_on_hangup(peer);
+      break;
+    case BTC_CONNEV_ERROR:
+      btc_peer_on_error(peer, ev->error);
+      break;
+    case BTC_CONNEV_DRAIN:
+      btc_peer_on_drain(peer);
+      break;
+    default:
+      break;
+  }
+}
+
+static void
+btc_conn_emit(btc_conn_t *conn, const btc_connev_t *ev) {
+  btc_pool_t *pool = conn->pool;
+  btc_connev_t *copy;
+  int wake;
+
+  if (conn->shard == NULL) {
+    btc_conn_dispatch(conn, (btc_connev_t *)ev);
+    return;
+  }
+
+  copy = btc_malloc(sizeof(btc_connev_t));
+
+  *copy = *ev;
+
+  if (ev->error != NULL) {
+    size_t len = strlen(ev->error);
+
+    copy->error = btc_malloc(len + 1);
+
+    memcpy(copy->error, ev->error, len + 1);
+  }
+
+  btc_mutex_lock(&pool->lock);
+
+  wake = btc_connq_push(&pool->outbox, copy);
+
+  btc_mutex_unlock(&pool->lock);
+
+  if (wake)
+    btc_loop_post(pool->loop, on_pool_events, pool);
+}
+
+static void
+btc_conn_signal(btc_conn_t *conn, enum btc_connev_type type) {
+  btc_connev_t ev;
+
+  btc_connev_init(&ev, type, conn);
+  btc_conn_emit(conn, &ev);
+}
+
+static void
+btc_conn_shutdown(btc_conn_t *conn) {
+  conn->parser.closed = 1;
+
+  if (conn->socket != NULL)
+    btc_socket_close(conn->socket);
+}
+
+static void
+btc_conn_fail(btc_conn_t *conn, const char *msg) {
+  btc_connev_t ev;
+
+  btc_connev_init(&ev, BTC_CONNEV_ERROR, conn);
+
+  ev.error = (char *)msg;
+
+  btc_conn_emit(conn, &ev);
+
+  if (conn->shard != NULL)
+    btc_conn_shutdown(conn);
+}
+
+static void
+btc_conn_throttle(btc_conn_t *conn, size_t length) {
+  /* Stop reading if the pool is falling behind. */
+  btc_shard_t *shard = conn->shard;
+  int pause = 0;
+
+  btc_mutex_lock(&shard->lock);
+
+  conn->backlog += length;
+
+  if (conn->backlog >= BTC_CONN_BACKLOG && !conn->paused) {
+    conn->paused = 1;
+    pause = 1;
+  }
+
+  btc_mutex_unlock(&shard->lock);
+
+  if (pause)
+    btc_socket_pause(conn->socket);
+}
+
+static void
+btc_conn_consume(btc_conn_t *conn, size_t length) {
+  btc_shard_t *shard = conn->shard;
+  int resume = 0;
+
+  btc_mutex_lock(&shard->lock);
+
+  conn->backlog -= length;
+
+  if (conn->paused && conn->backlog < BTC_CONN_BACKLOG) {
+    conn->paused = 0;
+    resume = 1;
+  }
+
+  btc_mutex_unlock(&shard->lock);
+
+  if (resume && !conn->closing)
+    btc_shard_post(shard, btc_connev_create(BTC_CONNOP_RESUME, conn));
+}
+
 static void
 on_connect(btc_socket_t *socket) {
   btc_socket_set_nodelay(socket, 1);
-  btc_peer_on_connect((btc_peer_t *)btc_socket_get_data(socket));
+  btc_conn_signal((btc_conn_t *)btc_socket_get_data(socket),
+                  BTC_CONNEV_CONNECT);
 }
 
 static void
 on_close(btc_socket_t *socket) {
-  btc_peer_on_close((btc_peer_t *)btc_socket_get_data(socket));
+  btc_conn_t *conn = (btc_conn_t *)btc_socket_get_data(socket);
+  btc_shard_t *shard = conn->shard;
+
+  conn->socket = NULL;
+
+  if (shard != NULL)
+    btc_list_remove(shard, conn, btc_conn_t);
+
+  btc_conn_signal(conn, BTC_CONNEV_CLOSE);
 }
 
 static void
 on_error(btc_socket_t *socket) {
-  btc_peer_on_error((btc_peer_t *)btc_socket_get_data(socket),
-                    btc_socket_strerror(socket));
+  btc_conn_fail((btc_conn_t *)btc_socket_get_data(socket),
+                btc_socket_strerror(socket));
+}
+
+static void *
+on_alloc(btc_socket_t *socket, size_t *size) {
+  btc_conn_t *conn = (btc_conn_t *)btc_socket_get_data(socket);
+
+  if (conn->parser.closed)
+    return NULL;
+
+  return btc_parser_window(&conn->parser, size);
 }
 
 static int
 on_data(btc_socket_t *socket, const void *data, size_t size) {
-  return btc_peer_on_data((btc_peer_t *)btc_socket_get_data(socket),
-                          (const uint8_t *)data,
-                          size);
+  btc_conn_t *conn = (btc_conn_t *)btc_socket_get_data(socket);
+
+  if (conn->parser.closed)
+    return 0;
+
+  if (size == 0) {
+    btc_conn_signal(conn, BTC_CONNEV_HANGUP);
+
+    if (conn->shard != NULL)
+      btc_conn_shutdown(conn);
+
+    return 0;
+  }
+
+  return !btc_parser_feed(&conn->parser, (const uint8_t *)data, size);
 }
 
 static void
 on_drain(btc_socket_t *socket) {
-  btc_peer_on_drain((btc_peer_t *)btc_socket_get_data(socket));
+  btc_conn_t *conn = (btc_conn_t *)btc_socket_get_data(socket);
+
+  if (conn->shard != NULL) {
+    btc_mutex_lock(&conn->shard->lock);
+    conn->buffered = btc_socket_buffered(socket);
+    btc_mutex_unlock(&conn->shard->lock);
+  }
+
+  btc_conn_signal(conn, BTC_CONNEV_DRAIN);
 }
 
 static void
 on_msg(btc_msg_t *msg, void *arg) {
-  btc_peer_on_msg((btc_peer_t *)arg, msg);
+  btc_conn_t *conn = (btc_conn_t *)arg;
+  btc_connev_t ev;
+
+  btc_connev_init(&ev, BTC_CONNEV_MSG, conn);
+
+  ev.msg = *msg;
+  ev.length = 24 + conn->parser.size;
+
+  if (conn->shard != NULL) {
+    /* The queued event owns the body now, along
+       with the payload it may still point into
+       (see btc_zinv_read). The parser allocates
+       a fresh buffer for the next message. */
+    ev.data = conn->parser.payload;
+
+    conn->parser.payload = NULL;
+    conn->parser.alloc = 0;
+
+    msg->body = NULL;
+
+    btc_conn_throttle(conn, ev.length);
+  }
+
+  btc_conn_emit(conn, &ev);
 }
 
 static void
 on_parse_error(void *arg) {
-  btc_peer_on_parse_error((btc_peer_t *)arg);
+  btc_conn_signal((btc_conn_t *)arg, BTC_CONNEV_PARSE_ERROR);
+}
+
+static void
+btc_conn_bind(btc_conn_t *conn, btc_socket_t *socket) {
+  btc_socket_set_data(socket, conn);
+  btc_socket_on_connect(socket, on_connect);
+  btc_socket_on_close(socket, on_close);
+  btc_socket_on_error(socket, on_error);
+  btc_socket_on_alloc(socket, on_alloc);
+  btc_socket_on_data(socket, on_data);
+  btc_socket_on_drain(socket, on_drain);
+}
+
+static void
+btc_conn_attach(btc_conn_t *conn, btc_socket_t *socket) {
+  conn->socket = socket;
+
+  if (conn->shard != NULL)
+    btc_list_push(conn->shard, conn, btc_conn_t);
+}
+
+static btc_conn_t *
+btc_conn_create(btc_pool_t *pool, struct btc_peer_s *peer) {
+  btc_conn_t *conn = btc_malloc(sizeof(btc_conn_t));
+
+  memset(conn, 0, sizeof(*conn));
+
+  conn->pool = pool;
+  conn->peer = peer;
+  conn->shard = btc_pool_shard(pool);
+
+  if (conn->shard != NULL)
+    conn->shard->peers++;
+
+  btc_parser_init(&conn->parser, pool->network->magic);
+
+  conn->parser.on_msg = on_msg;
+  conn->parser.on_error = on_parse_error;
+  conn->parser.arg = conn;
+
+  return conn;
+}
+
+static void
+btc_conn_free(btc_conn_t *conn) {
+  btc_parser_clear(&conn->parser);
+  btc_free(conn);
+}
+
+static void
+btc_conn_destroy(btc_conn_t *conn) {
+  btc_shard_t *shard = conn->shard;
+
+  if (shard == NULL) {
+    btc_conn_free(conn);
+    return;
+  }
+
+  /* Queued behind anything still referencing it. */
+  shard->peers--;
+
+  btc_shard_post(shard, btc_connev_create(BTC_CONNOP_RELEASE, conn));
+}
+
+static int
+btc_conn_connect(btc_conn_t *conn, const btc_sockaddr_t *addr) {
+  btc_socket_t *socket;
+  btc_connev_t *op;
+
+  if (conn->shard == NULL) {
+    socket = btc_loop_connect(conn->pool->loop, addr);
+
+    if (socket == NULL)
+      return 0;
+
+    btc_conn_bind(conn, socket);
+    btc_conn_attach(conn, socket);
+
+    return 1;
+  }
+
+  op = btc_connev_create(BTC_CONNOP_CONNECT, conn);
+  op->addr = *addr;
+
+  btc_shard_post(conn->shard, op);
+
+  return 1;
+}
+
+static void
+btc_conn_accept(btc_conn_t *conn, btc_socket_t *socket) {
+  btc_connev_t *op;
+
+  btc_conn_bind(conn, socket);
+
+  if (conn->shard == NULL) {
+    btc_conn_attach(conn, socket);
+    return;
+  }
+
+  btc_socket_detach(socket);
+
+  op = btc_connev_create(BTC_CONNOP_ADOPT, conn);
+  op->socket = socket;
+
+  btc_shard_post(conn->shard, op);
+}
+
+static int
+btc_conn_write(btc_conn_t *conn, void *data, size_t length) {
+  btc_connev_t *op;
+
+  if (conn->shard == NULL)
+    return btc_socket_write(conn->socket, data, length);
+
+  if (conn->closing) {
+    btc_free(data);
+    return -1;
+  }
+
+  op = btc_connev_create(BTC_CONNOP_WRITE, conn);
+  op->data = data;
+  op->length = length;
+
+  btc_shard_post(conn->shard, op);
+
+  return 1;
+}
+
+static int
+btc_conn_write_copy(btc_conn_t *conn, const void *data, size_t length) {
+  void *copy;
+
+  if (conn->shard == NULL)
+    return btc_socket_write_copy(conn->socket, data, length);
+
+  if (conn->closing)
+    return -1;
+
+  copy = btc_malloc(length);
+
+  memcpy(copy, data, length);
+
+  return btc_conn_write(conn, copy, length);
+}
+
+static int
+btc_conn_write_buf(btc_conn_t *conn, btc_sockbuf_t *buf) {
+  btc_connev_t *op;
+
+  if (conn->shard == NULL)
+    return btc_socket_write_buf(conn->socket, buf);
+
+  if (conn->closing)
+    return -1;
+
+  op = btc_connev_create(BTC_CONNOP_WRITE, conn);
+  op->buf = btc_sockbuf_ref(buf);
+  op->length = btc_sockbuf_length(buf);
+
+  btc_shard_post(conn->shard, op);
+
+  return 1;
+}
+
+static size_t
+btc_conn_buffered(btc_conn_t *conn) {
+  size_t size;
+
+  if (conn->shard == NULL)
+    return btc_socket_buffered(conn->socket);
+
+  btc_mutex_lock(&conn->shard->lock);
+
+  size = conn->queued + conn->buffered;
+
+  btc_mutex_unlock(&conn->shard->lock);
+
+  return size;
+}
+
+static const char *
+btc_conn_strerror(btc_conn_t *conn) {
+  if (conn->shard == NULL)
+    return btc_loop_strerror(conn->pool->loop);
+
+  return "Connection closed";
+}
+
+static void
+btc_conn_close(btc_conn_t *conn) {
+  if (conn->closing)
+    return;
+
+  conn->closing = 1;
+
+  if (conn->shard == NULL) {
+    btc_conn_shutdown(conn);
+    return;
+  }
+
+  btc_shard_post(conn->shard, btc_connev_create(BTC_CONNOP_CLOSE, conn));
+}
+
+/*
+ * Shard
+ */
+
+/* An I/O thread running its own loop. */
+
+static void
+btc_shard_run(btc_shard_t *shard, btc_connev_t *op) {
+  btc_conn_t *conn = op->conn;
+  btc_socket_t *socket = conn->socket;
+  int rc;
+
+  switch (op->type) {
+    case BTC_CONNOP_CONNECT: {
+      socket = btc_loop_connect(shard->loop, &op->addr);
+
+      if (socket == NULL) {
+        btc_conn_fail(conn, btc_loop_strerror(shard->loop));
+        btc_conn_signal(conn, BTC_CONNEV_CLOSE);
+        break;
+      }
+
+      btc_conn_bind(conn, socket);
+      btc_conn_attach(conn, socket);
+
+      break;
+    }
+
+    case BTC_CONNOP_ADOPT: {
+      socket = op->socket;
+
+      op->socket = NULL;
+
+      if (!btc_loop_attach(shard->loop, socket)) {
+        btc_conn_fail(conn, btc_loop_strerror(shard->loop));
+        btc_conn_signal(conn, BTC_CONNEV_CLOSE);
+        break;
+      }
+
+      btc_conn_attach(conn, socket);
+
+      break;
+    }
+
+    case BTC_CONNOP_WRITE: {
+      if (socket != NULL) {
+        if (op->buf != NULL) {
+          rc = btc_socket_write_buf(socket, op->buf);
+        } else {
+          rc = btc_socket_write(socket, op->data, op->length);
+          op->data = NULL;
+        }
+
+        if (rc == -1)
+          btc_conn_fail(conn, btc_socket_strerror(socket));
+      }
+
+      btc_mutex_lock(&shard->lock);
+
+      conn->queued -= op->length;
+
+      if (conn->socket != NULL)
+        conn->buffered = btc_socket_buffered(conn->socket);
+      else
+        conn->buffered = 0;
+
+      btc_mutex_unlock(&shard->lock);
+
+      break;
+    }
+
+    case BTC_CONNOP_CLOSE: {
+      btc_conn_shutdown(conn);
+      break;
+    }
+
+    case BTC_CONNOP_RESUME: {
+      if (socket != NULL)
+        btc_socket_resume(socket);
+      break;
+    }
+
+    case BTC_CONNOP_RELEASE: {
+      CHECK(socket == NULL);
+      btc_conn_free(conn);
+      break;
+    }
+
+    default: {
+      btc_abort(); /* LCOV_EXCL_LINE */
+      break;
+    }
+  }
+}
+
+static void
+btc_shard_drain(btc_shard_t *shard) {
+  btc_connev_t *op, *next;
+
+  btc_mutex_lock(&shard->lock);
+
+  op = btc_connq_take(&shard->inbox);
+
+  btc_mutex_unlock(&shard->lock);
+
+  for (; op != NULL; op = next) {
+    next = op->next;
+
+    btc_shard_run(shard, op);
+    btc_connev_destroy(op);
+  }
+}
+
+static void
+on_shard_ops(void *arg) {
+  btc_shard_drain((btc_shard_t *)arg);
+}
+
+static void
+btc_shard_post(btc_shard_t *shard, btc_connev_t *op) {
+  int wake;
+
+  btc_mutex_lock(&shard->lock);
+
+  if (op->type == BTC_CONNOP_WRITE)
+    op->conn->queued += op->length;
+
+  wake = btc_connq_push(&shard->inbox, op);
+
+  btc_mutex_unlock(&shard->lock);
+
+  if (wake)
+    btc_loop_post(shard->loop, on_shard_ops, shard);
+}
+
+static void
+on_shard_tick(void *arg) {
+  /* Let the pool see partial flushes. */
+  btc_shard_t *shard = (btc_shard_t *)arg;
+  int64_t now = btc_time_msec();
+  btc_conn_t *conn;
+
+  if (now < shard->sample_time + 100)
+    return;
+
+  shard->sample_time = now;
+
+  btc_mutex_lock(&shard->lock);
+
+  for (conn = shard->head; conn != NULL; conn = conn->next)
+    conn->buffered = btc_socket_buffered(conn->socket);
+
+  btc_mutex_unlock(&shard->lock);
+}
+
+static void
+on_shard_stop(void *arg) {
+  btc_loop_stop(((btc_shard_t *)arg)->loop);
+}
+
+static void
+btc_shard_thread(void *arg) {
+  btc_loop_start(((btc_shard_t *)arg)->loop);
+}
+
+static void
+btc_shard_init(btc_shard_t *shard, btc_pool_t *pool) {
+  memset(shard, 0, sizeof(*shard));
+
+  shard->pool = pool;
+  shard->loop = btc_loop_create();
+
+  btc_mutex_init(&shard->lock);
+  btc_connq_init(&shard->inbox);
+  btc_loop_on_tick(shard->loop, on_shard_tick, shard);
+}
+
+static void
+btc_shard_clear(btc_shard_t *shard) {
+  /* Thread is gone; release whatever is left. */
+  btc_shard_drain(shard);
+
+  CHECK(shard->length == 0);
+
+  btc_loop_destroy(shard->loop);
+  btc_mutex_destroy(&shard->lock);
+}
+
+static void
+btc_shard_start(btc_shard_t *shard) {
+  btc_thread_create(&shard->thread, btc_shard_thread, shard);
+}
+
+static void
+btc_shard_stop(btc_shard_t *shard) {
+  /* The loop closes its sockets on the way out. */
+  btc_loop_post(shard->loop, on_shard_stop, shard);
+  btc_thread_join(&shard->thread);
 }
 
 /*
@@ -478,8 +1344,7 @@ btc_peer_create(btc_pool_t *pool) {
   peer->pool = pool;
   peer->network = pool->network;
   peer->logger = pool->logger;
-  peer->loop = pool->loop;
-  peer->socket = NULL;
+  peer->conn = btc_conn_create(pool, peer);
 
   if (pool->id == 0)
     pool->id++;
@@ -494,16 +1359,11 @@ btc_peer_create(btc_pool_t *pool) {
   peer->last_pong = -1;
   peer->last_ping = -1;
   peer->min_ping = -1;
+  peer->ping = -1;
   peer->block_time = -1;
   peer->gb_time = -1;
   peer->gh_time = -1;
 
-  btc_parser_init(&peer->parser, peer->network->magic);
-
-  peer->parser.on_msg = on_msg;
-  peer->parser.on_error = on_parse_error;
-  peer->parser.arg = peer;
-
   btc_inv_init(&peer->inv_queue);
 
   btc_filter_init(&peer->addr_filter);
@@ -512,10 +1372,16 @@ btc_peer_create(btc_pool_t *pool) {
   btc_filter_init(&peer->inv_filter);
   btc_filter_set(&peer->inv_filter, 50000, 0.000001);
 
-  btc_hashtab_init(&peer->block_map);
-  btc_hashtab_init(&peer->tx_map);
+  btc_hashmap_init(&peer->block_map);
+  btc_hashmap_init(&peer->tx_map);
   btc_hashmap_init(&peer->compact_map);
 
+  btc_longmap_init(&peer->recon_set);
+  btc_longmap_init(&peer->recon_snap);
+
+  peer->compact_timer = btc_timer_create(pool->loop, on_compact_stall, peer);
+  peer->recon_timer = btc_timer_create(pool->loop, on_recon, peer);
+
   return peer;
 }
 
@@ -526,22 +1392,33 @@ static void
 btc_peer_destroy(btc_peer_t *peer) {
   btc_mapiter_t it;
 
-  btc_parser_clear(&peer->parser);
+  btc_conn_destroy(peer->conn);
 
   btc_peer_clear_data(peer);
 
   /* Free block hashes. */
-  btc_map_each(&peer->block_map, it)
+  btc_map_each(&peer->block_map, it) {
+    btc_timer_destroy(peer->block_map.vals[it]);
     btc_free(peer->block_map.keys[it]);
+  }
 
   /* Free TXIDs. */
-  btc_map_each(&peer->tx_map, it)
+  btc_map_each(&peer->tx_map, it) {
+    btc_timer_destroy(peer->tx_map.vals[it]);
     btc_free(peer->tx_map.keys[it]);
+  }
 
   /* Free compact blocks. */
   btc_map_each(&peer->compact_map, it)
     btc_cmpct_destroy(peer->compact_map.vals[it]);
 
+  /* Free reconciliation sets. */
+  btc_map_each(&peer->recon_set, it)
+    btc_free(peer->recon_set.vals[it]);
+
+  btc_map_each(&peer->recon_snap, it)
+    btc_free(peer->recon_snap.vals[it]);
+
   btc_inv_clear(&peer->inv_queue);
 
   btc_filter_clear(&peer->addr_filter);
@@ -550,39 +1427,33 @@ btc_peer_destroy(btc_peer_t *peer) {
   if (peer->spv_filter != NULL)
     btc_bloom_destroy(peer->spv_filter);
 
-  btc_hashtab_clear(&peer->block_map);
-  btc_hashtab_clear(&peer->tx_map);
+  btc_hashmap_clear(&peer->block_map);
+  btc_hashmap_clear(&peer->tx_map);
   btc_hashmap_clear(&peer->compact_map);
+  btc_longmap_clear(&peer->recon_set);
+  btc_longmap_clear(&peer->recon_snap);
+
+  btc_timer_destroy(peer->compact_timer);
+  btc_timer_destroy(peer->recon_timer);
 
   btc_free(peer);
 }
 
 static int
 btc_peer_open(btc_peer_t *peer, const btc_netaddr_t *addr) {
-  btc_socket_t *socket;
   btc_sockaddr_t sa;
 
   btc_netaddr_get_sockaddr(&sa, addr);
 
-  socket = btc_loop_connect(peer->loop, &sa);
-
-  if (socket == NULL)
+  if (!btc_conn_connect(peer->conn, &sa))
     return 0;
 
   peer->state = BTC_PEER_CONNECTING;
-  peer->socket = socket;
   peer->addr = *addr;
   peer->outbound = 1;
   peer->time = btc_time_msec();
   peer->nonce = btc_nonces_alloc(&peer->pool->nonces);
 
-  btc_socket_set_data(socket, peer);
-  btc_socket_on_connect(socket, on_connect);
-  btc_socket_on_close(socket, on_close);
-  btc_socket_on_error(socket, on_error);
-  btc_socket_on_data(socket, on_data);
-  btc_socket_on_drain(socket, on_drain);
-
   return 1;
 }
 
@@ -594,7 +1465,6 @@ btc_peer_accept(btc_peer_t *peer, btc_socket_t *socket) {
 
   /* We're shy. Wait for an introduction. */
   peer->state = BTC_PEER_WAIT_VERSION;
-  peer->socket = socket;
 
   btc_netaddr_set_sockaddr(&peer->addr, &sa);
 
@@ -602,11 +1472,7 @@ btc_peer_accept(btc_peer_t *peer, btc_socket_t *socket) {
   peer->time = btc_time_msec();
   peer->nonce = btc_nonces_alloc(&peer->pool->nonces);
 
-  btc_socket_set_data(socket, peer);
-  btc_socket_on_close(socket, on_close);
-  btc_socket_on_error(socket, on_error);
-  btc_socket_on_data(socket, on_data);
-  btc_socket_on_drain(socket, on_drain);
+  btc_conn_accept(peer->conn, socket);
 
   btc_peer_info(peer, "Accepted connection from %N.", &peer->addr);
 
@@ -615,9 +1481,8 @@ btc_peer_accept(btc_peer_t *peer, btc_socket_t *socket) {
 
 static void
 btc_peer_close(btc_peer_t *peer) {
-  btc_socket_close(peer->socket);
+  btc_conn_close(peer->conn);
   peer->state = BTC_PEER_DEAD;
-  peer->parser.closed = 1;
 }
 
 static void
@@ -637,11 +1502,11 @@ btc_peer_increase_ban(btc_peer_t *peer, int score) {
 }
 
 static int
-btc_peer_write(btc_peer_t *peer, uint8_t *data, size_t length) {
-  int rc = btc_socket_write(peer->socket, data, length);
+btc_peer_written(btc_peer_t *peer, int rc) {
+  size_t buffered;
 
   if (rc == -1) {
-    const char *msg = btc_socket_strerror(peer->socket);
+    const char *msg = btc_conn_strerror(peer->conn);
 
     btc_peer_error(peer, "Write error (%N): %s", &peer->addr, msg);
     btc_peer_close(peer);
@@ -651,33 +1516,102 @@ btc_peer_write(btc_peer_t *peer, uint8_t *data, size_t length) {
 
   peer->last_send = btc_time_msec();
 
+  buffered = btc_conn_buffered(peer->conn);
+
+  if (buffered > peer->buffered_max)
+    peer->buffered_max = buffered;
+
   return rc;
 }
 
 static int
-btc_peer_send(btc_peer_t *peer, const btc_msg_t *msg) {
-  size_t bodylen = btc_msg_size(msg);
-  size_t length = 24 + bodylen;
-  uint8_t *data = (uint8_t *)btc_malloc(length);
+btc_peer_write(btc_peer_t *peer, uint8_t *data, size_t length) {
+  return btc_peer_written(peer, btc_conn_write(peer->conn, data, length));
+}
+
+static void
+btc_frame_write(uint8_t *data,
+                uint32_t magic,
+                const char *cmd,
+                size_t bodylen) {
+  /* Prepend the header to a payload which
+     was serialized at `data + 24`. */
   uint8_t *body = data + 24;
   uint8_t *zp = data;
 
-  /* Payload. */
-  btc_msg_export(body, msg);
-
   /* Magic value. */
-  zp = btc_uint32_write(zp, peer->network->magic);
+  zp = btc_uint32_write(zp, magic);
 
   /* Command. */
-  zp = btc_nullstr_write(zp, msg->cmd, 12);
+  zp = btc_nullstr_write(zp, cmd, 12);
 
   /* Payload length. */
   zp = btc_uint32_write(zp, bodylen);
 
   /* Checksum. */
   btc_uint32_write(zp, btc_checksum(body, bodylen));
+}
+
+static int
+btc_peer_send(btc_peer_t *peer, const btc_msg_t *msg) {
+  size_t bodylen = btc_msg_size(msg);
+  uint8_t *data;
+  int rc;
+
+  peer->traffic.bytes_sent[msg->type] += 24 + bodylen;
+  peer->traffic.msgs_sent[msg->type] += 1;
 
-  return btc_peer_write(peer, data, length);
+  /* Small messages (ping, inv, getdata, etc.) are
+     serialized on the stack and copied straight
+     into the socket's coalescing buffer. */
+  if (24 + bodylen <= BTC_PEER_SMALL) {
+    uint8_t tmp[BTC_PEER_SMALL];
+
+    btc_msg_export(tmp + 24, msg);
+    btc_frame_write(tmp, peer->network->magic, msg->cmd, bodylen);
+
+    rc = btc_conn_write_copy(peer->conn, tmp, 24 + bodylen);
+
+    return btc_peer_written(peer, rc);
+  }
+
+  data = (uint8_t *)btc_malloc(24 + bodylen);
+
+  /* Payload. */
+  btc_msg_export(data + 24, msg);
+
+  /* Header. */
+  btc_frame_write(data, peer->network->magic, msg->cmd, bodylen);
+
+  return btc_peer_write(peer, data, 24 + bodylen);
+}
+
+static int
+btc_peer_send_buf(btc_peer_t *peer,
+                  enum btc_msgtype type,
+                  btc_sockbuf_t *buf) {
+  peer->traffic.bytes_sent[type] += btc_sockbuf_length(buf);
+  peer->traffic.msgs_sent[type] += 1;
+  return btc_peer_written(peer, btc_conn_write_buf(peer->conn, buf));
+}
+
+static btc_sockbuf_t *
+btc_pool_frame(btc_pool_t *pool, enum btc_msgtype type, const void *body) {
+  btc_msg_t msg;
+  size_t bodylen;
+  uint8_t *data;
+
+  btc_msg_set_type(&msg, type);
+
+  msg.body = (void *)body;
+
+  bodylen = btc_msg_size(&msg);
+  data = (uint8_t *)btc_malloc(24 + bodylen);
+
+  btc_msg_export(data + 24, &msg);
+  btc_frame_write(data, pool->network->magic, msg.cmd, bodylen);
+
+  return btc_sockbuf_create(data, 24 + bodylen);
 }
 
 static int
@@ -721,6 +1655,24 @@ btc_peer_send_verack(btc_peer_t *peer) {
   return btc_peer_sendmsg(peer, BTC_MSG_VERACK, NULL);
 }
 
+static int
+btc_peer_send_wtxidrelay(btc_peer_t *peer) {
+  return btc_peer_sendmsg(peer, BTC_MSG_WTXIDRELAY, NULL);
+}
+
+static int
+btc_peer_send_sendtxrcncl(btc_peer_t *peer) {
+  btc_sendtxrcncl_t msg;
+
+  peer->recon_offer = 1;
+  peer->recon_salt = btc_nonce();
+
+  msg.version = BTC_RECON_VERSION;
+  msg.salt = peer->recon_salt;
+
+  return btc_peer_sendmsg(peer, BTC_MSG_SENDTXRCNCL, &msg);
+}
+
 static int
 btc_peer_send_ping(btc_peer_t *peer) {
   btc_ping_t ping;
@@ -736,6 +1688,7 @@ btc_peer_send_ping(btc_peer_t *peer) {
   }
 
   peer->last_ping = btc_time_msec();
+  peer->ping_sent = peer->last_ping;
   peer->challenge = btc_nonce();
 
   ping.nonce = peer->challenge;
@@ -976,18 +1929,28 @@ btc_peer_send_headers(btc_peer_t *peer, const btc_headers_t *msg) {
   return btc_peer_sendmsg(peer, BTC_MSG_HEADERS, msg);
 }
 
-static int
-btc_peer_send_headers_1(btc_peer_t *peer, const btc_header_t *hdr) {
-  btc_header_t *items[1];
-  btc_headers_t msg;
+static int
+btc_peer_send_headers_1(btc_peer_t *peer,
+                        const btc_header_t *hdr,
+                        const uint8_t *hash) {
+  btc_msgcache_t *cache = &peer->pool->msgcache;
+  btc_sockbuf_t *buf = btc_msgcache_get(cache, BTC_MSG_HEADERS, hash);
+
+  if (buf == NULL) {
+    btc_header_t *items[1];
+    btc_headers_t msg;
+
+    items[0] = (btc_header_t *)hdr;
 
-  items[0] = (btc_header_t *)hdr;
+    msg.items = items;
+    msg.alloc = 0;
+    msg.length = 1;
 
-  msg.items = items;
-  msg.alloc = 0;
-  msg.length = 1;
+    buf = btc_pool_frame(peer->pool, BTC_MSG_HEADERS, &msg);
+    buf = btc_msgcache_put(cache, BTC_MSG_HEADERS, hash, buf);
+  }
 
-  return btc_peer_sendmsg(peer, BTC_MSG_HEADERS, &msg);
+  return btc_peer_send_buf(peer, BTC_MSG_HEADERS, buf);
 }
 
 static int
@@ -1079,6 +2042,40 @@ btc_peer_get_full_block(btc_peer_t *peer, const uint8_t *hash) {
   return btc_peer_send_getdata_1(peer, type, hash);
 }
 
+static int
+btc_peer_send_cached(btc_peer_t *peer,
+                     enum btc_msgtype type,
+                     const uint8_t *hash) {
+  btc_sockbuf_t *buf = btc_msgcache_get(&peer->pool->msgcache, type, hash);
+
+  if (buf == NULL)
+    return 0;
+
+  btc_peer_send_buf(peer, type, buf);
+
+  return 1;
+}
+
+static int
+btc_peer_send_block_base(btc_peer_t *peer,
+                         const btc_rawblock_t *block,
+                         const uint8_t *hash) {
+  /* Strip witnesses straight from the stored block
+     without materializing any of its transactions. */
+  btc_msgcache_t *cache = &peer->pool->msgcache;
+  size_t bodylen = btc_rawblock_base_size(block);
+  uint8_t *data = (uint8_t *)btc_malloc(24 + bodylen);
+  btc_sockbuf_t *buf;
+
+  btc_rawblock_base_write(data + 24, block);
+  btc_frame_write(data, peer->network->magic, "block", bodylen);
+
+  buf = btc_sockbuf_create(data, 24 + bodylen);
+  buf = btc_msgcache_put(cache, BTC_MSG_BLOCK_BASE, hash, buf);
+
+  return btc_peer_send_buf(peer, BTC_MSG_BLOCK_BASE, buf);
+}
+
 static int
 btc_peer_send_merkleblock(btc_peer_t *peer, const btc_block_t *block) {
   btc_merkleblock_t mrkl;
@@ -1101,23 +2098,38 @@ btc_peer_send_merkleblock(btc_peer_t *peer, const btc_block_t *block) {
   return rc;
 }
 
+static enum btc_msgtype
+btc_peer_cmpct_type(btc_peer_t *peer) {
+  if (peer->compact_witness)
+    return BTC_MSG_CMPCTBLOCK;
+
+  return BTC_MSG_CMPCTBLOCK_BASE;
+}
+
 static int
-btc_peer_send_cmpctblock(btc_peer_t *peer, const btc_block_t *block) {
-  enum btc_msgtype type = BTC_MSG_CMPCTBLOCK_BASE;
-  btc_cmpct_t msg;
-  int rc;
+btc_peer_send_cmpctblock(btc_peer_t *peer,
+                         const btc_block_t *block,
+                         const uint8_t *hash) {
+  /* The short ID nonce is shared by every peer we
+     send this block to, as in bitcoind. Only the
+     witness flag affects the serialization. */
+  btc_msgcache_t *cache = &peer->pool->msgcache;
+  enum btc_msgtype type = btc_peer_cmpct_type(peer);
+  btc_sockbuf_t *buf = btc_msgcache_get(cache, type, hash);
 
-  btc_cmpct_init(&msg);
-  btc_cmpct_set_block(&msg, block, peer->compact_witness);
+  if (buf == NULL) {
+    btc_cmpct_t msg;
 
-  if (peer->compact_witness)
-    type = BTC_MSG_CMPCTBLOCK;
+    btc_cmpct_init(&msg);
+    btc_cmpct_set_block(&msg, block, peer->compact_witness);
 
-  rc = btc_peer_sendmsg(peer, type, &msg);
+    buf = btc_pool_frame(peer->pool, type, &msg);
+    buf = btc_msgcache_put(cache, type, hash, buf);
 
-  btc_cmpct_clear(&msg);
+    btc_cmpct_clear(&msg);
+  }
 
-  return rc;
+  return btc_peer_send_buf(peer, type, buf);
 }
 
 static int
@@ -1209,14 +2221,14 @@ btc_peer_announce_block(btc_peer_t *peer,
      they're using compact block mode 1. */
   if (peer->compact_mode == 1) {
     btc_filter_add(&peer->inv_filter, hash, 32);
-    btc_peer_send_cmpctblock(peer, block);
+    btc_peer_send_cmpctblock(peer, block, hash);
     return 1;
   }
 
   /* Send header for peers that request it. */
   if (peer->prefer_headers) {
     btc_filter_add(&peer->inv_filter, hash, 32);
-    btc_peer_send_headers_1(peer, &block->header);
+    btc_peer_send_headers_1(peer, &block->header, hash);
     return 1;
   }
 
@@ -1226,14 +2238,119 @@ btc_peer_announce_block(btc_peer_t *peer,
   return 1;
 }
 
+static int
+btc_peer_recon_add(btc_peer_t *peer, const uint8_t *wtxid) {
+  uint64_t id = btc_recon_sid(peer->recon_key, wtxid);
+  btc_mapiter_t it = btc_longmap_lookup(&peer->recon_set, id);
+
+  /* Already queued, or a short ID collision. */
+  if (it != peer->recon_set.n_buckets)
+    return memcmp(peer->recon_set.vals[it], wtxid, 32) == 0;
+
+  if (peer->recon_set.size >= BTC_RECON_MAX_SET)
+    return 0;
+
+  btc_longmap_put(&peer->recon_set, id, btc_hash_clone(wtxid));
+
+  return 1;
+}
+
+static void
+btc_peer_recon_snapshot(btc_peer_t *peer) {
+  /* Freeze the current set for this round. New
+     transactions go into a fresh one meanwhile. */
+  btc_longmap_t set = peer->recon_snap;
+
+  peer->recon_snap = peer->recon_set;
+  peer->recon_set = set;
+  peer->recon_busy = 1;
+  peer->recon_time = btc_time_msec();
+}
+
+static void
+btc_peer_recon_sketch(btc_peer_t *peer, btc_sketch_t *sketch, size_t capacity) {
+  btc_mapiter_t it;
+
+  btc_sketch_reset(sketch, capacity);
+
+  btc_map_each(&peer->recon_snap, it)
+    btc_sketch_add(sketch, peer->recon_snap.keys[it]);
+}
+
+static void
+btc_peer_recon_finish(btc_peer_t *peer, const btc_array_t *ids) {
+  /* Announce the short IDs the peer is missing. It
+     has everything else in the snapshot already.
+     Without a reconciled difference, flood it all. */
+  btc_longmap_t *snap = &peer->recon_snap;
+  btc_mapiter_t it;
+  size_t i;
+
+  if (ids != NULL) {
+    for (i = 0; i < ids->length; i++) {
+      it = btc_longmap_lookup(snap, (uint32_t)ids->items[i]);
+
+      if (it == snap->n_buckets)
+        continue;
+
+      btc_inv_push_item(&peer->inv_queue, BTC_INV_WTX, snap->vals[it]);
+      btc_free(snap->vals[it]);
+      btc_longmap_remove(snap, it);
+    }
+  }
+
+  btc_map_each(snap, it) {
+    if (ids != NULL)
+      btc_filter_add(&peer->inv_filter, snap->vals[it], 32);
+    else
+      btc_inv_push_item(&peer->inv_queue, BTC_INV_WTX, snap->vals[it]);
+
+    btc_free(snap->vals[it]);
+  }
+
+  btc_longmap_reset(snap);
+
+  peer->recon_busy = 0;
+
+  btc_peer_flush_inv(peer);
+}
+
+static uint64_t
+btc_peer_recon_bytes(const uint64_t *bytes) {
+  return bytes[BTC_MSG_SENDTXRCNCL]
+       + bytes[BTC_MSG_REQRECON]
+       + bytes[BTC_MSG_SKETCH]
+       + bytes[BTC_MSG_RECONCILDIFF];
+}
+
+static int
+btc_peer_send_reqrecon(btc_peer_t *peer) {
+  btc_reqrecon_t msg;
+
+  btc_peer_recon_snapshot(peer);
+
+  msg.set_size = peer->recon_snap.size;
+  msg.q = BTC_RECON_Q;
+
+  return btc_peer_sendmsg(peer, BTC_MSG_REQRECON, &msg);
+}
+
 static int
 btc_peer_announce_tx(btc_peer_t *peer, const btc_mpentry_t *entry) {
+  const uint8_t *hash = entry->hash;
+  uint32_t type = BTC_INV_TX;
+
   /* Do not send txs to spv clients that have relay unset. */
   if (!peer->relay)
     return 0;
 
+  if (peer->wtxid_relay) {
+    hash = entry->whash;
+    type = BTC_INV_WTX;
+  }
+
   /* Don't send if they already have it. */
-  if (btc_filter_has(&peer->inv_filter, entry->hash, 32))
+  if (btc_filter_has(&peer->inv_filter, hash, 32))
     return 0;
 
   /* Check the peer's bloom filter. */
@@ -1250,7 +2367,13 @@ btc_peer_announce_tx(btc_peer_t *peer, const btc_mpentry_t *entry) {
       return 0;
   }
 
-  btc_inv_push_item(&peer->inv_queue, BTC_INV_TX, entry->hash);
+  /* Reconciling peers hear about it next round. */
+  if (peer->recon && !peer->recon_flood) {
+    if (btc_peer_recon_add(peer, hash))
+      return 1;
+  }
+
+  btc_inv_push_item(&peer->inv_queue, type, hash);
 
   if (peer->inv_queue.length >= 500)
     btc_peer_flush_inv(peer);
@@ -1352,6 +2475,18 @@ btc_peer_on_version(btc_peer_t *peer, const btc_version_t *msg) {
   if (!peer->outbound)
     btc_peer_send_version(peer);
 
+  /* Must come between version and verack. */
+  if (peer->version >= BTC_NET_WTXID_VERSION)
+    btc_peer_send_wtxidrelay(peer);
+
+  /* Likewise. Only worth it if txs flow both ways. */
+  if ((peer->pool->flags & BTC_POOL_BIP330)
+      && !(peer->pool->flags & BTC_POOL_BLOCKSONLY)
+      && peer->version >= BTC_NET_WTXID_VERSION
+      && peer->relay) {
+    btc_peer_send_sendtxrcncl(peer);
+  }
+
   btc_peer_send_verack(peer);
 
   peer->state = BTC_PEER_WAIT_VERACK;
@@ -1367,6 +2502,11 @@ btc_peer_on_verack(btc_peer_t *peer) {
 
   peer->state = BTC_PEER_CONNECTED;
 
+  if (peer->recon_offer && peer->recon_accept && peer->wtxid_relay) {
+    btc_recon_key(peer->recon_key, peer->recon_salt, peer->recon_peer_salt);
+    peer->recon = 1;
+  }
+
   btc_peer_debug(peer, "Version handshake complete (%N).", &peer->addr);
   btc_pool_on_complete(peer->pool, peer);
 }
@@ -1398,16 +2538,17 @@ btc_peer_on_pong(btc_peer_t *peer, const btc_pong_t *msg) {
     return;
   }
 
-  if (now >= peer->last_ping) {
+  /* last_ping is also bumped by block arrivals
+     (to hold off the ping timeout); measure the
+     round trip from when the challenge went out. */
+  if (now >= peer->ping_sent) {
     peer->last_pong = now;
+    peer->ping = now - peer->ping_sent;
+    peer->ping_total += peer->ping;
+    peer->ping_count += 1;
 
-    if (peer->min_ping == -1)
-      peer->min_ping = now - peer->last_ping;
-
-    now -= peer->last_ping;
-
-    if (now < peer->min_ping)
-      peer->min_ping = now;
+    if (peer->min_ping == -1 || peer->ping < peer->min_ping)
+      peer->min_ping = peer->ping;
   } else {
     btc_peer_debug(peer, "Timing mismatch (what?) (%N).", &peer->addr);
   }
@@ -1426,6 +2567,21 @@ btc_peer_on_sendheaders(btc_peer_t *peer) {
   peer->prefer_headers = 1;
 }
 
+static void
+btc_peer_on_wtxidrelay(btc_peer_t *peer) {
+  if (peer->state != BTC_PEER_WAIT_VERACK) {
+    btc_peer_debug(peer, "Peer sent wtxidrelay after verack (%N).",
+                         &peer->addr);
+    btc_peer_close(peer);
+    return;
+  }
+
+  if (peer->version < BTC_NET_WTXID_VERSION)
+    return;
+
+  peer->wtxid_relay = 1;
+}
+
 static void
 btc_peer_on_filterload(btc_peer_t *peer, const btc_bloom_t *filter) {
   btc_pool_t *pool = peer->pool;
@@ -1502,8 +2658,21 @@ btc_peer_on_feefilter(btc_peer_t *peer, const btc_feefilter_t *msg) {
 
 static void
 btc_peer_on_sendcmpct(btc_peer_t *peer, const btc_sendcmpct_t *msg) {
+  /* Later messages may only switch the mode. */
   if (peer->compact_mode != -1) {
-    btc_peer_debug(peer, "Peer sent a duplicate sendcmpct (%N).", &peer->addr);
+    if ((msg->version == 2) != peer->compact_witness || msg->mode > 1) {
+      btc_peer_debug(peer, "Peer sent a duplicate sendcmpct (%N).",
+                           &peer->addr);
+      return;
+    }
+
+    if (msg->mode != peer->compact_mode) {
+      btc_peer_debug(peer, "Peer switched to compact blocks mode %hhu (%N).",
+                           msg->mode, &peer->addr);
+    }
+
+    peer->compact_mode = msg->mode;
+
     return;
   }
 
@@ -1530,25 +2699,142 @@ btc_peer_on_sendcmpct(btc_peer_t *peer, const btc_sendcmpct_t *msg) {
 }
 
 static void
-btc_peer_on_error(btc_peer_t *peer, const char *msg) {
-  btc_peer_error(peer, "Socket error (%N): %s", &peer->addr, msg);
-  btc_peer_close(peer);
+btc_peer_on_sendtxrcncl(btc_peer_t *peer, const btc_sendtxrcncl_t *msg) {
+  if (peer->state != BTC_PEER_WAIT_VERACK) {
+    btc_peer_debug(peer, "Peer sent sendtxrcncl after verack (%N).",
+                         &peer->addr);
+    btc_peer_close(peer);
+    return;
+  }
+
+  if (peer->recon_accept) {
+    btc_peer_debug(peer, "Peer sent a duplicate sendtxrcncl (%N).",
+                         &peer->addr);
+    return;
+  }
+
+  if (msg->version < BTC_RECON_VERSION) {
+    /* Ignore. */
+    btc_peer_info(peer, "Peer requested reconciliation version %u (%N).",
+                        msg->version, &peer->addr);
+    return;
+  }
+
+  peer->recon_accept = 1;
+  peer->recon_peer_salt = msg->salt;
 }
 
-static int
-btc_peer_on_data(btc_peer_t *peer, const uint8_t *data, size_t size) {
-  if (peer->state == BTC_PEER_DEAD)
-    return 0;
+static void
+btc_peer_on_reqrecon(btc_peer_t *peer, const btc_reqrecon_t *msg) {
+  /* We're the responder: sketch our side. */
+  btc_sketch_t sketch;
+  size_t capacity;
 
-  if (size == 0) {
-    btc_peer_error(peer, "Socket hangup (%N).", &peer->addr);
-    btc_peer_close(peer);
-    return 0;
+  if (!peer->recon || peer->outbound) {
+    btc_peer_debug(peer, "Peer sent unsolicited reqrecon (%N).", &peer->addr);
+    btc_peer_increase_ban(peer, 10);
+    return;
+  }
+
+  if (peer->recon_busy) {
+    btc_peer_debug(peer, "Peer sent an overlapping reqrecon (%N).",
+                         &peer->addr);
+    return;
+  }
+
+  btc_peer_recon_snapshot(peer);
+
+  capacity = btc_recon_capacity(peer->recon_snap.size,
+                                msg->set_size,
+                                msg->q);
+
+  btc_sketch_init(&sketch);
+
+  btc_peer_recon_sketch(peer, &sketch, capacity);
+  btc_peer_sendmsg(peer, BTC_MSG_SKETCH, &sketch);
+
+  btc_sketch_clear(&sketch);
+
+  btc_timer_start(peer->recon_timer, BTC_RECON_TIMEOUT);
+}
+
+static void
+btc_peer_on_sketch(btc_peer_t *peer, const btc_sketch_t *msg) {
+  /* We're the initiator: the merged sketch holds
+     the symmetric difference of both snapshots. */
+  btc_reconcildiff_t diff;
+  btc_sketch_t sketch;
+  btc_array_t ids;
+  size_t i;
+
+  if (!peer->recon || !peer->outbound || !peer->recon_busy) {
+    btc_peer_debug(peer, "Peer sent unsolicited sketch (%N).", &peer->addr);
+    btc_peer_increase_ban(peer, 10);
+    return;
+  }
+
+  if (msg->capacity > BTC_RECON_MAX_CAPACITY) {
+    btc_peer_increase_ban(peer, 100);
+    return;
+  }
+
+  btc_reconcildiff_init(&diff);
+  btc_sketch_init(&sketch);
+  btc_array_init(&ids);
+
+  btc_peer_recon_sketch(peer, &sketch, msg->capacity);
+  btc_sketch_merge(&sketch, msg);
+
+  diff.success = (msg->capacity > 0 && btc_sketch_solve(&ids, &sketch));
+
+  /* Whatever we don't have, they do. */
+  for (i = 0; i < ids.length; i++) {
+    if (!btc_longmap_has(&peer->recon_snap, (uint32_t)ids.items[i]))
+      btc_array_push(&diff.ask, ids.items[i]);
+  }
+
+  btc_peer_debug(peer,
+    "Reconciled txs with %N (local=%zu, capacity=%zu, diff=%zu, ok=%d).",
+    &peer->addr, (size_t)peer->recon_snap.size,
+    msg->capacity, ids.length, diff.success);
+
+  btc_peer_sendmsg(peer, BTC_MSG_RECONCILDIFF, &diff);
+  btc_peer_recon_finish(peer, diff.success ? &ids : NULL);
+
+  btc_reconcildiff_clear(&diff);
+  btc_sketch_clear(&sketch);
+  btc_array_clear(&ids);
+}
+
+static void
+btc_peer_on_reconcildiff(btc_peer_t *peer, const btc_reconcildiff_t *msg) {
+  if (!peer->recon || peer->outbound || !peer->recon_busy) {
+    btc_peer_debug(peer, "Peer sent unsolicited reconcildiff (%N).",
+                         &peer->addr);
+    btc_peer_increase_ban(peer, 10);
+    return;
+  }
+
+  if (msg->ask.length > BTC_RECON_MAX_CAPACITY) {
+    btc_peer_increase_ban(peer, 100);
+    return;
   }
 
-  peer->last_recv = btc_time_msec();
+  btc_timer_stop(peer->recon_timer);
+
+  btc_peer_recon_finish(peer, msg->success ? &msg->ask : NULL);
+}
+
+static void
+btc_peer_on_error(btc_peer_t *peer, const char *msg) {
+  btc_peer_error(peer, "Socket error (%N): %s", &peer->addr, msg);
+  btc_peer_close(peer);
+}
 
-  return !btc_parser_feed(&peer->parser, data, size);
+static void
+btc_peer_on_hangup(btc_peer_t *peer) {
+  btc_peer_error(peer, "Socket hangup (%N).", &peer->addr);
+  btc_peer_close(peer);
 }
 
 static int
@@ -1586,6 +2872,9 @@ btc_peer_on_msg(btc_peer_t *peer, btc_msg_t *msg) {
     case BTC_MSG_SENDHEADERS:
       btc_peer_on_sendheaders(peer);
       break;
+    case BTC_MSG_WTXIDRELAY:
+      btc_peer_on_wtxidrelay(peer);
+      break;
     case BTC_MSG_FILTERLOAD:
       btc_peer_on_filterload(peer, (const btc_bloom_t *)msg->body);
       break;
@@ -1601,6 +2890,18 @@ btc_peer_on_msg(btc_peer_t *peer, btc_msg_t *msg) {
     case BTC_MSG_SENDCMPCT:
       btc_peer_on_sendcmpct(peer, (const btc_sendcmpct_t *)msg->body);
       break;
+    case BTC_MSG_SENDTXRCNCL:
+      btc_peer_on_sendtxrcncl(peer, (const btc_sendtxrcncl_t *)msg->body);
+      break;
+    case BTC_MSG_REQRECON:
+      btc_peer_on_reqrecon(peer, (const btc_reqrecon_t *)msg->body);
+      break;
+    case BTC_MSG_SKETCH:
+      btc_peer_on_sketch(peer, (const btc_sketch_t *)msg->body);
+      break;
+    case BTC_MSG_RECONCILDIFF:
+      btc_peer_on_reconcildiff(peer, (const btc_reconcildiff_t *)msg->body);
+      break;
     default:
       break;
   }
@@ -1643,7 +2944,7 @@ btc_peer_flush_data(btc_peer_t *peer) {
 
   for (item = peer->sending.head; item != NULL; item = next) {
     next = item->next;
-    size = btc_socket_buffered(peer->socket) + nf.length * 36;
+    size = btc_conn_buffered(peer->conn) + nf.length * 36;
     type = item->type;
 
     if (size >= (10 << 20) || peer->state == BTC_PEER_DEAD) {
@@ -1668,23 +2969,39 @@ btc_peer_flush_data(btc_peer_t *peer) {
     switch (type) {
       case BTC_INV_BLOCK: {
         const btc_entry_t *entry = btc_chain_by_hash(chain, item->hash);
-        btc_block_t *block;
+        btc_rawblock_t block;
+        size_t length;
+        uint8_t *data;
 
         if (entry == NULL) {
           btc_inv_push(&nf, item);
           break;
         }
 
-        block = btc_chain_get_block(chain, entry);
+        if (btc_peer_send_cached(peer, BTC_MSG_BLOCK_BASE, item->hash)) {
+          btc_invitem_destroy(item);
+          blk_count += 1;
+          break;
+        }
 
-        if (block == NULL) {
+        if (!btc_chain_get_raw_block(chain, &data, &length, entry)) {
           btc_inv_push(&nf, item);
           break;
         }
 
-        btc_peer_sendmsg(peer, BTC_MSG_BLOCK_BASE, block);
+        btc_rawblock_init(&block);
 
-        btc_block_destroy(block);
+        if (!btc_rawblock_import(&block, data + 24, length - 24)) {
+          btc_rawblock_clear(&block);
+          btc_free(data);
+          btc_inv_push(&nf, item);
+          break;
+        }
+
+        btc_peer_send_block_base(peer, &block, item->hash);
+
+        btc_rawblock_clear(&block);
+        btc_free(data);
         btc_invitem_destroy(item);
 
         blk_count += 1;
@@ -1694,6 +3011,7 @@ btc_peer_flush_data(btc_peer_t *peer) {
 
       case BTC_INV_WITNESS_BLOCK: {
         const btc_entry_t *entry = btc_chain_by_hash(chain, item->hash);
+        btc_sockbuf_t *buf;
         size_t length;
         uint8_t *data;
 
@@ -1702,12 +3020,23 @@ btc_peer_flush_data(btc_peer_t *peer) {
           break;
         }
 
+        if (btc_peer_send_cached(peer, BTC_MSG_BLOCK, item->hash)) {
+          btc_invitem_destroy(item);
+          blk_count += 1;
+          break;
+        }
+
         if (!btc_chain_get_raw_block(chain, &data, &length, entry)) {
           btc_inv_push(&nf, item);
           break;
         }
 
-        btc_peer_write(peer, data, length);
+        /* Stored blocks are already framed. */
+        buf = btc_sockbuf_create(data, length);
+        buf = btc_msgcache_put(&pool->msgcache, BTC_MSG_BLOCK,
+                               item->hash, buf);
+
+        btc_peer_send_buf(peer, BTC_MSG_BLOCK, buf);
 
         btc_invitem_destroy(item);
 
@@ -1725,6 +3054,14 @@ btc_peer_flush_data(btc_peer_t *peer) {
           break;
         }
 
+        if (btc_peer_send_cached(peer, btc_peer_cmpct_type(peer),
+                                       item->hash)) {
+          btc_invitem_destroy(item);
+          blk_count += 1;
+          cmpct_count += 1;
+          break;
+        }
+
         block = btc_chain_get_block(chain, entry);
 
         if (block == NULL) {
@@ -1732,7 +3069,7 @@ btc_peer_flush_data(btc_peer_t *peer) {
           break;
         }
 
-        btc_peer_send_cmpctblock(peer, block);
+        btc_peer_send_cmpctblock(peer, block, item->hash);
 
         btc_block_destroy(block);
         btc_invitem_destroy(item);
@@ -1784,18 +3121,33 @@ btc_peer_flush_data(btc_peer_t *peer) {
       }
 
       case BTC_INV_TX:
-      case BTC_INV_WITNESS_TX: {
-        const btc_mpentry_t *entry = btc_mempool_get(mempool, item->hash);
+      case BTC_INV_WITNESS_TX:
+      case BTC_INV_WTX: {
+        enum btc_msgtype mtype = BTC_MSG_TX;
+        const btc_mpentry_t *entry;
+
+        if (type == BTC_INV_WTX)
+          entry = btc_mempool_get_wtxid(mempool, item->hash);
+        else
+          entry = btc_mempool_get(mempool, item->hash);
+
+        if (type == BTC_INV_TX)
+          mtype = BTC_MSG_TX_BASE;
 
         if (entry == NULL) {
           btc_inv_push(&nf, item);
           break;
         }
 
-        if (type == BTC_INV_TX)
-          btc_peer_sendmsg(peer, BTC_MSG_TX_BASE, entry->tx);
-        else
-          btc_peer_sendmsg(peer, BTC_MSG_TX, entry->tx);
+        /* Keyed by wtxid: the mempool's copy
+           of a txid may change its witness. */
+        if (!btc_peer_send_cached(peer, mtype, entry->whash)) {
+          btc_sockbuf_t *buf = btc_pool_frame(pool, mtype, entry->tx);
+
+          buf = btc_msgcache_put(&pool->msgcache, mtype, entry->whash, buf);
+
+          btc_peer_send_buf(peer, mtype, buf);
+        }
 
         btc_invitem_destroy(item);
 
@@ -1826,6 +3178,8 @@ btc_peer_flush_data(btc_peer_t *peer) {
   if (nf.length > 0)
     btc_peer_send_notfound(peer, &nf);
 
+  peer->blocks_served += blk_count;
+
   if (blk_count > 0) {
     btc_pool_debug(pool,
       "Served %d blocks with getdata (notfound=%zu, cmpct=%d) (%N).",
@@ -1899,67 +3253,117 @@ btc_peer_maybe_timeout(btc_peer_t *peer, int64_t now) {
     }
   }
 
-  if (btc_chain_synced(chain) || !peer->syncing) {
-    btc_mapiter_t it;
+  if (now > peer->time + 60000) {
+    int mult = (peer->version <= BTC_NET_PONG_VERSION ? 4 : 1);
+
+    if (peer->last_recv == 0 || peer->last_send == 0) {
+      btc_peer_error(peer, "Peer is stalling (no message) (%N).", &peer->addr);
+      btc_peer_close(peer);
+      return;
+    }
+
+    if (now > peer->last_send + 20 * 60000) {
+      btc_peer_error(peer, "Peer is stalling (send) (%N).", &peer->addr);
+      btc_peer_close(peer);
+      return;
+    }
 
-    btc_map_each(&peer->block_map, it) {
-      int64_t ts = peer->block_map.vals[it];
+    if (now > peer->last_recv + 20 * 60000 * mult) {
+      btc_peer_error(peer, "Peer is stalling (recv) (%N).", &peer->addr);
+      btc_peer_close(peer);
+      return;
+    }
 
-      if (now > ts + 120000) {
-        btc_peer_error(peer, "Peer is stalling (block) (%N).", &peer->addr);
-        btc_peer_close(peer);
-        return;
-      }
+    if (peer->challenge && now > peer->last_ping + 20 * 60000) {
+      btc_peer_error(peer, "Peer is stalling (ping) (%N).", &peer->addr);
+      btc_peer_close(peer);
+      return;
     }
+  }
+}
+
+static int
+btc_peer_may_stall(btc_peer_t *peer) {
+  /* The loader may sit on requests while we sync;
+     block_time covers it. We look again later. */
+  return btc_chain_synced(peer->pool->chain) || !peer->syncing;
+}
+
+static void
+btc_peer_on_stall(btc_peer_t *peer, btc_timer_t *timer, const char *type) {
+  /* Fired by a request's own deadline. */
+  if (peer->state == BTC_PEER_DEAD)
+    return;
+
+  if (!btc_peer_may_stall(peer)) {
+    btc_timer_start(timer, 5000);
+    return;
+  }
 
-    btc_map_each(&peer->tx_map, it) {
-      int64_t ts = peer->tx_map.vals[it];
+  btc_peer_error(peer, "Peer is stalling (%s) (%N).", type, &peer->addr);
+  btc_peer_close(peer);
+}
 
-      if (now > ts + 120000) {
-        btc_peer_error(peer, "Peer is stalling (tx) (%N).", &peer->addr);
-        btc_peer_close(peer);
-        return;
-      }
-    }
+static void
+btc_peer_on_compact_stall(btc_peer_t *peer) {
+  /* At most 15 compact blocks are pending,
+     so one timer for all of them will do. */
+  int64_t now = btc_time_msec();
+  int64_t next = -1;
+  btc_mapiter_t it;
 
-    btc_map_each(&peer->compact_map, it) {
-      btc_cmpct_t *block = peer->compact_map.vals[it];
+  if (peer->state == BTC_PEER_DEAD)
+    return;
 
-      if (now > block->now + 30000) {
-        btc_peer_error(peer, "Peer is stalling (blocktxn) (%N).", &peer->addr);
-        btc_peer_close(peer);
-        return;
-      }
-    }
+  if (!btc_peer_may_stall(peer)) {
+    btc_timer_start(peer->compact_timer, 5000);
+    return;
   }
 
-  if (now > peer->time + 60000) {
-    int mult = (peer->version <= BTC_NET_PONG_VERSION ? 4 : 1);
+  btc_map_each(&peer->compact_map, it) {
+    btc_cmpct_t *block = peer->compact_map.vals[it];
 
-    if (peer->last_recv == 0 || peer->last_send == 0) {
-      btc_peer_error(peer, "Peer is stalling (no message) (%N).", &peer->addr);
+    if (now > block->now + 30000) {
+      btc_peer_error(peer, "Peer is stalling (blocktxn) (%N).", &peer->addr);
       btc_peer_close(peer);
       return;
     }
 
-    if (now > peer->last_send + 20 * 60000) {
-      btc_peer_error(peer, "Peer is stalling (send) (%N).", &peer->addr);
-      btc_peer_close(peer);
-      return;
-    }
+    if (next == -1 || block->now < next)
+      next = block->now;
+  }
 
-    if (now > peer->last_recv + 20 * 60000 * mult) {
-      btc_peer_error(peer, "Peer is stalling (recv) (%N).", &peer->addr);
-      btc_peer_close(peer);
-      return;
+  if (next != -1)
+    btc_timer_start(peer->compact_timer, next + 30000 - now + 1);
+}
+
+static void
+btc_peer_on_recon(btc_peer_t *peer) {
+  /* Outbound: time for the next round. Inbound:
+     the initiator never finished the last one. */
+  if (peer->state != BTC_PEER_CONNECTED || !peer->recon)
+    return;
+
+  if (!peer->outbound) {
+    if (peer->recon_busy) {
+      btc_peer_debug(peer, "Peer is stalling (reconcildiff) (%N).",
+                           &peer->addr);
+      btc_peer_recon_finish(peer, NULL);
     }
+    return;
+  }
 
-    if (peer->challenge && now > peer->last_ping + 20 * 60000) {
-      btc_peer_error(peer, "Peer is stalling (ping) (%N).", &peer->addr);
-      btc_peer_close(peer);
+  btc_timer_start(peer->recon_timer, BTC_RECON_INTERVAL);
+
+  if (peer->recon_busy) {
+    if (btc_time_msec() < peer->recon_time + BTC_RECON_TIMEOUT)
       return;
-    }
+
+    btc_peer_debug(peer, "Peer is stalling (sketch) (%N).", &peer->addr);
+    btc_peer_recon_finish(peer, NULL);
   }
+
+  btc_peer_send_reqrecon(peer);
 }
 
 static void
@@ -1991,9 +3395,19 @@ btc_peer_on_tick(btc_peer_t *peer, int64_t now) {
     peer->stall_timer = now;
   }
 
+  if (now >= peer->rate_time + 10000) {
+    uint64_t blocks = peer->blocks_recv - peer->rate_blocks;
+
+    if (peer->rate_time > 0)
+      peer->block_rate = (double)blocks * 1000.0 / (now - peer->rate_time);
+
+    peer->rate_blocks = peer->blocks_recv;
+    peer->rate_time = now;
+  }
+
   btc_peer_flush_data(peer);
 
-  if (btc_socket_buffered(peer->socket) > (30 << 20)) {
+  if (btc_conn_buffered(peer->conn) > (30 << 20)) {
     btc_peer_error(peer, "Peer stalled (drain) (%N).", &peer->addr);
     btc_peer_close(peer);
     return;
@@ -2134,6 +3548,12 @@ btc_pool_create(const btc_network_t *network,
   btc_hashset_init(&pool->block_map);
   btc_hashset_init(&pool->tx_map);
   btc_hashset_init(&pool->compact_map);
+  btc_msgcache_init(&pool->msgcache);
+  btc_extras_init(&pool->extras);
+  pool->shards = NULL;
+  pool->threads = 0;
+  btc_mutex_init(&pool->lock);
+  btc_connq_init(&pool->outbox);
   pool->block_mode = 0;
   pool->checkpoints = 0;
   pool->header_tip = NULL;
@@ -2171,6 +3591,9 @@ btc_pool_destroy(btc_pool_t *pool) {
   btc_hashset_clear(&pool->block_map);
   btc_hashset_clear(&pool->tx_map);
   btc_hashset_clear(&pool->compact_map);
+  btc_msgcache_clear(&pool->msgcache);
+  btc_extras_clear(&pool->extras);
+  btc_mutex_destroy(&pool->lock);
   btc_free(pool);
 }
 
@@ -2229,6 +3652,21 @@ btc_pool_set_maxoutbound(btc_pool_t *pool, size_t max_outbound) {
   pool->max_outbound = max_outbound;
 }
 
+void
+btc_pool_set_threads(btc_pool_t *pool, int threads) {
+#if defined(_WIN32) || defined(BTC_PTHREAD)
+  if (threads < 0)
+    threads = 0;
+
+  if (threads > BTC_SHARD_MAX)
+    threads = BTC_SHARD_MAX;
+#else
+  threads = 0;
+#endif
+
+  pool->threads = threads;
+}
+
 void
 btc_pool_set_bantime(btc_pool_t *pool, int64_t ban_time) {
   btc_addrman_set_bantime(pool->addrman, ban_time);
@@ -2395,6 +3833,85 @@ btc_pool_reset_chain(btc_pool_t *pool) {
   }
 }
 
+static btc_shard_t *
+btc_pool_shard(btc_pool_t *pool) {
+  /* Least loaded I/O thread, if any. */
+  btc_shard_t *best = NULL;
+  int i;
+
+  if (pool->shards == NULL)
+    return NULL;
+
+  for (i = 0; i < pool->threads; i++) {
+    btc_shard_t *shard = &pool->shards[i];
+
+    if (best == NULL || shard->peers < best->peers)
+      best = shard;
+  }
+
+  return best;
+}
+
+static void
+btc_pool_drain(btc_pool_t *pool) {
+  btc_connev_t *ev, *next;
+
+  btc_mutex_lock(&pool->lock);
+
+  ev = btc_connq_take(&pool->outbox);
+
+  btc_mutex_unlock(&pool->lock);
+
+  for (; ev != NULL; ev = next) {
+    next = ev->next;
+
+    btc_conn_dispatch(ev->conn, ev);
+
+    if (ev->type == BTC_CONNEV_MSG)
+      btc_conn_consume(ev->conn, ev->length);
+
+    btc_connev_destroy(ev);
+  }
+}
+
+static void
+btc_pool_start_shards(btc_pool_t *pool) {
+  int i;
+
+  if (pool->threads == 0)
+    return;
+
+  btc_pool_info(pool, "Starting %d I/O threads.", pool->threads);
+
+  pool->shards = btc_malloc(pool->threads * sizeof(btc_shard_t));
+
+  for (i = 0; i < pool->threads; i++) {
+    btc_shard_init(&pool->shards[i], pool);
+    btc_shard_start(&pool->shards[i]);
+  }
+}
+
+static void
+btc_pool_stop_shards(btc_pool_t *pool) {
+  int i;
+
+  if (pool->shards == NULL)
+    return;
+
+  for (i = 0; i < pool->threads; i++)
+    btc_shard_stop(&pool->shards[i]);
+
+  /* Deliver the final close events. */
+  btc_pool_drain(pool);
+
+  for (i = 0; i < pool->threads; i++)
+    btc_shard_clear(&pool->shards[i]);
+
+  btc_free(pool->shards);
+
+  pool->shards = NULL;
+}
+
 int
 btc_pool_open(btc_pool_t *pool, const char *prefix, unsigned int flags) {
   char file[BTC_PATH_MAX];
@@ -2431,6 +3948,8 @@ btc_pool_open(btc_pool_t *pool, const char *prefix, unsigned int flags) {
 
   btc_pool_reset_chain(pool);
 
+  btc_pool_start_shards(pool);
+
   btc_loop_on_tick(pool->loop, on_tick, pool);
 
   return 1;
@@ -2444,7 +3963,9 @@ btc_pool_close(btc_pool_t *pool) {
 
   btc_server_close(pool->server);
   btc_peers_close(&pool->peers);
+  btc_pool_stop_shards(pool);
   btc_pool_clear_chain(pool);
+  btc_msgcache_clear(&pool->msgcache);
   btc_addrman_close(pool->addrman);
 }
 
@@ -2777,6 +4298,8 @@ btc_pool_on_connect(btc_pool_t *pool, btc_peer_t *peer) {
 static void
 btc_pool_on_complete(btc_pool_t *pool, btc_peer_t *peer) {
   const btc_netaddr_t *addr;
+  btc_peer_t *other;
+  int flooding = 0;
 
   if (peer->outbound) {
     /* Advertise our address. */
@@ -2796,6 +4319,21 @@ btc_pool_on_complete(btc_pool_t *pool, btc_peer_t *peer) {
   if (pool->flags & BTC_POOL_BIP152)
     btc_peer_send_sendcmpct(peer, pool->block_mode);
 
+  /* We initiate reconciliation with outbound peers,
+     and keep flooding to a few of them regardless. */
+  if (peer->recon && peer->outbound) {
+    for (other = pool->peers.head; other != NULL; other = other->next)
+      flooding += other->recon_flood;
+
+    if (flooding < BTC_RECON_FANOUT)
+      peer->recon_flood = 1;
+
+    btc_timer_start(peer->recon_timer, BTC_RECON_INTERVAL);
+
+    btc_peer_debug(peer, "Reconciling transactions with %N (flood=%d).",
+                         &peer->addr, peer->recon_flood);
+  }
+
   if (peer->outbound) {
     /* Start syncing the chain. */
     btc_pool_send_sync(pool, peer);
@@ -2838,36 +4376,75 @@ btc_pool_resync(btc_pool_t *pool, int force) {
   btc_vector_clear(&locator);
 }
 
+static void
+btc_request_put(btc_hashset_t *set,
+                btc_hashmap_t *map,
+                const uint8_t *hash,
+                btc_timer_t *timer,
+                int64_t timeout) {
+  /* Each request carries its own deadline. */
+  uint8_t *key = btc_hash_clone(hash);
+
+  btc_timer_start(timer, timeout);
+
+  btc_hashset_put(set, key);
+  btc_hashmap_put(map, key, timer);
+}
+
 static int
-btc_pool_resolve_block(btc_pool_t *pool,
-                       btc_peer_t *peer,
-                       const uint8_t *hash) {
-  uint8_t *key = btc_hashtab_del(&peer->block_map, hash);
+btc_request_del(btc_hashset_t *set,
+                btc_hashmap_t *map,
+                const uint8_t *hash) {
+  btc_mapiter_t it = btc_hashmap_lookup(map, hash);
+  uint8_t *key;
 
-  if (key == NULL)
+  if (it == map->n_buckets)
     return 0;
 
-  CHECK(btc_hashset_del(&pool->block_map, hash) == key);
+  key = map->keys[it];
+
+  btc_timer_destroy(map->vals[it]);
+  btc_hashmap_remove(map, it);
+
+  CHECK(btc_hashset_del(set, hash) == key);
 
   btc_free(key);
 
   return 1;
 }
 
-static int
-btc_pool_resolve_tx(btc_pool_t *pool,
-                    btc_peer_t *peer,
-                    const uint8_t *hash) {
-  uint8_t *key = btc_hashtab_del(&peer->tx_map, hash);
+static void
+btc_pool_track_block(btc_pool_t *pool,
+                     btc_peer_t *peer,
+                     const uint8_t *hash,
+                     int64_t timeout) {
+  btc_timer_t *timer = btc_timer_create(pool->loop, on_block_stall, peer);
 
-  if (key == NULL)
-    return 0;
+  btc_request_put(&pool->block_map, &peer->block_map, hash, timer, timeout);
+}
 
-  CHECK(btc_hashset_del(&pool->tx_map, hash) == key);
+static void
+btc_pool_track_tx(btc_pool_t *pool,
+                  btc_peer_t *peer,
+                  const uint8_t *hash,
+                  int64_t timeout) {
+  btc_timer_t *timer = btc_timer_create(pool->loop, on_tx_stall, peer);
 
-  btc_free(key);
+  btc_request_put(&pool->tx_map, &peer->tx_map, hash, timer, timeout);
+}
 
-  return 1;
+static int
+btc_pool_resolve_block(btc_pool_t *pool,
+                       btc_peer_t *peer,
+                       const uint8_t *hash) {
+  return btc_request_del(&pool->block_map, &peer->block_map, hash);
+}
+
+static int
+btc_pool_resolve_tx(btc_pool_t *pool,
+                    btc_peer_t *peer,
+                    const uint8_t *hash) {
+  return btc_request_del(&pool->tx_map, &peer->tx_map, hash);
 }
 
 static int
@@ -2877,6 +4454,7 @@ btc_pool_resolve_item(btc_pool_t *pool,
   switch (item->type) {
     case BTC_INV_TX:
     case BTC_INV_WITNESS_TX:
+    case BTC_INV_WTX:
       return btc_pool_resolve_tx(pool, peer, item->hash);
     case BTC_INV_BLOCK:
     case BTC_INV_FILTERED_BLOCK:
@@ -2912,6 +4490,7 @@ static void
 btc_pool_on_close(btc_pool_t *pool, btc_peer_t *peer) {
   size_t size = peer->block_map.size;
   int loader = peer->loader;
+  btc_peer_t *other;
 
   btc_pool_remove_peer(pool, peer);
 
@@ -2922,8 +4501,33 @@ btc_pool_on_close(btc_pool_t *pool, btc_peer_t *peer) {
       btc_pool_reset_chain(pool);
   }
 
+  if (peer->recon_flood) {
+    /* Hand flooding off to another reconciling peer. */
+    for (other = pool->peers.head; other != NULL; other = other->next) {
+      if (other->recon && other->outbound && !other->recon_flood) {
+        btc_pool_debug(pool, "Flooding transactions to %N.", &other->addr);
+        other->recon_flood = 1;
+        break;
+      }
+    }
+  }
+
   btc_nonces_remove(&pool->nonces, peer->nonce);
 
+  btc_mempool_drop_orphans(pool->mempool, peer->id);
+
+  btc_pool_debug(pool,
+    "Announced txs to %N with %llu/%llu inv and %llu/%llu recon bytes.",
+    &peer->addr,
+    peer->traffic.bytes_sent[BTC_MSG_INV]
+      + peer->traffic.bytes_sent[BTC_MSG_INV_FULL],
+    peer->traffic.bytes_recv[BTC_MSG_INV]
+      + peer->traffic.bytes_recv[BTC_MSG_INV_FULL],
+    btc_peer_recon_bytes(peer->traffic.bytes_sent),
+    btc_peer_recon_bytes(peer->traffic.bytes_recv));
+
+  btc_traffic_add(&pool->traffic, &peer->traffic);
+
   if (btc_chain_synced(pool->chain) && size > 0) {
     btc_pool_warn(pool, "Peer disconnected with requested blocks (%N).",
                        &peer->addr);
@@ -3171,8 +4775,8 @@ static void
 btc_pool_request_blocks(btc_pool_t *pool,
                         btc_peer_t *peer,
                         const btc_vector_t *hashes) {
+  int64_t timeout = 120000;
   btc_zinv_t inv;
-  int64_t now;
   size_t i;
 
   if (peer->state != BTC_PEER_CONNECTED) {
@@ -3181,25 +4785,19 @@ btc_pool_request_blocks(btc_pool_t *pool,
     return;
   }
 
-  now = btc_time_msec();
-
   btc_zinv_init(&inv);
   btc_zinv_grow(&inv, hashes->length);
 
   for (i = 0; i < hashes->length; i++) {
     const uint8_t *hash = hashes->items[i];
-    uint8_t *key;
 
     if (btc_hashset_has(&pool->block_map, hash))
       continue;
 
-    key = btc_hash_clone(hash);
-
-    btc_hashset_put(&pool->block_map, key);
-    btc_hashtab_put(&peer->block_map, key, now);
+    btc_pool_track_block(pool, peer, hash, timeout);
 
     if (btc_chain_synced(pool->chain))
-      now += 100;
+      timeout += 100;
 
     btc_zinv_push(&inv, btc_peer_block_type(peer), hash);
   }
@@ -3289,9 +4887,11 @@ btc_pool_on_blockinv(btc_pool_t *pool,
 static void
 btc_pool_request_txs(btc_pool_t *pool,
                      btc_peer_t *peer,
-                     const btc_vector_t *hashes) {
+                     const btc_vector_t *hashes,
+                     int wtxid) {
+  uint32_t type = wtxid ? BTC_INV_WTX : btc_peer_tx_type(peer);
+  int64_t timeout = 120000;
   btc_zinv_t inv;
-  int64_t now;
   size_t i;
 
   if (peer->state != BTC_PEER_CONNECTED) {
@@ -3300,27 +4900,21 @@ btc_pool_request_txs(btc_pool_t *pool,
     return;
   }
 
-  now = btc_time_msec();
-
   btc_zinv_init(&inv);
   btc_zinv_grow(&inv, hashes->length);
 
   for (i = 0; i < hashes->length; i++) {
     const uint8_t *hash = hashes->items[i];
-    uint8_t *key;
 
     if (btc_hashset_has(&pool->tx_map, hash))
       continue;
 
-    key = btc_hash_clone(hash);
-
-    btc_hashset_put(&pool->tx_map, key);
-    btc_hashtab_put(&peer->tx_map, key, now);
+    btc_pool_track_tx(pool, peer, hash, timeout);
 
     if (btc_chain_synced(pool->chain))
-      now += 50;
+      timeout += 50;
 
-    btc_zinv_push(&inv, btc_peer_tx_type(peer), hash);
+    btc_zinv_push(&inv, type, hash);
   }
 
   if (inv.length == 0) {
@@ -3345,14 +4939,20 @@ btc_pool_request_txs(btc_pool_t *pool,
 }
 
 static int
-btc_pool_has_tx(btc_pool_t *pool, const uint8_t *hash) {
+btc_pool_has_tx(btc_pool_t *pool, const uint8_t *hash, int wtxid) {
+  btc_mempool_t *mempool = pool->mempool;
+
   /* Check the mempool. */
-  if (btc_mempool_has(pool->mempool, hash))
+  if (wtxid ? btc_mempool_has_wtxid(mempool, hash)
+            : btc_mempool_has(mempool, hash)) {
     return 1;
+  }
 
   /* Check for orphans. */
-  if (btc_mempool_has_orphan(pool->mempool, hash))
+  if (wtxid ? btc_mempool_has_orphan_wtxid(mempool, hash)
+            : btc_mempool_has_orphan(mempool, hash)) {
     return 1;
+  }
 
   /* If we recently rejected this item. Ignore. */
   if (btc_mempool_has_reject(pool->mempool, hash)) {
@@ -3383,13 +4983,13 @@ btc_pool_on_txinv(btc_pool_t *pool,
   for (i = 0; i < hashes->length; i++) {
     const uint8_t *hash = hashes->items[i];
 
-    if (btc_pool_has_tx(pool, hash))
+    if (btc_pool_has_tx(pool, hash, peer->wtxid_relay))
       continue;
 
     btc_vector_push(&out, hash);
   }
 
-  btc_pool_request_txs(pool, peer, &out);
+  btc_pool_request_txs(pool, peer, &out, peer->wtxid_relay);
 
   btc_vector_clear(&out);
 }
@@ -3419,7 +5019,10 @@ btc_pool_on_inv(btc_pool_t *pool,
         btc_vector_push(&blocks, item->hash);
         break;
       case BTC_INV_TX:
-        btc_vector_push(&txs, item->hash);
+      case BTC_INV_WTX:
+        /* bip339: one or the other, as negotiated. */
+        if ((item->type == BTC_INV_WTX) == peer->wtxid_relay)
+          btc_vector_push(&txs, item->hash);
         break;
       default:
         unknown = item->type;
@@ -3818,6 +5421,84 @@ btc_pool_announce_tx(btc_pool_t *pool, const btc_mpentry_t *entry) {
   }
 }
 
+void
+btc_pool_add_extra_tx(btc_pool_t *pool, const btc_tx_t *tx) {
+  btc_extras_push(&pool->extras, tx);
+}
+
+size_t
+btc_pool_peers(btc_pool_t *pool) {
+  return pool->peers.length;
+}
+
+size_t
+btc_pool_get_peers(btc_pool_t *pool, btc_peerinfo_t *items, size_t size) {
+  /* Peer timestamps are monotonic; report unix time. */
+  int64_t skew = btc_now() * 1000 - btc_time_msec();
+  btc_peer_t *peer;
+  size_t i = 0;
+
+  for (peer = pool->peers.head; peer != NULL && i < size; peer = peer->next) {
+    btc_peerinfo_t *info = &items[i];
+
+    if (peer->state != BTC_PEER_CONNECTED)
+      continue;
+
+    info->id = peer->id;
+    info->addr = peer->addr;
+    info->local = peer->local;
+    info->outbound = peer->outbound;
+    info->version = peer->version;
+    info->services = peer->services;
+
+    strcpy(info->agent, peer->agent);
+
+    info->relay = peer->relay;
+    info->height = peer->height;
+    info->ban_score = peer->ban_score;
+    info->time = (peer->time + skew) / 1000;
+    info->last_send = 0;
+    info->last_recv = 0;
+
+    if (peer->last_send > 0)
+      info->last_send = (peer->last_send + skew) / 1000;
+
+    if (peer->last_recv > 0)
+      info->last_recv = (peer->last_recv + skew) / 1000;
+
+    info->ping = peer->ping;
+    info->min_ping = peer->min_ping;
+    info->avg_ping = -1;
+
+    if (peer->ping_count > 0)
+      info->avg_ping = peer->ping_total / peer->ping_count;
+
+    info->buffered = btc_conn_buffered(peer->conn);
+    info->buffered_max = peer->buffered_max;
+    info->blocks_served = peer->blocks_served;
+    info->blocks_recv = peer->blocks_recv;
+    info->block_rate = peer->block_rate;
+    info->compact_hb_to = peer->compact_mode == 1;
+    info->compact_hb_from = peer->compact_hb;
+    info->recon = peer->recon;
+    info->traffic = peer->traffic;
+
+    i++;
+  }
+
+  return i;
+}
+
+void
+btc_pool_get_traffic(btc_pool_t *pool, btc_traffic_t *traffic) {
+  btc_peer_t *peer;
+
+  *traffic = pool->traffic;
+
+  for (peer = pool->peers.head; peer != NULL; peer = peer->next)
+    btc_traffic_add(traffic, &peer->traffic);
+}
+
 void
 btc_pool_handle_badorphan(btc_pool_t *pool,
                           const char *msg,
@@ -3838,6 +5519,128 @@ btc_pool_handle_badorphan(btc_pool_t *pool,
   btc_peer_reject(peer, msg, err);
 }
 
+static void
+btc_peer_send_compact_mode(btc_peer_t *peer, uint8_t mode) {
+  btc_sendcmpct_t msg;
+
+  btc_peer_debug(peer, "Switching to compact blocks mode %hhu (%N).",
+                       mode, &peer->addr);
+
+  msg.mode = mode;
+  msg.version = 2;
+
+  peer->compact_hb = mode;
+
+  btc_peer_sendmsg(peer, BTC_MSG_SENDCMPCT, &msg);
+}
+
+static void
+btc_pool_select_compact(btc_pool_t *pool, btc_peer_t *peer) {
+  /* The last few peers to hand us a new tip are asked
+     to push compact blocks before validating them
+     (bip152 high-bandwidth mode). One of them stays
+     outbound so inbound peers can't take every slot. */
+  btc_peer_t *oldest = NULL;
+  btc_peer_t *other;
+  int outbound = 0;
+  int count = 0;
+
+  if (!(pool->flags & BTC_POOL_BIP152) || pool->block_mode == 1)
+    return;
+
+  if (!btc_chain_synced(pool->chain))
+    return;
+
+  if (!btc_peer_has_compact_support(peer) || !btc_peer_has_compact(peer))
+    return;
+
+  peer->compact_time = btc_time_msec();
+
+  if (peer->compact_hb)
+    return;
+
+  for (other = pool->peers.head; other != NULL; other = other->next) {
+    if (other->compact_hb) {
+      outbound += other->outbound;
+      count += 1;
+    }
+  }
+
+  if (count >= BTC_COMPACT_HB_PEERS) {
+    for (other = pool->peers.head; other != NULL; other = other->next) {
+      if (!other->compact_hb)
+        continue;
+
+      if (other->outbound && outbound == 1 && !peer->outbound)
+        continue;
+
+      if (oldest == NULL || other->compact_time < oldest->compact_time)
+        oldest = other;
+    }
+
+    CHECK(oldest != NULL);
+
+    btc_peer_send_compact_mode(oldest, 0);
+  }
+
+  btc_peer_send_compact_mode(peer, 1);
+}
+
+static void
+btc_pool_relay_compact(btc_pool_t *pool,
+                       btc_peer_t *source,
+                       const btc_block_t *block,
+                       const uint8_t *hash) {
+  /* Push a new tip to our high-bandwidth peers as
+     soon as its proof of work checks out, ahead of
+     full validation (bip152). Everyone else hears
+     about it once it's connected. */
+  const btc_entry_t *tip = btc_chain_tip(pool->chain);
+  const btc_header_t *hdr = &block->header;
+  int64_t now = btc_timedata_now(pool->timedata);
+  btc_verify_error_t err;
+  btc_peer_t *peer;
+  size_t count = 0;
+
+  if (!btc_chain_synced(pool->chain))
+    return;
+
+  if (memcmp(hdr->prev_block, tip->hash, 32) != 0)
+    return;
+
+  for (peer = pool->peers.head; peer != NULL; peer = peer->next) {
+    if (peer != source && peer->compact_mode == 1)
+      count += 1;
+  }
+
+  if (count == 0)
+    return;
+
+  /* The header's own bits say nothing; anyone can
+     mine an easy header. Require the work the chain
+     expects of the next block, a sane timestamp and
+     a body which matches the merkle root. */
+  if (hdr->bits != btc_chain_get_target(pool->chain, hdr->time, tip))
+    return;
+
+  if (hdr->time <= btc_entry_median_time(tip))
+    return;
+
+  if (!btc_header_verify(hdr))
+    return;
+
+  if (!btc_block_check_sanity(&err, block, now))
+    return;
+
+  for (peer = pool->peers.head; peer != NULL; peer = peer->next) {
+    if (peer == source || peer->state != BTC_PEER_CONNECTED)
+      continue;
+
+    if (peer->compact_mode == 1)
+      btc_peer_announce_block(peer, block, hash);
+  }
+}
+
 static void
 btc_pool_add_block(btc_pool_t *pool,
                    btc_peer_t *peer,
@@ -3857,6 +5660,9 @@ btc_pool_add_block(btc_pool_t *pool,
 
   peer->block_time = btc_time_msec();
   peer->last_ping = peer->block_time;
+  peer->blocks_recv += 1;
+
+  btc_pool_relay_compact(pool, peer, block, hash);
 
   if (!btc_chain_add(pool->chain, block, flags, peer->id)) {
     btc_peer_reject(peer, "block", btc_chain_error(pool->chain));
@@ -3882,6 +5688,9 @@ btc_pool_add_block(btc_pool_t *pool,
     btc_pool_resync(pool, 0);
   }
 
+  if (memcmp(btc_chain_tip(pool->chain)->hash, hash, 32) == 0)
+    btc_pool_select_compact(pool, peer);
+
   height = btc_chain_height(pool->chain);
 
   if (height % 20 == 0) {
@@ -3915,7 +5724,10 @@ btc_pool_on_block(btc_pool_t *pool,
 
 static void
 btc_pool_on_tx(btc_pool_t *pool, btc_peer_t *peer, const btc_tx_t *tx) {
-  if (!btc_pool_resolve_tx(pool, peer, tx->hash)) {
+  /* Announced txs are requested by wtxid where
+     negotiated, missing parents always by txid. */
+  if (!btc_pool_resolve_tx(pool, peer, tx->whash) &&
+      !btc_pool_resolve_tx(pool, peer, tx->hash)) {
     btc_pool_warn(pool, "Peer sent unrequested tx: %H (%N).",
                         tx->hash, &peer->addr);
     btc_peer_close(peer);
@@ -3923,18 +5735,26 @@ btc_pool_on_tx(btc_pool_t *pool, btc_peer_t *peer, const btc_tx_t *tx) {
   }
 
   if (!btc_mempool_add(pool->mempool, tx, peer->id)) {
-    btc_peer_reject(peer, "tx", btc_mempool_error(pool->mempool));
+    const btc_verify_error_t *err = btc_mempool_error(pool->mempool);
+
+    /* A miner may see things differently. */
+    if (!err->malleated && err->code != BTC_REJECT_ALREADYKNOWN)
+      btc_extras_push(&pool->extras, tx);
+
+    btc_peer_reject(peer, "tx", err);
     return;
   }
 
   if (btc_mempool_has_orphan(pool->mempool, tx->hash)) {
     btc_vector_t *missing = btc_mempool_missing(pool->mempool, tx);
 
+    btc_extras_push(&pool->extras, tx);
+
     if (missing->length > 0) {
       btc_pool_debug(pool, "Requesting %zu missing transactions (%N).",
                            missing->length, &peer->addr);
 
-      btc_pool_request_txs(pool, peer, missing);
+      btc_pool_request_txs(pool, peer, missing, 0);
     }
 
     btc_vector_destroy(missing);
@@ -3979,7 +5799,10 @@ btc_pool_on_mempool(btc_pool_t *pool, btc_peer_t *peer) {
   btc_map_each(map, it) {
     const btc_mpentry_t *entry = map->vals[it];
 
-    btc_zinv_push(&items, BTC_INV_TX, entry->hash);
+    if (peer->wtxid_relay)
+      btc_zinv_push(&items, BTC_INV_WTX, entry->whash);
+    else
+      btc_zinv_push(&items, BTC_INV_TX, entry->hash);
 
     if (items.length == 1000) {
       btc_peer_send_inv(peer, &items);
@@ -4051,7 +5874,7 @@ static void
 btc_pool_on_cmpctblock(btc_pool_t *pool,
                        btc_peer_t *peer,
                        btc_cmpct_t *block) {
-  const btc_hashmap_t *map = btc_mempool_map(pool->mempool);
+  const btc_mpindex_t *index = btc_mempool_index(pool->mempool);
   int rc;
 
   if (!(pool->flags & BTC_POOL_BIP152)) {
@@ -4080,10 +5903,10 @@ btc_pool_on_cmpctblock(btc_pool_t *pool,
     return;
   }
 
-  if (!btc_hashtab_has(&peer->block_map, block->hash)) {
-    uint8_t *hash;
-
-    if (pool->block_mode != 1) {
+  if (!btc_hashmap_has(&peer->block_map, block->hash)) {
+    /* A peer we've since demoted from high-bandwidth
+       mode may still have had one in flight. */
+    if (pool->block_mode != 1 && peer->compact_time == 0) {
       btc_pool_debug(pool, "Peer sent us an unrequested compact block (%N).",
                            &peer->addr);
       btc_peer_close(peer);
@@ -4092,12 +5915,21 @@ btc_pool_on_cmpctblock(btc_pool_t *pool,
 
     btc_filter_add(&peer->inv_filter, block->hash, 32);
 
-    CHECK(!btc_hashset_has(&pool->block_map, block->hash));
+    /* Another peer announced it first and we've
+       asked them for it. Let that request finish. */
+    if (btc_hashset_has(&pool->block_map, block->hash)) {
+      btc_pool_debug(pool, "Already requested compact block %H (%N).",
+                           block->hash, &peer->addr);
+      return;
+    }
 
-    hash = btc_hash_clone(block->hash);
+    if (btc_chain_has_hash(pool->chain, block->hash)) {
+      btc_pool_debug(pool, "Peer sent a known compact block %H (%N).",
+                           block->hash, &peer->addr);
+      return;
+    }
 
-    btc_hashset_put(&pool->block_map, hash);
-    btc_hashtab_put(&peer->block_map, hash, btc_time_msec());
+    btc_pool_track_block(pool, peer, block->hash, 120000);
   }
 
   if (!btc_header_verify(&block->header)) {
@@ -4124,7 +5956,9 @@ btc_pool_on_cmpctblock(btc_pool_t *pool,
     return;
   }
 
-  if (btc_cmpct_fill_mempool(block, map, peer->compact_witness)) {
+  if (btc_cmpct_fill_mempool(block, index, peer->compact_witness)
+      || btc_cmpct_fill_extra(block, pool->extras.items, BTC_EXTRA_TXS,
+                              peer->compact_witness)) {
     btc_block_t *blk = btc_block_create();
 
     btc_pool_debug(pool, "Received full compact block %H (%N).",
@@ -4148,6 +5982,9 @@ btc_pool_on_cmpctblock(btc_pool_t *pool,
   CHECK(btc_hashset_put(&pool->compact_map, block->hash));
   CHECK(btc_hashmap_put(&peer->compact_map, block->hash, btc_cmpct_ref(block)));
 
+  if (!btc_timer_active(peer->compact_timer))
+    btc_timer_start(peer->compact_timer, 30000);
+
   btc_pool_debug(pool, "Received non-full compact block %H tx=%zu/%zu (%N).",
                        block->hash, block->count, block->avail.length,
                        &peer->addr);
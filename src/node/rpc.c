@@ -42,6 +42,7 @@
 #include <mako/netaddr.h>
 #include <mako/netmsg.h>
 #include <mako/network.h>
+#include <mako/printf.h>
 #include <mako/script.h>
 #include <mako/tx.h>
 #include <mako/util.h>
@@ -198,6 +199,7 @@ typedef struct rpc_res_s {
   json_value *result;
   json_int_t code;
   const char *msg;
+  int deferred;
 } rpc_res_t;
 
 static void
@@ -205,6 +207,7 @@ rpc_res_init(rpc_res_t *res) {
   res->result = NULL;
   res->code = 0;
   res->msg = NULL;
+  res->deferred = 0;
 }
 
 static void
@@ -272,6 +275,9 @@ struct btc_rpc_s {
   int port;
   btc_vector_t bind;
   uint8_t auth_hash[32];
+  http_res_t *http_res;
+  const json_value *http_id;
+  btc_vector_t waiters;
 };
 
 BTC_DEFINE_LOGGER(btc_log, btc_rpc_t, "rpc")
@@ -301,6 +307,7 @@ btc_rpc_create(btc_node_t *node) {
   rpc->port = network->rpc_port;
 
   btc_vector_init(&rpc->bind);
+  btc_vector_init(&rpc->waiters);
 
   rpc->http->on_request = on_request;
   rpc->http->data = rpc;
@@ -315,7 +322,10 @@ btc_rpc_destroy(btc_rpc_t *rpc) {
   for (i = 0; i < rpc->bind.length; i++)
     btc_free(rpc->bind.items[i]);
 
+  CHECK(rpc->waiters.length == 0);
+
   btc_vector_clear(&rpc->bind);
+  btc_vector_clear(&rpc->waiters);
   http_server_destroy(rpc->http);
   btc_free(rpc);
 }
@@ -397,10 +407,15 @@ btc_rpc_open(btc_rpc_t *rpc, unsigned int flags) {
   return 1;
 }
 
+static void
+btc_rpc_drop_waiters(btc_rpc_t *rpc);
+
 void
 btc_rpc_close(btc_rpc_t *rpc) {
   btc_log_info(rpc, "Closing RPC.");
 
+  btc_rpc_drop_waiters(rpc);
+
   http_server_close(rpc->http);
 }
 
@@ -679,10 +694,26 @@ static void
 btc_rpc_getmempoolinfo(btc_rpc_t *rpc,
                        const json_params *params,
                        rpc_res_t *res) {
-  (void)rpc;
+  btc_mempool_t *mp = rpc->mempool;
+  int64_t min_relay = rpc->network->min_relay;
+  json_value *obj;
 
   if (params->help || params->length != 0)
     THROW_MISC("getmempoolinfo");
+
+  obj = json_object_new(8);
+
+  json_object_push(obj, "loaded", json_boolean_new(1));
+  json_object_push(obj, "size", json_integer_new(btc_mempool_size(mp)));
+  json_object_push(obj, "bytes", json_integer_new(btc_mempool_bytes(mp)));
+  json_object_push(obj, "usage", json_integer_new(btc_mempool_usage(mp)));
+  json_object_push(obj, "total_fee", json_amount_new(btc_mempool_fees(mp)));
+  json_object_push(obj, "maxmempool",
+                        json_integer_new(btc_mempool_max_size(mp)));
+  json_object_push(obj, "mempoolminfee", json_amount_new(min_relay));
+  json_object_push(obj, "minrelaytxfee", json_amount_new(min_relay));
+
+  res->result = obj;
 }
 
 static void
@@ -934,14 +965,390 @@ btc_rpc_setgenerate(btc_rpc_t *rpc, const json_params *params, rpc_res_t *res) {
  * Mining
  */
 
+/*
+ * Long Polling
+ */
+
+#define RPC_LONGPOLL_MIN_DELTA 1000
+
+typedef struct rpc_waiter_s {
+  btc_rpc_t *rpc;
+  http_res_t *res;
+  json_value *id;
+  uint8_t tip[32];
+  int64_t fees;
+} rpc_waiter_t;
+
+static rpc_waiter_t *
+rpc_waiter_create(btc_rpc_t *rpc, const uint8_t *tip, int64_t fees) {
+  rpc_waiter_t *waiter = btc_malloc(sizeof(rpc_waiter_t));
+  const json_value *id = rpc->http_id;
+
+  waiter->rpc = rpc;
+  waiter->res = rpc->http_res;
+
+  if (id != NULL && id->type == json_integer)
+    waiter->id = json_integer_new(id->u.integer);
+  else if (id != NULL && id->type == json_string)
+    waiter->id = json_string_new(id->u.string.ptr);
+  else
+    waiter->id = json_null_new();
+
+  btc_hash_copy(waiter->tip, tip);
+
+  waiter->fees = fees;
+
+  return waiter;
+}
+
+static void
+rpc_waiter_destroy(rpc_waiter_t *waiter) {
+  json_builder_free(waiter->id);
+  btc_free(waiter);
+}
+
+static void
+rpc_waiter_send(rpc_waiter_t *waiter, const char *result) {
+  /* The template is serialized once for every
+     waiter; splice it into each response. */
+  char *id = json_encode(waiter->id);
+  size_t size = strlen(result) + strlen(id) + 32;
+  char *body = btc_malloc(size);
+  int len;
+
+  len = sprintf(body, "{\"result\":%s,\"error\":null,\"id\":%s}\n",
+                      result, id);
+
+  http_res_send_data(waiter->res, 200, "application/json", body, len);
+
+  free(id);
+}
+
+static void
+btc_rpc_remove_waiter(btc_rpc_t *rpc, const rpc_waiter_t *waiter) {
+  size_t i;
+
+  for (i = 0; i < rpc->waiters.length; i++) {
+    if (rpc->waiters.items[i] == waiter) {
+      rpc->waiters.items[i] = btc_vector_pop(&rpc->waiters);
+      break;
+    }
+  }
+}
+
+static void
+on_waiter_close(http_res_t *res) {
+  rpc_waiter_t *waiter = res->data;
+
+  btc_rpc_remove_waiter(waiter->rpc, waiter);
+
+  rpc_waiter_destroy(waiter);
+}
+
+static void
+btc_rpc_drop_waiters(btc_rpc_t *rpc) {
+  size_t i;
+
+  for (i = 0; i < rpc->waiters.length; i++) {
+    rpc_waiter_t *waiter = rpc->waiters.items[i];
+
+    btc_socket_close(waiter->res->socket);
+
+    http_res_release(waiter->res);
+
+    rpc_waiter_destroy(waiter);
+  }
+
+  btc_vector_reset(&rpc->waiters);
+}
+
+static void
+btc_rpc_longpoll_id(char *zp, const uint8_t *tip, int64_t fees) {
+  btc_hash_export(zp, tip);
+  btc_sprintf(zp + 64, "%T", fees);
+}
+
+static int
+btc_rpc_longpoll_parse(uint8_t *tip, int64_t *fees, const char *xp) {
+  size_t len = strlen(xp);
+  int64_t num = 0;
+  char str[65];
+  size_t i;
+
+  if (len <= 64 || len > 64 + 16)
+    return 0;
+
+  memcpy(str, xp, 64);
+
+  str[64] = '\0';
+
+  if (!btc_hash_import(tip, str))
+    return 0;
+
+  for (i = 64; i < len; i++) {
+    int ch = xp[i];
+
+    if (ch < '0' || ch > '9')
+      return 0;
+
+    num = num * 10 + (ch - '0');
+  }
+
+  if (num > BTC_MAX_MONEY)
+    return 0;
+
+  *fees = num;
+
+  return 1;
+}
+
+static int
+btc_rpc_longpoll_ready(btc_rpc_t *rpc, const uint8_t *tip, int64_t fees) {
+  const btc_entry_t *entry = btc_chain_tip(rpc->chain);
+  int64_t delta = fees / 16;
+
+  if (!btc_hash_equal(entry->hash, tip))
+    return 1;
+
+  if (delta < RPC_LONGPOLL_MIN_DELTA)
+    delta = RPC_LONGPOLL_MIN_DELTA;
+
+  return btc_mempool_fees(rpc->mempool) >= fees + delta;
+}
+
+static int
+btc_rpc_longpoll_wait(btc_rpc_t *rpc, const uint8_t *tip, int64_t fees) {
+  rpc_waiter_t *waiter;
+
+  /* Only plain (non-batched) HTTP requests can be parked. */
+  if (rpc->http_res == NULL)
+    return 0;
+
+  waiter = rpc_waiter_create(rpc, tip, fees);
+
+  if (!http_res_defer(rpc->http_res, on_waiter_close, waiter)) {
+    rpc_waiter_destroy(waiter);
+    return 0;
+  }
+
+  btc_vector_push(&rpc->waiters, waiter);
+
+  return 1;
+}
+
+/*
+ * Mining
+ */
+
+static json_value *
+btc_rpc_template_json(btc_rpc_t *rpc, const btc_tmpl_t *bt) {
+  int64_t fees = btc_mempool_fees(rpc->mempool);
+  json_value *obj, *txs, *aux, *rules, *mut;
+  char lpid[64 + 21];
+  uint8_t target[32];
+  btc_hashtab_t index;
+  char bits[9];
+  size_t i, j;
+
+  btc_hashtab_init(&index);
+
+  txs = json_array_new(bt->txs.length);
+
+  for (i = 0; i < bt->txs.length; i++) {
+    const btc_blockentry_t *item = bt->txs.items[i];
+    const btc_tx_t *tx = item->tx;
+    json_value *deps = json_array_new(0);
+    json_value *ent = json_object_new(7);
+
+    for (j = 0; j < tx->inputs.length; j++) {
+      const btc_input_t *input = tx->inputs.items[j];
+      int64_t dep = btc_hashtab_get(&index, input->prevout.hash);
+      unsigned int k;
+
+      if (dep == -1)
+        continue;
+
+      for (k = 0; k < deps->u.array.length; k++) {
+        if (deps->u.array.values[k]->u.integer == dep)
+          break;
+      }
+
+      if (k == deps->u.array.length)
+        json_array_push(deps, json_integer_new(dep));
+    }
+
+    json_object_push(ent, "data", json_tx_raw(tx));
+    json_object_push(ent, "txid", json_hash_new(tx->hash));
+    json_object_push(ent, "hash", json_hash_new(tx->whash));
+    json_object_push(ent, "depends", deps);
+    json_object_push(ent, "fee", json_integer_new(item->fee));
+    json_object_push(ent, "sigops", json_integer_new(item->sigops));
+    json_object_push(ent, "weight", json_integer_new(item->weight));
+
+    json_array_push(txs, ent);
+
+    btc_hashtab_put(&index, tx->hash, i + 1);
+  }
+
+  btc_hashtab_clear(&index);
+
+  aux = json_object_new(1);
+
+  json_object_push(aux, "flags", json_buffer_new(&bt->cbflags));
+
+  rules = json_array_new(3);
+
+  if (bt->flags & BTC_SCRIPT_VERIFY_CHECKSEQUENCEVERIFY)
+    json_array_push(rules, json_string_new("csv"));
+
+  if (bt->flags & BTC_SCRIPT_VERIFY_WITNESS)
+    json_array_push(rules, json_string_new("!segwit"));
+
+  if (bt->flags & BTC_SCRIPT_VERIFY_TAPROOT)
+    json_array_push(rules, json_string_new("taproot"));
+
+  mut = json_array_new(3);
+
+  json_array_push(mut, json_string_new("time"));
+  json_array_push(mut, json_string_new("transactions"));
+  json_array_push(mut, json_string_new("prevblock"));
+
+  btc_rpc_longpoll_id(lpid, bt->prev_block, fees);
+
+  CHECK(btc_compact_export(target, bt->bits));
+
+  sprintf(bits, "%08lx", (unsigned long)bt->bits);
+
+  obj = json_object_new(22);
+
+  json_object_push(obj, "capabilities", json_array_new(0));
+  json_object_push(obj, "version", json_integer_new(bt->version));
+  json_object_push(obj, "rules", rules);
+  json_object_push(obj, "vbavailable", json_object_new(0));
+  json_object_push(obj, "vbrequired", json_integer_new(0));
+  json_object_push(obj, "previousblockhash", json_hash_new(bt->prev_block));
+  json_object_push(obj, "transactions", txs);
+  json_object_push(obj, "coinbaseaux", aux);
+  json_object_push(obj, "coinbasevalue",
+                         json_integer_new(btc_tmpl_reward(bt)));
+  json_object_push(obj, "longpollid", json_string_new(lpid));
+  json_object_push(obj, "target", json_hash_new(target));
+  json_object_push(obj, "mintime", json_integer_new(bt->mtp + 1));
+  json_object_push(obj, "mutable", mut);
+  json_object_push(obj, "noncerange", json_string_new("00000000ffffffff"));
+  json_object_push(obj, "sigoplimit",
+                         json_integer_new(BTC_MAX_BLOCK_SIGOPS_COST));
+  json_object_push(obj, "sizelimit", json_integer_new(BTC_MAX_BLOCK_SIZE));
+  json_object_push(obj, "weightlimit",
+                         json_integer_new(BTC_MAX_BLOCK_WEIGHT));
+  json_object_push(obj, "curtime", json_integer_new(bt->time));
+  json_object_push(obj, "bits", json_string_new(bits));
+  json_object_push(obj, "height", json_integer_new(bt->height));
+
+  if (btc_tmpl_witness(bt)) {
+    btc_script_t script;
+
+    btc_script_init(&script);
+    btc_script_set_commitment(&script, bt->commitment);
+
+    json_object_push(obj, "default_witness_commitment",
+                          json_buffer_new(&script));
+
+    btc_script_clear(&script);
+  }
+
+  return obj;
+}
+
+static int
+json_rules_has(const json_value *rules, const char *name) {
+  unsigned int i;
+
+  for (i = 0; i < rules->u.array.length; i++) {
+    const json_value *rule = rules->u.array.values[i];
+
+    if (rule->type != json_string)
+      continue;
+
+    if (strcmp(rule->u.string.ptr, name) == 0)
+      return 1;
+  }
+
+  return 0;
+}
+
 static void
 btc_rpc_getblocktemplate(btc_rpc_t *rpc,
                          const json_params *params,
                          rpc_res_t *res) {
-  (void)rpc;
+  const btc_deployment_state_t *state = btc_chain_state(rpc->chain);
+  const json_value *longpoll = NULL;
+  const char *mode = "template";
+  int segwit = 0;
+  btc_tmpl_t *bt;
 
   if (params->help || params->length > 1)
     THROW_MISC("getblocktemplate ( \"template_request\" )");
+
+  if (params->length > 0 && params->values[0]->type != json_null) {
+    const json_value *opts = params->values[0];
+    const json_value *value;
+
+    if (opts->type != json_object)
+      THROW_TYPE(template_request, object);
+
+    value = json_object_get(opts, "mode");
+
+    if (value != NULL && !json_string_get(&mode, value))
+      THROW_TYPE(mode, string);
+
+    value = json_object_get(opts, "rules");
+
+    if (value != NULL) {
+      if (value->type != json_array)
+        THROW_TYPE(rules, array);
+
+      segwit = json_rules_has(value, "segwit");
+    }
+
+    longpoll = json_object_get(opts, "longpollid");
+  }
+
+  if (strcmp(mode, "template") != 0)
+    THROW(RPC_INVALID_PARAMETER, "Invalid mode");
+
+  if (!btc_chain_synced(rpc->chain))
+    THROW(RPC_CLIENT_IN_INITIAL_DOWNLOAD, "Mako is downloading blocks...");
+
+  if ((state->flags & BTC_SCRIPT_VERIFY_WITNESS) && !segwit) {
+    THROW(RPC_INVALID_PARAMETER,
+          "getblocktemplate must be called with the segwit rule set");
+  }
+
+  if (longpoll != NULL) {
+    const char *str;
+    uint8_t tip[32];
+    int64_t fees;
+
+    if (!json_string_get(&str, longpoll))
+      THROW_TYPE(longpollid, string);
+
+    if (!btc_rpc_longpoll_parse(tip, &fees, str))
+      THROW(RPC_INVALID_PARAMETER, "Invalid longpollid");
+
+    if (!btc_rpc_longpoll_ready(rpc, tip, fees)) {
+      if (btc_rpc_longpoll_wait(rpc, tip, fees)) {
+        res->deferred = 1;
+        return;
+      }
+    }
+  }
+
+  bt = btc_miner_template(rpc->miner);
+
+  res->result = btc_rpc_template_json(rpc, bt);
+
+  btc_tmpl_destroy(bt);
 }
 
 static void
@@ -976,10 +1383,22 @@ static void
 btc_rpc_prioritisetransaction(btc_rpc_t *rpc,
                               const json_params *params,
                               rpc_res_t *res) {
-  (void)rpc;
+  uint8_t hash[32];
+  int delta;
 
   if (params->help || params->length != 2)
     THROW_MISC("prioritisetransaction \"txid\" fee_delta");
+
+  if (!json_hash_get(hash, params->values[0]))
+    THROW_TYPE(txid, hash);
+
+  if (!json_signed_get(&delta, params->values[1]))
+    THROW_TYPE(fee_delta, integer);
+
+  if (!btc_mempool_prioritise(rpc->mempool, hash, delta))
+    THROW_MISC("Transaction not in mempool.");
+
+  res->result = json_boolean_new(1);
 }
 
 static void
@@ -994,6 +1413,116 @@ btc_rpc_submitblock(btc_rpc_t *rpc, const json_params *params, rpc_res_t *res) {
  * Network
  */
 
+static json_value *
+json_traffic_new(const uint64_t *counts) {
+  /* Internal message types share their wire
+     command with a public one; fold them in. */
+  json_value *obj = json_object_new(0);
+  btc_msg_t msg, tmp;
+  uint64_t total;
+  int i, j;
+
+  for (i = 0; i <= BTC_MSG_WTXIDRELAY; i++) {
+    btc_msg_set_type(&msg, (enum btc_msgtype)i);
+
+    total = counts[i];
+
+    for (j = BTC_MSG_WTXIDRELAY + 1; j < BTC_MSG_UNKNOWN; j++) {
+      btc_msg_set_type(&tmp, (enum btc_msgtype)j);
+
+      if (strcmp(tmp.cmd, msg.cmd) == 0)
+        total += counts[j];
+    }
+
+    if (total > 0)
+      json_object_push(obj, msg.cmd, json_integer_new(total));
+  }
+
+  if (counts[BTC_MSG_UNKNOWN] > 0) {
+    json_object_push(obj, "*other*",
+                     json_integer_new(counts[BTC_MSG_UNKNOWN]));
+  }
+
+  return obj;
+}
+
+static uint64_t
+btc_traffic_sum(const uint64_t *counts) {
+  uint64_t total = 0;
+  int i;
+
+  for (i = 0; i <= BTC_MSG_UNKNOWN; i++)
+    total += counts[i];
+
+  return total;
+}
+
+static json_value *
+json_peerinfo_new(const btc_peerinfo_t *info) {
+  const btc_traffic_t *traffic = &info->traffic;
+  char addr[BTC_ADDRSTRLEN + 1];
+  char local[BTC_ADDRSTRLEN + 1];
+  char services[17];
+  json_value *obj;
+
+  btc_netaddr_get_str(addr, &info->addr);
+  btc_netaddr_get_str(local, &info->local);
+
+  sprintf(services, "%08lx%08lx",
+          (unsigned long)(info->services >> 32),
+          (unsigned long)(info->services & 0xffffffff));
+
+  obj = json_object_new(32);
+
+  json_object_push(obj, "id", json_integer_new(info->id));
+  json_object_push(obj, "addr", json_string_new(addr));
+  json_object_push(obj, "addrlocal", json_string_new(local));
+  json_object_push(obj, "services", json_string_new(services));
+  json_object_push(obj, "relaytxes", json_boolean_new(info->relay));
+  json_object_push(obj, "lastsend", json_integer_new(info->last_send));
+  json_object_push(obj, "lastrecv", json_integer_new(info->last_recv));
+  json_object_push(obj, "bytessent",
+                   json_integer_new(btc_traffic_sum(traffic->bytes_sent)));
+  json_object_push(obj, "bytesrecv",
+                   json_integer_new(btc_traffic_sum(traffic->bytes_recv)));
+  json_object_push(obj, "conntime", json_integer_new(info->time));
+
+  if (info->ping >= 0) {
+    json_object_push(obj, "pingtime", json_double_new(info->ping / 1000.0));
+    json_object_push(obj, "minping",
+                     json_double_new(info->min_ping / 1000.0));
+    json_object_push(obj, "avgping",
+                     json_double_new(info->avg_ping / 1000.0));
+  }
+
+  json_object_push(obj, "version", json_integer_new(info->version));
+  json_object_push(obj, "subver", json_string_new(info->agent));
+  json_object_push(obj, "inbound", json_boolean_new(!info->outbound));
+  json_object_push(obj, "startingheight", json_integer_new(info->height));
+  json_object_push(obj, "banscore", json_integer_new(info->ban_score));
+  json_object_push(obj, "bip152_hb_to", json_boolean_new(info->compact_hb_to));
+  json_object_push(obj, "bip152_hb_from",
+                   json_boolean_new(info->compact_hb_from));
+  json_object_push(obj, "txreconciliation", json_boolean_new(info->recon));
+  json_object_push(obj, "sendbuffer", json_integer_new(info->buffered));
+  json_object_push(obj, "sendbuffermax",
+                   json_integer_new(info->buffered_max));
+  json_object_push(obj, "blocksserved",
+                   json_integer_new(info->blocks_served));
+  json_object_push(obj, "blocksrecv", json_integer_new(info->blocks_recv));
+  json_object_push(obj, "blockrate", json_double_new(info->block_rate));
+  json_object_push(obj, "bytessent_per_msg",
+                   json_traffic_new(traffic->bytes_sent));
+  json_object_push(obj, "bytesrecv_per_msg",
+                   json_traffic_new(traffic->bytes_recv));
+  json_object_push(obj, "msgssent_per_msg",
+                   json_traffic_new(traffic->msgs_sent));
+  json_object_push(obj, "msgsrecv_per_msg",
+                   json_traffic_new(traffic->msgs_recv));
+
+  return obj;
+}
+
 static void
 btc_rpc_addnode(btc_rpc_t *rpc, const json_params *params, rpc_res_t *res) {
   (void)rpc;
@@ -1034,20 +1563,37 @@ static void
 btc_rpc_getconnectioncount(btc_rpc_t *rpc,
                            const json_params *params,
                            rpc_res_t *res) {
-  (void)rpc;
-
   if (params->help || params->length != 0)
     THROW_MISC("getconnectioncount");
+
+  res->result = json_integer_new(btc_pool_peers(rpc->pool));
 }
 
 static void
 btc_rpc_getnettotals(btc_rpc_t *rpc,
                      const json_params *params,
                      rpc_res_t *res) {
-  (void)rpc;
+  btc_traffic_t traffic;
+  json_value *obj;
 
   if (params->help || params->length != 0)
     THROW_MISC("getnettotals");
+
+  btc_pool_get_traffic(rpc->pool, &traffic);
+
+  obj = json_object_new(5);
+
+  json_object_push(obj, "totalbytesrecv",
+                   json_integer_new(btc_traffic_sum(traffic.bytes_recv)));
+  json_object_push(obj, "totalbytessent",
+                   json_integer_new(btc_traffic_sum(traffic.bytes_sent)));
+  json_object_push(obj, "timemillis", json_integer_new(btc_now() * 1000));
+  json_object_push(obj, "bytesrecv_per_msg",
+                   json_traffic_new(traffic.bytes_recv));
+  json_object_push(obj, "bytessent_per_msg",
+                   json_traffic_new(traffic.bytes_sent));
+
+  res->result = obj;
 }
 
 static void
@@ -1072,10 +1618,21 @@ btc_rpc_getnodeaddresses(btc_rpc_t *rpc,
 
 static void
 btc_rpc_getpeerinfo(btc_rpc_t *rpc, const json_params *params, rpc_res_t *res) {
-  (void)rpc;
+  size_t i, length = btc_pool_peers(rpc->pool);
+  btc_peerinfo_t *items;
 
   if (params->help || params->length != 0)
     THROW_MISC("getpeerinfo");
+
+  items = (btc_peerinfo_t *)btc_malloc(length * sizeof(btc_peerinfo_t) + 1);
+  length = btc_pool_get_peers(rpc->pool, items, length);
+
+  res->result = json_array_new(length);
+
+  for (i = 0; i < length; i++)
+    json_array_push(res->result, json_peerinfo_new(&items[i]));
+
+  btc_free(items);
 }
 
 static void
@@ -3231,10 +3788,23 @@ on_request(http_server_t *server, http_req_t *req, http_res_t *res) {
     rpc_req_init(&rreq);
     rpc_res_init(&rres);
 
-    if (!rpc_req_set(&rreq, input))
+    rpc->http_res = res;
+    rpc->http_id = rreq.id;
+
+    if (!rpc_req_set(&rreq, input)) {
       rpc_res_error(&rres, RPC_INVALID_REQUEST, "Invalid request");
-    else
+    } else {
+      rpc->http_id = rreq.id;
       btc_rpc_handle(rpc, &rreq, &rres);
+    }
+
+    rpc->http_res = NULL;
+    rpc->http_id = NULL;
+
+    if (rres.deferred) {
+      json_value_free(input);
+      return 1;
+    }
 
     output = rpc_res_encode(&rres, rreq.id);
   }
@@ -3247,6 +3817,49 @@ on_request(http_server_t *server, http_req_t *req, http_res_t *res) {
   return 1;
 }
 
+/*
+ * Notifications
+ */
+
+void
+btc_rpc_notify(btc_rpc_t *rpc) {
+  char *result = NULL;
+  btc_tmpl_t *bt;
+  size_t i = 0;
+
+  while (i < rpc->waiters.length) {
+    rpc_waiter_t *waiter = rpc->waiters.items[i];
+
+    if (!btc_rpc_longpoll_ready(rpc, waiter->tip, waiter->fees)) {
+      i++;
+      continue;
+    }
+
+    /* Build the template once for all waiters. */
+    if (result == NULL) {
+      json_value *obj;
+
+      bt = btc_miner_template(rpc->miner);
+      obj = btc_rpc_template_json(rpc, bt);
+      result = json_encode(obj);
+
+      json_builder_free(obj);
+      btc_tmpl_destroy(bt);
+    }
+
+    rpc_waiter_send(waiter, result);
+
+    http_res_release(waiter->res);
+
+    rpc_waiter_destroy(waiter);
+
+    rpc->waiters.items[i] = btc_vector_pop(&rpc->waiters);
+  }
+
+  if (result != NULL)
+    free(result);
+}
+
 /*
  * Testing
  */
@@ -162,15 +162,14 @@ btc_stack_get_int(int *num,
   return 1;
 }
 
-int
-btc_stack_get_bool(const btc_stack_t *stack, int index) {
-  const btc_buffer_t *buf = btc_stack_get(stack, index);
+static int
+btc_cast_bool(const uint8_t *xp, size_t xn) {
   size_t i;
 
-  for (i = 0; i < buf->length; i++) {
-    if (buf->data[i] != 0) {
+  for (i = 0; i < xn; i++) {
+    if (xp[i] != 0) {
       /* Cannot be negative zero. */
-      if (i == buf->length - 1 && buf->data[i] == 0x80)
+      if (i == xn - 1 && xp[i] == 0x80)
         return 0;
       return 1;
     }
@@ -179,6 +178,12 @@ btc_stack_get_bool(const btc_stack_t *stack, int index) {
   return 0;
 }
 
+int
+btc_stack_get_bool(const btc_stack_t *stack, int index) {
+  const btc_buffer_t *buf = btc_stack_get(stack, index);
+  return btc_cast_bool(buf->data, buf->length);
+}
+
 void
 btc_stack_push_data(btc_stack_t *stack, const uint8_t *data, size_t length) {
   btc_buffer_t *item = btc_buffer_create();
@@ -186,13 +191,6 @@ btc_stack_push_data(btc_stack_t *stack, const uint8_t *data, size_t length) {
   btc_stack_push(stack, item);
 }
 
-static void
-btc_stack_push_rodata(btc_stack_t *stack, const uint8_t *data, size_t length) {
-  btc_buffer_t *item = btc_buffer_create();
-  btc_buffer_roset(item, data, length);
-  btc_stack_push(stack, item);
-}
-
 void
 btc_stack_push_num(btc_stack_t *stack, int64_t num) {
   btc_buffer_t *item = btc_buffer_create();
@@ -214,17 +212,6 @@ btc_stack_push_bool(btc_stack_t *stack, int value) {
   btc_stack_push(stack, item);
 }
 
-static void
-btc_stack_push_robool(btc_stack_t *stack, int value) {
-  static const uint8_t one[1] = {1};
-  btc_buffer_t *item = btc_buffer_create();
-
-  if (value)
-    btc_buffer_roset(item, one, 1);
-
-  btc_stack_push(stack, item);
-}
-
 static void
 btc_stack_insert(btc_stack_t *stack, int index, btc_buffer_t *item) {
   size_t i;
@@ -303,6 +290,150 @@ btc_stack_swap(btc_stack_t *stack, int i1, int i2) {
   stack->items[i2] = v1;
 }
 
+/*
+ * Stack Arena
+ */
+
+/* Items created while verifying a single input are carved
+ * out of a bump allocator rather than the heap. They carry
+ * a pinned reference count so that the usual drop, clear
+ * and destroy calls never free them. The whole arena is
+ * released once btc_script_verify returns, by which point
+ * every stack referencing its items has been cleared.
+ *
+ * Growth is bounded by the script size limit: at worst a
+ * script of pushes adds one small item per byte. Tapscript
+ * has no such limit and so never evaluates on the arena.
+ */
+
+#define BTC_ARENA_REFS (INT_MAX / 2)
+#define BTC_ARENA_SLAB 1024
+#define BTC_ARENA_CHUNK 16384
+
+typedef struct btc_chunk_s {
+  struct btc_chunk_s *next;
+} btc_chunk_t;
+
+typedef struct btc_arena_s {
+  void *slab[BTC_ARENA_SLAB / sizeof(void *)];
+  unsigned char *ptr;
+  size_t left;
+  btc_chunk_t *chunks;
+} btc_arena_t;
+
+static void
+btc_arena_init(btc_arena_t *arena) {
+  arena->ptr = (unsigned char *)arena->slab;
+  arena->left = sizeof(arena->slab);
+  arena->chunks = NULL;
+}
+
+static void
+btc_arena_clear(btc_arena_t *arena) {
+  btc_chunk_t *chunk, *next;
+
+  for (chunk = arena->chunks; chunk != NULL; chunk = next) {
+    next = chunk->next;
+    btc_free(chunk);
+  }
+
+  btc_arena_init(arena);
+}
+
+static void *
+btc_arena_alloc(btc_arena_t *arena, size_t size) {
+  void *ptr;
+
+  size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+
+  if (size > arena->left) {
+    size_t length = BTC_MAX(size, BTC_ARENA_CHUNK);
+    btc_chunk_t *chunk = btc_malloc(sizeof(btc_chunk_t) + length);
+
+    chunk->next = arena->chunks;
+
+    arena->chunks = chunk;
+    arena->ptr = (unsigned char *)(chunk + 1);
+    arena->left = length;
+  }
+
+  ptr = arena->ptr;
+
+  arena->ptr += size;
+  arena->left -= size;
+
+  return ptr;
+}
+
+static btc_buffer_t *
+btc_arena_item(btc_arena_t *arena, size_t size) {
+  btc_buffer_t *item;
+
+  if (arena == NULL) {
+    item = btc_buffer_create();
+
+    if (size > 0)
+      btc_buffer_grow(item, size);
+
+    return item;
+  }
+
+  item = btc_arena_alloc(arena, sizeof(btc_buffer_t) + size);
+
+  btc_buffer_init(item);
+
+  if (size > 0)
+    item->data = (uint8_t *)(item + 1);
+
+  item->_refs = BTC_ARENA_REFS;
+
+  return item;
+}
+
+static void
+btc_stack_push_rodata(btc_stack_t *stack,
+                      const uint8_t *data,
+                      size_t length,
+                      btc_arena_t *arena) {
+  btc_buffer_t *item = btc_arena_item(arena, 0);
+  btc_buffer_roset(item, data, length);
+  btc_stack_push(stack, item);
+}
+
+static void
+btc_stack_push_robool(btc_stack_t *stack, int value, btc_arena_t *arena) {
+  static const uint8_t one[1] = {1};
+  btc_buffer_t *item = btc_arena_item(arena, 0);
+
+  if (value)
+    btc_buffer_roset(item, one, 1);
+
+  btc_stack_push(stack, item);
+}
+
+static void
+btc_stack_push_hash(btc_stack_t *stack,
+                    const uint8_t *hash,
+                    size_t length,
+                    btc_arena_t *arena) {
+  btc_buffer_t *item = btc_arena_item(arena, length);
+
+  memcpy(item->data, hash, length);
+
+  item->length = length;
+
+  btc_stack_push(stack, item);
+}
+
+static void
+btc_stack_push_int(btc_stack_t *stack, int64_t num, btc_arena_t *arena) {
+  btc_buffer_t *item = btc_arena_item(arena, 9);
+
+  item->length = btc_scriptnum_export(item->data, num);
+
+  btc_stack_push(stack, item);
+}
+
 /*
  * Opcode
  */
@@ -1594,18 +1725,117 @@ checksig(const uint8_t *msg, const btc_buffer_t *sig, const btc_buffer_t *key) {
   return btc_ecdsa_verify(msg, 32, tmp, key->data, key->length);
 }
 
-#define THROW(x) do { err = (x); goto done; } while (0)
+/* Per-input taproot state (BIP341/342). */
+typedef struct btc_tapdata_s {
+  const uint8_t *annex;
+  const uint8_t *leaf;
+  uint8_t annex_hash[32];
+  uint8_t leaf_hash[32];
+  uint32_t codesep;
+  int64_t budget;
+} btc_tapdata_t;
 
-int
-btc_script_execute(const btc_script_t *script,
-                   btc_stack_t *stack,
+static int
+checksig_schnorr(const btc_buffer_t *sig,
+                 const uint8_t *key,
+                 const btc_tx_t *tx,
+                 size_t index,
+                 const btc_tapdata_t *tap,
+                 btc_tx_cache_t *cache) {
+  uint8_t hash[32];
+  int type = 0;
+
+  if (sig->length == 65) {
+    type = sig->data[64];
+
+    /* Must be omitted rather than explicit. */
+    if (type == 0)
+      return BTC_SCRIPT_ERR_SCHNORR_SIG_HASHTYPE;
+  } else if (sig->length != 64) {
+    return BTC_SCRIPT_ERR_SCHNORR_SIG_SIZE;
+  }
+
+  if (!btc_tx_sighash_taproot(hash, tx, index, type, tap->annex,
+                              tap->leaf, tap->codesep, cache)) {
+    return BTC_SCRIPT_ERR_SCHNORR_SIG_HASHTYPE;
+  }
+
+  /* A failed schnorr check is always fatal, so
+     the check can be deferred to a batch without
+     changing the outcome of script execution. */
+  if (cache != NULL && cache->batch != NULL) {
+    btc_sigbatch_push(cache->batch, hash, sig->data, key);
+    return BTC_SCRIPT_ERR_OK;
+  }
+
+  if (!btc_bip340_verify(hash, 32, sig->data, key))
+    return BTC_SCRIPT_ERR_SCHNORR_SIG;
+
+  return BTC_SCRIPT_ERR_OK;
+}
+
+static int
+checksig_tapscript(int *res,
+                   const btc_buffer_t *sig,
+                   const btc_buffer_t *key,
                    unsigned int flags,
                    const btc_tx_t *tx,
                    size_t index,
-                   int64_t value,
-                   int version,
+                   btc_tapdata_t *tap,
                    btc_tx_cache_t *cache) {
+  int err;
+
+  *res = (sig->length > 0);
+
+  if (*res) {
+    tap->budget -= BTC_VALIDATION_WEIGHT_PER_SIGOP;
+
+    if (tap->budget < 0)
+      return BTC_SCRIPT_ERR_TAPSCRIPT_VALIDATION_WEIGHT;
+  }
+
+  if (key->length == 0)
+    return BTC_SCRIPT_ERR_PUBKEYTYPE;
+
+  if (key->length == 32) {
+    if (*res) {
+      if ((err = checksig_schnorr(sig, key->data, tx, index, tap, cache)))
+        return err;
+    }
+  } else {
+    if (flags & BTC_SCRIPT_VERIFY_DISCOURAGE_UPGRADABLE_PUBKEYTYPE)
+      return BTC_SCRIPT_ERR_DISCOURAGE_UPGRADABLE_PUBKEYTYPE;
+  }
+
+  return BTC_SCRIPT_ERR_OK;
+}
+
+static int
+is_op_success(int op) {
+  return op == 80 || op == 98
+      || (op >= 126 && op <= 129)
+      || (op >= 131 && op <= 134)
+      || (op >= 137 && op <= 138)
+      || (op >= 141 && op <= 142)
+      || (op >= 149 && op <= 153)
+      || (op >= 187 && op <= 254);
+}
+
+#define THROW(x) do { err = (x); goto done; } while (0)
+
+static int
+btc_script_eval(const btc_script_t *script,
+                btc_stack_t *stack,
+                unsigned int flags,
+                const btc_tx_t *tx,
+                size_t index,
+                int64_t value,
+                int version,
+                btc_tx_cache_t *cache,
+                btc_arena_t *arena,
+                btc_tapdata_t *tap) {
   int err = BTC_SCRIPT_ERR_OK;
+  uint32_t position = 0;
   int opcount = 0;
   int negate = 0;
   int minimal = 0;
@@ -1617,7 +1847,8 @@ btc_script_execute(const btc_script_t *script,
   btc_script_t subscript;
   btc_opcode_t op;
 
-  if (script->length > BTC_MAX_SCRIPT_SIZE)
+  /* Version 2 is tapscript: no size or opcount limits. */
+  if (version != 2 && script->length > BTC_MAX_SCRIPT_SIZE)
     return BTC_SCRIPT_ERR_SCRIPT_SIZE;
 
   if (flags & BTC_SCRIPT_VERIFY_MINIMALDATA)
@@ -1633,11 +1864,15 @@ btc_script_execute(const btc_script_t *script,
     if (!btc_reader_next(&op, &reader))
       THROW(BTC_SCRIPT_ERR_BAD_OPCODE);
 
+    position += 1;
+
     if (op.length > BTC_MAX_SCRIPT_PUSH)
       THROW(BTC_SCRIPT_ERR_PUSH_SIZE);
 
-    if (op.value > BTC_OP_16 && ++opcount > BTC_MAX_SCRIPT_OPS)
-      THROW(BTC_SCRIPT_ERR_OP_COUNT);
+    if (version != 2) {
+      if (op.value > BTC_OP_16 && ++opcount > BTC_MAX_SCRIPT_OPS)
+        THROW(BTC_SCRIPT_ERR_OP_COUNT);
+    }
 
     if (btc_opcode_is_disabled(&op))
       THROW(BTC_SCRIPT_ERR_DISABLED_OPCODE);
@@ -1652,7 +1887,7 @@ btc_script_execute(const btc_script_t *script,
       if (minimal && !btc_opcode_is_minimal(&op))
         THROW(BTC_SCRIPT_ERR_MINIMALDATA);
 
-      btc_stack_push_rodata(stack, op.data, op.length);
+      btc_stack_push_rodata(stack, op.data, op.length, arena);
 
       if (stack->length + alt.length > BTC_MAX_SCRIPT_STACK)
         THROW(BTC_SCRIPT_ERR_STACK_SIZE);
@@ -1662,7 +1897,7 @@ btc_script_execute(const btc_script_t *script,
 
     switch (op.value) {
       case BTC_OP_1NEGATE: {
-        btc_stack_push_num(stack, -1);
+        btc_stack_push_int(stack, -1, arena);
         break;
       }
       case BTC_OP_1:
@@ -1681,7 +1916,7 @@ btc_script_execute(const btc_script_t *script,
       case BTC_OP_14:
       case BTC_OP_15:
       case BTC_OP_16: {
-        btc_stack_push_num(stack, op.value - (BTC_OP_1 - 1));
+        btc_stack_push_int(stack, op.value - (BTC_OP_1 - 1), arena);
         break;
       }
       case BTC_OP_NOP: {
@@ -1761,7 +1996,16 @@ btc_script_execute(const btc_script_t *script,
           if (stack->length < 1)
             THROW(BTC_SCRIPT_ERR_UNBALANCED_CONDITIONAL);
 
-          if (version == 1 && (flags & BTC_SCRIPT_VERIFY_MINIMALIF)) {
+          if (version == 2) {
+            const btc_buffer_t *item = btc_stack_get(stack, -1);
+
+            /* Consensus for tapscript. */
+            if (item->length > 1)
+              THROW(BTC_SCRIPT_ERR_TAPSCRIPT_MINIMALIF);
+
+            if (item->length == 1 && item->data[0] != 1)
+              THROW(BTC_SCRIPT_ERR_TAPSCRIPT_MINIMALIF);
+          } else if (version == 1 && (flags & BTC_SCRIPT_VERIFY_MINIMALIF)) {
             const btc_buffer_t *item = btc_stack_get(stack, -1);
 
             if (item->length > 1)
@@ -1930,7 +2174,7 @@ btc_script_execute(const btc_script_t *script,
         break;
       }
       case BTC_OP_DEPTH: {
-        btc_stack_push_num(stack, stack->length);
+        btc_stack_push_int(stack, stack->length, arena);
         break;
       }
       case BTC_OP_DROP: {
@@ -2039,7 +2283,7 @@ btc_script_execute(const btc_script_t *script,
 
         val = btc_stack_get(stack, -1);
 
-        btc_stack_push_num(stack, val->length);
+        btc_stack_push_int(stack, val->length, arena);
 
         break;
       }
@@ -2059,7 +2303,7 @@ btc_script_execute(const btc_script_t *script,
         btc_stack_drop(stack);
         btc_stack_drop(stack);
 
-        btc_stack_push_robool(stack, res);
+        btc_stack_push_robool(stack, res, arena);
 
         if (op.value == BTC_OP_EQUALVERIFY) {
           if (!res)
@@ -2110,7 +2354,7 @@ btc_script_execute(const btc_script_t *script,
         }
 
         btc_stack_drop(stack);
-        btc_stack_push_num(stack, num);
+        btc_stack_push_int(stack, num, arena);
 
         break;
       }
@@ -2186,7 +2430,7 @@ btc_script_execute(const btc_script_t *script,
         btc_stack_drop(stack);
         btc_stack_drop(stack);
 
-        btc_stack_push_num(stack, num);
+        btc_stack_push_int(stack, num, arena);
 
         if (op.value == BTC_OP_NUMEQUALVERIFY) {
           if (!btc_stack_get_bool(stack, -1))
@@ -2219,7 +2463,7 @@ btc_script_execute(const btc_script_t *script,
         btc_stack_drop(stack);
         btc_stack_drop(stack);
 
-        btc_stack_push_robool(stack, val);
+        btc_stack_push_robool(stack, val, arena);
 
         break;
       }
@@ -2235,7 +2479,7 @@ btc_script_execute(const btc_script_t *script,
         btc_ripemd160(hash, val->data, val->length);
 
         btc_stack_drop(stack);
-        btc_stack_push_data(stack, hash, 20);
+        btc_stack_push_hash(stack, hash, 20, arena);
 
         break;
       }
@@ -2251,7 +2495,7 @@ btc_script_execute(const btc_script_t *script,
         btc_sha1(hash, val->data, val->length);
 
         btc_stack_drop(stack);
-        btc_stack_push_data(stack, hash, 20);
+        btc_stack_push_hash(stack, hash, 20, arena);
 
         break;
       }
@@ -2267,7 +2511,7 @@ btc_script_execute(const btc_script_t *script,
         btc_sha256(hash, val->data, val->length);
 
         btc_stack_drop(stack);
-        btc_stack_push_data(stack, hash, 32);
+        btc_stack_push_hash(stack, hash, 32, arena);
 
         break;
       }
@@ -2283,7 +2527,7 @@ btc_script_execute(const btc_script_t *script,
         btc_hash160(hash, val->data, val->length);
 
         btc_stack_drop(stack);
-        btc_stack_push_data(stack, hash, 20);
+        btc_stack_push_hash(stack, hash, 20, arena);
 
         break;
       }
@@ -2299,13 +2543,17 @@ btc_script_execute(const btc_script_t *script,
         btc_hash256(hash, val->data, val->length);
 
         btc_stack_drop(stack);
-        btc_stack_push_data(stack, hash, 32);
+        btc_stack_push_hash(stack, hash, 32, arena);
 
         break;
       }
       case BTC_OP_CODESEPARATOR: {
         begin.data = reader.data;
         begin.length = reader.length;
+
+        if (version == 2)
+          tap->codesep = position - 1;
+
         break;
       }
       case BTC_OP_CHECKSIG:
@@ -2323,37 +2571,47 @@ btc_script_execute(const btc_script_t *script,
         sig = btc_stack_get(stack, -2);
         key = btc_stack_get(stack, -1);
 
-        btc_script_set(&subscript, begin.data, begin.length);
-
-        if (version == 0)
-          btc_script_find_and_delete(&subscript, sig);
+        if (version == 2) {
+          if ((err = checksig_tapscript(&res, sig, key, flags,
+                                        tx, index, tap, cache))) {
+            goto done;
+          }
+        } else {
+          /* Only legacy scripts need a mutable copy. */
+          if (version == 0) {
+            btc_script_set(&subscript, begin.data, begin.length);
+            btc_script_find_and_delete(&subscript, sig);
+          } else {
+            btc_script_roset(&subscript, begin.data, begin.length);
+          }
 
-        if ((err = validate_signature(sig, flags)))
-          goto done;
+          if ((err = validate_signature(sig, flags)))
+            goto done;
 
-        if ((err = validate_key(key, flags, version)))
-          goto done;
+          if ((err = validate_key(key, flags, version)))
+            goto done;
 
-        res = 0;
+          res = 0;
 
-        if (sig->length > 0) {
-          type = sig->data[sig->length - 1];
+          if (sig->length > 0) {
+            type = sig->data[sig->length - 1];
 
-          btc_tx_sighash(hash, tx, index, &subscript,
-                         value, type, version, cache);
+            btc_tx_sighash(hash, tx, index, &subscript,
+                           value, type, version, cache);
 
-          res = checksig(hash, sig, key);
-        }
+            res = checksig(hash, sig, key);
+          }
 
-        if (!res && (flags & BTC_SCRIPT_VERIFY_NULLFAIL)) {
-          if (sig->length != 0)
-            THROW(BTC_SCRIPT_ERR_SIG_NULLFAIL);
+          if (!res && (flags & BTC_SCRIPT_VERIFY_NULLFAIL)) {
+            if (sig->length != 0)
+              THROW(BTC_SCRIPT_ERR_SIG_NULLFAIL);
+          }
         }
 
         btc_stack_drop(stack);
         btc_stack_drop(stack);
 
-        btc_stack_push_robool(stack, res);
+        btc_stack_push_robool(stack, res, arena);
 
         if (op.value == BTC_OP_CHECKSIGVERIFY) {
           if (!res)
@@ -2364,6 +2622,39 @@ btc_script_execute(const btc_script_t *script,
 
         break;
       }
+      case BTC_OP_CHECKSIGADD: {
+        const btc_buffer_t *sig, *key;
+        int64_t num;
+        int res;
+
+        if (version != 2)
+          THROW(BTC_SCRIPT_ERR_BAD_OPCODE);
+
+        if (tx == NULL)
+          THROW(BTC_SCRIPT_ERR_UNKNOWN_ERROR);
+
+        if (stack->length < 3)
+          THROW(BTC_SCRIPT_ERR_INVALID_STACK_OPERATION);
+
+        sig = btc_stack_get(stack, -3);
+        key = btc_stack_get(stack, -1);
+
+        if (!btc_stack_get_num(&num, stack, -2, minimal, 4))
+          THROW(BTC_SCRIPT_ERR_UNKNOWN_ERROR);
+
+        if ((err = checksig_tapscript(&res, sig, key, flags,
+                                      tx, index, tap, cache))) {
+          goto done;
+        }
+
+        btc_stack_drop(stack);
+        btc_stack_drop(stack);
+        btc_stack_drop(stack);
+
+        btc_stack_push_int(stack, num + res, arena);
+
+        break;
+      }
       case BTC_OP_CHECKMULTISIG:
       case BTC_OP_CHECKMULTISIGVERIFY: {
         int i, j, m, n, okey, ikey, isig;
@@ -2371,6 +2662,9 @@ btc_script_execute(const btc_script_t *script,
         uint8_t hash[32];
         int res, type;
 
+        if (version == 2)
+          THROW(BTC_SCRIPT_ERR_TAPSCRIPT_CHECKMULTISIG);
+
         if (tx == NULL)
           THROW(BTC_SCRIPT_ERR_UNKNOWN_ERROR);
 
@@ -2411,13 +2705,15 @@ btc_script_execute(const btc_script_t *script,
         if (stack->length < (size_t)i)
           THROW(BTC_SCRIPT_ERR_INVALID_STACK_OPERATION);
 
-        btc_script_set(&subscript, begin.data, begin.length);
-
-        for (j = 0; j < m; j++) {
-          sig = btc_stack_get(stack, -isig - j);
+        if (version == 0) {
+          btc_script_set(&subscript, begin.data, begin.length);
 
-          if (version == 0)
+          for (j = 0; j < m; j++) {
+            sig = btc_stack_get(stack, -isig - j);
             btc_script_find_and_delete(&subscript, sig);
+          }
+        } else {
+          btc_script_roset(&subscript, begin.data, begin.length);
         }
 
         res = 1;
@@ -2474,7 +2770,7 @@ btc_script_execute(const btc_script_t *script,
         }
 
         btc_stack_drop(stack);
-        btc_stack_push_robool(stack, res);
+        btc_stack_push_robool(stack, res, arena);
 
         if (op.value == BTC_OP_CHECKMULTISIGVERIFY) {
           if (!res)
@@ -2504,6 +2800,171 @@ done:
   return err;
 }
 
+int
+btc_script_execute(const btc_script_t *script,
+                   btc_stack_t *stack,
+                   unsigned int flags,
+                   const btc_tx_t *tx,
+                   size_t index,
+                   int64_t value,
+                   int version,
+                   btc_tx_cache_t *cache) {
+  /* Tapscript needs the state set up by btc_script_verify. */
+  CHECK(version == 0 || version == 1);
+
+  return btc_script_eval(script, stack, flags, tx, index,
+                         value, version, cache, NULL, NULL);
+}
+
+static int
+btc_script_verify_taproot(const btc_stack_t *witness,
+                          const uint8_t *key,
+                          unsigned int flags,
+                          const btc_tx_t *tx,
+                          size_t index,
+                          int64_t value,
+                          btc_tx_cache_t *cache) {
+  const btc_buffer_t *control, *item;
+  size_t length = witness->length;
+  uint8_t hash[32], tweak[32];
+  btc_reader_t reader;
+  btc_script_t script;
+  btc_hash256_t ctx;
+  btc_tapdata_t tap;
+  btc_stack_t stack;
+  btc_opcode_t op;
+  int err, version;
+  size_t i;
+
+  if (tx == NULL)
+    return BTC_SCRIPT_ERR_UNKNOWN_ERROR;
+
+  if (length == 0)
+    return BTC_SCRIPT_ERR_WITNESS_PROGRAM_WITNESS_EMPTY;
+
+  tap.annex = NULL;
+  tap.leaf = NULL;
+  tap.codesep = UINT32_MAX;
+  tap.budget = 0;
+
+  /* Strip the annex. */
+  item = witness->items[length - 1];
+
+  if (length >= 2 && item->length > 0 && item->data[0] == 0x50) {
+    btc_sha256_init(&ctx);
+    btc_buffer_update(&ctx, item);
+    btc_sha256_final(&ctx, tap.annex_hash);
+
+    tap.annex = tap.annex_hash;
+
+    length -= 1;
+  }
+
+  /* Key path spend. */
+  if (length == 1)
+    return checksig_schnorr(witness->items[0], key, tx, index, &tap, cache);
+
+  /* Script path spend. */
+  control = witness->items[length - 1];
+  item = witness->items[length - 2];
+
+  if (control->length < 33 || ((control->length - 33) & 31) != 0)
+    return BTC_SCRIPT_ERR_TAPROOT_WRONG_CONTROL_SIZE;
+
+  if ((control->length - 33) / 32 > BTC_TAPROOT_MAX_DEPTH)
+    return BTC_SCRIPT_ERR_TAPROOT_WRONG_CONTROL_SIZE;
+
+  version = control->data[0] & 0xfe;
+
+  btc_sha256_tagged(&ctx, "TapLeaf");
+  btc_uint8_update(&ctx, version);
+  btc_buffer_update(&ctx, item);
+  btc_sha256_final(&ctx, tap.leaf_hash);
+
+  btc_hash_copy(hash, tap.leaf_hash);
+
+  for (i = 33; i < control->length; i += 32) {
+    const uint8_t *node = control->data + i;
+
+    btc_sha256_tagged(&ctx, "TapBranch");
+
+    if (memcmp(hash, node, 32) < 0) {
+      btc_sha256_update(&ctx, hash, 32);
+      btc_sha256_update(&ctx, node, 32);
+    } else {
+      btc_sha256_update(&ctx, node, 32);
+      btc_sha256_update(&ctx, hash, 32);
+    }
+
+    btc_sha256_final(&ctx, hash);
+  }
+
+  btc_sha256_tagged(&ctx, "TapTweak");
+  btc_sha256_update(&ctx, control->data + 1, 32);
+  btc_sha256_update(&ctx, hash, 32);
+  btc_sha256_final(&ctx, tweak);
+
+  if (!btc_bip340_pubkey_tweak_add_check(control->data + 1, tweak, key,
+                                         control->data[0] & 1)) {
+    return BTC_SCRIPT_ERR_WITNESS_PROGRAM_MISMATCH;
+  }
+
+  if (version != BTC_TAPROOT_LEAF_TAPSCRIPT) {
+    if (flags & BTC_SCRIPT_VERIFY_DISCOURAGE_UPGRADABLE_TAPROOT_VERSION)
+      return BTC_SCRIPT_ERR_DISCOURAGE_UPGRADABLE_TAPROOT_VERSION;
+    return BTC_SCRIPT_ERR_OK;
+  }
+
+  btc_script_roset(&script, item->data, item->length);
+
+  /* OP_SUCCESSx anywhere makes the spend valid,
+     even if the script fails to parse after it. */
+  btc_reader_init(&reader, &script);
+
+  while (reader.length > 0) {
+    if (!btc_reader_next(&op, &reader))
+      return BTC_SCRIPT_ERR_BAD_OPCODE;
+
+    if (is_op_success(op.value)) {
+      if (flags & BTC_SCRIPT_VERIFY_DISCOURAGE_OP_SUCCESS)
+        return BTC_SCRIPT_ERR_DISCOURAGE_OP_SUCCESS;
+      return BTC_SCRIPT_ERR_OK;
+    }
+  }
+
+  length -= 2;
+
+  if (length > BTC_MAX_SCRIPT_STACK)
+    return BTC_SCRIPT_ERR_STACK_SIZE;
+
+  for (i = 0; i < length; i++) {
+    if (witness->items[i]->length > BTC_MAX_SCRIPT_PUSH)
+      return BTC_SCRIPT_ERR_PUSH_SIZE;
+  }
+
+  tap.leaf = tap.leaf_hash;
+  tap.budget = btc_stack_size(witness) + BTC_VALIDATION_WEIGHT_OFFSET;
+
+  btc_stack_init(&stack);
+  btc_stack_assign(&stack, witness);
+  btc_stack_resize(&stack, length);
+
+  /* Tapscript has no script size or opcount limits, so
+     items must be freed as they are dropped rather than
+     pile up in the arena. */
+  err = btc_script_eval(&script, &stack, flags, tx, index,
+                        value, 2, cache, NULL, &tap);
+
+  if (err == BTC_SCRIPT_ERR_OK) {
+    if (stack.length != 1 || !btc_stack_get_bool(&stack, -1))
+      err = BTC_SCRIPT_ERR_EVAL_FALSE;
+  }
+
+  btc_stack_clear(&stack);
+
+  return err;
+}
+
 static int
 btc_script_verify_program(const btc_stack_t *witness,
                           const btc_script_t *output,
@@ -2511,17 +2972,30 @@ btc_script_verify_program(const btc_stack_t *witness,
                           const btc_tx_t *tx,
                           size_t index,
                           int64_t value,
-                          btc_tx_cache_t *cache) {
+                          int is_p2sh,
+                          btc_tx_cache_t *cache,
+                          btc_arena_t *arena) {
   int err = BTC_SCRIPT_ERR_OK;
   btc_script_t *redeem = NULL;
   btc_program_t program;
+  btc_script_t p2pkh;
   btc_stack_t stack;
+  uint8_t raw[25];
   uint8_t hash[32];
   size_t i;
 
   CHECK((flags & BTC_SCRIPT_VERIFY_WITNESS) != 0);
   CHECK(btc_script_get_program(&program, output));
 
+  /* Taproot cannot be nested in P2SH. */
+  if (program.version == 1 && program.length == 32 && !is_p2sh) {
+    if (!(flags & BTC_SCRIPT_VERIFY_TAPROOT))
+      return BTC_SCRIPT_ERR_OK;
+
+    return btc_script_verify_taproot(witness, program.data, flags,
+                                     tx, index, value, cache);
+  }
+
   btc_stack_init(&stack);
   btc_stack_assign(&stack, witness);
 
@@ -2540,9 +3014,11 @@ btc_script_verify_program(const btc_stack_t *witness,
       if (stack.length != 2)
         THROW(BTC_SCRIPT_ERR_WITNESS_PROGRAM_MISMATCH);
 
-      redeem = btc_script_create();
+      /* Build the implied script in place. */
+      btc_script_rwset(&p2pkh, raw, sizeof(raw));
+      btc_script_set_p2pkh(&p2pkh, program.data);
 
-      btc_script_set_p2pkh(redeem, program.data);
+      redeem = &p2pkh;
     } else {
       THROW(BTC_SCRIPT_ERR_WITNESS_PROGRAM_WRONG_LENGTH);
     }
@@ -2559,8 +3035,8 @@ btc_script_verify_program(const btc_stack_t *witness,
   }
 
   /* Verify the redeem script. */
-  if ((err = btc_script_execute(redeem, &stack, flags,
-                                tx, index, value, 1, cache))) {
+  if ((err = btc_script_eval(redeem, &stack, flags,
+                             tx, index, value, 1, cache, arena, NULL))) {
     goto done;
   }
 
@@ -2570,7 +3046,7 @@ btc_script_verify_program(const btc_stack_t *witness,
 
 done:
   btc_stack_clear(&stack);
-  if (redeem != NULL)
+  if (redeem != NULL && redeem != &p2pkh)
     btc_script_destroy(redeem);
   return err;
 }
@@ -2587,11 +3063,13 @@ btc_script_verify(const btc_script_t *input,
   int err = BTC_SCRIPT_ERR_OK;
   btc_script_t *redeem = NULL;
   btc_stack_t stack, copy;
+  btc_arena_t arena;
   int had_witness;
 
   /* Setup a stack. */
   btc_stack_init(&stack);
   btc_stack_init(&copy);
+  btc_arena_init(&arena);
 
   if (flags & BTC_SCRIPT_VERIFY_SIGPUSHONLY) {
     if (!btc_script_is_push_only(input))
@@ -2599,8 +3077,8 @@ btc_script_verify(const btc_script_t *input,
   }
 
   /* Execute the input script. */
-  if ((err = btc_script_execute(input, &stack, flags,
-                                tx, index, value, 0, cache))) {
+  if ((err = btc_script_eval(input, &stack, flags,
+                             tx, index, value, 0, cache, &arena, NULL))) {
     goto done;
   }
 
@@ -2609,8 +3087,8 @@ btc_script_verify(const btc_script_t *input,
     btc_stack_assign(&copy, &stack);
 
   /* Execute the previous output script. */
-  if ((err = btc_script_execute(output, &stack, flags,
-                                tx, index, value, 0, cache))) {
+  if ((err = btc_script_eval(output, &stack, flags,
+                             tx, index, value, 0, cache, &arena, NULL))) {
     goto done;
   }
 
@@ -2630,7 +3108,8 @@ btc_script_verify(const btc_script_t *input,
 
     /* Verify the program in the output script. */
     if ((err = btc_script_verify_program(witness, output, flags,
-                                         tx, index, value, cache))) {
+                                         tx, index, value, 0, cache,
+                                         &arena))) {
       goto done;
     }
 
@@ -2655,8 +3134,8 @@ btc_script_verify(const btc_script_t *input,
     redeem = btc_stack_pop(&stack);
 
     /* Execute the redeem script. */
-    if ((err = btc_script_execute(redeem, &stack, flags,
-                                  tx, index, value, 0, cache))) {
+    if ((err = btc_script_eval(redeem, &stack, flags,
+                               tx, index, value, 0, cache, &arena, NULL))) {
       goto done;
     }
 
@@ -2673,7 +3152,8 @@ btc_script_verify(const btc_script_t *input,
 
       /* Verify the program in the redeem script. */
       if ((err = btc_script_verify_program(witness, redeem, flags,
-                                           tx, index, value, cache))) {
+                                           tx, index, value, 1, cache,
+                                           &arena))) {
         goto done;
       }
 
@@ -2701,11 +3181,327 @@ done:
   btc_stack_clear(&copy);
   if (redeem != NULL)
     btc_script_destroy(redeem);
+  btc_arena_clear(&arena);
   return err;
 }
 
 #undef THROW
 
+/*
+ * Fast Paths
+ */
+
+static int
+btc_script_verify_pkh(const btc_buffer_t *sig,
+                      const btc_buffer_t *key,
+                      const uint8_t *hash,
+                      const btc_script_t *code,
+                      const btc_tx_t *tx,
+                      size_t index,
+                      int64_t value,
+                      int version,
+                      unsigned int flags,
+                      btc_tx_cache_t *cache) {
+  /**
+   * The body of DUP HASH160 <hash> EQUALVERIFY CHECKSIG
+   * applied to a stack of exactly [sig, key]. Every check
+   * here is one the interpreter performs, so a failure is
+   * a failure there too (with a more specific error).
+   */
+  uint8_t msg[32];
+  int type;
+
+  if (sig->length > BTC_MAX_SCRIPT_PUSH || key->length > BTC_MAX_SCRIPT_PUSH)
+    return 0;
+
+  btc_hash160(msg, key->data, key->length);
+
+  if (memcmp(msg, hash, 20) != 0)
+    return 0;
+
+  if (validate_signature(sig, flags) != BTC_SCRIPT_ERR_OK)
+    return 0;
+
+  if (validate_key(key, flags, version) != BTC_SCRIPT_ERR_OK)
+    return 0;
+
+  if (sig->length == 0)
+    return 0;
+
+  type = sig->data[sig->length - 1];
+
+  btc_tx_sighash(msg, tx, index, code, value, type, version, cache);
+
+  return checksig(msg, sig, key);
+}
+
+static int
+btc_script_verify_p2pkh(const btc_script_t *input,
+                        const btc_stack_t *witness,
+                        const btc_script_t *output,
+                        const btc_tx_t *tx,
+                        size_t index,
+                        int64_t value,
+                        unsigned int flags,
+                        btc_tx_cache_t *cache) {
+  const uint8_t *xp = input->data;
+  size_t xn = input->length;
+  btc_opcode_t op1, op2;
+  btc_buffer_t sig, key;
+
+  /* A witness is either an error or ignored. */
+  if (witness->length != 0)
+    return -1;
+
+  /* Input must be exactly <sig> <key>. */
+  if (!btc_opcode_read(&op1, &xp, &xn) || op1.value > BTC_OP_PUSHDATA4)
+    return -1;
+
+  if (!btc_opcode_read(&op2, &xp, &xn) || op2.value > BTC_OP_PUSHDATA4)
+    return -1;
+
+  if (xn != 0)
+    return -1;
+
+  if (flags & BTC_SCRIPT_VERIFY_MINIMALDATA) {
+    if (!btc_opcode_is_minimal(&op1) || !btc_opcode_is_minimal(&op2))
+      return -1;
+  }
+
+  /* A 20 byte signature could be found and deleted
+     from the script code. Leave that to FindAndDelete. */
+  if (op1.length == 20)
+    return -1;
+
+  btc_buffer_init(&sig);
+  btc_buffer_init(&key);
+  btc_buffer_roset(&sig, op1.data, op1.length);
+  btc_buffer_roset(&key, op2.data, op2.length);
+
+  return btc_script_verify_pkh(&sig, &key, output->data + 3, output,
+                               tx, index, value, 0, flags, cache);
+}
+
+static int
+btc_script_verify_p2wpkh(const btc_stack_t *witness,
+                         const uint8_t *program,
+                         const btc_tx_t *tx,
+                         size_t index,
+                         int64_t value,
+                         unsigned int flags,
+                         btc_tx_cache_t *cache) {
+  btc_script_t code;
+  uint8_t raw[25];
+
+  /* Evaluated as the result of the output script. */
+  if (!btc_cast_bool(program, 20))
+    return 0;
+
+  if (witness->length != 2)
+    return 0;
+
+  btc_script_rwset(&code, raw, sizeof(raw));
+  btc_script_set_p2pkh(&code, program);
+
+  return btc_script_verify_pkh(witness->items[0], witness->items[1],
+                               program, &code, tx, index, value, 1,
+                               flags, cache);
+}
+
+int
+btc_script_verify_fast(const btc_script_t *input,
+                       const btc_stack_t *witness,
+                       const btc_script_t *output,
+                       const btc_tx_t *tx,
+                       size_t index,
+                       int64_t value,
+                       unsigned int flags,
+                       btc_tx_cache_t *cache) {
+  /**
+   * Verify the standard single-key spends without
+   * going through the interpreter. Returns 1 if the
+   * spend is valid, 0 if it is invalid, and -1 if
+   * the spend does not fit a template (in which case
+   * btc_script_verify must be consulted).
+   */
+  const uint8_t *data = output->data;
+  uint8_t hash[20];
+
+  /* P2PKH: DUP HASH160 <20> EQUALVERIFY CHECKSIG */
+  if (output->length == 25
+      && data[0] == BTC_OP_DUP
+      && data[1] == BTC_OP_HASH160
+      && data[2] == 20
+      && data[23] == BTC_OP_EQUALVERIFY
+      && data[24] == BTC_OP_CHECKSIG) {
+    return btc_script_verify_p2pkh(input, witness, output,
+                                   tx, index, value, flags, cache);
+  }
+
+  if ((flags & BTC_SCRIPT_VERIFY_P2SH) == 0)
+    return -1;
+
+  if ((flags & BTC_SCRIPT_VERIFY_WITNESS) == 0)
+    return -1;
+
+  /* P2WPKH: 0 <20> */
+  if (btc_script_is_p2wpkh(output)) {
+    if (input->length != 0)
+      return 0;
+
+    return btc_script_verify_p2wpkh(witness, data + 2, tx,
+                                    index, value, flags, cache);
+  }
+
+  /* P2SH-P2WPKH: HASH160 <20> EQUAL, <0 <20>> */
+  if (btc_script_is_p2sh(output)) {
+    if (input->length != 23 || input->data[0] != 22)
+      return -1;
+
+    if (input->data[1] != BTC_OP_0 || input->data[2] != 20)
+      return -1;
+
+    btc_hash160(hash, input->data + 1, 22);
+
+    if (memcmp(hash, data + 2, 20) != 0)
+      return 0;
+
+    return btc_script_verify_p2wpkh(witness, input->data + 3, tx,
+                                    index, value, flags, cache);
+  }
+
+  return -1;
+}
+
+/*
+ * Signature Batch
+ */
+
+/* Schnorr checks deferred by tapscript and taproot
+ * key spends. Each entry owns a copy of its inputs
+ * so the batch can outlive the transaction cache.
+ * Entries are verified in chunks which fit the
+ * multi-scalar multiplication scratch space.
+ */
+
+#define BTC_SIGBATCH_CHUNK 64
+
+typedef struct btc_sigentry_s {
+  uint8_t msg[32];
+  uint8_t sig[64];
+  uint8_t pub[32];
+} btc_sigentry_t;
+
+struct btc_sigbatch_s {
+  btc_sigentry_t *items;
+  size_t alloc;
+  size_t length;
+  btc_scratch_t *scratch;
+};
+
+btc_sigbatch_t *
+btc_sigbatch_create(void) {
+  btc_sigbatch_t *batch = btc_malloc(sizeof(btc_sigbatch_t));
+
+  batch->items = NULL;
+  batch->alloc = 0;
+  batch->length = 0;
+  batch->scratch = NULL;
+
+  return batch;
+}
+
+void
+btc_sigbatch_destroy(btc_sigbatch_t *batch) {
+  if (batch->items != NULL)
+    btc_free(batch->items);
+
+  if (batch->scratch != NULL)
+    btc_scratch_destroy(batch->scratch);
+
+  btc_free(batch);
+}
+
+void
+btc_sigbatch_reset(btc_sigbatch_t *batch) {
+  batch->length = 0;
+}
+
+size_t
+btc_sigbatch_length(const btc_sigbatch_t *batch) {
+  return batch->length;
+}
+
+void
+btc_sigbatch_push(btc_sigbatch_t *batch,
+                  const uint8_t *msg,
+                  const uint8_t *sig,
+                  const uint8_t *pub) {
+  btc_sigentry_t *entry;
+
+  if (batch->length == batch->alloc) {
+    size_t alloc = batch->alloc == 0 ? 16 : batch->alloc * 2;
+
+    batch->items = btc_realloc(batch->items, alloc * sizeof(btc_sigentry_t));
+    batch->alloc = alloc;
+  }
+
+  entry = &batch->items[batch->length++];
+
+  memcpy(entry->msg, msg, 32);
+  memcpy(entry->sig, sig, 64);
+  memcpy(entry->pub, pub, 32);
+}
+
+int
+btc_sigbatch_verify(btc_sigbatch_t *batch) {
+  const uint8_t *msgs[BTC_SIGBATCH_CHUNK];
+  const uint8_t *sigs[BTC_SIGBATCH_CHUNK];
+  const uint8_t *pubs[BTC_SIGBATCH_CHUNK];
+  size_t lens[BTC_SIGBATCH_CHUNK];
+  size_t i, j, n;
+
+  if (batch->length == 0)
+    return 1;
+
+  if (batch->scratch == NULL)
+    batch->scratch = btc_scratch_create(BTC_SIGBATCH_CHUNK * 2);
+
+  for (i = 0; i < batch->length; i += n) {
+    n = BTC_MIN(batch->length - i, BTC_SIGBATCH_CHUNK);
+
+    for (j = 0; j < n; j++) {
+      const btc_sigentry_t *entry = &batch->items[i + j];
+
+      msgs[j] = entry->msg;
+      sigs[j] = entry->sig;
+      pubs[j] = entry->pub;
+      lens[j] = 32;
+    }
+
+    if (!btc_bip340_verify_batch(msgs, lens, sigs, pubs, n, batch->scratch))
+      return 0;
+  }
+
+  return 1;
+}
+
+size_t
+btc_sigbatch_find(const btc_sigbatch_t *batch, size_t start, size_t end) {
+  size_t i;
+
+  CHECK(start <= end && end <= batch->length);
+
+  for (i = start; i < end; i++) {
+    const btc_sigentry_t *entry = &batch->items[i];
+
+    if (!btc_bip340_verify(entry->msg, 32, entry->sig, entry->pub))
+      return i;
+  }
+
+  return end;
+}
+
 /*
  * Reader
  */
@@ -2929,6 +3725,9 @@ asm_opcode(int value) {
     X(OP_NOP9);
     X(OP_NOP10);
 
+    /* tapscript */
+    X(OP_CHECKSIGADD);
+
     X(OP_INVALIDOPCODE);
 #undef X
   }
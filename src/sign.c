@@ -364,7 +364,7 @@ btc_tx_sign(btc_tx_t *tx,
   int total = 0;
   size_t i;
 
-  memset(&cache, 0, sizeof(cache));
+  btc_tx_cache_init(&cache);
 
   for (i = 0; i < addrs->length; i++) {
     const btc_address_t *addr = addrs->items[i];
@@ -382,5 +382,7 @@ btc_tx_sign(btc_tx_t *tx,
 
   btc_vector_destroy(addrs);
 
+  btc_tx_cache_clear(&cache);
+
   return total;
 }
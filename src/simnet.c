@@ -215,6 +215,15 @@ static const btc_network_t simnet = {
         0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
         0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
       }
+    },
+    /* .taproot = */ {
+      0,
+      {
+        0xf6, 0x7a, 0xd7, 0x69, 0x5d, 0x9b, 0x66, 0x2a,
+        0x72, 0xff, 0x3d, 0x8e, 0xdb, 0xbb, 0x2d, 0xe0,
+        0xbf, 0xa6, 0x7b, 0x13, 0x97, 0x4b, 0xb9, 0x91,
+        0x0d, 0x11, 0x6d, 0x5c, 0xbd, 0x86, 0x3e, 0x68
+      }
     }
   },
   /* .activation_threshold = */ 75, /* 75% for testchains */
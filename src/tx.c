@@ -29,6 +29,14 @@
 
 DEFINE_SERIALIZABLE_REFOBJ(btc_tx, SCOPE_EXTERN)
 
+static int
+btc_tx_is_packed(const btc_tx_t *tx) {
+  /* Vectors never have a zero allocation while
+     holding items unless they are borrowed. */
+  return (tx->inputs.length > 0 && tx->inputs.alloc == 0)
+      || (tx->outputs.length > 0 && tx->outputs.alloc == 0);
+}
+
 void
 btc_tx_init(btc_tx_t *tx) {
   btc_hash_init(tx->hash);
@@ -43,6 +51,13 @@ btc_tx_init(btc_tx_t *tx) {
 
 void
 btc_tx_clear(btc_tx_t *tx) {
+  if (btc_tx_is_packed(tx)) {
+    /* Everything lives in the same block as `tx`. */
+    btc_inpvec_init(&tx->inputs);
+    btc_outvec_init(&tx->outputs);
+    return;
+  }
+
   btc_inpvec_clear(&tx->inputs);
   btc_outvec_clear(&tx->outputs);
 }
@@ -123,17 +138,133 @@ btc_tx_refresh(btc_tx_t *tx) {
   }
 }
 
+void
+btc_tx_cache_init(btc_tx_cache_t *cache) {
+  memset(cache, 0, sizeof(*cache));
+}
+
+void
+btc_tx_cache_clear(btc_tx_cache_t *cache) {
+  if (cache->midstates != NULL)
+    btc_free(cache->midstates);
+
+  btc_tx_cache_init(cache);
+}
+
+/* Outpoint, empty script, sequence. */
+#define BTC_SIGHASH_ENTRY_SIZE 41
+
+static void
+btc_tx_cache_legacy(btc_tx_cache_t *cache, const btc_tx_t *tx) {
+  /**
+   * Serialize the SIGHASH_ALL preimage once, with every
+   * input script nulled out, and record the sha256 state
+   * at each block boundary up to the last input. Any
+   * input's sighash can then resume hashing from the
+   * nearest midstate instead of the start of the tx.
+   */
+  size_t start = 4 + btc_size_size(tx->inputs.length);
+  size_t end = start + tx->inputs.length * BTC_SIGHASH_ENTRY_SIZE;
+  size_t length = end + btc_outvec_size(&tx->outputs) + 4;
+  size_t blocks = (end >> 6) + 1;
+  btc_sha256_t ctx;
+  uint8_t *zp;
+  size_t i;
+
+  cache->midstates = btc_malloc(blocks * 32 + length);
+  cache->legacy = (uint8_t *)(cache->midstates + blocks * 8);
+  cache->legacy_len = length;
+  cache->has_legacy = 1;
+
+  zp = cache->legacy;
+  zp = btc_uint32_write(zp, tx->version);
+  zp = btc_size_write(zp, tx->inputs.length);
+
+  for (i = 0; i < tx->inputs.length; i++) {
+    const btc_input_t *input = tx->inputs.items[i];
+
+    zp = btc_outpoint_write(zp, &input->prevout);
+    zp = btc_uint8_write(zp, 0);
+    zp = btc_uint32_write(zp, input->sequence);
+  }
+
+  zp = btc_outvec_write(zp, &tx->outputs);
+  zp = btc_uint32_write(zp, tx->locktime);
+
+  CHECK((size_t)(zp - cache->legacy) == length);
+
+  btc_sha256_init(&ctx);
+
+  for (i = 0; i < blocks; i++) {
+    if (i > 0)
+      btc_sha256_update(&ctx, cache->legacy + (i - 1) * 64, 64);
+
+    memcpy(cache->midstates + i * 8, ctx.state, 32);
+  }
+}
+
+static void
+btc_tx_sighash_v0_all(uint8_t *hash,
+                      const btc_tx_t *tx,
+                      size_t index,
+                      const btc_script_t *prev,
+                      int type,
+                      btc_tx_cache_t *cache) {
+  size_t start = 4 + btc_size_size(tx->inputs.length);
+  size_t pos = start + index * BTC_SIGHASH_ENTRY_SIZE;
+  const uint8_t *entry;
+  btc_hash256_t ctx;
+  size_t off;
+
+  if (!cache->has_legacy)
+    btc_tx_cache_legacy(cache, tx);
+
+  entry = cache->legacy + pos;
+  off = pos & ~(size_t)63;
+
+  /* Resume from the last block boundary before our input. */
+  memcpy(ctx.state, cache->midstates + (pos >> 6) * 8, 32);
+
+  ctx.size = off;
+
+  btc_hash256_update(&ctx, cache->legacy + off, pos - off);
+
+  /* Outpoint, previous output script, sequence. */
+  btc_hash256_update(&ctx, entry, 36);
+  btc_script_update_v0(&ctx, prev);
+  btc_hash256_update(&ctx, entry + 37, 4);
+
+  /* Remaining inputs, outputs and locktime. */
+  btc_hash256_update(&ctx, entry + BTC_SIGHASH_ENTRY_SIZE,
+                     cache->legacy_len - pos - BTC_SIGHASH_ENTRY_SIZE);
+
+  btc_int32_update(&ctx, type);
+
+  btc_hash256_final(&ctx, hash);
+}
+
 static void
 btc_tx_sighash_v0(uint8_t *hash,
                   const btc_tx_t *tx,
                   size_t index,
                   const btc_script_t *prev,
-                  int type) {
+                  int type,
+                  btc_tx_cache_t *cache) {
   const btc_input_t *input;
   const btc_output_t *output;
   btc_hash256_t ctx;
   size_t i;
 
+  /* Avoid re-hashing every input for every signature. */
+  if (cache != NULL && tx->inputs.length > 1) {
+    if (!(type & BTC_SIGHASH_ANYONECANPAY)
+        && (type & 0x1f) != BTC_SIGHASH_NONE
+        && (type & 0x1f) != BTC_SIGHASH_SINGLE) {
+      btc_tx_sighash_v0_all(hash, tx, index, prev, type, cache);
+      return;
+    }
+  }
+
   if ((type & 0x1f) == BTC_SIGHASH_SINGLE) {
     /**
      * Satoshi's code returned 1 as an error code.
@@ -360,7 +491,7 @@ btc_tx_sighash(uint8_t *hash,
                btc_tx_cache_t *cache) {
   /* Traditional sighashing. */
   if (version == 0) {
-    btc_tx_sighash_v0(hash, tx, index, prev, type);
+    btc_tx_sighash_v0(hash, tx, index, prev, type, cache);
     return;
   }
 
@@ -373,27 +504,178 @@ btc_tx_sighash(uint8_t *hash,
   btc_abort(); /* LCOV_EXCL_LINE */
 }
 
+static int
+btc_tx_cache_taproot(btc_tx_cache_t *cache, const btc_tx_t *tx) {
+  btc_hash256_t prevouts, amounts, scripts, sequences;
+  const btc_input_t *input;
+  const btc_coin_t *coin;
+  btc_hash256_t outputs;
+  size_t i;
+
+  if (cache->has_taproot)
+    return 1;
+
+  if (cache->view == NULL)
+    return 0;
+
+  btc_sha256_init(&prevouts);
+  btc_sha256_init(&amounts);
+  btc_sha256_init(&scripts);
+  btc_sha256_init(&sequences);
+  btc_sha256_init(&outputs);
+
+  for (i = 0; i < tx->inputs.length; i++) {
+    input = tx->inputs.items[i];
+    coin = btc_view_get(cache->view, &input->prevout);
+
+    if (coin == NULL)
+      return 0;
+
+    btc_outpoint_update(&prevouts, &input->prevout);
+    btc_int64_update(&amounts, coin->output.value);
+    btc_script_update(&scripts, &coin->output.script);
+    btc_uint32_update(&sequences, input->sequence);
+  }
+
+  for (i = 0; i < tx->outputs.length; i++)
+    btc_output_update(&outputs, tx->outputs.items[i]);
+
+  /* Single SHA256, unlike BIP143. */
+  btc_sha256_final(&prevouts, cache->tap_prevouts);
+  btc_sha256_final(&amounts, cache->tap_amounts);
+  btc_sha256_final(&scripts, cache->tap_scripts);
+  btc_sha256_final(&sequences, cache->tap_sequences);
+  btc_sha256_final(&outputs, cache->tap_outputs);
+
+  cache->has_taproot = 1;
+
+  return 1;
+}
+
+int
+btc_tx_sighash_taproot(uint8_t *hash,
+                       const btc_tx_t *tx,
+                       size_t index,
+                       int type,
+                       const uint8_t *annex,
+                       const uint8_t *leaf,
+                       uint32_t codesep,
+                       btc_tx_cache_t *cache) {
+  const btc_input_t *input = tx->inputs.items[index];
+  int output_type = type & 3;
+  int anyone = type & BTC_SIGHASH_ANYONECANPAY;
+  btc_hash256_t ctx;
+
+  /* Zero is an alias for SIGHASH_ALL. */
+  if (output_type == 0)
+    output_type = BTC_SIGHASH_ALL;
+
+  if ((type & ~(BTC_SIGHASH_ANYONECANPAY | 3)) != 0)
+    return 0;
+
+  if (type == BTC_SIGHASH_ANYONECANPAY)
+    return 0;
+
+  if (output_type == BTC_SIGHASH_SINGLE && index >= tx->outputs.length)
+    return 0;
+
+  if (cache == NULL || !btc_tx_cache_taproot(cache, tx))
+    return 0;
+
+  btc_sha256_tagged(&ctx, "TapSighash");
+
+  /* Epoch. */
+  btc_uint8_update(&ctx, 0);
+
+  btc_uint8_update(&ctx, (uint8_t)type);
+  btc_uint32_update(&ctx, tx->version);
+  btc_uint32_update(&ctx, tx->locktime);
+
+  if (!anyone) {
+    btc_raw_update(&ctx, cache->tap_prevouts, 32);
+    btc_raw_update(&ctx, cache->tap_amounts, 32);
+    btc_raw_update(&ctx, cache->tap_scripts, 32);
+    btc_raw_update(&ctx, cache->tap_sequences, 32);
+  }
+
+  if (output_type == BTC_SIGHASH_ALL)
+    btc_raw_update(&ctx, cache->tap_outputs, 32);
+
+  /* Spend type. */
+  btc_uint8_update(&ctx, (leaf != NULL) * 2 + (annex != NULL));
+
+  if (anyone) {
+    const btc_coin_t *coin = btc_view_get(cache->view, &input->prevout);
+
+    btc_outpoint_update(&ctx, &input->prevout);
+    btc_int64_update(&ctx, coin->output.value);
+    btc_script_update(&ctx, &coin->output.script);
+    btc_uint32_update(&ctx, input->sequence);
+  } else {
+    btc_uint32_update(&ctx, index);
+  }
+
+  if (annex != NULL)
+    btc_raw_update(&ctx, annex, 32);
+
+  if (output_type == BTC_SIGHASH_SINGLE) {
+    btc_hash256_t out;
+    uint8_t single[32];
+
+    btc_sha256_init(&out);
+    btc_output_update(&out, tx->outputs.items[index]);
+    btc_sha256_final(&out, single);
+
+    btc_raw_update(&ctx, single, 32);
+  }
+
+  if (leaf != NULL) {
+    btc_raw_update(&ctx, leaf, 32);
+    btc_uint8_update(&ctx, 0); /* Key version. */
+    btc_uint32_update(&ctx, codesep);
+  }
+
+  btc_sha256_final(&ctx, hash);
+
+  return 1;
+}
+
 int
 btc_tx_verify(const btc_tx_t *tx, const btc_view_t *view, unsigned int flags) {
+  return btc_tx_verify_batch(tx, view, flags, NULL);
+}
+
+int
+btc_tx_verify_batch(const btc_tx_t *tx,
+                    const btc_view_t *view,
+                    unsigned int flags,
+                    btc_sigbatch_t *batch) {
   const btc_input_t *input;
   const btc_coin_t *coin;
   btc_tx_cache_t cache;
+  int ret = 0;
   size_t i;
 
-  memset(&cache, 0, sizeof(cache));
+  btc_tx_cache_init(&cache);
+
+  cache.view = view;
+  cache.batch = batch;
 
   for (i = 0; i < tx->inputs.length; i++) {
     input = tx->inputs.items[i];
     coin = btc_view_get(view, &input->prevout);
 
     if (coin == NULL)
-      return 0;
+      goto fail;
 
     if (!btc_tx_verify_input(tx, i, &coin->output, flags, &cache))
-      return 0;
+      goto fail;
   }
 
-  return 1;
+  ret = 1;
+fail:
+  btc_tx_cache_clear(&cache);
+  return ret;
 }
 
 int
@@ -403,15 +685,28 @@ btc_tx_verify_input(const btc_tx_t *tx,
                     unsigned int flags,
                     btc_tx_cache_t *cache) {
   const btc_input_t *input = tx->inputs.items[index];
-
-  int ret = btc_script_verify(&input->script,
-                              &input->witness,
-                              &coin->script,
-                              tx,
-                              index,
-                              coin->value,
-                              flags,
-                              cache);
+  int ret;
+
+  ret = btc_script_verify_fast(&input->script,
+                               &input->witness,
+                               &coin->script,
+                               tx,
+                               index,
+                               coin->value,
+                               flags,
+                               cache);
+
+  if (ret >= 0)
+    return ret;
+
+  ret = btc_script_verify(&input->script,
+                          &input->witness,
+                          &coin->script,
+                          tx,
+                          index,
+                          coin->value,
+                          flags,
+                          cache);
 
   return ret == BTC_SCRIPT_ERR_OK;
 }
@@ -1244,6 +1539,204 @@ btc_tx_sigops_size(const btc_tx_t *tx, int sigops) {
   return (weight + BTC_WITNESS_SCALE_FACTOR - 1) / BTC_WITNESS_SCALE_FACTOR;
 }
 
+#define PACK_ALIGN(n) (((n) + 7) & ~(size_t)7)
+
+static size_t
+pack_size(size_t inputs, size_t outputs, size_t items, size_t bytes) {
+  size_t size = 0;
+
+  size += PACK_ALIGN(sizeof(btc_tx_t));
+  size += PACK_ALIGN(inputs * sizeof(btc_input_t *));
+  size += PACK_ALIGN(inputs * sizeof(btc_input_t));
+  size += PACK_ALIGN(outputs * sizeof(btc_output_t *));
+  size += PACK_ALIGN(outputs * sizeof(btc_output_t));
+  size += PACK_ALIGN(items * sizeof(btc_buffer_t *));
+  size += PACK_ALIGN(items * sizeof(btc_buffer_t));
+  size += bytes;
+
+  return size;
+}
+
+static size_t
+btc_tx_packed_size(const btc_tx_t *tx) {
+  size_t items = 0;
+  size_t bytes = 0;
+  size_t i, j;
+
+  for (i = 0; i < tx->inputs.length; i++) {
+    const btc_input_t *input = tx->inputs.items[i];
+
+    bytes += input->script.length;
+
+    for (j = 0; j < input->witness.length; j++)
+      bytes += input->witness.items[j]->length;
+
+    items += input->witness.length;
+  }
+
+  for (i = 0; i < tx->outputs.length; i++)
+    bytes += tx->outputs.items[i]->script.length;
+
+  return pack_size(tx->inputs.length, tx->outputs.length, items, bytes);
+}
+
+static void *
+pack_alloc(uint8_t **zp, size_t size) {
+  void *ptr = *zp;
+  *zp += PACK_ALIGN(size);
+  return ptr;
+}
+
+static void
+pack_data(btc_buffer_t *z, const uint8_t *xp, size_t xn, uint8_t **dp) {
+  z->data = NULL;
+  z->alloc = 0;
+  z->length = xn;
+  z->_refs = 0;
+
+  if (xn > 0) {
+    z->data = *dp;
+    memcpy(*dp, xp, xn);
+    *dp += xn;
+  }
+}
+
+static void
+pack_buffer(btc_buffer_t *z, const btc_buffer_t *x, uint8_t **dp) {
+  pack_data(z, x->data, x->length, dp);
+}
+
+btc_tx_t *
+btc_tx_pack(const btc_tx_t *tx) {
+  /* Rebuild the transaction inside a single allocation.
+   *
+   * The layout is:
+   *
+   *   [tx][input ptrs][inputs][output ptrs][outputs]
+   *   [witness item ptrs][witness items][data...]
+   *
+   * Every vector and buffer in the result has a zero
+   * `alloc` (i.e. borrowed storage), which makes the
+   * packed transaction a read-only btc_tx_t which is
+   * released as a whole by btc_tx_destroy.
+   */
+  size_t size = btc_tx_packed_size(tx);
+  uint8_t *zp = (uint8_t *)btc_malloc(size);
+  btc_buffer_t **witptrs;
+  btc_input_t **inptrs;
+  btc_output_t **outptrs;
+  btc_buffer_t *items;
+  btc_input_t *inputs;
+  btc_output_t *outputs;
+  size_t count = 0;
+  btc_tx_t *z;
+  uint8_t *dp;
+  size_t i, j;
+
+  for (i = 0; i < tx->inputs.length; i++)
+    count += tx->inputs.items[i]->witness.length;
+
+  z = pack_alloc(&zp, sizeof(btc_tx_t));
+  inptrs = pack_alloc(&zp, tx->inputs.length * sizeof(btc_input_t *));
+  inputs = pack_alloc(&zp, tx->inputs.length * sizeof(btc_input_t));
+  outptrs = pack_alloc(&zp, tx->outputs.length * sizeof(btc_output_t *));
+  outputs = pack_alloc(&zp, tx->outputs.length * sizeof(btc_output_t));
+  witptrs = pack_alloc(&zp, count * sizeof(btc_buffer_t *));
+  items = pack_alloc(&zp, count * sizeof(btc_buffer_t));
+  dp = zp;
+
+  btc_hash_copy(z->hash, tx->hash);
+  btc_hash_copy(z->whash, tx->whash);
+
+  z->version = tx->version;
+  z->inputs.items = tx->inputs.length > 0 ? inptrs : NULL;
+  z->inputs.alloc = 0;
+  z->inputs.length = tx->inputs.length;
+  z->outputs.items = tx->outputs.length > 0 ? outptrs : NULL;
+  z->outputs.alloc = 0;
+  z->outputs.length = tx->outputs.length;
+  z->locktime = tx->locktime;
+  z->_index = tx->_index;
+  z->_refs = 1;
+
+  for (i = 0; i < tx->inputs.length; i++) {
+    const btc_input_t *x = tx->inputs.items[i];
+    btc_input_t *input = &inputs[i];
+
+    input->prevout = x->prevout;
+    input->sequence = x->sequence;
+
+    pack_buffer(&input->script, &x->script, &dp);
+
+    input->witness.items = x->witness.length > 0 ? witptrs : NULL;
+    input->witness.alloc = 0;
+    input->witness.length = x->witness.length;
+
+    for (j = 0; j < x->witness.length; j++) {
+      pack_buffer(items, x->witness.items[j], &dp);
+
+      /* Witness items are refcounted. The packed tx
+         holds the only reference which never drops. */
+      items->_refs = 1;
+
+      *witptrs++ = items++;
+    }
+
+    inptrs[i] = input;
+  }
+
+  for (i = 0; i < tx->outputs.length; i++) {
+    const btc_output_t *x = tx->outputs.items[i];
+    btc_output_t *output = &outputs[i];
+
+    output->value = x->value;
+
+    pack_buffer(&output->script, &x->script, &dp);
+
+    outptrs[i] = output;
+  }
+
+  CHECK((size_t)(dp - (uint8_t *)z) == size);
+
+  return z;
+}
+
+size_t
+btc_tx_usage(const btc_tx_t *tx) {
+  size_t usage = 0;
+  size_t i, j;
+
+  if (btc_tx_is_packed(tx))
+    return btc_malloc_usage(btc_tx_packed_size(tx));
+
+  usage += btc_malloc_usage(sizeof(btc_tx_t));
+  usage += btc_malloc_usage(tx->inputs.alloc * sizeof(btc_input_t *));
+  usage += btc_malloc_usage(tx->outputs.alloc * sizeof(btc_output_t *));
+
+  for (i = 0; i < tx->inputs.length; i++) {
+    const btc_input_t *input = tx->inputs.items[i];
+    const btc_stack_t *witness = &input->witness;
+
+    usage += btc_malloc_usage(sizeof(btc_input_t));
+    usage += btc_malloc_usage(input->script.alloc);
+    usage += btc_malloc_usage(witness->alloc * sizeof(btc_buffer_t *));
+
+    for (j = 0; j < witness->length; j++) {
+      usage += btc_malloc_usage(sizeof(btc_buffer_t));
+      usage += btc_malloc_usage(witness->items[j]->alloc);
+    }
+  }
+
+  for (i = 0; i < tx->outputs.length; i++) {
+    const btc_output_t *output = tx->outputs.items[i];
+
+    usage += btc_malloc_usage(sizeof(btc_output_t));
+    usage += btc_malloc_usage(output->script.alloc);
+  }
+
+  return usage;
+}
+
 uint8_t *
 btc_tx_base_write(uint8_t *zp, const btc_tx_t *tx) {
   zp = btc_uint32_write(zp, tx->version);
@@ -1278,11 +1771,26 @@ btc_tx_write(uint8_t *zp, const btc_tx_t *tx) {
   return zp;
 }
 
+static void
+btc_tx_stripped_hash(uint8_t *hash, const uint8_t *xp,
+                                    size_t witness,
+                                    size_t length) {
+  /* Compute the txid of a witness serialization by
+     hashing around the marker, flag and witness. */
+  btc_hash256_t ctx;
+
+  btc_hash256_init(&ctx);
+  btc_raw_update(&ctx, xp, 4);
+  btc_raw_update(&ctx, xp + 6, witness - 6);
+  btc_raw_update(&ctx, xp + length - 4, 4);
+  btc_hash256_final(&ctx, hash);
+}
+
 int
 btc_tx_read(btc_tx_t *z, const uint8_t **xp, size_t *xn) {
   const uint8_t *sp = *xp;
+  const uint8_t *wp = NULL;
   unsigned int flags = 0;
-  int witness = 0;
   size_t i;
 
   if (!btc_uint32_read(&z->version, xp, xn))
@@ -1302,6 +1810,7 @@ btc_tx_read(btc_tx_t *z, const uint8_t **xp, size_t *xn) {
 
   if (flags & 1) {
     flags ^= 1;
+    wp = *xp;
 
     for (i = 0; i < z->inputs.length; i++) {
       if (!btc_stack_read(&z->inputs.items[i]->witness, xp, xn))
@@ -1310,8 +1819,6 @@ btc_tx_read(btc_tx_t *z, const uint8_t **xp, size_t *xn) {
 
     if (!btc_tx_has_witness(z))
       return 0;
-
-    witness = 1;
   }
 
   if (flags != 0)
@@ -1320,8 +1827,8 @@ btc_tx_read(btc_tx_t *z, const uint8_t **xp, size_t *xn) {
   if (!btc_uint32_read(&z->locktime, xp, xn))
     return 0;
 
-  if (witness) {
-    btc_tx_txid(z->hash, z);
+  if (wp != NULL) {
+    btc_tx_stripped_hash(z->hash, sp, wp - sp, *xp - sp);
     btc_hash256(z->whash, sp, *xp - sp);
   } else {
     btc_hash256(z->hash, sp, *xp - sp);
@@ -1370,6 +1877,285 @@ btc_tx_base_decode(const uint8_t *xp, size_t xn) {
   return tx;
 }
 
+/*
+ * Raw Transaction
+ */
+
+static int
+btc_rawtx_skip(size_t *bytes, const uint8_t **xp, size_t *xn) {
+  const uint8_t *zp;
+  size_t zn;
+
+  if (!btc_size_read(&zn, xp, xn))
+    return 0;
+
+  if (!btc_zraw_read(&zp, zn, xp, xn))
+    return 0;
+
+  *bytes += zn;
+
+  return 1;
+}
+
+int
+btc_rawtx_read(btc_rawtx_t *z, const uint8_t **xp, size_t *xn) {
+  /* Walk the serialization without copying anything,
+   * recording the element counts needed to decode it
+   * later in a single allocation. Accepts exactly the
+   * same encodings as btc_tx_read.
+   */
+  const uint8_t *sp = *xp;
+  unsigned int flags = 0;
+  const uint8_t *zp;
+  size_t i, j, count;
+
+  z->data = sp;
+  z->length = 0;
+  z->witness = 0;
+  z->inputs = 0;
+  z->outputs = 0;
+  z->items = 0;
+  z->bytes = 0;
+
+  if (!btc_zraw_read(&zp, 4, xp, xn))
+    return 0;
+
+  if (*xn >= 2 && (*xp)[0] == 0 && (*xp)[1] != 0) {
+    flags = (*xp)[1];
+    *xp += 2;
+    *xn -= 2;
+  }
+
+  if (!btc_size_read(&z->inputs, xp, xn))
+    return 0;
+
+  for (i = 0; i < z->inputs; i++) {
+    if (!btc_zraw_read(&zp, 36, xp, xn))
+      return 0;
+
+    if (!btc_rawtx_skip(&z->bytes, xp, xn))
+      return 0;
+
+    if (!btc_zraw_read(&zp, 4, xp, xn))
+      return 0;
+  }
+
+  if (!btc_size_read(&z->outputs, xp, xn))
+    return 0;
+
+  for (i = 0; i < z->outputs; i++) {
+    if (!btc_zraw_read(&zp, 8, xp, xn))
+      return 0;
+
+    if (!btc_rawtx_skip(&z->bytes, xp, xn))
+      return 0;
+  }
+
+  if (flags & 1) {
+    flags ^= 1;
+
+    z->witness = *xp - sp;
+
+    for (i = 0; i < z->inputs; i++) {
+      if (!btc_size_read(&count, xp, xn))
+        return 0;
+
+      for (j = 0; j < count; j++) {
+        if (!btc_rawtx_skip(&z->bytes, xp, xn))
+          return 0;
+      }
+
+      z->items += count;
+    }
+
+    if (z->items == 0)
+      return 0;
+  }
+
+  if (flags != 0)
+    return 0;
+
+  if (!btc_zraw_read(&zp, 4, xp, xn))
+    return 0;
+
+  z->length = *xp - sp;
+
+  if (z->witness > 0) {
+    btc_tx_stripped_hash(z->hash, sp, z->witness, z->length);
+    btc_hash256(z->whash, sp, z->length);
+  } else {
+    btc_hash256(z->hash, sp, z->length);
+    btc_hash_copy(z->whash, z->hash);
+  }
+
+  return 1;
+}
+
+int
+btc_rawtx_import(btc_rawtx_t *z, const uint8_t *xp, size_t xn) {
+  return btc_rawtx_read(z, &xp, &xn);
+}
+
+int
+btc_rawtx_has_witness(const btc_rawtx_t *tx) {
+  return tx->witness > 0;
+}
+
+size_t
+btc_rawtx_base_size(const btc_rawtx_t *tx) {
+  if (tx->witness > 0)
+    return tx->witness - 2 + 4;
+
+  return tx->length;
+}
+
+size_t
+btc_rawtx_size(const btc_rawtx_t *tx) {
+  return tx->length;
+}
+
+size_t
+btc_rawtx_weight(const btc_rawtx_t *tx) {
+  size_t base = btc_rawtx_base_size(tx);
+  return base * (BTC_WITNESS_SCALE_FACTOR - 1) + tx->length;
+}
+
+uint8_t *
+btc_rawtx_base_write(uint8_t *zp, const btc_rawtx_t *tx) {
+  const uint8_t *xp = tx->data;
+
+  if (tx->witness == 0)
+    return btc_raw_write(zp, xp, tx->length);
+
+  zp = btc_raw_write(zp, xp, 4);
+  zp = btc_raw_write(zp, xp + 6, tx->witness - 6);
+  zp = btc_raw_write(zp, xp + tx->length - 4, 4);
+
+  return zp;
+}
+
+uint8_t *
+btc_rawtx_write(uint8_t *zp, const btc_rawtx_t *tx) {
+  return btc_raw_write(zp, tx->data, tx->length);
+}
+
+static void
+unpack_data(btc_buffer_t *z, const uint8_t **xp, size_t *xn, uint8_t **dp) {
+  const uint8_t *zp;
+  size_t zn;
+
+  CHECK(btc_size_read(&zn, xp, xn));
+  CHECK(btc_zraw_read(&zp, zn, xp, xn));
+
+  pack_data(z, zp, zn, dp);
+}
+
+btc_tx_t *
+btc_rawtx_decode(const btc_rawtx_t *tx) {
+  /* Materialize a packed transaction (see btc_tx_pack)
+     directly from the raw bytes. The counts gathered
+     by btc_rawtx_read let us size it up front. */
+  size_t size = pack_size(tx->inputs, tx->outputs, tx->items, tx->bytes);
+  uint8_t *zp = (uint8_t *)btc_malloc(size);
+  const uint8_t *xp = tx->data;
+  size_t xn = tx->length;
+  btc_buffer_t **witptrs;
+  btc_input_t **inptrs;
+  btc_output_t **outptrs;
+  btc_buffer_t *items;
+  btc_input_t *inputs;
+  btc_output_t *outputs;
+  btc_tx_t *z;
+  uint8_t *dp;
+  size_t i, j, count;
+
+  z = pack_alloc(&zp, sizeof(btc_tx_t));
+  inptrs = pack_alloc(&zp, tx->inputs * sizeof(btc_input_t *));
+  inputs = pack_alloc(&zp, tx->inputs * sizeof(btc_input_t));
+  outptrs = pack_alloc(&zp, tx->outputs * sizeof(btc_output_t *));
+  outputs = pack_alloc(&zp, tx->outputs * sizeof(btc_output_t));
+  witptrs = pack_alloc(&zp, tx->items * sizeof(btc_buffer_t *));
+  items = pack_alloc(&zp, tx->items * sizeof(btc_buffer_t));
+  dp = zp;
+
+  btc_hash_copy(z->hash, tx->hash);
+  btc_hash_copy(z->whash, tx->whash);
+
+  CHECK(btc_uint32_read(&z->version, &xp, &xn));
+
+  if (tx->witness > 0) {
+    xp += 2;
+    xn -= 2;
+  }
+
+  CHECK(btc_size_read(&count, &xp, &xn) && count == tx->inputs);
+
+  z->inputs.items = tx->inputs > 0 ? inptrs : NULL;
+  z->inputs.alloc = 0;
+  z->inputs.length = tx->inputs;
+
+  for (i = 0; i < tx->inputs; i++) {
+    btc_input_t *input = &inputs[i];
+
+    CHECK(btc_outpoint_read(&input->prevout, &xp, &xn));
+
+    unpack_data(&input->script, &xp, &xn, &dp);
+
+    CHECK(btc_uint32_read(&input->sequence, &xp, &xn));
+
+    btc_stack_init(&input->witness);
+
+    inptrs[i] = input;
+  }
+
+  CHECK(btc_size_read(&count, &xp, &xn) && count == tx->outputs);
+
+  z->outputs.items = tx->outputs > 0 ? outptrs : NULL;
+  z->outputs.alloc = 0;
+  z->outputs.length = tx->outputs;
+
+  for (i = 0; i < tx->outputs; i++) {
+    btc_output_t *output = &outputs[i];
+
+    CHECK(btc_int64_read(&output->value, &xp, &xn));
+
+    unpack_data(&output->script, &xp, &xn, &dp);
+
+    outptrs[i] = output;
+  }
+
+  if (tx->witness > 0) {
+    for (i = 0; i < tx->inputs; i++) {
+      btc_stack_t *witness = &inputs[i].witness;
+
+      CHECK(btc_size_read(&count, &xp, &xn));
+
+      witness->items = count > 0 ? witptrs : NULL;
+      witness->alloc = 0;
+      witness->length = count;
+
+      for (j = 0; j < count; j++) {
+        unpack_data(items, &xp, &xn, &dp);
+
+        /* See btc_tx_pack. */
+        items->_refs = 1;
+
+        *witptrs++ = items++;
+      }
+    }
+  }
+
+  CHECK(btc_uint32_read(&z->locktime, &xp, &xn));
+  CHECK(xn == 0);
+
+  z->_index = 0;
+  z->_refs = 1;
+
+  CHECK((size_t)(dp - (uint8_t *)z) == size);
+
+  return z;
+}
+
 /*
  * Transaction Vector
  */
@@ -0,0 +1,221 @@
+/*!
+ * b-loop.c - event loop benchmark for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <io/core.h>
+#include <io/loop.h>
+#include "lib/tests.h"
+
+/*
+ * Constants
+ */
+
+#define ROUNDS 5
+#define CONNS 64
+#define MSGS 4000
+#define MSG_SIZE 256
+#define ACCEPTS 4000
+#define PENDING 256
+
+/*
+ * State
+ */
+
+static size_t received;
+static int accepted;
+static int closed;
+
+/*
+ * Helpers
+ */
+
+static int
+on_data(btc_socket_t *socket, const void *data, size_t size) {
+  (void)data;
+
+  if (size == 0) {
+    btc_socket_close(socket);
+    return 0;
+  }
+
+  received += size;
+
+  return 1;
+}
+
+static void
+on_stream(btc_socket_t *server, btc_socket_t *socket) {
+  (void)server;
+  btc_socket_on_data(socket, on_data);
+}
+
+static void
+on_accept(btc_socket_t *server, btc_socket_t *socket) {
+  (void)server;
+  accepted++;
+  btc_socket_close(socket);
+}
+
+static void
+on_close(btc_socket_t *socket) {
+  (void)socket;
+  closed++;
+}
+
+static btc_socket_t *
+listen_any(btc_loop_t *loop, btc_sockaddr_t *addr) {
+  btc_socket_t *server;
+  int i;
+
+  for (i = 0; i < 100; i++) {
+    ASSERT(btc_sockaddr_import(addr, "127.0.0.1", 47000 + i));
+
+    server = btc_loop_listen(loop, addr);
+
+    if (server != NULL)
+      return server;
+  }
+
+  ASSERT(0 && "no free port");
+
+  return NULL;
+}
+
+/*
+ * Benchmarks
+ */
+
+static int64_t
+bench_stream(void) {
+  /* Many small writes spread over a set of connections. */
+  size_t total = (size_t)CONNS * MSGS * MSG_SIZE;
+  btc_loop_t *loop = btc_loop_create();
+  btc_socket_t *clients[CONNS];
+  btc_socket_t *server;
+  btc_sockaddr_t addr;
+  int64_t start;
+  int i, j;
+
+  server = listen_any(loop, &addr);
+
+  btc_socket_on_socket(server, on_stream);
+
+  for (i = 0; i < CONNS; i++) {
+    clients[i] = btc_loop_connect(loop, &addr);
+
+    ASSERT(clients[i] != NULL);
+  }
+
+  for (i = 0; i < 50; i++)
+    btc_loop_poll(loop, 1);
+
+  received = 0;
+  start = btc_time_msec();
+
+  for (j = 0; j < MSGS; j++) {
+    for (i = 0; i < CONNS; i++) {
+      void *msg = calloc(1, MSG_SIZE);
+
+      ASSERT(msg != NULL);
+
+      btc_socket_write(clients[i], msg, MSG_SIZE);
+    }
+
+    if ((j & 7) == 0)
+      btc_loop_poll(loop, 0);
+  }
+
+  while (received < total)
+    btc_loop_poll(loop, 10);
+
+  start = btc_time_msec() - start;
+
+  btc_loop_close(loop);
+  btc_loop_destroy(loop);
+
+  return start;
+}
+
+static int64_t
+bench_accept(void) {
+  /* Short-lived connections against one listener. */
+  btc_loop_t *loop = btc_loop_create();
+  btc_socket_t *server;
+  btc_sockaddr_t addr;
+  int opened = 0;
+  int64_t start;
+  int i;
+
+  server = listen_any(loop, &addr);
+
+  btc_socket_on_socket(server, on_accept);
+
+  accepted = 0;
+  closed = 0;
+  start = btc_time_msec();
+
+  while (accepted < ACCEPTS) {
+    for (i = 0; i < 64; i++) {
+      btc_socket_t *client;
+
+      if (opened == ACCEPTS || opened - closed >= PENDING)
+        break;
+
+      client = btc_loop_connect(loop, &addr);
+
+      if (client == NULL)
+        break;
+
+      btc_socket_on_close(client, on_close);
+      btc_socket_on_data(client, on_data);
+
+      opened++;
+    }
+
+    btc_loop_poll(loop, 1);
+  }
+
+  start = btc_time_msec() - start;
+
+  btc_loop_close(loop);
+  btc_loop_destroy(loop);
+
+  return start;
+}
+
+/*
+ * Main
+ */
+
+int
+main(void) {
+  int64_t stream = 0;
+  int64_t accept = 0;
+  int64_t ms;
+  int i;
+
+  /* Best of several rounds. */
+  for (i = 0; i < ROUNDS; i++) {
+    ms = bench_stream();
+
+    if (i == 0 || ms < stream)
+      stream = ms;
+
+    ms = bench_accept();
+
+    if (i == 0 || ms < accept)
+      accept = ms;
+  }
+
+  printf("stream, %d conns x %d x %dB: %ldms\n",
+         CONNS, MSGS, MSG_SIZE, (long)stream);
+
+  printf("accept, %d connections: %ldms\n", ACCEPTS, (long)accept);
+
+  return 0;
+}
@@ -0,0 +1,96 @@
+/*!
+ * b-sha256.c - sha256 benchmark for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <mako/crypto/hash.h>
+#include "lib/tests.h"
+
+/*
+ * Constants
+ */
+
+#define BULK_SIZE (1 << 20)
+#define BULK_ROUNDS 256
+#define HEADER_ROUNDS 2000000
+
+static const char *backends[] = {
+  "shani",
+  "armv8",
+  "generic"
+};
+
+/*
+ * Helpers
+ */
+
+static double
+seconds(clock_t start) {
+  return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+/*
+ * Benchmarks
+ */
+
+static void
+bench_bulk(const char *name) {
+  static uint8_t data[BULK_SIZE];
+  uint8_t out[32];
+  clock_t start;
+  double sec;
+  int i;
+
+  start = clock();
+
+  for (i = 0; i < BULK_ROUNDS; i++)
+    btc_sha256(out, data, sizeof(data));
+
+  sec = seconds(start);
+
+  printf("%-8s sha256(1 MiB):     %7.1f MB/s\n", name,
+         ((double)BULK_ROUNDS * BULK_SIZE) / 1e6 / sec);
+}
+
+static void
+bench_header(const char *name) {
+  /* Double hashing of an 80 byte header (3 blocks). */
+  uint8_t data[80] = {0};
+  clock_t start;
+  double sec;
+  long i;
+
+  start = clock();
+
+  for (i = 0; i < HEADER_ROUNDS; i++)
+    btc_hash256(data, data, sizeof(data));
+
+  sec = seconds(start);
+
+  printf("%-8s hash256(80 bytes): %7.1f ns\n", name,
+         sec * 1e9 / HEADER_ROUNDS);
+}
+
+/*
+ * Main
+ */
+
+int
+main(void) {
+  size_t i;
+
+  for (i = 0; i < lengthof(backends); i++) {
+    if (!btc_sha256_select(backends[i]))
+      continue;
+
+    bench_bulk(backends[i]);
+    bench_header(backends[i]);
+  }
+
+  return 0;
+}
@@ -0,0 +1,147 @@
+/* Key path spending vectors from BIP341 (wallet-test-vectors.json). */
+
+typedef struct bip341_utxo_s {
+  const char *script;
+  int64_t value;
+} bip341_utxo_t;
+
+typedef struct bip341_vector_s {
+  size_t index;
+  const char *priv;
+  const char *root;
+  int type;
+  const char *sighash;
+} bip341_vector_t;
+
+static const char *bip341_tx =
+  "02000000097de20cbff686da83a54981d2b9bab3586f4ca7e48f57f5b55963115f3b33"
+  "4e9c010000000000000000d7b7cab57b1393ace2d064f4d4a2cb8af6def61273e12751"
+  "7d44759b6dafdd990000000000fffffffff8e1f583384333689228c5d28eac13366be0"
+  "82dc57441760d957275419a418420000000000fffffffff0689180aa63b30cb162a73c"
+  "6d2a38b7eeda2a83ece74310fda0843ad604853b0100000000feffffffaa5202bdf6d8"
+  "ccd2ee0f0202afbbb7461d9264a25e5bfd3c5a52ee1239e0ba6c0000000000feffffff"
+  "956149bdc66faa968eb2be2d2faa29718acbfe3941215893a2a3446d32acd050000000"
+  "000000000000e664b9773b88c09c32cb70a2a3e4da0ced63b7ba3b22f848531bbb1d5d"
+  "5f4c94010000000000000000e9aa6b8e6c9de67619e6a3924ae25696bb7b694bb677a6"
+  "32a74ef7eadfd4eabf0000000000ffffffffa778eb6a263dc090464cd125c466b5a996"
+  "67720b1c110468831d058aa1b82af10100000000ffffffff0200ca9a3b000000001976"
+  "a91406afd46bcdfd22ef94ac122aa11f241244a37ecc88ac807840cb0000000020ac9a"
+  "87f5594be208f8532db38cff670c450ed2fea8fcdefcc9a663f78bab962b0065cd1d";
+
+static const bip341_utxo_t bip341_utxos[] = {
+  {
+    "512053a1f6e454df1aa2776a2814a721372d6258050de330b3c6d10ee8f4e0dda343",
+    420000000
+  },
+  {
+    "5120147c9c57132f6e7ecddba9800bb0c4449251c92a1e60371ee77557b6620f3ea3",
+    462000000
+  },
+  {
+    "76a914751e76e8199196d454941c45d1b3a323f1433bd688ac",
+    294000000
+  },
+  {
+    "5120e4d810fd50586274face62b8a807eb9719cef49c04177cc6b76a9a4251d5450e",
+    504000000
+  },
+  {
+    "512091b64d5324723a985170e4dc5a0f84c041804f2cd12660fa5dec09fc21783605",
+    630000000
+  },
+  {
+    "00147dd65592d0ab2fe0d0257d571abf032cd9db93dc",
+    378000000
+  },
+  {
+    "512075169f4001aa68f15bbed28b218df1d0a62cbbcf1188c6665110c293c907b831",
+    672000000
+  },
+  {
+    "5120712447206d7a5238acc7ff53fbe94a3b64539ad291c7cdbc490b7577e4b17df5",
+    546000000
+  },
+  {
+    "512077e30a5522dd9f894c3f8b8bd4c4b2cf82ca7da8a3ea6a239655c39c050ab220",
+    588000000
+  }
+};
+
+/* Intermediary hashes shared by every input. */
+static const char *bip341_prevouts =
+  "e3b33bb4ef3a52ad1fffb555c0d82828eb22737036eaeb02a235d82b909c4c3f";
+
+static const char *bip341_amounts =
+  "58a6964a4f5f8f0b642ded0a8a553be7622a719da71d1f5befcefcdee8e0fde6";
+
+static const char *bip341_scripts =
+  "23ad0f61ad2bca5ba6a7693f50fce988e17c3780bf2b1e720cfbb38fbdd52e21";
+
+static const char *bip341_sequences =
+  "18959c7221ab5ce9e26c3cd67b22c24f8baa54bac281d8e6b05e400e6c3a957e";
+
+static const char *bip341_outputs =
+  "a2e6dab7c1f0dcd297c8d61647fd17d821541ea69c3cc37dcbad7f90d4eb4bc5";
+
+static const bip341_vector_t bip341_vectors[] = {
+  {
+    0,
+    "6b973d88838f27366ed61c9ad6367663045cb456e28335c109e30717ae0c6baa",
+    NULL,
+    3,
+    "2514a6272f85cfa0f45eb907fcb0d121b808ed37c6ea160a5a9046ed5526d555"
+  },
+  {
+    1,
+    "1e4da49f6aaf4e5cd175fe08a32bb5cb4863d963921255f33d3bc31e1343907f",
+    "5b75adecf53548f3ec6ad7d78383bf84cc57b55a3127c72b9a2481752dd88b21",
+    131,
+    "325a644af47e8a5a2591cda0ab0723978537318f10e6a63d4eed783b96a71a4d"
+  },
+  {
+    3,
+    "d3c7af07da2d54f7a7735d3d0fc4f0a73164db638b2f2f7c43f711f6d4aa7e64",
+    "c525714a7f49c28aedbbba78c005931a81c234b2f6c99a73e4d06082adc8bf2b",
+    1,
+    "bf013ea93474aa67815b1b6cc441d23b64fa310911d991e713cd34c7f5d46669"
+  },
+  {
+    4,
+    "f36bb07a11e469ce941d16b63b11b9b9120a84d9d87cff2c84a8d4affb438f4e",
+    "ccbd66c6f7e8fdab47b3a486f59d28262be857f30d4773f2d5ea47f7761ce0e2",
+    0,
+    "4f900a0bae3f1446fd48490c2958b5a023228f01661cda3496a11da502a7f7ef"
+  },
+  {
+    6,
+    "415cfe9c15d9cea27d8104d5517c06e9de48e2f986b695e4f5ffebf230e725d8",
+    "2f6b2c5397b6d68ca18e09a3f05161668ffe93a988582d55c6f07bd5b3329def",
+    2,
+    "15f25c298eb5cdc7eb1d638dd2d45c97c4c59dcaec6679cfc16ad84f30876b85"
+  },
+  {
+    7,
+    "c7b0e81f0a9a0b0499e112279d718cca98e79a12e2f137c72ae5b213aad0d103",
+    "6c2dc106ab816b73f9d07e3cd1ef2c8c1256f519748e0813e4edd2405d277bef",
+    130,
+    "cd292de50313804dabe4685e83f923d2969577191a3e1d2882220dca88cbeb10"
+  },
+  {
+    8,
+    "77863416be0d0665e517e1c375fd6f75839544eca553675ef7fdf4949518ebaa",
+    "ab179431c28d3b68fb798957faf5497d69c883c6fb1e1cd9f81483d87bac90cc",
+    129,
+    "cccb739eca6c13a8a89e6e5cd317ffe55669bbda23f2fd37b0f18755e008edd2"
+  }
+};
+
+/* Single leaf tree from the scriptPubKey vectors. Its
+   leaf hash is the merkle root committed to by input 1. */
+static const char *bip341_leaf_script =
+  "20d85a959b0290bf19bb89ed43c916be835475d013da4b362117393e25a48229b8ac";
+
+static const char *bip341_leaf_hash =
+  "5b75adecf53548f3ec6ad7d78383bf84cc57b55a3127c72b9a2481752dd88b21";
+
+static const char *bip341_control =
+  "c1187791b6f712a8ea41c8ecdd0ee77fab3e85263b37e1ec18a3651926b3a6cf27";
@@ -9,6 +9,22 @@
 #include <string.h>
 #include "tests.h"
 
+#if defined(__has_feature)
+#  if __has_feature(address_sanitizer)
+#    define TEST_ASAN
+#  endif
+#endif
+
+#if defined(__SANITIZE_ADDRESS__)
+#  define TEST_ASAN
+#endif
+
+/* ASan quarantines freed memory, which skews the peak. */
+#if (defined(__linux__) || defined(__APPLE__)) && !defined(TEST_ASAN)
+#  include <sys/resource.h>
+#  define TEST_HAVE_RUSAGE
+#endif
+
 TEST_NORETURN void
 test_assert_fail(const char *file, int line, const char *expr) {
   fprintf(stderr, "%s:%d: Assertion `%s' failed.\n", file, line, expr);
@@ -68,3 +84,22 @@ hex_decode(unsigned char *zp, size_t *zn, const char *xp) {
 
   *zn = xn / 2;
 }
+
+size_t
+test_peak_memory(void) {
+  /* Peak resident set size in bytes, or zero if unknown. */
+#if defined(TEST_HAVE_RUSAGE)
+  struct rusage usage;
+
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+
+#if defined(__APPLE__)
+  return usage.ru_maxrss;
+#else
+  return (size_t)usage.ru_maxrss * 1024;
+#endif
+#else
+  return 0;
+#endif
+}
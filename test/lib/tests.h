@@ -72,4 +72,7 @@ hex_decode(unsigned char *zp, size_t *zn, const char *xp);
 int
 btc_rimraf(const char *path);
 
+size_t
+test_peak_memory(void);
+
 #endif /* BTC_TESTS_H */
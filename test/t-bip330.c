@@ -0,0 +1,175 @@
+/*!
+ * t-bip330.c - bip330 test for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mako/array.h>
+#include <mako/bip330.h>
+#include "lib/tests.h"
+
+static uint32_t rng_state = 0x12345678;
+
+static uint32_t
+rng_next(void) {
+  /* xorshift32; never yields zero. */
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+static int
+array_has(const btc_array_t *x, uint32_t y) {
+  size_t i;
+
+  for (i = 0; i < x->length; i++) {
+    if ((uint32_t)x->items[i] == y)
+      return 1;
+  }
+
+  return 0;
+}
+
+static void
+test_sketch_solve(size_t capacity, size_t count) {
+  /* Two sets sharing most of their elements; the merged
+     sketch must decode to exactly the difference. */
+  uint32_t *diff = malloc((count + 1) * sizeof(uint32_t));
+  btc_sketch_t a, b;
+  btc_array_t out;
+  size_t i;
+
+  ASSERT(diff != NULL);
+
+  btc_sketch_init(&a);
+  btc_sketch_init(&b);
+  btc_array_init(&out);
+
+  btc_sketch_reset(&a, capacity);
+  btc_sketch_reset(&b, capacity + 3);
+
+  for (i = 0; i < 50; i++) {
+    uint32_t x = rng_next();
+
+    btc_sketch_add(&a, x);
+    btc_sketch_add(&b, x);
+  }
+
+  for (i = 0; i < count; i++) {
+    diff[i] = rng_next();
+
+    if (i & 1)
+      btc_sketch_add(&a, diff[i]);
+    else
+      btc_sketch_add(&b, diff[i]);
+  }
+
+  btc_sketch_merge(&a, &b);
+
+  ASSERT(a.capacity == capacity);
+
+  if (count <= capacity) {
+    ASSERT(btc_sketch_solve(&out, &a));
+    ASSERT(out.length == count);
+
+    for (i = 0; i < count; i++)
+      ASSERT(array_has(&out, diff[i]));
+  } else if (capacity >= 10) {
+    /* A random polynomial of degree c splits into c
+       distinct roots with probability around 1/c!, so
+       small sketches can't reliably detect overflow. */
+    ASSERT(!btc_sketch_solve(&out, &a));
+    ASSERT(out.length == 0);
+  }
+
+  btc_sketch_clear(&a);
+  btc_sketch_clear(&b);
+  btc_array_clear(&out);
+
+  free(diff);
+}
+
+static void
+test_sketch_serialize(void) {
+  uint8_t raw[1 + 4 * 16];
+  btc_sketch_t a, b;
+  btc_array_t out;
+  int i;
+
+  btc_sketch_init(&a);
+  btc_sketch_init(&b);
+  btc_array_init(&out);
+
+  btc_sketch_reset(&a, 16);
+
+  for (i = 1; i <= 10; i++)
+    btc_sketch_add(&a, i);
+
+  ASSERT(btc_sketch_size(&a) == sizeof(raw));
+  ASSERT(btc_sketch_write(raw, &a) == raw + sizeof(raw));
+
+  /* Length prefix, then the first syndrome: the plain sum (XOR). */
+  ASSERT(raw[0] == 64);
+  ASSERT(raw[1] == 11 && raw[2] == 0 && raw[3] == 0 && raw[4] == 0);
+
+  ASSERT(!btc_sketch_import(&b, raw, sizeof(raw) - 1));
+  ASSERT(btc_sketch_import(&b, raw, sizeof(raw)));
+  ASSERT(b.capacity == 16);
+
+  ASSERT(btc_sketch_solve(&out, &b));
+  ASSERT(out.length == 10);
+
+  for (i = 1; i <= 10; i++)
+    ASSERT(array_has(&out, i));
+
+  btc_sketch_clear(&a);
+  btc_sketch_clear(&b);
+  btc_array_clear(&out);
+}
+
+static void
+test_recon_sid(void) {
+  uint8_t key1[16], key2[16];
+  uint8_t wtxid[32];
+  int i;
+
+  btc_recon_key(key1, 1, 2);
+  btc_recon_key(key2, 2, 1);
+
+  ASSERT(memcmp(key1, key2, 16) == 0);
+
+  btc_recon_key(key2, 1, 3);
+
+  ASSERT(memcmp(key1, key2, 16) != 0);
+
+  for (i = 0; i < 256; i++) {
+    memset(wtxid, i, 32);
+    ASSERT(btc_recon_sid(key1, wtxid) != 0);
+  }
+
+  ASSERT(btc_recon_capacity(0, 0, BTC_RECON_Q) == 1);
+  ASSERT(btc_recon_capacity(10, 3, BTC_RECON_Q) == 8);
+  ASSERT(btc_recon_capacity(100, 100, BTC_RECON_Q) == 25);
+  ASSERT(btc_recon_capacity(5000, 0, BTC_RECON_Q) == BTC_RECON_MAX_CAPACITY);
+}
+
+int
+main(void) {
+  size_t capacity, count;
+
+  for (capacity = 1; capacity <= 32; capacity += 3) {
+    for (count = 0; count <= capacity + 2; count++)
+      test_sketch_solve(capacity, count);
+  }
+
+  test_sketch_solve(BTC_RECON_MAX_CAPACITY, BTC_RECON_MAX_CAPACITY);
+
+  test_sketch_serialize();
+  test_recon_sid();
+
+  return 0;
+}
@@ -9,6 +9,7 @@
 #include <node/chain.h>
 #include <mako/block.h>
 #include <mako/network.h>
+#include <mako/util.h>
 #include "lib/tests.h"
 #include "data/chain_vectors_main.h"
 #include "data/chain_vectors_testnet.h"
@@ -18,7 +19,9 @@ test_chain(const btc_network_t *network, const char **vectors, size_t length) {
   unsigned int flags = BTC_BLOCK_DEFAULT_FLAGS;
   btc_chain_t *chain = btc_chain_create(network);
   unsigned char data[65536];
+  btc_rawblock_t raw;
   btc_block_t block;
+  uint8_t root[32];
   size_t i;
 
   btc_rimraf(BTC_PREFIX);
@@ -33,6 +36,19 @@ test_chain(const btc_network_t *network, const char **vectors, size_t length) {
     btc_block_init(&block);
 
     ASSERT(btc_block_import(&block, data, size));
+
+    btc_rawblock_init(&raw);
+
+    ASSERT(btc_rawblock_import(&raw, data, size));
+    ASSERT(raw.length == block.txs.length);
+    ASSERT(btc_rawblock_merkle_root(root, &raw));
+    ASSERT(btc_hash_equal(root, block.header.merkle_root));
+    ASSERT(btc_rawblock_base_size(&raw) == btc_block_base_size(&block));
+    ASSERT(btc_rawblock_size(&raw) == size);
+    ASSERT(btc_rawblock_weight(&raw) == btc_block_weight(&block));
+
+    btc_rawblock_clear(&raw);
+
     ASSERT(btc_chain_add(chain, &block, flags, -1));
 
     btc_block_clear(&block);
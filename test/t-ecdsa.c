@@ -5,6 +5,7 @@
  */
 
 #include <stddef.h>
+#include <stdint.h>
 #include <string.h>
 #include <mako/crypto/drbg.h>
 #include <mako/crypto/ecc.h>
@@ -283,9 +284,78 @@ test_ecdsa_svdw(void) {
   ASSERT(btc_memcmp(out, bytes, 32) == 0);
 }
 
+static void
+test_ecdsa_cache(void) {
+  unsigned char pubs[4][65];
+  unsigned char sigs[4][64];
+  unsigned char msg[32];
+  uint64_t hits, misses;
+  btc_drbg_t rng;
+  int i, j;
+
+  btc_drbg_init(&rng, NULL, 0);
+  btc_drbg_generate(&rng, msg, sizeof(msg));
+
+  btc_ecdsa_cache_init(1024);
+
+  for (i = 0; i < 4; i++) {
+    unsigned char priv[32];
+
+    btc_drbg_generate(&rng, priv, sizeof(priv));
+
+    priv[0] &= 0x7f;
+
+    ASSERT(btc_ecdsa_sign(sigs[i], NULL, msg, 32, priv));
+    ASSERT(btc_ecdsa_pubkey_create(pubs[i], priv, i & 1));
+  }
+
+  for (j = 0; j < 3; j++) {
+    for (i = 0; i < 4; i++) {
+      size_t len = (i & 1) ? 33 : 65;
+
+      ASSERT(btc_ecdsa_verify(msg, 32, sigs[i], pubs[i], len));
+      ASSERT(!btc_ecdsa_verify(msg, 32, sigs[i ^ 2], pubs[i], len));
+    }
+  }
+
+  btc_ecdsa_cache_stats(&hits, &misses);
+
+  ASSERT(misses == 4);
+  ASSERT(hits == 20);
+
+  /* Invalid keys must never be cached. */
+  memset(pubs[0] + 1, 0xff, 32);
+  pubs[0][0] = 0x02;
+
+  ASSERT(!btc_ecdsa_verify(msg, 32, sigs[0], pubs[0], 33));
+  ASSERT(!btc_ecdsa_verify(msg, 32, sigs[0], pubs[0], 33));
+
+  btc_ecdsa_cache_stats(&hits, &misses);
+
+  ASSERT(misses == 6);
+  ASSERT(hits == 20);
+
+  /* Thrash a tiny cache with the regular tests. */
+  btc_ecdsa_cache_init(1);
+
+  test_ecdsa_vectors();
+  test_ecdsa_random();
+
+  btc_ecdsa_cache_stats(&hits, &misses);
+
+  ASSERT(hits > 0);
+  ASSERT(misses > 0);
+
+  btc_ecdsa_cache_clear();
+  btc_ecdsa_cache_stats(&hits, &misses);
+
+  ASSERT(hits == 0 && misses == 0);
+}
+
 int main(void) {
   test_ecdsa_vectors();
   test_ecdsa_random();
   test_ecdsa_svdw();
+  test_ecdsa_cache();
   return 0;
 }
@@ -1,5 +1,5 @@
 /*!
- * t-stub.c - stub test for mako
+ * t-hash256.c - hash256 test for mako
  * Copyright (c) 2021, Christopher Jeffrey (MIT License).
  * https://github.com/chjj/mako
  */
@@ -7,8 +7,112 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <mako/crypto/hash.h>
+#include <mako/util.h>
 #include "lib/tests.h"
 
-int main(void) {
+static const char *backends[] = {
+  "avx512",
+  "avx2",
+  "sse2",
+  "generic"
+};
+
+static void
+test_hash256_batch(size_t count) {
+  static uint8_t data[64 * 64];
+  static uint8_t out[64 * 32];
+  static uint8_t expect[64 * 32];
+  size_t i;
+
+  for (i = 0; i < count * 64; i++)
+    data[i] = (uint8_t)(i * 7 + count);
+
+  for (i = 0; i < count; i++)
+    btc_hash256(expect + i * 32, data + i * 64, 64);
+
+  btc_hash256_batch(out, data, count);
+
+  ASSERT(memcmp(out, expect, count * 32) == 0);
+
+  /* In-place. */
+  btc_hash256_batch(data, data, count);
+
+  ASSERT(memcmp(data, expect, count * 32) == 0);
+}
+
+static uint32_t
+search_serial(uint8_t *hdr, const uint8_t *target, uint32_t nonce) {
+  uint8_t hash[32];
+
+  for (;;) {
+    hdr[76] = (uint8_t)(nonce >>  0);
+    hdr[77] = (uint8_t)(nonce >>  8);
+    hdr[78] = (uint8_t)(nonce >> 16);
+    hdr[79] = (uint8_t)(nonce >> 24);
+    btc_hash256(hash, hdr, 80);
+
+    if (btc_hash_compare(hash, target) <= 0)
+      return nonce;
+
+    nonce++;
+  }
+}
+
+static void
+test_hash256_search(uint32_t start) {
+  uint8_t target[32];
+  uint8_t hdr[80];
+  uint32_t expect, nonce;
+  size_t i;
+
+  for (i = 0; i < 80; i++)
+    hdr[i] = (uint8_t)(i * 13 + start);
+
+  /* Roughly one hit every 64 nonces. */
+  memset(target, 0xff, 32);
+
+  target[31] = 0x03;
+
+  expect = search_serial(hdr, target, start);
+
+  nonce = start;
+
+  ASSERT(btc_hash256_search(&nonce, hdr, target, 0));
+  ASSERT(nonce == expect);
+
+  if (expect == start)
+    return;
+
+  /* Stop just short of the hit. */
+  nonce = start;
+
+  ASSERT(!btc_hash256_search(&nonce, hdr, target, expect - start));
+  ASSERT(nonce == expect);
+
+  /* Resume from where we stopped. */
+  ASSERT(btc_hash256_search(&nonce, hdr, target, 1));
+  ASSERT(nonce == expect);
+}
+
+int
+main(void) {
+  size_t i, j;
+
+  for (i = 0; i < lengthof(backends); i++) {
+    if (!btc_hash256_select(backends[i]))
+      continue;
+
+    ASSERT(strcmp(btc_hash256_backend(), backends[i]) == 0);
+
+    for (j = 0; j <= 64; j++)
+      test_hash256_batch(j);
+
+    for (j = 0; j < 32; j++)
+      test_hash256_search(j * 1000);
+  }
+
+  ASSERT(!btc_hash256_select("foobar"));
+
   return 0;
 }
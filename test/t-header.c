@@ -1,5 +1,5 @@
 /*!
- * t-stub.c - stub test for mako
+ * t-header.c - header test for mako
  * Copyright (c) 2021, Christopher Jeffrey (MIT License).
  * https://github.com/chjj/mako
  */
@@ -7,8 +7,63 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <mako/header.h>
 #include "lib/tests.h"
 
-int main(void) {
+static void
+test_header_mine(uint32_t bits, uint32_t nonce) {
+  btc_header_t hdr, ref;
+  int i;
+
+  for (i = 0; i < 32; i++) {
+    btc_header_init(&hdr);
+
+    hdr.version = 0x20000000;
+    hdr.prev_block[0] = i;
+    hdr.merkle_root[31] = i * 7;
+    hdr.time = 1600000000 + i;
+    hdr.bits = bits;
+    hdr.nonce = nonce;
+
+    ref = hdr;
+
+    while (!btc_header_verify(&ref))
+      ref.nonce++;
+
+    ASSERT(btc_header_mine(&hdr, 0));
+    ASSERT(hdr.nonce == ref.nonce);
+    ASSERT(btc_header_verify(&hdr));
+  }
+}
+
+static void
+test_header_limit(void) {
+  btc_header_t hdr;
+
+  btc_header_init(&hdr);
+
+  hdr.bits = 0x03000001;
+  hdr.nonce = 100;
+
+  ASSERT(!btc_header_mine(&hdr, 37));
+  ASSERT(hdr.nonce == 137);
+
+  hdr.nonce = 0xfffffff3;
+
+  ASSERT(!btc_header_mine(&hdr, 0));
+  ASSERT(hdr.nonce == 0);
+
+  hdr.nonce = 0xfffffff3;
+
+  ASSERT(!btc_header_mine(&hdr, 5));
+  ASSERT(hdr.nonce == 0xfffffff8);
+}
+
+int
+main(void) {
+  test_header_mine(0x207fffff, 0);
+  test_header_mine(0x1f0fffff, 0);
+  test_header_mine(0x207fffff, 0xfffffff0);
+  test_header_limit();
   return 0;
 }
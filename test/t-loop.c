@@ -1,5 +1,5 @@
 /*!
- * t-stub.c - stub test for mako
+ * t-loop.c - event loop test for mako
  * Copyright (c) 2021, Christopher Jeffrey (MIT License).
  * https://github.com/chjj/mako
  */
@@ -7,8 +7,474 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <io/core.h>
+#include <io/loop.h>
 #include "lib/tests.h"
 
-int main(void) {
+/*
+ * Constants
+ */
+
+#define SMALL_COUNT 5000
+#define LARGE_SIZE (1 << 20)
+#define TOTAL_SIZE (SMALL_COUNT * 37 + 2 * LARGE_SIZE)
+#define POST_COUNT 1000
+
+/*
+ * Stream Test
+ */
+
+typedef struct state_s {
+  btc_loop_t *loop;
+  btc_socket_t *socket;
+  size_t received;
+  int corrupt;
+  int closed;
+} state_t;
+
+static unsigned char
+expect_byte(size_t i) {
+  return (unsigned char)((i * 131) >> 3);
+}
+
+static int
+on_data(btc_socket_t *socket, const void *data, size_t size) {
+  state_t *state = btc_socket_get_data(socket);
+  const unsigned char *raw = data;
+  size_t i;
+
+  if (size == 0) {
+    btc_socket_close(socket);
+    return 0;
+  }
+
+  for (i = 0; i < size; i++) {
+    if (raw[i] != expect_byte(state->received + i))
+      state->corrupt = 1;
+  }
+
+  state->received += size;
+
+  return 1;
+}
+
+static void
+on_close(btc_socket_t *socket) {
+  state_t *state = btc_socket_get_data(socket);
+  state->closed = 1;
+}
+
+static void
+on_socket(btc_socket_t *server, btc_socket_t *socket) {
+  state_t *state = btc_socket_get_data(server);
+
+  state->socket = socket;
+
+  btc_socket_set_data(socket, state);
+  btc_socket_on_data(socket, on_data);
+  btc_socket_on_close(socket, on_close);
+}
+
+static void *
+fill(size_t pos, size_t len) {
+  unsigned char *raw = malloc(len);
+  size_t i;
+
+  ASSERT(raw != NULL);
+
+  for (i = 0; i < len; i++)
+    raw[i] = expect_byte(pos + i);
+
+  return raw;
+}
+
+static btc_socket_t *
+open_pair(btc_loop_t *loop, state_t *state, btc_socket_socket_cb *handler) {
+  btc_socket_t *server = NULL;
+  btc_socket_t *client;
+  btc_sockaddr_t addr;
+  int i;
+
+  memset(state, 0, sizeof(*state));
+
+  state->loop = loop;
+
+  for (i = 0; i < 100; i++) {
+    ASSERT(btc_sockaddr_import(&addr, "127.0.0.1", 48500 + i));
+
+    server = btc_loop_listen(loop, &addr);
+
+    if (server != NULL)
+      break;
+  }
+
+  ASSERT(server != NULL);
+
+  btc_socket_set_data(server, state);
+  btc_socket_on_socket(server, handler);
+
+  client = btc_loop_connect(loop, &addr);
+
+  ASSERT(client != NULL);
+
+  return client;
+}
+
+static void
+wait_for(btc_loop_t *loop, state_t *state, size_t total) {
+  int i;
+
+  for (i = 0; i < 10000 && state->received < total; i++)
+    btc_loop_poll(loop, 10);
+
+  ASSERT(state->received == total);
+  ASSERT(!state->corrupt);
+}
+
+static void
+test_stream(void) {
+  /* Interleave small coalesced writes (owned and
+     copied) with large writes and make sure the
+     receiver sees one intact, ordered stream. */
+  btc_loop_t *loop = btc_loop_create();
+  btc_socket_t *client;
+  state_t state;
+  size_t pos = 0;
+  void *data;
+  int i;
+
+  client = open_pair(loop, &state, on_socket);
+
+  for (i = 0; i < SMALL_COUNT; i++) {
+    if (i == SMALL_COUNT / 2) {
+      data = fill(pos, LARGE_SIZE);
+      ASSERT(btc_socket_write(client, data, LARGE_SIZE) != -1);
+      pos += LARGE_SIZE;
+    }
+
+    data = fill(pos, 37);
+
+    if (i & 1) {
+      ASSERT(btc_socket_write_copy(client, data, 37) != -1);
+      free(data);
+    } else {
+      ASSERT(btc_socket_write(client, data, 37) != -1);
+    }
+
+    pos += 37;
+
+    if ((i % 100) == 0)
+      btc_loop_poll(loop, 0);
+  }
+
+  data = fill(pos, LARGE_SIZE);
+
+  ASSERT(btc_socket_write(client, data, LARGE_SIZE) != -1);
+
+  pos += LARGE_SIZE;
+
+  ASSERT(pos == TOTAL_SIZE);
+
+  wait_for(loop, &state, TOTAL_SIZE);
+
+  ASSERT(btc_socket_buffered(client) == 0);
+
+  /* Corked output must survive an immediate close. */
+  data = fill(pos, 37);
+
+  ASSERT(btc_socket_write(client, data, 37) == 1);
+
+  btc_socket_close(client);
+
+  for (i = 0; i < 1000 && !state.closed; i++)
+    btc_loop_poll(loop, 10);
+
+  ASSERT(state.closed);
+  ASSERT(state.received == TOTAL_SIZE + 37);
+  ASSERT(!state.corrupt);
+
+  btc_loop_close(loop);
+  btc_loop_destroy(loop);
+}
+
+static void
+test_shared(void) {
+  /* Queue the same buffers several times over. The
+     pattern repeats every 2048 bytes, so the stream
+     stays contiguous. The buffers must outlive our
+     own references for as long as they're queued. */
+  btc_loop_t *loop = btc_loop_create();
+  btc_sockbuf_t *large = btc_sockbuf_create(fill(0, LARGE_SIZE), LARGE_SIZE);
+  btc_sockbuf_t *small = btc_sockbuf_create(fill(0, 2048), 2048);
+  btc_socket_t *client;
+  state_t state;
+  int i;
+
+  client = open_pair(loop, &state, on_socket);
+
+  for (i = 0; i < 4; i++) {
+    ASSERT(btc_socket_write_buf(client, large) != -1);
+    ASSERT(btc_socket_write_buf(client, small) != -1);
+  }
+
+  ASSERT(btc_sockbuf_length(large) == LARGE_SIZE);
+
+  btc_sockbuf_unref(large);
+  btc_sockbuf_unref(small);
+
+  wait_for(loop, &state, 4 * (LARGE_SIZE + 2048));
+
+  ASSERT(btc_socket_buffered(client) == 0);
+
+  btc_loop_close(loop);
+  btc_loop_destroy(loop);
+}
+
+static btc_loop_t *target_loop;
+
+static void
+on_migrate(btc_socket_t *server, btc_socket_t *socket) {
+  on_socket(server, socket);
+  btc_socket_detach(socket);
+  ASSERT(btc_loop_attach(target_loop, socket));
+}
+
+static void
+test_migrate(void) {
+  /* Accept on one loop, serve on another. */
+  btc_loop_t *loop = btc_loop_create();
+  btc_socket_t *client;
+  state_t state;
+  size_t total = 0;
+  int i;
+
+  target_loop = btc_loop_create();
+
+  client = open_pair(loop, &state, on_migrate);
+
+  for (i = 0; i < 8; i++) {
+    ASSERT(btc_socket_write(client, fill(total, 4096), 4096) != -1);
+    total += 4096;
+  }
+
+  for (i = 0; i < 10000 && state.received < total; i++) {
+    btc_loop_poll(loop, 0);
+    btc_loop_poll(target_loop, 1);
+  }
+
+  ASSERT(state.received == total);
+  ASSERT(!state.corrupt);
+
+  btc_loop_close(loop);
+  btc_loop_destroy(loop);
+
+  for (i = 0; i < 1000 && !state.closed; i++)
+    btc_loop_poll(target_loop, 1);
+
+  ASSERT(state.closed);
+
+  btc_loop_close(target_loop);
+  btc_loop_destroy(target_loop);
+}
+
+static void
+test_handoff(void) {
+  /* Move a connection between loops mid-stream,
+     while the old loop may still be reading it. */
+  btc_loop_t *loop = btc_loop_create();
+  btc_loop_t *target = btc_loop_create();
+  btc_socket_t *client;
+  state_t state;
+  size_t total = 4096;
+  int i;
+
+  client = open_pair(loop, &state, on_socket);
+
+  ASSERT(btc_socket_write(client, fill(0, total), total) != -1);
+
+  wait_for(loop, &state, total);
+
+  btc_loop_poll(loop, 0);
+
+  ASSERT(btc_socket_write(client, fill(total, LARGE_SIZE), LARGE_SIZE) != -1);
+
+  total += LARGE_SIZE;
+
+  btc_socket_detach(state.socket);
+
+  ASSERT(btc_loop_attach(target, state.socket));
+
+  for (i = 0; i < 10000 && state.received < total; i++) {
+    btc_loop_poll(loop, 0);
+    btc_loop_poll(target, 1);
+  }
+
+  ASSERT(state.received == total);
+  ASSERT(!state.corrupt);
+
+  btc_loop_close(loop);
+  btc_loop_destroy(loop);
+
+  for (i = 0; i < 1000 && !state.closed; i++)
+    btc_loop_poll(target, 1);
+
+  ASSERT(state.closed);
+
+  btc_loop_close(target);
+  btc_loop_destroy(target);
+}
+
+typedef struct post_state_s {
+  btc_loop_t *loop;
+  int count;
+} post_state_t;
+
+static void
+on_post(void *arg) {
+  post_state_t *state = arg;
+  state->count++;
+}
+
+static void
+post_thread(void *arg) {
+  post_state_t *state = arg;
+  int i;
+
+  for (i = 0; i < POST_COUNT; i++)
+    btc_loop_post(state->loop, on_post, state);
+}
+
+static void
+test_post(void) {
+  /* Callbacks posted from another thread must
+     all run, and must wake a blocked poll. */
+  post_state_t state;
+  int64_t start;
+  int i;
+
+  state.loop = btc_loop_create();
+  state.count = 0;
+
+#if defined(_WIN32) || defined(BTC_PTHREAD)
+  {
+    btc_thread_t thread;
+
+    btc_thread_create(&thread, post_thread, &state);
+
+    start = btc_time_msec();
+
+    for (i = 0; i < 100 && state.count < POST_COUNT; i++)
+      btc_loop_poll(state.loop, 10000);
+
+    btc_thread_join(&thread);
+  }
+#else
+  start = btc_time_msec();
+
+  post_thread(&state);
+
+  btc_loop_poll(state.loop, 0);
+#endif
+
+  btc_loop_poll(state.loop, 0);
+
+  ASSERT(state.count == POST_COUNT);
+
+#ifndef _WIN32
+  ASSERT(btc_time_msec() - start < 5000);
+#endif
+
+  btc_loop_close(state.loop);
+  btc_loop_destroy(state.loop);
+}
+
+typedef struct timer_state_s {
+  int64_t start;
+  int64_t fired[4];
+  int repeats;
+} timer_state_t;
+
+static timer_state_t timer_state;
+
+static void
+on_timer(btc_timer_t *timer) {
+  int64_t *fired = btc_timer_get_data(timer);
+  *fired = btc_time_msec();
+}
+
+static void
+on_repeat(btc_timer_t *timer) {
+  if (++timer_state.repeats < 5)
+    btc_timer_start(timer, 10);
+}
+
+static void
+test_timer(void) {
+  /* Timers fire no earlier than requested, both
+     within the first level and after a cascade.
+     Stopped timers never fire. */
+  static const int64_t timeouts[4] = {0, 40, 1100, 300};
+  btc_loop_t *loop = btc_loop_create();
+  btc_timer_t *timers[4];
+  btc_timer_t *repeat;
+  int i, j;
+
+  memset(&timer_state, 0, sizeof(timer_state));
+
+  timer_state.start = btc_time_msec();
+
+  for (i = 0; i < 4; i++) {
+    timers[i] = btc_timer_create(loop, on_timer, &timer_state.fired[i]);
+    btc_timer_start(timers[i], timeouts[i]);
+    ASSERT(btc_timer_active(timers[i]));
+  }
+
+  repeat = btc_timer_create(loop, on_repeat, NULL);
+
+  btc_timer_start(repeat, 10);
+  btc_timer_stop(timers[3]);
+
+  ASSERT(!btc_timer_active(timers[3]));
+
+  for (i = 0; i < 1000; i++) {
+    btc_loop_poll(loop, 5);
+
+    if (timer_state.fired[2] != 0)
+      break;
+  }
+
+  for (j = 0; j < 3; j++) {
+    ASSERT(timer_state.fired[j] != 0);
+    ASSERT(timer_state.fired[j] - timer_state.start >= timeouts[j]);
+    ASSERT(!btc_timer_active(timers[j]));
+  }
+
+  ASSERT(timer_state.fired[3] == 0);
+  ASSERT(timer_state.repeats == 5);
+  ASSERT(!btc_timer_active(repeat));
+
+  for (i = 0; i < 4; i++)
+    btc_timer_destroy(timers[i]);
+
+  btc_timer_destroy(repeat);
+
+  btc_loop_close(loop);
+  btc_loop_destroy(loop);
+}
+
+/*
+ * Main
+ */
+
+int
+main(void) {
+  btc_net_startup();
+  test_stream();
+  test_shared();
+  test_migrate();
+  test_handoff();
+  test_post();
+  test_timer();
+  btc_net_cleanup();
   return 0;
 }
@@ -1,5 +1,5 @@
 /*!
- * t-stub.c - stub test for mako
+ * t-merkle.c - merkle test for mako
  * Copyright (c) 2021, Christopher Jeffrey (MIT License).
  * https://github.com/chjj/mako
  */
@@ -7,8 +7,92 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <mako/crypto/hash.h>
+#include <mako/crypto/merkle.h>
 #include "lib/tests.h"
 
-int main(void) {
+static const char *backends[] = {
+  "avx512",
+  "avx2",
+  "sse2",
+  "generic"
+};
+
+static int
+merkle_root(uint8_t *root, uint8_t *nodes, size_t size) {
+  uint8_t *left, *right, *last;
+  int malleated = 0;
+  size_t i;
+
+  if (size == 0) {
+    memset(root, 0, 32);
+    return 1;
+  }
+
+  last = &nodes[0 * 32];
+
+  while (size > 1) {
+    for (i = 0; i < size; i += 2) {
+      left = &nodes[(i + 0) * 32];
+      right = left;
+
+      if (i + 1 < size) {
+        right = &nodes[(i + 1) * 32];
+
+        if (i + 2 == size && memcmp(left, right, 32) == 0)
+          malleated = 1;
+      }
+
+      last = &nodes[(i / 2) * 32];
+
+      btc_hash256_root(last, left, right);
+    }
+
+    size = (size + 1) / 2;
+  }
+
+  memcpy(root, last, 32);
+
+  return malleated == 0;
+}
+
+static void
+test_merkle_root(size_t size, int dup) {
+  static uint8_t nodes[100 * 32];
+  static uint8_t copy[100 * 32];
+  uint8_t expect[32];
+  uint8_t root[32];
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    btc_hash256(&nodes[i * 32], &i, sizeof(i));
+
+  if (dup && size >= 2)
+    memcpy(&nodes[(size - 1) * 32], &nodes[(size - 2) * 32], 32);
+
+  memcpy(copy, nodes, size * 32);
+
+  ASSERT(btc_merkle_root(root, nodes, size) == merkle_root(expect, copy, size));
+  ASSERT(memcmp(root, expect, 32) == 0);
+}
+
+int
+main(void) {
+  size_t i, j;
+
+  for (i = 0; i < lengthof(backends); i++) {
+    if (!btc_hash256_select(backends[i]))
+      continue;
+
+    ASSERT(strcmp(btc_hash256_backend(), backends[i]) == 0);
+
+    for (j = 0; j <= 100; j++) {
+      test_merkle_root(j, 0);
+      test_merkle_root(j, 1);
+    }
+  }
+
+  ASSERT(!btc_hash256_select("foobar"));
+
   return 0;
 }
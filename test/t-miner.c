@@ -1,14 +1,218 @@
 /*!
- * t-stub.c - stub test for mako
+ * t-miner.c - miner test for mako
  * Copyright (c) 2021, Christopher Jeffrey (MIT License).
  * https://github.com/chjj/mako
  */
 
+#include <stdarg.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <io/core.h>
+#include <io/loop.h>
+#include <node/chain.h>
+#include <node/mempool.h>
+#include <node/miner.h>
+#include <mako/address.h>
+#include <mako/block.h>
+#include <mako/crypto/hash.h>
+#include <mako/network.h>
+#include <mako/script.h>
+#include <mako/tx.h>
+#include <mako/util.h>
 #include "lib/tests.h"
 
-int main(void) {
+/*
+ * Constants
+ */
+
+/* Anyone-can-spend redeem script. Segwit isn't active
+   on a fresh regtest chain, so we stick to p2sh. */
+static const uint8_t redeem[2] = { BTC_OP_NOP, BTC_OP_1 };
+static const uint8_t unlock[3] = { 2, BTC_OP_NOP, BTC_OP_1 };
+
+/*
+ * Helpers
+ */
+
+static void
+on_tx(const btc_mpentry_t *entry, const btc_view_t *view, void *arg) {
+  (void)view;
+  btc_miner_add_tx((btc_miner_t *)arg, entry);
+}
+
+static void
+on_remove_tx(const btc_mpentry_t *entry, void *arg) {
+  btc_miner_remove_tx((btc_miner_t *)arg, entry);
+}
+
+static void
+on_prioritise_tx(const btc_mpentry_t *entry, void *arg) {
+  btc_miner_update_tx((btc_miner_t *)arg, entry);
+}
+
+static btc_tx_t *
+mine_block(btc_chain_t *chain, btc_miner_t *miner) {
+  btc_tmpl_t *bt = btc_miner_template(miner);
+  btc_block_t *block = btc_tmpl_mine(bt);
+  btc_tx_t *cb;
+
+  btc_tmpl_destroy(bt);
+
+  ASSERT(btc_chain_add(chain, block, BTC_BLOCK_DEFAULT_FLAGS, -1));
+
+  cb = btc_tx_clone(block->txs.items[0]);
+
+  btc_block_destroy(block);
+
+  return cb;
+}
+
+static btc_tx_t *
+spend(const btc_tx_t *prev, int64_t fee) {
+  btc_input_t *input = btc_input_create();
+  btc_output_t *output = btc_output_create();
+  btc_tx_t *tx = btc_tx_create();
+  uint8_t hash[32];
+
+  btc_tx_txid(hash, prev);
+  btc_outpoint_set(&input->prevout, hash, 0);
+  btc_script_set(&input->script, unlock, sizeof(unlock));
+  btc_inpvec_push(&tx->inputs, input);
+
+  btc_hash160(hash, redeem, sizeof(redeem));
+
+  output->value = prev->outputs.items[0]->value - fee;
+
+  btc_script_set_p2sh(&output->script, hash);
+  btc_outvec_push(&tx->outputs, output);
+
+  btc_tx_refresh(tx);
+
+  return tx;
+}
+
+static void
+check_order(btc_miner_t *miner, size_t length, ...) {
+  btc_tmpl_t *bt = btc_miner_template(miner);
+  va_list ap;
+  size_t i;
+
+  ASSERT(bt->txs.length == length);
+
+  va_start(ap, length);
+
+  for (i = 0; i < length; i++) {
+    const btc_blockentry_t *item = bt->txs.items[i];
+    const btc_tx_t *tx = va_arg(ap, const btc_tx_t *);
+
+    ASSERT(btc_hash_equal(item->hash, tx->hash));
+  }
+
+  va_end(ap);
+
+  btc_tmpl_destroy(bt);
+}
+
+/*
+ * Miner Test
+ */
+
+static void
+test_miner_prioritise(void) {
+  const btc_network_t *network = btc_regtest;
+  btc_loop_t *loop = btc_loop_create();
+  btc_chain_t *chain = btc_chain_create(network);
+  btc_mempool_t *mempool = btc_mempool_create(network, chain);
+  btc_miner_t *miner = btc_miner_create(network, loop, chain, mempool);
+  btc_tx_t *cbs[3];
+  btc_tx_t *a, *b, *c, *d;
+  btc_address_t addr;
+  uint8_t hash[32];
+  int i;
+
+  btc_rimraf(BTC_PREFIX);
+
+  btc_mempool_on_tx(mempool, on_tx);
+  btc_mempool_on_remove(mempool, on_remove_tx);
+  btc_mempool_on_prioritise(mempool, on_prioritise_tx);
+  btc_mempool_set_context(mempool, miner);
+
+  btc_hash160(hash, redeem, sizeof(redeem));
+  btc_address_set_p2sh(&addr, hash);
+  btc_miner_add_address(miner, &addr);
+
+  ASSERT(btc_chain_open(chain, BTC_PREFIX, 0));
+  ASSERT(btc_mempool_open(mempool, BTC_PREFIX, 0));
+
+  for (i = 0; i < 103; i++) {
+    btc_tx_t *cb = mine_block(chain, miner);
+
+    if (i < 3)
+      cbs[i] = cb;
+    else
+      btc_tx_destroy(cb);
+  }
+
+  a = spend(cbs[0], 1000);
+  b = spend(cbs[1], 2000);
+  c = spend(cbs[2], 3000);
+  d = spend(a, 20000);
+
+  ASSERT(btc_mempool_add(mempool, a, 0));
+  ASSERT(btc_mempool_add(mempool, b, 0));
+  ASSERT(btc_mempool_add(mempool, c, 0));
+
+  check_order(miner, 3, c, b, a);
+
+  /* A bump moves the entry to the front... */
+  ASSERT(btc_mempool_prioritise(mempool, a->hash, 5000));
+
+  check_order(miner, 3, a, c, b);
+
+  /* ...and taking it back restores the original order. */
+  ASSERT(btc_mempool_prioritise(mempool, a->hash, -5000));
+
+  check_order(miner, 3, c, b, a);
+
+  /* A rich child pulls its parent forward. */
+  ASSERT(btc_mempool_add(mempool, d, 0));
+
+  check_order(miner, 4, a, d, c, b);
+
+  /* Deprioritising the child lets the parent fall back. */
+  ASSERT(btc_mempool_prioritise(mempool, d->hash, -19000));
+
+  check_order(miner, 4, c, b, a, d);
+
+  /* Unknown transactions are rejected. */
+  ASSERT(!btc_mempool_prioritise(mempool, cbs[0]->hash, 1000));
+
+  for (i = 0; i < 3; i++)
+    btc_tx_destroy(cbs[i]);
+
+  btc_tx_destroy(a);
+  btc_tx_destroy(b);
+  btc_tx_destroy(c);
+  btc_tx_destroy(d);
+
+  btc_mempool_close(mempool);
+  btc_chain_close(chain);
+
+  btc_miner_destroy(miner);
+  btc_mempool_destroy(mempool);
+  btc_chain_destroy(chain);
+  btc_loop_destroy(loop);
+
+  btc_rimraf(BTC_PREFIX);
+}
+
+/*
+ * Main
+ */
+
+int
+main(void) {
+  test_miner_prioritise();
   return 0;
 }
@@ -1,5 +1,5 @@
 /*!
- * t-stub.c - stub test for mako
+ * t-netmsg.c - netmsg test for mako
  * Copyright (c) 2021, Christopher Jeffrey (MIT License).
  * https://github.com/chjj/mako
  */
@@ -7,8 +7,393 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <mako/crypto/hash.h>
+#include <mako/netmsg.h>
 #include "lib/tests.h"
 
-int main(void) {
+/*
+ * Constants
+ */
+
+#define MAGIC 0xdab5bffa
+#define MAX_BODY (4 * 1000 * 1000)
+#define MIN(x, y) ((x) < (y) ? (x) : (y))
+
+/*
+ * RNG
+ */
+
+static uint32_t rng_state = 0x12345678;
+
+static uint32_t
+rng_next(void) {
+  /* xorshift32; never yields zero. */
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+static size_t
+rng_range(size_t lo, size_t hi) {
+  return lo + rng_next() % (hi - lo + 1);
+}
+
+/*
+ * Framing
+ */
+
+static void
+write32le(uint8_t *zp, uint32_t x) {
+  zp[0] = (uint8_t)(x >>  0);
+  zp[1] = (uint8_t)(x >>  8);
+  zp[2] = (uint8_t)(x >> 16);
+  zp[3] = (uint8_t)(x >> 24);
+}
+
+static size_t
+frame(uint8_t *zp, uint32_t magic, const char *cmd,
+      const uint8_t *body, size_t size) {
+  uint8_t hash[32];
+
+  btc_hash256(hash, body, size);
+
+  write32le(zp, magic);
+  memset(zp + 4, 0, 12);
+  memcpy(zp + 4, cmd, strlen(cmd));
+  write32le(zp + 16, size);
+  memcpy(zp + 20, hash, 4);
+
+  if (size > 0)
+    memcpy(zp + 24, body, size);
+
+  return 24 + size;
+}
+
+/*
+ * Receiver
+ */
+
+typedef struct expect_s {
+  const char *cmd;
+  const uint8_t *body;
+  size_t size;
+} expect_t;
+
+typedef struct receiver_s {
+  btc_parser_t parser;
+  const expect_t *items;
+  size_t length;
+  size_t count;
+  int errors;
+} receiver_t;
+
+static void
+on_msg(btc_msg_t *msg, void *arg) {
+  receiver_t *rcv = (receiver_t *)arg;
+  const expect_t *item;
+
+  ASSERT(rcv->count < rcv->length);
+
+  item = &rcv->items[rcv->count++];
+
+  ASSERT(strcmp(msg->cmd, item->cmd) == 0);
+
+  if (msg->type == BTC_MSG_UNKNOWN) {
+    const btc_unknown_t *body = (const btc_unknown_t *)msg->body;
+
+    ASSERT(body->length == item->size);
+
+    if (item->size > 0)
+      ASSERT(memcmp(body->data, item->body, item->size) == 0);
+  } else if (msg->type == BTC_MSG_PING) {
+    const btc_ping_t *body = (const btc_ping_t *)msg->body;
+    uint8_t tmp[8];
+
+    write32le(tmp + 0, (uint32_t)(body->nonce >>  0));
+    write32le(tmp + 4, (uint32_t)(body->nonce >> 32));
+
+    ASSERT(item->size == 8);
+    ASSERT(memcmp(tmp, item->body, 8) == 0);
+  } else {
+    ASSERT(msg->type == BTC_MSG_VERACK);
+    ASSERT(item->size == 0);
+  }
+}
+
+static void
+on_error(void *arg) {
+  receiver_t *rcv = (receiver_t *)arg;
+
+  rcv->errors++;
+
+  /* Mimic the pool, which drops the peer. */
+  rcv->parser.closed = 1;
+}
+
+static void
+receiver_init(receiver_t *rcv, const expect_t *items, size_t length) {
+  btc_parser_init(&rcv->parser, MAGIC);
+
+  rcv->parser.on_msg = on_msg;
+  rcv->parser.on_error = on_error;
+  rcv->parser.arg = rcv;
+
+  rcv->items = items;
+  rcv->length = length;
+  rcv->count = 0;
+  rcv->errors = 0;
+}
+
+static void
+receiver_push(receiver_t *rcv, const uint8_t *data, size_t length) {
+  /* Hand the stream over in random fragments, reading
+     into the parser's window whenever it offers one. */
+  while (length > 0) {
+    size_t size = 0;
+    uint8_t *window;
+    size_t n;
+
+    window = (uint8_t *)btc_parser_window(&rcv->parser, &size);
+
+    if (window != NULL && (rng_next() & 3) != 0) {
+      ASSERT(size > 0);
+
+      n = rng_range(1, MIN(size, length));
+
+      memcpy(window, data, n);
+
+      btc_parser_feed(&rcv->parser, window, n);
+    } else {
+      switch (rng_next() & 3) {
+        case 0:
+          n = 1;
+          break;
+        case 1:
+          n = rng_range(1, 32);
+          break;
+        case 2:
+          n = rng_range(1, 4096);
+          break;
+        default:
+          n = rng_range(1, 1 << 18);
+          break;
+      }
+
+      n = MIN(n, length);
+
+      btc_parser_feed(&rcv->parser, data, n);
+    }
+
+    data += n;
+    length -= n;
+  }
+}
+
+/*
+ * Tests
+ */
+
+static void
+test_parser_fragment(void) {
+  static const char *cmds[] = { "verack", "ping", "zzz" };
+  size_t i, round, len, size;
+  expect_t items[64];
+  uint8_t *stream;
+  uint8_t *pool;
+
+  pool = (uint8_t *)malloc(MAX_BODY);
+
+  ASSERT(pool != NULL);
+
+  for (i = 0; i < MAX_BODY; i++)
+    pool[i] = (uint8_t)rng_next();
+
+  for (round = 0; round < 20; round++) {
+    receiver_t rcv;
+
+    len = 0;
+
+    for (i = 0; i < lengthof(items); i++) {
+      expect_t *item = &items[i];
+      const char *cmd = cmds[rng_next() % lengthof(cmds)];
+
+      if (strcmp(cmd, "verack") == 0) {
+        size = 0;
+      } else if (strcmp(cmd, "ping") == 0) {
+        size = 8;
+      } else {
+        switch (rng_next() & 15) {
+          case 0:
+          case 1:
+            size = 0;
+            break;
+          case 2:
+            size = MAX_BODY;
+            break;
+          case 3:
+          case 4:
+            size = rng_range(16384, MAX_BODY / 2);
+            break;
+          default:
+            size = rng_range(1, 16384);
+            break;
+        }
+      }
+
+      item->cmd = cmd;
+      item->body = pool + rng_range(0, MAX_BODY - size);
+      item->size = size;
+
+      len += 24 + size;
+    }
+
+    stream = (uint8_t *)malloc(len);
+
+    ASSERT(stream != NULL);
+
+    len = 0;
+
+    for (i = 0; i < lengthof(items); i++) {
+      const expect_t *item = &items[i];
+
+      len += frame(stream + len, MAGIC, item->cmd, item->body, item->size);
+    }
+
+    receiver_init(&rcv, items, lengthof(items));
+    receiver_push(&rcv, stream, len);
+
+    ASSERT(rcv.errors == 0);
+    ASSERT(rcv.count == lengthof(items));
+    ASSERT(rcv.parser.total == 0);
+    ASSERT(!rcv.parser.has_header);
+
+    /* Nothing larger than a megabyte outlives its message. */
+    ASSERT(rcv.parser.alloc <= (1 << 20));
+
+    btc_parser_clear(&rcv.parser);
+
+    free(stream);
+  }
+
+  stream = (uint8_t *)malloc(8 * (24 + 40000));
+
+  ASSERT(stream != NULL);
+
+  /* A corrupted frame anywhere in the stream stops the parser. */
+  for (round = 0; round < 20; round++) {
+    receiver_t rcv;
+    size_t bad = rng_range(0, 7);
+    size_t pos = 0;
+
+    len = 0;
+
+    for (i = 0; i < 8; i++) {
+      items[i].cmd = "zzz";
+      items[i].body = pool + i;
+      items[i].size = rng_range(0, 40000);
+
+      if (i == bad)
+        pos = len;
+
+      len += frame(stream + len, MAGIC, "zzz", items[i].body, items[i].size);
+    }
+
+    if (round & 1)
+      stream[pos] ^= 1; /* magic */
+    else
+      stream[pos + 20] ^= 1; /* checksum */
+
+    receiver_init(&rcv, items, 8);
+    receiver_push(&rcv, stream, len);
+
+    ASSERT(rcv.errors == 1);
+    ASSERT(rcv.count == bad);
+
+    btc_parser_clear(&rcv.parser);
+  }
+
+  /* Oversized length fields are rejected at the header. */
+  {
+    receiver_t rcv;
+
+    frame(stream, MAGIC, "zzz", NULL, 0);
+    write32le(stream + 16, MAX_BODY + 1);
+
+    receiver_init(&rcv, items, 0);
+    receiver_push(&rcv, stream, 24);
+
+    ASSERT(rcv.errors == 1);
+    ASSERT(rcv.parser.alloc == 0);
+
+    btc_parser_clear(&rcv.parser);
+  }
+
+  free(stream);
+  free(pool);
+}
+
+static void
+test_parser_alloc(void) {
+  /* A bare header claiming a 4MB body shouldn't
+     commit anything close to 4MB up front. */
+  static uint8_t body[100000];
+  static uint8_t stream[24 + sizeof(body)];
+  receiver_t rcv;
+  expect_t item;
+  size_t size = 0;
+  uint8_t *window;
+  size_t i;
+
+  for (i = 0; i < sizeof(body); i++)
+    body[i] = (uint8_t)rng_next();
+
+  item.cmd = "zzz";
+  item.body = body;
+  item.size = sizeof(body);
+
+  frame(stream, MAGIC, "zzz", body, sizeof(body));
+  write32le(stream + 16, MAX_BODY);
+
+  receiver_init(&rcv, &item, 1);
+
+  btc_parser_feed(&rcv.parser, stream, 24);
+
+  ASSERT(rcv.parser.has_header);
+  ASSERT(rcv.parser.size == MAX_BODY);
+  ASSERT(rcv.parser.alloc == 0);
+
+  /* Buffered reads grow with the data. */
+  btc_parser_feed(&rcv.parser, stream + 24, 100);
+
+  ASSERT(rcv.parser.alloc <= 1024);
+
+  /* Windowed reads grow geometrically. */
+  for (i = 0; i < 8; i++) {
+    window = (uint8_t *)btc_parser_window(&rcv.parser, &size);
+
+    ASSERT(window != NULL);
+    ASSERT(size >= 16384);
+    ASSERT(rcv.parser.alloc <= 2 * (rcv.parser.total + 16384));
+
+    btc_parser_feed(&rcv.parser, window, 1);
+
+    ASSERT(rcv.parser.alloc < 65536);
+  }
+
+  ASSERT(rcv.count == 0);
+  ASSERT(rcv.errors == 0);
+
+  btc_parser_clear(&rcv.parser);
+}
+
+/*
+ * Main
+ */
+
+int
+main(void) {
+  test_parser_fragment();
+  test_parser_alloc();
   return 0;
 }
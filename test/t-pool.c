@@ -0,0 +1,745 @@
+/*!
+ * t-pool.c - pool test for mako
+ * Copyright (c) 2021, Christopher Jeffrey (MIT License).
+ * https://github.com/chjj/mako
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <io/core.h>
+#include <io/loop.h>
+#include <node/chain.h>
+#include <node/mempool.h>
+#include <node/miner.h>
+#include <node/pool.h>
+#include <mako/address.h>
+#include <mako/bip152.h>
+#include <mako/bip330.h>
+#include <mako/block.h>
+#include <mako/crypto/hash.h>
+#include <mako/crypto/rand.h>
+#include <mako/header.h>
+#include <mako/net.h>
+#include <mako/netaddr.h>
+#include <mako/netmsg.h>
+#include <mako/network.h>
+#include <mako/script.h>
+#include <mako/tx.h>
+#include <mako/util.h>
+#include "lib/tests.h"
+
+/*
+ * Helpers
+ */
+
+static void
+write32le(uint8_t *zp, uint32_t x) {
+  zp[0] = (x >>  0) & 0xff;
+  zp[1] = (x >>  8) & 0xff;
+  zp[2] = (x >> 16) & 0xff;
+  zp[3] = (x >> 24) & 0xff;
+}
+
+static uint32_t
+read32le(const uint8_t *xp) {
+  return ((uint32_t)xp[0] <<  0)
+       | ((uint32_t)xp[1] <<  8)
+       | ((uint32_t)xp[2] << 16)
+       | ((uint32_t)xp[3] << 24);
+}
+
+/*
+ * Fake Peer
+ */
+
+/* A scripted remote peer speaking just enough of the
+   protocol to walk the pool through a block race. */
+typedef struct fake_s {
+  const btc_network_t *network;
+  btc_socket_t *server;
+  btc_socket_t *socket;
+  uint8_t *data;
+  size_t length;
+  int recon;
+  int verack;
+  int closed;
+  int hb_mode;
+  uint32_t getdata_type;
+  uint8_t getdata_hash[32];
+  int getdata;
+  uint8_t cmpct_hash[32];
+  int cmpct;
+  int inv_tx;
+} fake_t;
+
+static void
+fake_send(fake_t *fake, enum btc_msgtype type, void *body) {
+  uint8_t hash[32];
+  btc_msg_t msg;
+  uint8_t *data;
+  size_t size;
+
+  btc_msg_init(&msg);
+  btc_msg_set_type(&msg, type);
+
+  msg.body = body;
+
+  size = btc_msg_size(&msg);
+  data = malloc(24 + size);
+
+  ASSERT(data != NULL);
+
+  btc_msg_write(data + 24, &msg);
+  btc_hash256(hash, data + 24, size);
+
+  write32le(data, fake->network->magic);
+  memset(data + 4, 0, 12);
+  memcpy(data + 4, msg.cmd, strlen(msg.cmd));
+  write32le(data + 16, size);
+  memcpy(data + 20, hash, 4);
+
+  ASSERT(btc_socket_write(fake->socket, data, 24 + size) != -1);
+}
+
+static void
+fake_send_version(fake_t *fake) {
+  btc_version_t msg;
+
+  btc_version_init(&msg);
+
+  msg.version = BTC_NET_PROTOCOL_VERSION;
+  msg.services = BTC_NET_LOCAL_SERVICES;
+  msg.time = btc_now();
+  msg.nonce = btc_nonce();
+  msg.height = 0;
+  msg.relay = 1;
+
+  strcpy(msg.agent, "/t-pool/");
+
+  fake_send(fake, BTC_MSG_VERSION, &msg);
+}
+
+static void
+fake_send_sendtxrcncl(fake_t *fake) {
+  btc_sendtxrcncl_t msg;
+
+  msg.version = BTC_RECON_VERSION;
+  msg.salt = btc_nonce();
+
+  fake_send(fake, BTC_MSG_SENDTXRCNCL, &msg);
+}
+
+static void
+fake_send_sendcmpct(fake_t *fake, int mode) {
+  btc_sendcmpct_t msg;
+
+  msg.mode = mode;
+  msg.version = 2;
+
+  fake_send(fake, BTC_MSG_SENDCMPCT, &msg);
+}
+
+static void
+fake_send_inv(fake_t *fake, const btc_block_t *block) {
+  uint8_t hash[32];
+  btc_inv_t inv;
+
+  btc_header_hash(hash, &block->header);
+
+  btc_inv_init(&inv);
+  btc_inv_push_item(&inv, BTC_INV_BLOCK, hash);
+
+  fake_send(fake, BTC_MSG_INV_FULL, &inv);
+
+  btc_inv_clear(&inv);
+}
+
+static void
+fake_send_cmpct(fake_t *fake, const btc_block_t *block) {
+  btc_cmpct_t cmpct;
+
+  btc_cmpct_init(&cmpct);
+  btc_cmpct_set_block(&cmpct, block, 1);
+
+  fake_send(fake, BTC_MSG_CMPCTBLOCK, &cmpct);
+
+  btc_cmpct_clear(&cmpct);
+}
+
+static void
+fake_send_block(fake_t *fake, btc_block_t *block) {
+  /* Answer however the pool asked for it. */
+  if (fake->getdata_type == BTC_INV_CMPCT_BLOCK)
+    fake_send_cmpct(fake, block);
+  else
+    fake_send(fake, BTC_MSG_BLOCK, block);
+}
+
+static void
+fake_on_msg(fake_t *fake, const char *cmd, const uint8_t *body, size_t size) {
+  if (strcmp(cmd, "version") == 0) {
+    if (fake->recon) {
+      /* We were dialed: introduce ourselves. */
+      fake_send_version(fake);
+      fake_send(fake, BTC_MSG_WTXIDRELAY, NULL);
+      fake_send_sendtxrcncl(fake);
+    }
+
+    fake_send(fake, BTC_MSG_VERACK, NULL);
+
+    return;
+  }
+
+  if (strcmp(cmd, "verack") == 0) {
+    fake->verack = 1;
+    return;
+  }
+
+  if (strcmp(cmd, "sendcmpct") == 0) {
+    btc_sendcmpct_t msg;
+
+    ASSERT(btc_sendcmpct_import(&msg, body, size));
+
+    fake->hb_mode = msg.mode;
+
+    return;
+  }
+
+  if (strcmp(cmd, "getdata") == 0) {
+    btc_inv_t inv;
+
+    btc_inv_init(&inv);
+
+    ASSERT(btc_inv_import(&inv, body, size));
+    ASSERT(inv.length > 0);
+
+    fake->getdata_type = inv.items[0]->type & ~BTC_INV_WITNESS_FLAG;
+    memcpy(fake->getdata_hash, inv.items[0]->hash, 32);
+    fake->getdata++;
+
+    btc_inv_clear(&inv);
+
+    return;
+  }
+
+  if (strcmp(cmd, "inv") == 0) {
+    btc_inv_t inv;
+    size_t i;
+
+    btc_inv_init(&inv);
+
+    ASSERT(btc_inv_import(&inv, body, size));
+
+    for (i = 0; i < inv.length; i++) {
+      uint32_t type = inv.items[i]->type;
+
+      if (type == BTC_INV_TX || type == BTC_INV_WTX)
+        fake->inv_tx++;
+    }
+
+    btc_inv_clear(&inv);
+
+    return;
+  }
+
+  if (strcmp(cmd, "cmpctblock") == 0) {
+    btc_cmpct_t cmpct;
+
+    btc_cmpct_init(&cmpct);
+
+    ASSERT(btc_cmpct_import(&cmpct, body, size));
+
+    btc_header_hash(fake->cmpct_hash, &cmpct.header);
+    fake->cmpct++;
+
+    btc_cmpct_clear(&cmpct);
+
+    return;
+  }
+}
+
+static int
+fake_on_data(btc_socket_t *socket, const void *data, size_t size) {
+  fake_t *fake = btc_socket_get_data(socket);
+  size_t pos = 0;
+
+  if (size == 0) {
+    btc_socket_close(socket);
+    return 0;
+  }
+
+  fake->data = realloc(fake->data, fake->length + size);
+
+  ASSERT(fake->data != NULL);
+
+  memcpy(fake->data + fake->length, data, size);
+
+  fake->length += size;
+
+  while (fake->length - pos >= 24) {
+    const uint8_t *hdr = fake->data + pos;
+    size_t len = read32le(hdr + 16);
+    char cmd[12 + 1];
+
+    if (fake->length - pos < 24 + len)
+      break;
+
+    memcpy(cmd, hdr + 4, 12);
+    cmd[12] = '\0';
+
+    fake_on_msg(fake, cmd, hdr + 24, len);
+
+    pos += 24 + len;
+  }
+
+  memmove(fake->data, fake->data + pos, fake->length - pos);
+
+  fake->length -= pos;
+
+  return 1;
+}
+
+static void
+fake_on_close(btc_socket_t *socket) {
+  fake_t *fake = btc_socket_get_data(socket);
+  fake->closed = 1;
+}
+
+static void
+fake_connect(fake_t *fake,
+             btc_loop_t *loop,
+             const btc_network_t *network,
+             int port) {
+  btc_sockaddr_t addr;
+
+  memset(fake, 0, sizeof(*fake));
+
+  fake->network = network;
+
+  ASSERT(btc_sockaddr_import(&addr, "127.0.0.1", port));
+
+  fake->socket = btc_loop_connect(loop, &addr);
+
+  ASSERT(fake->socket != NULL);
+
+  btc_socket_set_data(fake->socket, fake);
+  btc_socket_on_data(fake->socket, fake_on_data);
+  btc_socket_on_close(fake->socket, fake_on_close);
+
+  fake_send_version(fake);
+}
+
+static void
+fake_on_socket(btc_socket_t *server, btc_socket_t *socket) {
+  fake_t *fake = btc_socket_get_data(server);
+
+  /* One connection per fake. */
+  if (fake->socket != NULL) {
+    btc_socket_close(socket);
+    return;
+  }
+
+  fake->socket = socket;
+
+  btc_socket_set_data(socket, fake);
+  btc_socket_on_data(socket, fake_on_data);
+  btc_socket_on_close(socket, fake_on_close);
+}
+
+static void
+fake_listen(fake_t *fake,
+            btc_loop_t *loop,
+            const btc_network_t *network,
+            btc_netaddr_t *addr) {
+  btc_sockaddr_t sa;
+  int i;
+
+  memset(fake, 0, sizeof(*fake));
+
+  fake->network = network;
+  fake->recon = 1;
+
+  for (i = 0; i < 100; i++) {
+    ASSERT(btc_sockaddr_import(&sa, "127.0.0.1", 48700 + i));
+
+    fake->server = btc_loop_listen(loop, &sa);
+
+    if (fake->server != NULL)
+      break;
+  }
+
+  ASSERT(fake->server != NULL);
+
+  btc_socket_set_data(fake->server, fake);
+  btc_socket_on_socket(fake->server, fake_on_socket);
+
+  btc_netaddr_set_sockaddr(addr, &sa);
+}
+
+static void
+fake_destroy(fake_t *fake) {
+  if (fake->server != NULL)
+    btc_socket_close(fake->server);
+
+  if (fake->socket != NULL && !fake->closed)
+    btc_socket_close(fake->socket);
+
+  fake->server = NULL;
+
+  free(fake->data);
+
+  fake->data = NULL;
+}
+
+/*
+ * Chain Helpers
+ */
+
+#define POLL_UNTIL(loop, cond) do {               \
+  int64_t _end = btc_time_msec() + 10000;         \
+  while (!(cond) && btc_time_msec() < _end)       \
+    btc_loop_poll(loop, 10);                      \
+  ASSERT(cond);                                   \
+} while (0)
+
+static void
+poll_for(btc_loop_t *loop, int64_t msec) {
+  int64_t end = btc_time_msec() + msec;
+
+  while (btc_time_msec() < end)
+    btc_loop_poll(loop, 10);
+}
+
+static btc_block_t *
+mine_block(btc_miner_t *miner) {
+  btc_tmpl_t *bt = btc_miner_template(miner);
+  btc_block_t *block = btc_tmpl_mine(bt);
+
+  btc_tmpl_destroy(bt);
+
+  return block;
+}
+
+static btc_tx_t *
+mine_coinbase(btc_chain_t *chain, btc_miner_t *miner) {
+  btc_block_t *block = mine_block(miner);
+  btc_tx_t *cb;
+
+  ASSERT(btc_chain_add(chain, block, BTC_BLOCK_DEFAULT_FLAGS, -1));
+
+  cb = btc_tx_clone(block->txs.items[0]);
+
+  btc_block_destroy(block);
+
+  return cb;
+}
+
+/* Anyone-can-spend p2sh, as in t-miner. */
+static const uint8_t redeem[2] = { BTC_OP_NOP, BTC_OP_1 };
+static const uint8_t unlock[3] = { 2, BTC_OP_NOP, BTC_OP_1 };
+
+static btc_tx_t *
+spend(const btc_tx_t *prev) {
+  btc_input_t *input = btc_input_create();
+  btc_output_t *output = btc_output_create();
+  btc_tx_t *tx = btc_tx_create();
+  uint8_t hash[32];
+
+  btc_tx_txid(hash, prev);
+  btc_outpoint_set(&input->prevout, hash, 0);
+  btc_script_set(&input->script, unlock, sizeof(unlock));
+  btc_inpvec_push(&tx->inputs, input);
+
+  btc_hash160(hash, redeem, sizeof(redeem));
+
+  output->value = prev->outputs.items[0]->value - 10000;
+
+  btc_script_set_p2sh(&output->script, hash);
+  btc_outvec_push(&tx->outputs, output);
+
+  btc_tx_refresh(tx);
+
+  return tx;
+}
+
+static void
+on_tx(const btc_mpentry_t *entry, const btc_view_t *view, void *arg) {
+  (void)view;
+  btc_pool_announce_tx((btc_pool_t *)arg, entry);
+}
+
+static int
+block_equal(const uint8_t *hash, const btc_block_t *block) {
+  uint8_t tmp[32];
+  btc_header_hash(tmp, &block->header);
+  return memcmp(tmp, hash, 32) == 0;
+}
+
+/*
+ * Pool Test
+ */
+
+static void
+test_pool_compact(void) {
+  const btc_network_t *network = btc_regtest;
+  /* Listen only: an empty connect list means no outbound peers. */
+  unsigned int flags = BTC_POOL_LISTEN | BTC_POOL_CONNECT | BTC_POOL_BIP152;
+  btc_loop_t *loop = btc_loop_create();
+  btc_chain_t *chain = btc_chain_create(network);
+  btc_mempool_t *mempool = btc_mempool_create(network, chain);
+  btc_miner_t *miner = btc_miner_create(network, loop, chain, NULL);
+  btc_pool_t *pool = btc_pool_create(network, loop, chain, mempool);
+  btc_block_t *block;
+  fake_t a, b;
+  int port = 0;
+  int i;
+
+  btc_rimraf(BTC_PREFIX);
+
+  ASSERT(btc_chain_open(chain, BTC_PREFIX, 0));
+  ASSERT(btc_mempool_open(mempool, BTC_PREFIX, 0));
+
+  /* A recent block marks the chain as synced. */
+  block = mine_block(miner);
+
+  ASSERT(btc_chain_add(chain, block, BTC_BLOCK_DEFAULT_FLAGS, -1));
+  ASSERT(btc_chain_synced(chain));
+
+  btc_block_destroy(block);
+
+  for (i = 0; i < 100; i++) {
+    port = 48600 + i;
+
+    btc_pool_set_port(pool, port);
+
+    if (btc_pool_open(pool, BTC_PREFIX, flags))
+      break;
+  }
+
+  ASSERT(i < 100);
+
+  fake_connect(&a, loop, network, port);
+  fake_connect(&b, loop, network, port);
+
+  POLL_UNTIL(loop, a.verack && b.verack);
+
+  /* B speaks compact blocks; A does not. */
+  fake_send_sendcmpct(&b, 0);
+
+  /* B hands us a new tip and is promoted to
+     high-bandwidth mode. */
+  block = mine_block(miner);
+
+  fake_send_inv(&b, block);
+
+  POLL_UNTIL(loop, b.getdata == 1);
+
+  ASSERT(block_equal(b.getdata_hash, block));
+
+  fake_send_block(&b, block);
+
+  POLL_UNTIL(loop, btc_chain_height(chain) == 2 && b.hb_mode == 1);
+
+  btc_block_destroy(block);
+
+  /* A announces the next block first; we ask A for
+     it. B then pushes the same block unsolicited
+     while A's request is still outstanding. */
+  block = mine_block(miner);
+
+  fake_send_inv(&a, block);
+
+  POLL_UNTIL(loop, a.getdata == 1);
+
+  ASSERT(block_equal(a.getdata_hash, block));
+
+  fake_send_cmpct(&b, block);
+
+  poll_for(loop, 200);
+
+  ASSERT(!b.closed);
+  ASSERT(btc_chain_height(chain) == 2);
+
+  /* A's response still lands. */
+  fake_send_block(&a, block);
+
+  POLL_UNTIL(loop, btc_chain_height(chain) == 3);
+
+  btc_block_destroy(block);
+
+  /* B asks for high-bandwidth relay. A valid block
+     from A is pushed to B ahead of validation... */
+  fake_send_sendcmpct(&b, 1);
+
+  poll_for(loop, 100);
+
+  block = mine_block(miner);
+
+  fake_send_inv(&a, block);
+
+  POLL_UNTIL(loop, a.getdata == 2);
+
+  fake_send_block(&a, block);
+
+  POLL_UNTIL(loop, b.cmpct == 1);
+
+  ASSERT(block_equal(b.cmpct_hash, block));
+  ASSERT(btc_chain_height(chain) == 4);
+
+  btc_block_destroy(block);
+
+  /* ...but one whose body doesn't match its
+     header is not, whatever its proof of work. */
+  block = mine_block(miner);
+
+  block->header.merkle_root[0] ^= 1;
+
+  ASSERT(btc_header_mine(&block->header, 0));
+
+  fake_send_inv(&a, block);
+
+  POLL_UNTIL(loop, a.getdata == 3);
+
+  fake_send_block(&a, block);
+
+  POLL_UNTIL(loop, a.closed);
+
+  poll_for(loop, 100);
+
+  ASSERT(b.cmpct == 1);
+  ASSERT(!b.closed);
+  ASSERT(btc_chain_height(chain) == 4);
+
+  btc_block_destroy(block);
+
+  fake_destroy(&a);
+  fake_destroy(&b);
+
+  btc_pool_close(pool);
+  btc_mempool_close(mempool);
+  btc_chain_close(chain);
+  btc_loop_close(loop);
+
+  btc_pool_destroy(pool);
+  btc_miner_destroy(miner);
+  btc_mempool_destroy(mempool);
+  btc_chain_destroy(chain);
+  btc_loop_destroy(loop);
+
+  btc_rimraf(BTC_PREFIX);
+}
+
+static void
+test_pool_recon_flood(void) {
+  /* Two reconciling outbound peers, one of which we flood to. */
+  const btc_network_t *network = btc_regtest;
+  unsigned int flags = BTC_POOL_CONNECT | BTC_POOL_BIP330;
+  btc_loop_t *loop = btc_loop_create();
+  btc_chain_t *chain = btc_chain_create(network);
+  btc_mempool_t *mempool = btc_mempool_create(network, chain);
+  btc_miner_t *miner = btc_miner_create(network, loop, chain, NULL);
+  btc_pool_t *pool = btc_pool_create(network, loop, chain, mempool);
+  btc_tx_t *cbs[2];
+  btc_tx_t *tx1, *tx2;
+  btc_netaddr_t addr;
+  btc_address_t p2sh;
+  fake_t a, b;
+  fake_t *flood, *other;
+  uint8_t hash[32];
+  int i;
+
+  btc_rimraf(BTC_PREFIX);
+
+  btc_mempool_on_tx(mempool, on_tx);
+  btc_mempool_set_context(mempool, pool);
+
+  btc_hash160(hash, redeem, sizeof(redeem));
+  btc_address_set_p2sh(&p2sh, hash);
+  btc_miner_add_address(miner, &p2sh);
+
+  ASSERT(btc_chain_open(chain, BTC_PREFIX, 0));
+  ASSERT(btc_mempool_open(mempool, BTC_PREFIX, 0));
+
+  for (i = 0; i < 101; i++) {
+    btc_tx_t *cb = mine_coinbase(chain, miner);
+
+    if (i < 2)
+      cbs[i] = cb;
+    else
+      btc_tx_destroy(cb);
+  }
+
+  ASSERT(btc_chain_synced(chain));
+
+  fake_listen(&a, loop, network, &addr);
+  btc_pool_set_connect(pool, &addr);
+
+  fake_listen(&b, loop, network, &addr);
+  btc_pool_set_connect(pool, &addr);
+
+  ASSERT(btc_pool_open(pool, BTC_PREFIX, flags));
+
+  POLL_UNTIL(loop, a.verack && b.verack);
+
+  poll_for(loop, 100);
+
+  /* Exactly one of them hears about new txs by inv. */
+  tx1 = spend(cbs[0]);
+
+  ASSERT(btc_mempool_add(mempool, tx1, 0));
+
+  POLL_UNTIL(loop, a.inv_tx + b.inv_tx > 0);
+
+  poll_for(loop, 100);
+
+  ASSERT(a.inv_tx + b.inv_tx == 1);
+
+  flood = a.inv_tx ? &a : &b;
+  other = a.inv_tx ? &b : &a;
+
+  /* When it leaves, the other peer takes over. */
+  fake_destroy(flood);
+
+  POLL_UNTIL(loop, btc_pool_peers(pool) == 1);
+
+  tx2 = spend(cbs[1]);
+
+  ASSERT(btc_mempool_add(mempool, tx2, 0));
+
+  POLL_UNTIL(loop, other->inv_tx == 1);
+
+  for (i = 0; i < 2; i++)
+    btc_tx_destroy(cbs[i]);
+
+  btc_tx_destroy(tx1);
+  btc_tx_destroy(tx2);
+
+  fake_destroy(other);
+
+  btc_pool_close(pool);
+  btc_mempool_close(mempool);
+  btc_chain_close(chain);
+  btc_loop_close(loop);
+
+  btc_pool_destroy(pool);
+  btc_miner_destroy(miner);
+  btc_mempool_destroy(mempool);
+  btc_chain_destroy(chain);
+  btc_loop_destroy(loop);
+
+  btc_rimraf(BTC_PREFIX);
+}
+
+/*
+ * Main
+ */
+
+int
+main(void) {
+  btc_net_startup();
+  test_pool_compact();
+  test_pool_recon_flood();
+  btc_net_cleanup();
+  return 0;
+}
@@ -7,11 +7,16 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <mako/coins.h>
+#include <mako/consensus.h>
+#include <mako/crypto/ecc.h>
+#include <mako/crypto/hash.h>
 #include <mako/script.h>
 #include <mako/tx.h>
 #include <mako/util.h>
+#include "data/bip341_vectors.h"
 #include "data/script_vectors.h"
 #include "lib/tests.h"
 
@@ -36,7 +41,7 @@ test_script_vector(const test_script_vector_t *vec, size_t index) {
     btc_tx_cache_t cache;
     int ret;
 
-    memset(&cache, 0, sizeof(cache));
+    btc_tx_cache_init(&cache);
 
     ret = btc_script_verify(input,
                             witness,
@@ -48,18 +53,961 @@ test_script_vector(const test_script_vector_t *vec, size_t index) {
                             &cache);
 
     ASSERT(ret == vec->expected);
+
+    ret = btc_script_verify_fast(input,
+                                 witness,
+                                 output,
+                                 &tx,
+                                 0,
+                                 value,
+                                 flags,
+                                 &cache);
+
+    if (ret >= 0)
+      ASSERT(ret == (vec->expected == BTC_SCRIPT_ERR_OK));
+
+    btc_tx_cache_clear(&cache);
   }
 
   btc_tx_clear(&prev);
   btc_tx_clear(&tx);
 }
 
+static const unsigned int fast_flags[] = {
+  BTC_SCRIPT_VERIFY_NONE,
+  BTC_SCRIPT_VERIFY_P2SH,
+  BTC_SCRIPT_VERIFY_DERSIG,
+  BTC_SCRIPT_VERIFY_P2SH | BTC_SCRIPT_VERIFY_WITNESS,
+  BTC_SCRIPT_STANDARD_VERIFY_FLAGS,
+  BTC_SCRIPT_STANDARD_VERIFY_FLAGS & ~BTC_SCRIPT_VERIFY_LOW_S,
+  BTC_SCRIPT_STANDARD_VERIFY_FLAGS | BTC_SCRIPT_VERIFY_CONST_SCRIPTCODE
+};
+
+static int
+test_fast_input(const btc_tx_t *tx, const btc_view_t *view, size_t index) {
+  const btc_input_t *input = tx->inputs.items[index];
+  const btc_coin_t *coin = btc_view_get(view, &input->prevout);
+  int hits = 0;
+  size_t i;
+
+  ASSERT(coin != NULL);
+
+  for (i = 0; i < lengthof(fast_flags); i++) {
+    btc_tx_cache_t cache;
+    int fast, ret;
+
+    btc_tx_cache_init(&cache);
+
+    ret = btc_script_verify(&input->script,
+                            &input->witness,
+                            &coin->output.script,
+                            tx,
+                            index,
+                            coin->output.value,
+                            fast_flags[i],
+                            &cache);
+
+    fast = btc_script_verify_fast(&input->script,
+                                  &input->witness,
+                                  &coin->output.script,
+                                  tx,
+                                  index,
+                                  coin->output.value,
+                                  fast_flags[i],
+                                  &cache);
+
+    if (fast >= 0) {
+      ASSERT(fast == (ret == BTC_SCRIPT_ERR_OK));
+      hits++;
+    }
+
+    btc_tx_cache_clear(&cache);
+  }
+
+  return hits;
+}
+
+static int
+test_fast_mutations(btc_tx_t *tx, const btc_view_t *view, size_t index) {
+  btc_input_t *input = tx->inputs.items[index];
+  const btc_coin_t *coin = btc_view_get(view, &input->prevout);
+  btc_buffer_t *sig = NULL;
+  btc_buffer_t *key = NULL;
+  uint8_t *type;
+  int hits = 0;
+  size_t j;
+
+  hits += test_fast_input(tx, view, index);
+
+  if (input->witness.length == 2) {
+    sig = input->witness.items[0];
+    key = input->witness.items[1];
+  }
+
+  /* Corrupt every byte of the signature (and the
+     sighash type) and some of the key in turn. */
+  for (j = 1; j < input->script.length; j += 7) {
+    input->script.data[j] ^= 0x01;
+    hits += test_fast_input(tx, view, index);
+    input->script.data[j] ^= 0x01;
+  }
+
+  if (sig != NULL) {
+    type = &sig->data[sig->length - 1];
+
+    for (j = 0; j < sig->length; j += 5) {
+      sig->data[j] ^= 0x01;
+      hits += test_fast_input(tx, view, index);
+      sig->data[j] ^= 0x01;
+    }
+
+    for (j = 0; j < key->length; j += 11) {
+      key->data[j] ^= 0x01;
+      hits += test_fast_input(tx, view, index);
+      key->data[j] ^= 0x01;
+    }
+
+    *type = BTC_SIGHASH_SINGLE;
+    hits += test_fast_input(tx, view, index);
+    *type = BTC_SIGHASH_ALL | 0x40;
+    hits += test_fast_input(tx, view, index);
+    *type = BTC_SIGHASH_ALL;
+
+    /* Swap the witness items. */
+    input->witness.items[0] = key;
+    input->witness.items[1] = sig;
+    hits += test_fast_input(tx, view, index);
+    input->witness.items[0] = sig;
+    input->witness.items[1] = key;
+
+    /* Drop a witness item. */
+    input->witness.length = 1;
+    hits += test_fast_input(tx, view, index);
+    input->witness.length = 2;
+  }
+
+  /* Still valid after all that. */
+  ASSERT(btc_tx_verify_input(tx, index, &coin->output,
+                             BTC_SCRIPT_STANDARD_VERIFY_FLAGS, NULL));
+
+  return hits;
+}
+
+static void
+test_script_fast(void) {
+  static const uint8_t priv[32] = {
+    0x5b, 0x6d, 0xb1, 0x59, 0x43, 0x8d, 0x0a, 0x6b,
+    0x8c, 0x0f, 0x4f, 0x6b, 0x05, 0x3f, 0x8a, 0x17,
+    0x2e, 0x6a, 0x8a, 0x3c, 0x91, 0x24, 0x77, 0x02,
+    0x1c, 0x4b, 0x2e, 0x9d, 0x3d, 0x8b, 0x01, 0x2a
+  };
+  uint8_t pub33[33], pub65[65];
+  uint8_t hash33[20], hash65[20];
+  uint8_t redeem[22], hash[20];
+  btc_view_t *view = btc_view_create();
+  btc_tx_t *tx = btc_tx_create();
+  btc_output_t *output;
+  btc_input_t *input;
+  btc_coin_t *coin;
+  int hits = 0;
+  size_t i;
+
+  ASSERT(btc_ecdsa_pubkey_create(pub33, priv, 1));
+  ASSERT(btc_ecdsa_pubkey_create(pub65, priv, 0));
+
+  btc_hash160(hash33, pub33, 33);
+  btc_hash160(hash65, pub65, 65);
+
+  redeem[0] = BTC_OP_0;
+  redeem[1] = 20;
+
+  memcpy(redeem + 2, hash33, 20);
+
+  btc_hash160(hash, redeem, 22);
+
+  for (i = 0; i < 4; i++) {
+    input = btc_input_create();
+    input->prevout.hash[0] = 1;
+    input->prevout.index = i;
+
+    coin = btc_coin_create();
+    coin->output.value = 100000 * (i + 1);
+
+    switch (i) {
+      case 0:
+        btc_script_set_p2pkh(&coin->output.script, hash33);
+        break;
+      case 1:
+        btc_script_set_p2pkh(&coin->output.script, hash65);
+        break;
+      case 2:
+        btc_script_set_p2wpkh(&coin->output.script, hash33);
+        break;
+      case 3:
+        btc_script_set_p2sh(&coin->output.script, hash);
+        break;
+    }
+
+    btc_view_put(view, &input->prevout, coin);
+    btc_inpvec_push(&tx->inputs, input);
+  }
+
+  output = btc_output_create();
+  output->value = 50000;
+
+  btc_script_set_p2wpkh(&output->script, hash33);
+  btc_outvec_push(&tx->outputs, output);
+
+  ASSERT(btc_tx_sign_step(tx, view, priv, NULL) == 4);
+  ASSERT(btc_tx_verify(tx, view, BTC_SCRIPT_STANDARD_VERIFY_FLAGS));
+
+  for (i = 0; i < tx->inputs.length; i++)
+    hits += test_fast_mutations(tx, view, i);
+
+  /* Make sure the templates were actually exercised. */
+  printf("fast path checks: %d\n", hits);
+
+  ASSERT(hits > 100);
+
+  btc_tx_destroy(tx);
+  btc_view_destroy(view);
+}
+
+/*
+ * Taproot
+ */
+
+#define TAPROOT_FLAGS (BTC_SCRIPT_VERIFY_P2SH    \
+                     | BTC_SCRIPT_VERIFY_WITNESS \
+                     | BTC_SCRIPT_VERIFY_TAPROOT)
+
+static void
+tap_leaf(uint8_t *hash, const uint8_t *script, size_t length) {
+  btc_sha256_t ctx;
+  uint8_t prefix[2];
+
+  prefix[0] = BTC_TAPROOT_LEAF_TAPSCRIPT;
+  prefix[1] = length;
+
+  btc_sha256_tagged(&ctx, "TapLeaf");
+  btc_sha256_update(&ctx, prefix, 2);
+  btc_sha256_update(&ctx, script, length);
+  btc_sha256_final(&ctx, hash);
+}
+
+static void
+tap_branch(uint8_t *hash, const uint8_t *left, const uint8_t *right) {
+  btc_sha256_t ctx;
+
+  btc_sha256_tagged(&ctx, "TapBranch");
+
+  if (memcmp(left, right, 32) < 0) {
+    btc_sha256_update(&ctx, left, 32);
+    btc_sha256_update(&ctx, right, 32);
+  } else {
+    btc_sha256_update(&ctx, right, 32);
+    btc_sha256_update(&ctx, left, 32);
+  }
+
+  btc_sha256_final(&ctx, hash);
+}
+
+static void
+tap_tweak(uint8_t *hash, const uint8_t *pub, const uint8_t *root) {
+  btc_sha256_t ctx;
+
+  btc_sha256_tagged(&ctx, "TapTweak");
+  btc_sha256_update(&ctx, pub, 32);
+
+  if (root != NULL)
+    btc_sha256_update(&ctx, root, 32);
+
+  btc_sha256_final(&ctx, hash);
+}
+
+static void
+tap_sign(uint8_t *sig,
+         const btc_tx_t *tx,
+         const btc_view_t *view,
+         size_t index,
+         int type,
+         const uint8_t *annex,
+         const uint8_t *leaf,
+         const uint8_t *priv) {
+  static const uint8_t aux[32] = {0};
+  btc_tx_cache_t cache;
+  uint8_t hash[32];
+
+  btc_tx_cache_init(&cache);
+
+  cache.view = view;
+
+  ASSERT(btc_tx_sighash_taproot(hash, tx, index, type, annex,
+                                leaf, UINT32_MAX, &cache));
+
+  ASSERT(btc_bip340_sign(sig, hash, 32, priv, aux));
+
+  sig[64] = type;
+
+  btc_tx_cache_clear(&cache);
+}
+
+static int
+tap_verify(const btc_tx_t *tx,
+           const btc_view_t *view,
+           size_t index,
+           unsigned int flags,
+           btc_sigbatch_t *batch) {
+  const btc_input_t *input = tx->inputs.items[index];
+  const btc_coin_t *coin = btc_view_get(view, &input->prevout);
+  btc_tx_cache_t cache;
+  int ret;
+
+  btc_tx_cache_init(&cache);
+
+  cache.view = view;
+  cache.batch = batch;
+
+  ret = btc_script_verify(&input->script,
+                          &input->witness,
+                          &coin->output.script,
+                          tx,
+                          index,
+                          coin->output.value,
+                          flags,
+                          &cache);
+
+  btc_tx_cache_clear(&cache);
+
+  return ret;
+}
+
+static void
+test_script_taproot(void) {
+  static const uint8_t priv[32] = {
+    0x1d, 0x40, 0x8b, 0x3c, 0x7a, 0x2e, 0x55, 0x90,
+    0x0f, 0x64, 0x31, 0xcc, 0x82, 0x19, 0xe7, 0x4b,
+    0x6a, 0x03, 0x58, 0xd1, 0x2f, 0x97, 0xb4, 0x0e,
+    0x4c, 0x21, 0x8a, 0x73, 0xf5, 0x16, 0x39, 0x02
+  };
+  static const uint8_t priv1[32] = {
+    0x7e, 0x05, 0x91, 0x2c, 0xd4, 0x60, 0x3b, 0x88,
+    0x15, 0xaf, 0x42, 0x9d, 0x06, 0xe1, 0x73, 0x5a,
+    0x2b, 0xc8, 0x94, 0x11, 0x6f, 0x3d, 0x80, 0xe2,
+    0x57, 0x0a, 0xcd, 0x36, 0x99, 0x4e, 0x12, 0x03
+  };
+  static const uint8_t priv2[32] = {
+    0x33, 0x9a, 0x64, 0x0e, 0xb7, 0x21, 0xd5, 0x4f,
+    0x88, 0x17, 0x6c, 0xe3, 0x0a, 0x5d, 0x92, 0x41,
+    0xf0, 0x2c, 0x7b, 0x58, 0xa6, 0x13, 0x49, 0xde,
+    0x05, 0x6e, 0x31, 0xba, 0x84, 0x27, 0x9c, 0x04
+  };
+  uint8_t pub[32], pub1[32], pub2[32];
+  uint8_t leaves[4][32], left[32], right[32];
+  uint8_t root[32], tweak[32], key[32], tpriv[32];
+  uint8_t checksig[34], success[1], multisig[4], sigadd[70];
+  uint8_t control[3][97];
+  uint8_t sig[65], annex[3], ahash[32];
+  btc_view_t *view = btc_view_create();
+  btc_tx_t *tx = btc_tx_create();
+  btc_sigbatch_t *batch;
+  btc_buffer_t *item;
+  btc_output_t *output;
+  btc_input_t *input;
+  btc_program_t program;
+  btc_coin_t *coin;
+  btc_sha256_t ctx;
+  int negated;
+  size_t i;
+
+  ASSERT(btc_bip340_pubkey_create(pub, priv));
+  ASSERT(btc_bip340_pubkey_create(pub1, priv1));
+  ASSERT(btc_bip340_pubkey_create(pub2, priv2));
+
+  /* <pub1> OP_CHECKSIG */
+  checksig[0] = 32;
+  memcpy(checksig + 1, pub1, 32);
+  checksig[33] = BTC_OP_CHECKSIG;
+
+  /* OP_SUCCESS80 */
+  success[0] = 0x50;
+
+  /* 0 0 0 OP_CHECKMULTISIG */
+  multisig[0] = BTC_OP_0;
+  multisig[1] = BTC_OP_0;
+  multisig[2] = BTC_OP_0;
+  multisig[3] = BTC_OP_CHECKMULTISIG;
+
+  /* <pub1> OP_CHECKSIG <pub2> OP_CHECKSIGADD 2 OP_NUMEQUAL */
+  sigadd[0] = 32;
+  memcpy(sigadd + 1, pub1, 32);
+  sigadd[33] = BTC_OP_CHECKSIG;
+  sigadd[34] = 32;
+  memcpy(sigadd + 35, pub2, 32);
+  sigadd[67] = BTC_OP_CHECKSIGADD;
+  sigadd[68] = BTC_OP_2;
+  sigadd[69] = BTC_OP_NUMEQUAL;
+
+  tap_leaf(leaves[0], checksig, sizeof(checksig));
+  tap_leaf(leaves[1], success, sizeof(success));
+  tap_leaf(leaves[2], multisig, sizeof(multisig));
+  tap_leaf(leaves[3], sigadd, sizeof(sigadd));
+
+  tap_branch(left, leaves[0], leaves[1]);
+  tap_branch(right, leaves[2], leaves[3]);
+  tap_branch(root, left, right);
+
+  tap_tweak(tweak, pub, root);
+
+  ASSERT(btc_bip340_pubkey_tweak_add(key, &negated, pub, tweak));
+  ASSERT(btc_bip340_privkey_tweak_add(tpriv, priv, tweak));
+
+  /* Control blocks for the checksig, success and sigadd leaves. */
+  for (i = 0; i < 3; i++) {
+    control[i][0] = BTC_TAPROOT_LEAF_TAPSCRIPT | negated;
+    memcpy(control[i] + 1, pub, 32);
+  }
+
+  memcpy(control[0] + 33, leaves[1], 32);
+  memcpy(control[0] + 65, right, 32);
+  memcpy(control[1] + 33, leaves[0], 32);
+  memcpy(control[1] + 65, right, 32);
+  memcpy(control[2] + 33, leaves[2], 32);
+  memcpy(control[2] + 65, left, 32);
+
+  program.version = 1;
+  program.data = key;
+  program.length = 32;
+
+  for (i = 0; i < 5; i++) {
+    input = btc_input_create();
+    input->prevout.hash[0] = 2;
+    input->prevout.index = i;
+
+    coin = btc_coin_create();
+    coin->output.value = 100000 * (i + 1);
+
+    btc_script_set_program(&coin->output.script, &program);
+
+    btc_view_put(view, &input->prevout, coin);
+    btc_inpvec_push(&tx->inputs, input);
+  }
+
+  for (i = 0; i < 2; i++) {
+    output = btc_output_create();
+    output->value = 50000 * (i + 1);
+
+    btc_script_set_p2wpkh(&output->script, pub1);
+    btc_outvec_push(&tx->outputs, output);
+  }
+
+  tx->version = 2;
+
+  /* Key path. */
+  tap_sign(sig, tx, view, 0, 0, NULL, NULL, tpriv);
+  btc_stack_push_data(&tx->inputs.items[0]->witness, sig, 64);
+
+  /* Script path: checksig. */
+  input = tx->inputs.items[1];
+  tap_sign(sig, tx, view, 1, BTC_SIGHASH_SINGLE | BTC_SIGHASH_ANYONECANPAY,
+           NULL, leaves[0], priv1);
+  btc_stack_push_data(&input->witness, sig, 65);
+  btc_stack_push_data(&input->witness, checksig, sizeof(checksig));
+  btc_stack_push_data(&input->witness, control[0], 97);
+
+  /* Script path: OP_SUCCESS. */
+  input = tx->inputs.items[2];
+  btc_stack_push_data(&input->witness, success, sizeof(success));
+  btc_stack_push_data(&input->witness, control[1], 97);
+
+  /* Script path: checksigadd. */
+  input = tx->inputs.items[3];
+  tap_sign(sig, tx, view, 3, BTC_SIGHASH_ALL, NULL, leaves[3], priv2);
+  btc_stack_push_data(&input->witness, sig, 65);
+  tap_sign(sig, tx, view, 3, BTC_SIGHASH_NONE, NULL, leaves[3], priv1);
+  btc_stack_push_data(&input->witness, sig, 65);
+  btc_stack_push_data(&input->witness, sigadd, sizeof(sigadd));
+  btc_stack_push_data(&input->witness, control[2], 97);
+
+  /* Script path: checkmultisig (disabled). */
+  input = tx->inputs.items[4];
+  btc_stack_push_data(&input->witness, multisig, sizeof(multisig));
+  btc_stack_push_data(&input->witness, control[2], 97);
+
+  memcpy(input->witness.items[1]->data + 33, leaves[3], 32);
+
+  ASSERT(tap_verify(tx, view, 0, TAPROOT_FLAGS, NULL) == 0);
+  ASSERT(tap_verify(tx, view, 1, TAPROOT_FLAGS, NULL) == 0);
+  ASSERT(tap_verify(tx, view, 2, TAPROOT_FLAGS, NULL) == 0);
+  ASSERT(tap_verify(tx, view, 3, TAPROOT_FLAGS, NULL) == 0);
+  ASSERT(tap_verify(tx, view, 4, TAPROOT_FLAGS, NULL)
+         == BTC_SCRIPT_ERR_TAPSCRIPT_CHECKMULTISIG);
+
+  ASSERT(tap_verify(tx, view, 0, BTC_SCRIPT_STANDARD_VERIFY_FLAGS, NULL) == 0);
+  ASSERT(tap_verify(tx, view, 2, BTC_SCRIPT_STANDARD_VERIFY_FLAGS, NULL)
+         == BTC_SCRIPT_ERR_DISCOURAGE_OP_SUCCESS);
+
+  /* Sighash types. */
+  item = tx->inputs.items[0]->witness.items[0];
+
+  btc_buffer_grow(item, 65);
+
+  item->data[64] = 0;
+  item->length = 65;
+
+  ASSERT(tap_verify(tx, view, 0, TAPROOT_FLAGS, NULL)
+         == BTC_SCRIPT_ERR_SCHNORR_SIG_HASHTYPE);
+
+  item->length = 63;
+
+  ASSERT(tap_verify(tx, view, 0, TAPROOT_FLAGS, NULL)
+         == BTC_SCRIPT_ERR_SCHNORR_SIG_SIZE);
+
+  item->length = 64;
+  item->data[5] ^= 1;
+
+  ASSERT(tap_verify(tx, view, 0, TAPROOT_FLAGS, NULL)
+         == BTC_SCRIPT_ERR_SCHNORR_SIG);
+
+  /* Not yet active. */
+  ASSERT(tap_verify(tx, view, 0, TAPROOT_FLAGS & ~BTC_SCRIPT_VERIFY_TAPROOT,
+                    NULL) == 0);
+
+  item->data[5] ^= 1;
+
+  /* The annex is committed to. */
+  annex[0] = 0x50;
+  annex[1] = 0x01;
+  annex[2] = 0x02;
+
+  btc_stack_push_data(&tx->inputs.items[0]->witness, annex, 3);
+
+  ASSERT(tap_verify(tx, view, 0, TAPROOT_FLAGS, NULL)
+         == BTC_SCRIPT_ERR_SCHNORR_SIG);
+
+  btc_sha256_init(&ctx);
+  btc_sha256_update(&ctx, "\x03", 1);
+  btc_sha256_update(&ctx, annex, 3);
+  btc_sha256_final(&ctx, ahash);
+
+  tap_sign(sig, tx, view, 0, 0, ahash, NULL, tpriv);
+  memcpy(item->data, sig, 64);
+
+  ASSERT(tap_verify(tx, view, 0, TAPROOT_FLAGS, NULL) == 0);
+
+  /* Control blocks. */
+  item = tx->inputs.items[1]->witness.items[2];
+  item->data[0] ^= 1;
+
+  ASSERT(tap_verify(tx, view, 1, TAPROOT_FLAGS, NULL)
+         == BTC_SCRIPT_ERR_WITNESS_PROGRAM_MISMATCH);
+
+  item->data[0] ^= 1;
+  item->length = 96;
+
+  ASSERT(tap_verify(tx, view, 1, TAPROOT_FLAGS, NULL)
+         == BTC_SCRIPT_ERR_TAPROOT_WRONG_CONTROL_SIZE);
+
+  item->length = 97;
+
+  /* Batch verification. */
+  batch = btc_sigbatch_create();
+
+  ASSERT(btc_tx_verify(tx, view, TAPROOT_FLAGS & ~BTC_SCRIPT_VERIFY_TAPROOT));
+
+  /* Swap the multisig spend for an OP_SUCCESS one. */
+  input = tx->inputs.items[4];
+  btc_stack_reset(&input->witness);
+  btc_stack_push_data(&input->witness, success, sizeof(success));
+  btc_stack_push_data(&input->witness, control[1], 97);
+
+  ASSERT(btc_tx_verify(tx, view, TAPROOT_FLAGS));
+  ASSERT(btc_tx_verify_batch(tx, view, TAPROOT_FLAGS, batch));
+  ASSERT(btc_sigbatch_length(batch) == 4);
+  ASSERT(btc_sigbatch_verify(batch));
+  ASSERT(btc_sigbatch_find(batch, 0, 4) == 4);
+
+  btc_sigbatch_reset(batch);
+
+  /* Corrupt the second checksigadd signature. */
+  tx->inputs.items[3]->witness.items[0]->data[9] ^= 1;
+
+  ASSERT(!btc_tx_verify(tx, view, TAPROOT_FLAGS));
+  ASSERT(btc_tx_verify_batch(tx, view, TAPROOT_FLAGS, batch));
+  ASSERT(!btc_sigbatch_verify(batch));
+  ASSERT(btc_sigbatch_find(batch, 0, 4) == 3);
+
+  btc_sigbatch_destroy(batch);
+  btc_tx_destroy(tx);
+  btc_view_destroy(view);
+}
+
+static void
+put32(uint8_t *zp, uint32_t x) {
+  zp[0] = (uint8_t)(x >>  0);
+  zp[1] = (uint8_t)(x >>  8);
+  zp[2] = (uint8_t)(x >> 16);
+  zp[3] = (uint8_t)(x >> 24);
+}
+
+static void
+test_script_tapscript_memory(void) {
+  /* Tapscript lifts the script size and opcount limits,
+     so a block-sized script of OP_1 OP_DROP must not hold
+     on to every item it ever pushed. */
+  static const uint8_t priv[32] = {
+    0x5b, 0x21, 0x9e, 0x04, 0xc7, 0x3a, 0x81, 0x6d,
+    0x12, 0xf8, 0x4e, 0xa3, 0x30, 0x97, 0x6c, 0xd5,
+    0x28, 0x0b, 0xe6, 0x73, 0x49, 0xbc, 0x15, 0x8f,
+    0x62, 0xda, 0x3d, 0x04, 0xa1, 0x5e, 0x97, 0x05
+  };
+  size_t pairs = 1000000;
+  size_t length = pairs * 2 + 1;
+  btc_view_t *view = btc_view_create();
+  btc_tx_t *tx = btc_tx_create();
+  uint8_t pub[32], key[32], leaf[32], tweak[32];
+  uint8_t control[33], prefix[6];
+  btc_output_t *output;
+  btc_input_t *input;
+  btc_program_t program;
+  btc_coin_t *coin;
+  btc_sha256_t ctx;
+  size_t before, after;
+  uint8_t *script;
+  int negated;
+  size_t i;
+
+  script = (uint8_t *)malloc(length);
+
+  ASSERT(script != NULL);
+
+  for (i = 0; i < pairs; i++) {
+    script[i * 2 + 0] = BTC_OP_1;
+    script[i * 2 + 1] = BTC_OP_DROP;
+  }
+
+  script[length - 1] = BTC_OP_1;
+
+  prefix[0] = BTC_TAPROOT_LEAF_TAPSCRIPT;
+  prefix[1] = 0xfe;
+
+  put32(prefix + 2, length);
+
+  btc_sha256_tagged(&ctx, "TapLeaf");
+  btc_sha256_update(&ctx, prefix, 6);
+  btc_sha256_update(&ctx, script, length);
+  btc_sha256_final(&ctx, leaf);
+
+  ASSERT(btc_bip340_pubkey_create(pub, priv));
+
+  tap_tweak(tweak, pub, leaf);
+
+  ASSERT(btc_bip340_pubkey_tweak_add(key, &negated, pub, tweak));
+
+  control[0] = BTC_TAPROOT_LEAF_TAPSCRIPT | negated;
+  memcpy(control + 1, pub, 32);
+
+  program.version = 1;
+  program.data = key;
+  program.length = 32;
+
+  input = btc_input_create();
+  input->prevout.hash[0] = 3;
+
+  btc_stack_push_data(&input->witness, script, length);
+  btc_stack_push_data(&input->witness, control, 33);
+
+  coin = btc_coin_create();
+  coin->output.value = 100000;
+
+  btc_script_set_program(&coin->output.script, &program);
+
+  btc_view_put(view, &input->prevout, coin);
+  btc_inpvec_push(&tx->inputs, input);
+
+  output = btc_output_create();
+  output->value = 90000;
+
+  btc_script_set_p2wpkh(&output->script, pub);
+  btc_outvec_push(&tx->outputs, output);
+
+  free(script);
+
+  before = test_peak_memory();
+
+  ASSERT(tap_verify(tx, view, 0, TAPROOT_FLAGS, NULL) == 0);
+
+  after = test_peak_memory();
+
+  /* Two million dead items would take ~50MB. */
+  ASSERT(after - before < ((size_t)16 << 20));
+
+  btc_tx_destroy(tx);
+  btc_view_destroy(view);
+}
+
+static void
+bip341_sighash(uint8_t *hash,
+               const btc_tx_t *tx,
+               const btc_view_t *view,
+               size_t index,
+               int type,
+               const uint8_t *leaf,
+               uint32_t codesep) {
+  /* The signature message spelled out as in BIP341 and
+     BIP342, built from the published intermediary hashes. */
+  const btc_input_t *input = tx->inputs.items[index];
+  int output_type = type & 3;
+  int anyone = type & BTC_SIGHASH_ANYONECANPAY;
+  uint8_t msg[512], tmp[32];
+  btc_sha256_t ctx;
+  size_t len = 0;
+
+  msg[len++] = 0x00;
+  msg[len++] = (uint8_t)type;
+
+  put32(msg + len, tx->version);
+  len += 4;
+
+  put32(msg + len, tx->locktime);
+  len += 4;
+
+  if (!anyone) {
+    hex_parse(msg + len, 32, bip341_prevouts);
+    len += 32;
+
+    hex_parse(msg + len, 32, bip341_amounts);
+    len += 32;
+
+    hex_parse(msg + len, 32, bip341_scripts);
+    len += 32;
+
+    hex_parse(msg + len, 32, bip341_sequences);
+    len += 32;
+  }
+
+  if (output_type != BTC_SIGHASH_NONE && output_type != BTC_SIGHASH_SINGLE) {
+    hex_parse(msg + len, 32, bip341_outputs);
+    len += 32;
+  }
+
+  msg[len++] = (leaf != NULL) * 2;
+
+  if (anyone) {
+    const btc_coin_t *coin = btc_view_get(view, &input->prevout);
+    const btc_script_t *script = &coin->output.script;
+    uint64_t value = coin->output.value;
+
+    btc_outpoint_write(msg + len, &input->prevout);
+    len += 36;
+
+    put32(msg + len + 0, (uint32_t)(value >>  0));
+    put32(msg + len + 4, (uint32_t)(value >> 32));
+    len += 8;
+
+    ASSERT(script->length < 0xfd);
+
+    msg[len++] = script->length;
+
+    memcpy(msg + len, script->data, script->length);
+    len += script->length;
+
+    put32(msg + len, input->sequence);
+    len += 4;
+  } else {
+    put32(msg + len, index);
+    len += 4;
+  }
+
+  if (output_type == BTC_SIGHASH_SINGLE) {
+    const btc_output_t *output = tx->outputs.items[index];
+    uint8_t raw[64];
+
+    ASSERT(btc_output_size(output) <= sizeof(raw));
+
+    btc_sha256_init(&ctx);
+    btc_sha256_update(&ctx, raw, btc_output_write(raw, output) - raw);
+    btc_sha256_final(&ctx, tmp);
+
+    memcpy(msg + len, tmp, 32);
+    len += 32;
+  }
+
+  if (leaf != NULL) {
+    memcpy(msg + len, leaf, 32);
+    len += 32;
+
+    msg[len++] = 0x00;
+
+    put32(msg + len, codesep);
+    len += 4;
+  }
+
+  btc_sha256_tagged(&ctx, "TapSighash");
+  btc_sha256_update(&ctx, msg, len);
+  btc_sha256_final(&ctx, hash);
+}
+
+static void
+test_script_bip341(void) {
+  static const int types[] = {
+    0x00, 0x01, 0x02, 0x03, 0x81, 0x82, 0x83
+  };
+  static const uint8_t aux[32] = {0};
+  uint8_t pub[32], key[32], tpriv[32], tweak[32];
+  uint8_t leaf[32], root[32], control[33];
+  uint8_t expect[32], hash[32], sig[65];
+  uint8_t raw[1024], script[64];
+  btc_view_t *view = btc_view_create();
+  btc_tx_cache_t cache;
+  size_t i, j, len;
+  btc_coin_t *coin;
+  int negated;
+  btc_tx_t tx;
+
+  btc_tx_init(&tx);
+
+  len = sizeof(raw);
+  hex_decode(raw, &len, bip341_tx);
+
+  ASSERT(btc_tx_import(&tx, raw, len));
+  ASSERT(tx.inputs.length == lengthof(bip341_utxos));
+
+  for (i = 0; i < lengthof(bip341_utxos); i++) {
+    coin = btc_coin_create();
+    coin->output.value = bip341_utxos[i].value;
+
+    len = sizeof(script);
+    hex_decode(script, &len, bip341_utxos[i].script);
+
+    btc_script_set(&coin->output.script, script, len);
+
+    btc_view_put(view, &tx.inputs.items[i]->prevout, coin);
+  }
+
+  btc_tx_cache_init(&cache);
+
+  cache.view = view;
+
+  /* Key path. */
+  for (i = 0; i < lengthof(bip341_vectors); i++) {
+    const bip341_vector_t *vec = &bip341_vectors[i];
+    const btc_input_t *input = tx.inputs.items[vec->index];
+    uint8_t priv[32];
+
+    hex_parse(priv, 32, vec->priv);
+    hex_parse(expect, 32, vec->sighash);
+
+    ASSERT(btc_bip340_pubkey_create(pub, priv));
+
+    if (vec->root != NULL) {
+      hex_parse(root, 32, vec->root);
+      tap_tweak(tweak, pub, root);
+    } else {
+      tap_tweak(tweak, pub, NULL);
+    }
+
+    ASSERT(btc_bip340_pubkey_tweak_add(key, &negated, pub, tweak));
+    ASSERT(btc_bip340_privkey_tweak_add(tpriv, priv, tweak));
+
+    coin = (btc_coin_t *)btc_view_get(view, &input->prevout);
+
+    ASSERT(coin->output.script.length == 34);
+    ASSERT(memcmp(coin->output.script.data + 2, key, 32) == 0);
+
+    ASSERT(btc_tx_sighash_taproot(hash, &tx, vec->index, vec->type,
+                                  NULL, NULL, UINT32_MAX, &cache));
+
+    ASSERT(memcmp(hash, expect, 32) == 0);
+
+    bip341_sighash(hash, &tx, view, vec->index, vec->type, NULL, UINT32_MAX);
+
+    ASSERT(memcmp(hash, expect, 32) == 0);
+
+    ASSERT(btc_bip340_sign(sig, expect, 32, tpriv, aux));
+
+    sig[64] = vec->type;
+
+    btc_stack_push_data(&tx.inputs.items[vec->index]->witness,
+                        sig, 64 + (vec->type != 0));
+
+    ASSERT(tap_verify(&tx, view, vec->index, TAPROOT_FLAGS, NULL) == 0);
+  }
+
+  hex_parse(expect, 32, bip341_prevouts);
+  ASSERT(memcmp(cache.tap_prevouts, expect, 32) == 0);
+
+  hex_parse(expect, 32, bip341_amounts);
+  ASSERT(memcmp(cache.tap_amounts, expect, 32) == 0);
+
+  hex_parse(expect, 32, bip341_scripts);
+  ASSERT(memcmp(cache.tap_scripts, expect, 32) == 0);
+
+  hex_parse(expect, 32, bip341_sequences);
+  ASSERT(memcmp(cache.tap_sequences, expect, 32) == 0);
+
+  hex_parse(expect, 32, bip341_outputs);
+  ASSERT(memcmp(cache.tap_outputs, expect, 32) == 0);
+
+  /* Script path. */
+  len = sizeof(script);
+  hex_decode(script, &len, bip341_leaf_script);
+
+  tap_leaf(leaf, script, len);
+
+  hex_parse(expect, 32, bip341_leaf_hash);
+  ASSERT(memcmp(leaf, expect, 32) == 0);
+
+  hex_parse(control, 33, bip341_control);
+
+  /* Input 1 commits to this leaf alone. */
+  ASSERT(strcmp(bip341_vectors[1].root, bip341_leaf_hash) == 0);
+
+  {
+    uint8_t priv[32];
+
+    hex_parse(priv, 32, bip341_vectors[1].priv);
+
+    ASSERT(btc_bip340_pubkey_create(pub, priv));
+    ASSERT(memcmp(control + 1, pub, 32) == 0);
+
+    tap_tweak(tweak, pub, leaf);
+
+    ASSERT(btc_bip340_pubkey_tweak_add(key, &negated, pub, tweak));
+    ASSERT(control[0] == (BTC_TAPROOT_LEAF_TAPSCRIPT | negated));
+  }
+
+  for (i = 0; i < lengthof(types); i++) {
+    static const uint32_t codeseps[] = { UINT32_MAX, 0, 1 };
+
+    for (j = 0; j < lengthof(codeseps); j++) {
+      bip341_sighash(expect, &tx, view, 1, types[i], leaf, codeseps[j]);
+
+      ASSERT(btc_tx_sighash_taproot(hash, &tx, 1, types[i], NULL,
+                                    leaf, codeseps[j], &cache));
+
+      ASSERT(memcmp(hash, expect, 32) == 0);
+    }
+  }
+
+  btc_tx_cache_clear(&cache);
+  btc_tx_clear(&tx);
+  btc_view_destroy(view);
+}
+
 int
 main(void) {
   size_t i;
 
+  /* First, while the peak memory is still low. */
+  test_script_tapscript_memory();
+
   for (i = 0; i < lengthof(test_script_vectors); i++)
     test_script_vector(&test_script_vectors[i], i);
 
+  test_script_fast();
+  test_script_taproot();
+  test_script_bip341();
+
   return 0;
 }
@@ -1,5 +1,5 @@
 /*!
- * t-stub.c - stub test for mako
+ * t-sha256.c - sha256 test for mako
  * Copyright (c) 2021, Christopher Jeffrey (MIT License).
  * https://github.com/chjj/mako
  */
@@ -7,8 +7,142 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <mako/crypto/hash.h>
 #include "lib/tests.h"
 
-int main(void) {
+static const char *backends[] = {
+  "generic",
+  "shani",
+  "armv8"
+};
+
+static const struct {
+  const char *msg;
+  const char *hash;
+} sha256_vectors[] = {
+  {
+    "",
+    "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"
+  },
+  {
+    "abc",
+    "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"
+  },
+  {
+    "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+    "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"
+  },
+  {
+    "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmn"
+    "hijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu",
+    "cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1"
+  }
+};
+
+static void
+test_sha256_vectors(void) {
+  uint8_t expect[32];
+  uint8_t out[32];
+  size_t i;
+
+  for (i = 0; i < lengthof(sha256_vectors); i++) {
+    const char *msg = sha256_vectors[i].msg;
+
+    hex_parse(expect, 32, sha256_vectors[i].hash);
+
+    btc_sha256(out, msg, strlen(msg));
+
+    ASSERT(memcmp(out, expect, 32) == 0);
+  }
+}
+
+static void
+test_sha256_million(void) {
+  static const char *hash =
+    "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0";
+  uint8_t expect[32];
+  uint8_t chunk[1000];
+  uint8_t out[32];
+  btc_sha256_t ctx;
+  int i;
+
+  hex_parse(expect, 32, hash);
+
+  memset(chunk, 'a', sizeof(chunk));
+
+  btc_sha256_init(&ctx);
+
+  for (i = 0; i < 1000; i++)
+    btc_sha256_update(&ctx, chunk, sizeof(chunk));
+
+  btc_sha256_final(&ctx, out);
+
+  ASSERT(memcmp(out, expect, 32) == 0);
+}
+
+static void
+test_sha256_update(const uint8_t *expect) {
+  static const size_t steps[] = { 1, 3, 63, 64, 65, 127, 128, 200 };
+  uint8_t data[1024];
+  uint8_t out[32];
+  btc_sha256_t ctx;
+  size_t i, j, len, pos;
+
+  for (i = 0; i < sizeof(data); i++)
+    data[i] = (uint8_t)(i * 13 + 7);
+
+  for (len = 0; len <= sizeof(data); len += 31) {
+    btc_sha256(out, data, len);
+
+    ASSERT(memcmp(out, expect + (len / 31) * 32, 32) == 0);
+
+    for (i = 0; i < lengthof(steps); i++) {
+      btc_sha256_init(&ctx);
+
+      for (pos = 0; pos < len; pos += j) {
+        j = steps[(i + pos) % lengthof(steps)];
+
+        if (j > len - pos)
+          j = len - pos;
+
+        btc_sha256_update(&ctx, data + pos, j);
+      }
+
+      btc_sha256_final(&ctx, out);
+
+      ASSERT(memcmp(out, expect + (len / 31) * 32, 32) == 0);
+    }
+  }
+}
+
+int
+main(void) {
+  static uint8_t expect[34 * 32];
+  uint8_t data[1024];
+  size_t i, len;
+
+  /* Reference digests from the generic backend. */
+  ASSERT(btc_sha256_select("generic"));
+  ASSERT(strcmp(btc_sha256_backend(), "generic") == 0);
+
+  for (i = 0; i < sizeof(data); i++)
+    data[i] = (uint8_t)(i * 13 + 7);
+
+  for (len = 0; len <= sizeof(data); len += 31)
+    btc_sha256(expect + (len / 31) * 32, data, len);
+
+  for (i = 0; i < lengthof(backends); i++) {
+    if (!btc_sha256_select(backends[i]))
+      continue;
+
+    ASSERT(strcmp(btc_sha256_backend(), backends[i]) == 0);
+
+    test_sha256_vectors();
+    test_sha256_million();
+    test_sha256_update(expect);
+  }
+
+  ASSERT(!btc_sha256_select("foobar"));
+
   return 0;
 }
@@ -16,9 +16,12 @@
 
 static void
 test_sighash_vector(const test_sighash_vector_t *vec, size_t index) {
+  btc_tx_cache_t cache;
   btc_script_t script;
   uint8_t msg[32];
+  uint8_t tmp[32];
   btc_tx_t tx;
+  size_t i;
 
   printf("sighash vector #%d: %s\n", (int)index, vec->comments);
 
@@ -33,6 +36,27 @@ test_sighash_vector(const test_sighash_vector_t *vec, size_t index) {
 
   ASSERT(memcmp(msg, vec->expected, 32) == 0);
 
+  btc_tx_cache_init(&cache);
+
+  btc_tx_sighash(msg, &tx, vec->index, &script, 0, vec->type, 0, &cache);
+
+  ASSERT(memcmp(msg, vec->expected, 32) == 0);
+
+  /* Every input must agree with the uncached path. */
+  for (i = 0; i < tx.inputs.length; i++) {
+    btc_tx_sighash(msg, &tx, i, &script, 0, vec->type, 0, NULL);
+    btc_tx_sighash(tmp, &tx, i, &script, 0, vec->type, 0, &cache);
+
+    ASSERT(memcmp(msg, tmp, 32) == 0);
+
+    btc_tx_sighash(msg, &tx, i, &script, 0, BTC_SIGHASH_ALL, 0, NULL);
+    btc_tx_sighash(tmp, &tx, i, &script, 0, BTC_SIGHASH_ALL, 0, &cache);
+
+    ASSERT(memcmp(msg, tmp, 32) == 0);
+  }
+
+  btc_tx_cache_clear(&cache);
+
   btc_tx_clear(&tx);
   btc_script_clear(&script);
 }
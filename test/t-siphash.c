@@ -1,5 +1,5 @@
 /*!
- * t-stub.c - stub test for mako
+ * t-siphash.c - siphash test for mako
  * Copyright (c) 2021, Christopher Jeffrey (MIT License).
  * https://github.com/chjj/mako
  */
@@ -7,8 +7,89 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <mako/crypto/siphash.h>
 #include "lib/tests.h"
 
-int main(void) {
+static const char *backends[] = {
+  "avx512",
+  "avx2",
+  "generic"
+};
+
+static void
+test_siphash_vector(void) {
+  /* Appendix A of the SipHash paper. */
+  uint8_t key[16];
+  uint8_t msg[15];
+  int i;
+
+  for (i = 0; i < 16; i++)
+    key[i] = i;
+
+  for (i = 0; i < 15; i++)
+    msg[i] = i;
+
+  ASSERT(btc_siphash_sum(msg, 15, key) == UINT64_C(0xa129ca6149be45e5));
+}
+
+static void
+test_siphash_batch_vector(void) {
+  /* Entry 32 of the reference implementation's vectors. */
+  uint64_t out[3];
+  uint8_t msg[3 * 32];
+  uint8_t key[16];
+  int i;
+
+  for (i = 0; i < 16; i++)
+    key[i] = i;
+
+  for (i = 0; i < 3 * 32; i++)
+    msg[i] = i % 32;
+
+  btc_siphash_batch(out, msg, 3, key);
+
+  for (i = 0; i < 3; i++)
+    ASSERT(out[i] == UINT64_C(0x7127512f72f27cce));
+}
+
+static void
+test_siphash_batch(size_t count) {
+  static uint8_t data[64 * 32];
+  static uint64_t out[64];
+  uint8_t key[32];
+  size_t i;
+
+  for (i = 0; i < 32; i++)
+    key[i] = (uint8_t)(i * 13 + count);
+
+  for (i = 0; i < count * 32; i++)
+    data[i] = (uint8_t)(i * 7 + count);
+
+  btc_siphash_batch(out, data, count, key);
+
+  for (i = 0; i < count; i++)
+    ASSERT(out[i] == btc_siphash_sum(data + i * 32, 32, key));
+}
+
+int
+main(void) {
+  size_t i, j;
+
+  test_siphash_vector();
+
+  for (i = 0; i < lengthof(backends); i++) {
+    if (!btc_siphash_select(backends[i]))
+      continue;
+
+    ASSERT(strcmp(btc_siphash_backend(), backends[i]) == 0);
+
+    test_siphash_batch_vector();
+
+    for (j = 0; j <= 64; j++)
+      test_siphash_batch(j);
+  }
+
+  ASSERT(!btc_siphash_select("foobar"));
+
   return 0;
 }
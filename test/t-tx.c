@@ -17,12 +17,48 @@
 #include "data/tx_invalid_vectors.h"
 #include "lib/tests.h"
 
+static void
+test_tx_raw(const btc_tx_t *tx, const uint8_t *xp, size_t xn) {
+  static uint8_t raw[100000];
+  static uint8_t base[100000];
+  btc_rawtx_t view;
+  btc_tx_t *z;
+
+  ASSERT(btc_rawtx_import(&view, xp, xn));
+
+  ASSERT(btc_hash_equal(view.hash, tx->hash));
+  ASSERT(btc_hash_equal(view.whash, tx->whash));
+  ASSERT(btc_rawtx_has_witness(&view) == btc_tx_has_witness(tx));
+  ASSERT(btc_rawtx_base_size(&view) == btc_tx_base_size(tx));
+  ASSERT(btc_rawtx_size(&view) == btc_tx_size(tx));
+  ASSERT(btc_rawtx_weight(&view) == btc_tx_weight(tx));
+
+  ASSERT(btc_rawtx_base_write(raw, &view) == raw + btc_tx_base_size(tx));
+  ASSERT(btc_tx_base_write(base, tx) == base + btc_tx_base_size(tx));
+  ASSERT(memcmp(raw, base, btc_tx_base_size(tx)) == 0);
+
+  z = btc_rawtx_decode(&view);
+
+  ASSERT(btc_hash_equal(z->hash, tx->hash));
+  ASSERT(btc_hash_equal(z->whash, tx->whash));
+  ASSERT(btc_tx_export(raw, z) == xn);
+  ASSERT(memcmp(raw, xp, xn) == 0);
+  ASSERT(btc_tx_usage(z) <= btc_tx_usage(tx));
+
+  btc_tx_destroy(z);
+
+  if (xn > 0)
+    ASSERT(!btc_rawtx_import(&view, xp, xn - 1));
+}
+
 static void
 test_tx_valid_vector(const test_valid_vector_t *vec, size_t index) {
+  static uint8_t raw[100000];
   uint8_t hash[32];
   uint8_t whash[32];
   btc_coin_t *coin;
   btc_view_t *view;
+  btc_tx_t *packed;
   btc_tx_t tx;
   size_t i;
 
@@ -45,6 +81,8 @@ test_tx_valid_vector(const test_valid_vector_t *vec, size_t index) {
   ASSERT(btc_hash_equal(tx.hash, hash));
   ASSERT(btc_hash_equal(tx.whash, whash));
 
+  test_tx_raw(&tx, vec->tx_raw, vec->tx_len);
+
   for (i = 0; i < vec->coins_len; i++) {
     coin = btc_coin_create();
 
@@ -59,6 +97,19 @@ test_tx_valid_vector(const test_valid_vector_t *vec, size_t index) {
   else
     ASSERT(btc_tx_verify(&tx, view, vec->flags));
 
+  packed = btc_tx_pack(&tx);
+
+  ASSERT(btc_hash_equal(packed->hash, hash));
+  ASSERT(btc_hash_equal(packed->whash, whash));
+  ASSERT(btc_tx_size(packed) == vec->tx_len);
+  ASSERT(btc_tx_export(raw, packed) == vec->tx_len);
+  ASSERT(memcmp(raw, vec->tx_raw, vec->tx_len) == 0);
+  ASSERT(btc_tx_usage(packed) < btc_tx_usage(&tx));
+
+  if (strstr(vec->comments, "Coinbase") != vec->comments)
+    ASSERT(btc_tx_verify(packed, view, vec->flags));
+
+  btc_tx_destroy(packed);
   btc_tx_clear(&tx);
   btc_view_destroy(view);
 }
@@ -91,6 +142,8 @@ test_tx_invalid_vector(const test_invalid_vector_t *vec, size_t index) {
   ASSERT(btc_hash_equal(tx.hash, hash));
   ASSERT(btc_hash_equal(tx.whash, whash));
 
+  test_tx_raw(&tx, vec->tx_raw, vec->tx_len);
+
   for (i = 0; i < vec->coins_len; i++) {
     coin = btc_coin_create();
 